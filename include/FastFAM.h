@@ -24,10 +24,20 @@
 #include "Geno.h"
 #include "Pheno.h"
 #include "Marker.h" 
+#include "TextFormat.h"
+#include "ResultStore.h"
+#include "ModelFile.h"
 #include "Eigen/Dense"
 #include "Eigen/Sparse"
+#include <Eigen/SparseCholesky>
+#include <Eigen/IterativeLinearSolvers>
+#if GCTA_CPU_x86
+#include <Eigen/PardisoSupport>
+#endif
 #include <vector>
 #include <mutex>
+#include <memory>
+#include <deque>
 #include <omp.h>
 
 using Eigen::Map;
@@ -86,6 +96,7 @@ public:
     
     static int registerOption(map<string, vector<string>>& options_in);
     static void processMain();
+    static void mergeShards();
     void processFAM(vector<function<void (uintptr_t *, const vector<uint32_t> &)>> callBacks);
     //void processFAM();
 
@@ -141,10 +152,41 @@ private:
     //REML
     vector<SpMat> A;
     void logLREML(const Ref<const VectorXd> pheno, vector<double> &varcomp, double &logL, double *Hinv=NULL);
+    // LDLT of V for the REML grid, one solver per thread. The pattern of V is the
+    //   same at all grid points, so the ordering and symbolic analysis are done once
+    //   per thread and each point only factorizes. Reset when the pattern changes.
+    vector<std::unique_ptr<Eigen::SimplicialLDLT<SpMat>>> gridSolvers;
+    void resetGridSolvers();
+    Eigen::SimplicialLDLT<SpMat>& factorizeGridV(const SpMat &V);
+    // --reml-slq: log|V| by stochastic Lanczos quadrature and V inverse by block
+    //   PCG, no factorization of V. The probes are drawn once from the seed and
+    //   shared by all grid points, so the logL curve stays smooth.
+    bool bSLQ = false;
+    int slqSteps;
+    MatrixXd slqProbes;
+    void initSLQProbes(int n);
+    void logLREMLSLQ(const Ref<const VectorXd> pheno, vector<double> &varcomp, double &logL, double *Hinv=NULL);
 
     void loadModel();
 
     SpMat V_inverse;
+    // .mdl.bin3: the mapping stays alive while the model is used. V inverse
+    //   is used from the mapped pages when the samples are in the model order
+    std::unique_ptr<ModelFile> modelMap;
+    std::unique_ptr<Map<const SpMat>> V_inverse_map;
+    void loadModelMap(const string &bin_file);
+    void saveModelMap(const string &bin_file);
+    // --llt, --pardiso and --cg: V inverse is applied by solving with the factor
+    //   (or the preconditioned CG) of V instead of forming V_inverse
+    bool bSolveV = false;
+    SpMat V_sp;
+    Eigen::SimplicialLLT<SpMat, Eigen::Lower, Eigen::AMDOrdering<long long>> solverLLT;
+    Eigen::ConjugateGradient<SpMat, Eigen::Lower|Eigen::Upper,
+        Eigen::IncompleteCholesky<double, Eigen::Lower, Eigen::AMDOrdering<long long>>> solverPCG;
+#if GCTA_CPU_x86
+    Eigen::PardisoLDLT<SpMat> solverPardiso;
+#endif
+    void solveV(const MatrixXd &X, MatrixXd &ViX);
     vector<double> phenos;
     VectorXd phenoVec;
     VectorXd envirVec; 
@@ -184,7 +226,9 @@ private:
 
     std::ofstream osOut;
     FILE * bOut = NULL;
+    ResultStoreWriter * resStore = NULL;
     vector<char> osBuf;
+    TextBlockWriter resWriter;
     uint32_t numMarkerOutput = 0;
 
     uint32_t seed;
@@ -209,7 +253,6 @@ private:
     void estBinGamma();
     void binGrammar_func(uintptr_t *genobuf, const vector<uint32_t> &markerIndex);
     void calculate_spa(uintptr_t *genobuf, const vector<uint32_t> &markerIndex);
-    void getX(uintptr_t *genobuf, const vector<uint32_t> &markerIndex);
     //void conditionCovarRegBin(Eigen::Ref<VectorXd> pheno);
     bool binGridREML(const SpMat& fam, Ref<VectorXd> est_a, int maxIter, double threshold);
     double binLogL(double cur_tao, const SpMat& fam, const SpMat& W, const Ref<VectorXd> Y, const Ref<MatrixXd> X);
@@ -224,10 +267,19 @@ private:
 
     // gene
     void processFAMreg();
-    MatrixXd gX;
-    VectorXd gAF;
-    VectorXd gN;
-    int num_gene_index;
+    // decoded genotypes of the set markers, in positional order. Sets are run
+    //   by their start, markers before the start of the current set are no
+    //   longer needed and dropped from the front, so each is decoded once.
+    //   Rare markers stay sparse in the cache with --sparse-geno
+    struct SetMarker{
+        uint32_t index; // extracted index
+        bool valid;
+        double af; // of the allele counted, flipped to the minor one
+        GenoBufItem geno;
+    };
+    std::deque<SetMarker> setCache;
+    void cacheSetMarker(uintptr_t *genobuf, const vector<uint32_t> &markerIndex);
+    void setTest(const MatrixXd &gX, const VectorXd &gAF, std::ostream &os);
     
 };
 
@@ -59,6 +59,7 @@ public:
     static void processMain();
     void processMakeGRM();
     void processMakeGRMX();
+    void setCheckpoint(const string &name, const vector<uint32_t> &processIndex);
 
     void loop_block(vector<function<void (double *buf, int num_block)>> callbacks
                     = vector<function<void (double *buf, int num_block)>>());
@@ -66,6 +67,7 @@ public:
     void prune_fam(float thresh, bool isSparse = true, float *val = NULL);
     void unify_grm(string mgrm_file, string out_file);
     void subtract_grm(string mgrm_file, string out_file);
+    void merge_shards(string out_file, int num_shards, bool bPart);
 
 private:
     Pheno *pheno = NULL;
@@ -81,6 +83,8 @@ private:
 
     double *grm = NULL;
     uint32_t *N = NULL;
+    uint64_t num_fill_grm = 0;
+    uint64_t num_fill_N = 0;
     uint32_t *sub_miss = NULL; // sample miss in all markers
 
     //========
@@ -139,6 +143,7 @@ private:
     uint32_t numValidMarkers = 0;
 
     GenoBufItem *gbufitems = NULL;
+    void add_sparse_GRM(const vector<int> &sparseIndex);
 
     //Just for testing
 #ifndef NDEBUG
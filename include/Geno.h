@@ -25,7 +25,11 @@
 #include "Marker.h"
 #include "Logger.h"
 #include "AsyncBuffer.hpp"
+#include "TextFormat.h"
+#include "ResultStore.h"
+#include "LoopCheckpoint.h"
 #include <functional>
+#include <memory>
 #include "tables.h"
 #include <unordered_map>
 
@@ -80,8 +84,40 @@ typedef struct GenoBufItem{
     double info;
     uint32_t nValidN;
     uint32_t nValidAllele;
+
+    // in: the consumer takes the sparse form. With --sparse-geno, rare markers
+    //   are then given as geno = base for all the samples but nzIndex, which
+    //   are nzValue, and geno is left empty
+    bool bSparse = false;
+    // out
+    bool isSparse = false;
+    double base;
+    vector<uint32_t> nzIndex;
+    vector<double> nzValue;
+
+    // in: the consumer takes the 16-bit dosages of PGEN, geno = dosage *
+    //   dosageScale + dosageOffset. dosage points into the read buffer and is
+    //   only valid in the callback of the block, geno is left empty
+    bool bDosage = false;
+    // out
+    bool isDosage = false;
+    const uint16_t *dosage = NULL;
+    double dosageScale;
+    double dosageOffset;
+    uint64_t dosageSum;
+    uint64_t dosageSumSq;
 } GenoBufItem;
 
+// products with the genotypes of a marker in any of the forms, n samples
+// sum(x * y), sumY is the sum of y
+double genoDot(const GenoBufItem &item, const double *y, double sumY);
+// sum(w * x^2), sumW is the sum of w
+double genoWeightedSquaredNorm(const GenoBufItem &item, const double *w, double sumW);
+double genoSquaredNorm(const GenoBufItem &item, uint32_t n);
+// out = M * x, M column major of rows x n, rowSum is the sums of its rows
+void genoMultiply(const GenoBufItem &item, const double *M, uint32_t rows, const double *rowSum, double *out);
+void genoToDense(const GenoBufItem &item, uint32_t n, double *out);
+
 
 class Geno {
 public:
@@ -135,6 +171,13 @@ public:
 
     void loopDouble(const vector<uint32_t> &extractIndex, int numMarkerBuf, bool bMakeGeno, bool bGenoCenter, bool bGenoStd, bool bMakeMiss, vector<function<void (uintptr_t *buf, const vector<uint32_t> &exIndex)>> callbacks = vector<function<void (uintptr_t *buf, const vector<uint32_t> &exIndex)>>(), bool showLog = true);
 
+    // --checkpoint and --resume for the next loopDouble over extractIndex. The
+    //   states of the consumers are loaded here if a checkpoint is resumed, so
+    //   they can reopen their outputs before the loop; returns true in that case
+    bool setCheckpoint(const string &name, const vector<uint32_t> &extractIndex, const vector<CheckpointItem> &items);
+    // call after the outputs are complete to remove the checkpoint
+    void finishCheckpoint();
+
     bool getGenoHasInfo();
 
     void setGRMMode(bool grm, bool dominace);
@@ -183,7 +226,7 @@ private:
     uint64_t *keep_mask = NULL;
     uint64_t *keep_male_mask = NULL;
     bool isX;
-    void bgen2bed(const vector<uint32_t> &raw_marker_index);
+    void convertBgen(bool bPgen);
 
     friend class LD;
 
@@ -291,6 +334,7 @@ private:
     int iGRMdc = -1; // 0 no male dosage comp; 1 full comp; //default value shall be -1, equal variance
     int iDC = 1;
     bool f_std = false;
+    double sparseMAF = 0; // --sparse-geno
     void setMaleWeight(double &weight, bool &needWeight); // set the male weight by bGRM, dc specity
 
     int8_t alleModel = 1; // 1: add; 2: Dom; 3: Reces; 4: Het; //currently unused affect a0 a1 a2 na;
@@ -311,11 +355,14 @@ private:
     void getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf);
     void endGenoDouble_bgen();
     void readGeno_bgen(const vector<uint32_t> &extractIndex);
+    uint8_t* decodeBgenRecord(uint8_t *curbuf, int fileIndex, const string &error_promp, uint32_t &len_decomp);
+    void convertBgenMarker(uintptr_t *buf, int idx, uint32_t extractedIndex, bool bPgen, uintptr_t *out);
     //PGEN format;
     void preGenoDouble_pgen();
     void getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf);
     void endGenoDouble_pgen();
     void readGeno_pgen(const vector<uint32_t> &extractIndex);
+    bool hasPgenDosage();
  
     //BED
     int bedRawGenoBuf1PtrSize; // how many 64bit geno of raw sample save 
@@ -349,10 +396,17 @@ private:
     int pgenDosagePresentPtrSize;
     int pgenDosageMainPtrSize;
 
+    std::unique_ptr<LoopCheckpoint> checkpoint;
+    uint32_t resumeMarker = 0;
+    bool bCheckpointLooped = false;
+    vector<uint32_t> loopIndex;
+
     std::ofstream osOut;
-    FILE * bOut = NULL;
+    ResultStoreWriter * resStore = NULL;
     vector<char> osBuf;
+    TextBlockWriter outWriter;
     uint32_t numMarkerOutput = 0;
+    string resumeOutput;
 
     // main funcs
     void processRecodet();
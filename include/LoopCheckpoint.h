@@ -0,0 +1,112 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Checkpoints of the genotype loop (Geno::loopDouble) for --checkpoint and
+   --resume. A consumer registers how to save and load its state, such as
+   partial sums or the position of its output; the loop saves them after a
+   completed block at a fixed interval, and a resumed loop skips the
+   markers already finished.
+
+   File layout (little endian):
+     magic "GCKP", version, name, number of markers and samples, hash of the
+       extracted marker indices, number of finished markers
+     per consumer: name, uint64 size, state
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GCTA2_LOOPCHECKPOINT_H
+#define GCTA2_LOOPCHECKPOINT_H
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+
+using std::string;
+using std::vector;
+
+struct CheckpointItem{
+    string name;
+    std::function<void (std::ostream &os)> save;
+    std::function<void (std::istream &is)> load;
+};
+
+namespace CheckpointIO {
+    template <typename T>
+    void write(std::ostream &os, const T &val){
+        os.write((const char *)&val, sizeof(T));
+    }
+    template <typename T>
+    void read(std::istream &is, T &val){
+        if(!is.read((char *)&val, sizeof(T))) throw std::ios_base::failure("checkpoint");
+    }
+    template <typename T>
+    void writeArray(std::ostream &os, const T *data, uint64_t num){
+        write(os, num);
+        os.write((const char *)data, num * sizeof(T));
+    }
+    // the number of items must be the same as saved
+    template <typename T>
+    void readArray(std::istream &is, T *data, uint64_t num){
+        uint64_t saved;
+        read(is, saved);
+        if(saved != num || !is.read((char *)data, num * sizeof(T))) throw std::ios_base::failure("checkpoint");
+    }
+    template <typename T>
+    void writeVector(std::ostream &os, const vector<T> &vec){
+        writeArray(os, vec.data(), vec.size());
+    }
+    template <typename T>
+    void readVector(std::istream &is, vector<T> &vec){
+        uint64_t num;
+        read(is, num);
+        vec.resize(num);
+        if(!is.read((char *)vec.data(), num * sizeof(T))) throw std::ios_base::failure("checkpoint");
+    }
+
+    // open a text output at the saved position, dropping anything written after it
+    void reopenText(std::ofstream &os, const string &filename, uint64_t offset);
+    // the same for a binary output written by stdio
+    FILE* reopenBinary(const string &filename, uint64_t offset);
+}
+
+class LoopCheckpoint{
+public:
+    // interval: seconds between two checkpoints
+    LoopCheckpoint(const string &filename, const string &name, const vector<uint32_t> &extractIndex,
+            uint32_t numSample, const vector<CheckpointItem> &items, double interval);
+    // loads the consumer states, returns the number of finished markers,
+    //   0 if there is no checkpoint
+    uint32_t restore();
+    // saves if the interval has passed since the last one, or bForce
+    void update(uint32_t numFinished, bool bForce = false);
+    bool matches(const vector<uint32_t> &extractIndex);
+    // the job has finished, the checkpoint isn't needed any more
+    void remove();
+
+private:
+    string filename;
+    string name;
+    uint32_t numMarker;
+    uint32_t numSample;
+    uint64_t indexHash;
+    vector<CheckpointItem> items;
+    double interval;
+    std::chrono::steady_clock::time_point lastSave;
+
+    static uint64_t hashIndex(const vector<uint32_t> &extractIndex);
+};
+
+#endif //GCTA2_LOOPCHECKPOINT_H
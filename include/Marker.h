@@ -60,8 +60,20 @@ public:
     bool isEffecRevRaw(uint32_t rawIndex);
     string get_marker(int rawindex, bool bflip=false);
     string getMarkerStrExtract(int extractindex, bool bflip=false);
+    // same text as getMarkerStrExtract, prepared once for all extracted markers;
+    //   buildMarkerStr must be called again after the extraction changes
+    void buildMarkerStr();
+    // fields of an extracted marker, a1 is the effect allele
+    void getMarkerFields(uint32_t extractindex, uint8_t &chr_out, uint32_t &pos, const string *&snp,
+            const string *&a1_out, const string *&a2_out);
+    const char* getMarkerStrBuf(uint32_t extractindex, uint32_t &len) const {
+        len = markerStrOffset[extractindex + 1] - markerStrOffset[extractindex];
+        return markerStrBuf.data() + markerStrOffset[extractindex];
+    }
     static int registerOption(map<string, vector<string>>& options_in);
     static void processMain();
+    // suffix of the outputs from shard `index` (1 based) of `num_shards`, e.g. .shard_500_007
+    static string shardTag(int num_shards, int index);
     static MarkerInfo extractBgenMarkerInfo(FILE *h_bgen, uint64_t &pos);
     static MarkerParam getBgenMarkerParam(FILE *h_bgen, string &outputs);
     void extract_marker(vector<string> markers, bool isExtract);
@@ -93,6 +105,9 @@ private:
     vector<uint64_t> byte_size;
     vector<uint32_t> raw_limits;
 
+    vector<char> markerStrBuf;
+    vector<uint64_t> markerStrOffset;
+
     //bgen
     uint64_t maxGeno1ByteSize = 0;
 
@@ -115,6 +130,7 @@ private:
     static void addOneFileOption(string key_store, string append_string, string key_name,
                                  map<string, vector<string>> options_in);
     vector<string> read_snplist(string snplist_file);
+    void keep_shard();
     void read_bgen_index(string bgen_file);
     map<string, uint8_t> chr_maps;
     vector<MarkerParam> markerParams;
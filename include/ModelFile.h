@@ -0,0 +1,119 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Versioned fastGWA model file (.mdl.bin3) for --model-only and --load-model.
+   The file is memory mapped read only, so the jobs loading the same model on
+   one node share the physical pages of the large sections.
+
+   File layout (little endian):
+     ModelFileHeader, padded to MODEL_FILE_ALIGN bytes
+     sections, each starting at a multiple of MODEL_FILE_ALIGN
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GCTA2_MODELFILE_H
+#define GCTA2_MODELFILE_H
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+using std::string;
+using std::vector;
+
+const uint32_t MODEL_FILE_VERSION = 1;
+const uint64_t MODEL_FILE_ALIGN = 4096;
+
+enum ModelType : uint32_t {MODEL_LINEAR = 0, MODEL_GLMM = 1};
+
+enum ModelFlag : uint32_t {MODEL_FAM = 1, MODEL_GRAMMAR = 2, MODEL_COVAR = 4, MODEL_ENVIR = 8, MODEL_PRECISE_COVAR = 16};
+
+enum ModelSection : uint32_t {
+    MODEL_SEC_IDS = 0,   // sample IDs, FID\tIID\n
+    MODEL_SEC_PHENO,     // double[n], y or V^-1 y as used by the test
+    MODEL_SEC_MU,        // double[n], GLMM only
+    MODEL_SEC_COVAR,     // double[n * c], column major
+    MODEL_SEC_H,         // double[c * n], covariate projection
+    MODEL_SEC_ENVIR,     // double[n]
+    MODEL_SEC_VI_OUTER,  // int64[n + 1], column pointers of V inverse
+    MODEL_SEC_VI_INNER,  // int64[nnz], row indices of V inverse
+    MODEL_SEC_VI_VALUE,  // double[nnz]
+    MODEL_SEC_MAX
+};
+
+struct ModelSectionInfo{
+    uint64_t offset; // 0 if the section is absent
+    uint64_t size; // bytes
+    uint64_t checksum;
+};
+
+struct ModelFileHeader{
+    char magic[8]; // GCTAMDL
+    uint32_t version;
+    uint32_t type;
+    uint64_t numIndi;
+    uint32_t numCovar;
+    uint32_t flags;
+    uint64_t sampleHash; // modelChecksum of the sample ID section
+    double c_inf;
+    double VR;
+    double tao;
+    char phenoName[256];
+    char method[32];
+    ModelSectionInfo sections[MODEL_SEC_MAX];
+    uint64_t headerChecksum; // of the bytes above
+};
+
+// order sensitive checksum of 64 bit words, computed by threads at the
+//   speed of the memory, to detect truncated or corrupted files
+uint64_t modelChecksum(const void *data, uint64_t size);
+
+class ModelFileWriter{
+public:
+    ModelFileWriter(const string &filename, const ModelFileHeader &header);
+    ~ModelFileWriter();
+    void addSection(ModelSection id, const void *data, uint64_t size);
+    void close();
+
+private:
+    string filename;
+    FILE *hOut = NULL;
+    ModelFileHeader header;
+    uint64_t curOffset;
+};
+
+class ModelFile{
+public:
+    // maps the file and checks the header
+    ModelFile(const string &filename);
+    ~ModelFile();
+    const ModelFileHeader& getHeader(){ return header; }
+    bool hasSection(ModelSection id){ return header.sections[id].offset != 0; }
+    // the pointer stays valid while the object lives; with bCheck, the
+    //   checksum of the section is verified before returning
+    template <typename T>
+    const T* section(ModelSection id, uint64_t &count, bool bCheck = true){
+        return static_cast<const T*>(sectionData(id, count, sizeof(T), bCheck));
+    }
+    vector<string> sampleIDs();
+    // read only the header, to find the model type before loading
+    static bool readHeader(const string &filename, ModelFileHeader &header);
+
+private:
+    string filename;
+    ModelFileHeader header;
+    char *base = NULL;
+    uint64_t fileSize = 0;
+    const void* sectionData(ModelSection id, uint64_t &count, uint64_t elemSize, bool bCheck);
+};
+
+#endif //GCTA2_MODELFILE_H
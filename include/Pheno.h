@@ -54,6 +54,8 @@ public:
     void getMaskBit(uint64_t *maskp);
     void getMaskBitMale(uint64_t *maskp);
     uint32_t getSeed();
+    // phenotype file and the --mpheno column, empty if no phenotype file
+    string getPhenoName();
 
     vector<uint32_t>& getSexValidRawIndex();
     vector<uint32_t>& getMaleRawIndex();
@@ -0,0 +1,170 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Columnar binary store of per-marker results (--save-bin), and the reader
+   to extract them by region or p-value threshold (--read-bin).
+
+   File layout (little endian):
+     ResultStoreHeader
+     schema: per column, uint8 type, uint8 reserved, uint16 name length, name
+     chunks: per column, uint64 raw size, uint64 stored size, data
+        numeric columns are packed arrays, string columns are
+        uint32 lengths[numRow] followed by the characters
+     ResultChunkIndex[numChunk] at header.indexStart
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GCTA2_RESULTSTORE_H
+#define GCTA2_RESULTSTORE_H
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "Marker.h"
+
+using std::string;
+using std::vector;
+using std::map;
+
+enum ResultColType : uint8_t {RES_STR = 0, RES_U8 = 1, RES_U32 = 2, RES_F32 = 3, RES_F64 = 4};
+
+struct ResultColumn{
+    string name;
+    uint8_t type;
+};
+
+struct ResultStoreHeader{
+    char magic[4]; // GRES
+    uint32_t version; // 1
+    uint32_t numCol;
+    uint32_t compress; // 0: none; 1: zstd
+    uint64_t numRow;
+    uint32_t chunkRows; // rows per chunk, the last one may be shorter
+    uint32_t numChunk;
+    uint64_t indexStart; // byte offset of the chunk index
+};
+
+struct ResultChunkIndex{
+    uint64_t startByte;
+    uint32_t numRow;
+    uint8_t chrStart; // 0 if no CHR column
+    uint8_t chrEnd;
+    uint16_t reserved;
+    uint32_t posStart; // min and max POS in the chunk
+    uint32_t posEnd;
+    double minP; // NaN if no P column
+};
+
+// Values of one chunk, column by column
+struct ResultChunk{
+    uint32_t numRow = 0;
+    vector<vector<char>> data;
+    vector<vector<uint64_t>> strOffset; // string columns only, numRow + 1
+
+    template <typename T>
+    T get(int col, uint32_t row) const {
+        T val;
+        memcpy(&val, data[col].data() + (uint64_t)row * sizeof(T), sizeof(T));
+        return val;
+    }
+    const char* getStr(int col, uint32_t row, uint32_t &len) const {
+        len = strOffset[col][row + 1] - strOffset[col][row];
+        return data[col].data() + strOffset[col][row];
+    }
+};
+
+class ResultStoreWriter{
+public:
+    // pColumn: the column to index for p-value slicing, empty if none
+    ResultStoreWriter(const string &filename, const vector<ResultColumn> &columns, bool bCompress,
+            const string &pColumn = "P", uint32_t chunkRows = 65536);
+    // reopens a file at the state saved by saveState, the chunks after it are dropped
+    ResultStoreWriter(const string &filename, const vector<ResultColumn> &columns, bool bCompress,
+            const string &pColumn, std::istream &state);
+    ~ResultStoreWriter();
+    // for checkpoints: writes out the rows so far and saves the position
+    void saveState(std::ostream &os);
+
+    // CHR SNP POS A1 A2
+    static vector<ResultColumn> markerColumns();
+    // fill the columns from markerColumns(), return the next column
+    int putMarker(Marker *marker, uint32_t extractIndex);
+
+    void putStr(int col, const char *str, uint32_t len);
+    template <typename T>
+    void put(int col, T val){
+        vector<char> &buf = colData[col];
+        size_t size = buf.size();
+        buf.resize(size + sizeof(T));
+        memcpy(&buf[size], &val, sizeof(T));
+    }
+    void endRow();
+    void close();
+    uint64_t count(){ return header.numRow; }
+
+private:
+    string filename;
+    FILE *hOut = NULL;
+    ResultStoreHeader header;
+    vector<ResultColumn> columns;
+    vector<vector<char>> colData;
+    vector<vector<uint32_t>> strLens;
+    vector<ResultChunkIndex> chunkIndex;
+    uint32_t curRows = 0;
+    int chrCol = -1;
+    int posCol = -1;
+    int pCol = -1;
+    vector<char> compBuf;
+
+    void initColumns(const string &pColumn);
+    void flushChunk();
+    void writeBytes(const void *buf, size_t size);
+};
+
+class ResultStoreReader{
+public:
+    ResultStoreReader(const string &filename);
+    ~ResultStoreReader();
+    const vector<ResultColumn>& getColumns(){ return columns; }
+    int findColumn(const string &name);
+    uint64_t count(){ return header.numRow; }
+    uint32_t numChunk(){ return header.numChunk; }
+    const ResultChunkIndex& getChunkIndex(uint32_t index){ return chunkIndex[index]; }
+    void readChunk(uint32_t index, ResultChunk &chunk);
+
+private:
+    string filename;
+    FILE *hIn = NULL;
+    ResultStoreHeader header;
+    vector<ResultColumn> columns;
+    vector<ResultChunkIndex> chunkIndex;
+    vector<char> compBuf;
+
+    void readBytes(void *buf, size_t size);
+};
+
+class ResultStore{
+public:
+    static int registerOption(map<string, vector<string>>& options_in);
+    static void processMain();
+
+private:
+    static map<string, string> options;
+    static map<string, double> options_d;
+    static vector<string> processFunctions;
+    static void extract();
+};
+
+#endif //GCTA2_RESULTSTORE_H
@@ -17,6 +17,7 @@
 #ifndef STAT_LIB_H
 #define STAT_LIB_H
 #include <Eigen/Eigen>
+#include <cstdint>
 using Eigen::VectorXd;
 
 namespace StatLib{
@@ -26,8 +27,27 @@ namespace StatLib{
 
     double pnorm(double x, bool bLowerTail=false);
 
+    // Batch versions over n statistics, p may be the same array as x.
+    //   df=1 is computed by erfc, df=2 by exp, instead of the incomplete
+    //   gamma function. They agree with the scalar versions to a relative
+    //   error of 1e-12 while p >= 1e-300; smaller p underflow to 0 in both,
+    //   use lpchisqd1 for the log of such p-values.
+    void pchisqd1(const double *x, double *p, uint64_t n);
+    void pchisqd2(const double *x, double *p, uint64_t n);
+
+    // natural log of pchisqd1(x), finite for any x >= 0 by the asymptotic
+    //   expansion of erfc in the far tail; printed by TextFormat::writeLogP
+    double lpchisqd1(double x);
+    void lpchisqd1(const double *x, double *lp, uint64_t n);
+
     bool rankContrast(int n, double *Z);
 
     VectorXd weightBetaMAF(const VectorXd& MAF, double weight_alpha, double weight_beta);
+
+    // P(sum lambda_i chi2_1 > x), by the moment matching of Liu et al. (2009)
+    //   with the kurtosis adjustment of SKAT
+    double pchisqsum(double x, const VectorXd &lambda);
+    // Cauchy combination (ACAT) of p-values with weights
+    double acat(const VectorXd &p, const VectorXd &weight);
 }
 #endif //STAT_LIB_H
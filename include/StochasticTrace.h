@@ -0,0 +1,53 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Stochastic estimators for large symmetric positive definite operators:
+   Hutchinson trace estimation, stochastic Lanczos quadrature (SLQ) of the
+   log-determinant and a block preconditioned conjugate gradient solver.
+   The operator is only accessed by products with a block of vectors, so a
+   sparse matrix or a matrix-free GRM can be used alike.
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GCTA2_STOCHASTICTRACE_H
+#define GCTA2_STOCHASTICTRACE_H
+#include <functional>
+#include <cstdint>
+#include "Eigen/Dense"
+
+namespace StochasticTrace {
+    using Eigen::MatrixXd;
+    using Eigen::VectorXd;
+
+    // Y = A * X for a block of column vectors X
+    typedef std::function<void (const MatrixXd &X, MatrixXd &Y)> BlockOp;
+
+    // fill Z with Rademacher (+1 / -1) probes, the same seed gives the same probes
+    void rademacher(MatrixXd &Z, uint32_t seed);
+
+    // Solves A X = B for all the columns at once with the Jacobi preconditioner
+    //   diag(A), one operator product per iteration. X is the initial guess,
+    //   zero if its size doesn't match B. Returns the number of iterations,
+    //   or -1 if some columns haven't reached the relative tolerance.
+    int blockCG(const BlockOp &op, const VectorXd &diag, const MatrixXd &B, MatrixXd &X,
+            double tol = 1e-8, int maxIter = 1000);
+
+    // Hutchinson estimate of tr(F) from the probes Z and FZ = F * Z
+    double hutchinson(const MatrixXd &Z, const MatrixXd &FZ);
+
+    // SLQ estimate of log|A|: a Lanczos run of at most `steps` from each probe,
+    //   and Gauss quadrature of log on the eigenvalues of the tridiagonal
+    //   matrix. Returns NaN if A is not positive definite on a Krylov space.
+    double slqLogDet(const BlockOp &op, const MatrixXd &Z, int steps);
+}
+
+#endif //GCTA2_STOCHASTICTRACE_H
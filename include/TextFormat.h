@@ -0,0 +1,136 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Fast text formatting of per-marker results: numbers are printed into
+   reusable char buffers, lines of a block are formatted in parallel and
+   flushed to the output stream in order.
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GCTA2_TEXTFORMAT_H
+#define GCTA2_TEXTFORMAT_H
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <omp.h>
+
+namespace TextFormat {
+    // same text as ostream << v with the default precision (printf "%.6g")
+    char* writeNum(char *p, double v, int precision = 6);
+    // same text as std::to_string(v) when decimals = 6 (printf "%.6f")
+    char* writeFixed(char *p, double v, int decimals = 6);
+    char* writeUInt(char *p, uint64_t v);
+    // p from its natural log: as writeNum(exp(lnp)) while that is a normal
+    //   double, in scientific notation from log10 below it (e.g. 3.5e-1000)
+    char* writeLogP(char *p, double lnp, int precision = 6);
+    // the longest text produced by the writers above
+    const int MAX_NUM_LEN = 32;
+}
+
+// Growable char buffer, the memory is kept between blocks
+class TextBuffer {
+public:
+    void clear(){ len = 0; }
+    size_t size() const { return len; }
+    const char* data() const { return buf.data(); }
+
+    void add(const char *s, size_t n){
+        reserve(n);
+        memcpy(&buf[len], s, n);
+        len += n;
+    }
+    void add(char c){
+        reserve(1);
+        buf[len++] = c;
+    }
+    void addNum(double v){
+        reserve(TextFormat::MAX_NUM_LEN);
+        len = TextFormat::writeNum(&buf[len], v) - buf.data();
+    }
+    void addFixed(double v, int decimals = 6){
+        reserve(TextFormat::MAX_NUM_LEN + decimals);
+        len = TextFormat::writeFixed(&buf[len], v, decimals) - buf.data();
+    }
+    void addUInt(uint64_t v){
+        reserve(TextFormat::MAX_NUM_LEN);
+        len = TextFormat::writeUInt(&buf[len], v) - buf.data();
+    }
+    // tab separated fields
+    void addFieldNum(double v){
+        add('\t');
+        addNum(v);
+    }
+    void addFieldLogP(double lnp){
+        add('\t');
+        reserve(TextFormat::MAX_NUM_LEN);
+        len = TextFormat::writeLogP(&buf[len], lnp) - buf.data();
+    }
+    void addFieldUInt(uint64_t v){
+        add('\t');
+        addUInt(v);
+    }
+    void addNA(int count){
+        for(int i = 0; i < count; i++) add("\tNA", 3);
+    }
+
+private:
+    std::vector<char> buf;
+    size_t len = 0;
+
+    void reserve(size_t n){
+        if(len + n > buf.size()){
+            buf.resize(std::max(buf.size() * 2, len + n + 4096));
+        }
+    }
+};
+
+// Formats numLines lines with fill(index, buffer) in parallel, fill returns
+//   whether it has appended a line. Lines are grouped into chunks of
+//   linesPerChunk, each chunk is formatted by one thread in its own buffer
+//   and written to the stream with a single write in the original order.
+class TextBlockWriter {
+public:
+    TextBlockWriter(int linesPerChunk = 64) : chunkLines(linesPerChunk){}
+    void setChunkLines(int linesPerChunk){ chunkLines = std::max(1, linesPerChunk); }
+
+    template <typename F>
+    uint32_t write(uint32_t numLines, std::ostream &os, F fill){
+        int nChunk = (numLines + chunkLines - 1) / chunkLines;
+        int nThread = omp_get_max_threads();
+        if(bufs.size() < nThread) bufs.resize(nThread);
+
+        uint32_t numWritten = 0;
+        #pragma omp parallel for ordered schedule(static, 1) reduction(+:numWritten)
+        for(int chunk = 0; chunk < nChunk; chunk++){
+            TextBuffer &buf = bufs[omp_get_thread_num()];
+            buf.clear();
+            uint32_t start = chunk * chunkLines;
+            uint32_t end = std::min(start + chunkLines, numLines);
+            for(uint32_t i = start; i < end; i++){
+                if(fill(i, buf)) numWritten++;
+            }
+            #pragma omp ordered
+            {
+                if(buf.size()) os.write(buf.data(), buf.size());
+            }
+        }
+        return numWritten;
+    }
+
+private:
+    uint32_t chunkLines;
+    std::vector<TextBuffer> bufs;
+};
+
+#endif //GCTA2_TEXTFORMAT_H
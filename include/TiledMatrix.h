@@ -0,0 +1,86 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Symmetric matrix stored by its lower tiles, in memory or in a memory
+   mapped scratch file, for REML on samples whose V doesn't fit in RAM.
+   The Cholesky factorization runs as a graph of tile tasks (OpenMP depend),
+   and the inverse, products and traces stream over the tiles, so only the
+   tiles in use have to be resident and each tile operation is one BLAS call.
+
+   Tile (i, j), i >= j, is stored column major in slot i * (i + 1) / 2 + j
+   of tile * tile doubles; the last tile row and column may be shorter.
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GCTA2_TILEDMATRIX_H
+#define GCTA2_TILEDMATRIX_H
+#include <string>
+#include <cstdint>
+#include "Eigen/Dense"
+
+using std::string;
+using Eigen::Map;
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+class TiledMatrix{
+public:
+    // n x n, in anonymous memory if scratch is empty, otherwise in the file
+    //   scratch, which is removed as soon as it is mapped
+    TiledMatrix(int n, int tile, const string &scratch = "");
+    ~TiledMatrix();
+    TiledMatrix(const TiledMatrix&) = delete;
+    TiledMatrix& operator=(const TiledMatrix&) = delete;
+
+    int rows() const { return n; }
+    int numTiles() const { return nt; }
+    int tileRows(int i) const { return (i == nt - 1) ? n - i * tile : tile; }
+    int tileStart(int i) const { return i * tile; }
+    // i >= j. Diagonal tiles are only valid in their lower triangle after
+    //   cholesky or inverse
+    Map<MatrixXd> block(int i, int j) const {
+        return Map<MatrixXd>(data + ((uint64_t)i * (i + 1) / 2 + j) * tile * tile, tileRows(i), tileRows(j));
+    }
+
+    void setZero();
+    // this += alpha * B, B has the same size and tile
+    void add(double alpha, const TiledMatrix &B);
+    // diagonal += d
+    void addDiagonal(const VectorXd &d);
+    VectorXd diagonal() const;
+
+    // in place lower Cholesky factor; false if not positive definite
+    bool cholesky(double &logdet);
+    // from the Cholesky factor, in place inverse of the matrix
+    void inverse();
+
+    // Y = this * X for the symmetric matrix
+    void multiply(const MatrixXd &X, MatrixXd &Y) const;
+    // sum of the elementwise product of the symmetric matrices
+    double frobenius(const TiledMatrix &B) const;
+
+    // release the resident pages of a scratch file, they are read back on use
+    void evict();
+
+    // bytes of the storage of an n x n matrix by tiles
+    static uint64_t storageSize(int n, int tile);
+
+private:
+    int n;
+    int tile;
+    int nt;
+    uint64_t bytes;
+    double *data = NULL;
+    bool bFile = false;
+};
+
+#endif //GCTA2_TILEDMATRIX_H
@@ -11,7 +11,10 @@
 #include "StatFunc.h"
 #include "numeric"
 #include <random>
+#include <cmath>
 #include "Logger.h"
+#include "StatLib.h"
+#include "TextFormat.h"
 
 ////////// P-value Calculatiion Functions Start ////////////////
 
@@ -630,6 +633,10 @@ double StatFunc::qnorm(double p, bool upper) {
 double StatFunc::pchisq(double x, double df) {
     if (x < 0) return -9;
 
+    // closed forms of the upper tail, much cheaper than the incomplete gamma
+    if (df == 1) return erfc(sqrt(0.5 * x));
+    if (df == 2) return exp(-0.5 * x);
+
     double p, q;
     int st = 0; // error variable
     int w = 1; // function variable
@@ -645,6 +652,12 @@ double StatFunc::pchisq(double x, double df) {
     return q;
 }
 
+std::string StatFunc::pchisq_text(double p, double x) {
+    char buf[TextFormat::MAX_NUM_LEN];
+    char *end = (p == 0.0 && x > 0.0) ? TextFormat::writeLogP(buf, StatLib::lpchisqd1(x)) : TextFormat::writeNum(buf, p);
+    return std::string(buf, end);
+}
+
 double StatFunc::qchisq(double q, double df) {
     if (q < 0) return -9;
     else if (q >= 1) return 0;
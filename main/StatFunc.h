@@ -102,6 +102,10 @@ namespace StatFunc
     // chisq distribution
     double pchisq(double x, double df);
     double qchisq(double q, double df);
+    // the text of p as ostream << p, or from the log of the upper tail of
+    //   the 1-df chi-square x when p has underflowed to 0 (x < 0 if p is
+    //   not from one)
+    std::string pchisq_text(double p, double x);
     
     // sum of chisq distribution
     double pchisqsum(double x, VectorXd lambda);
@@ -0,0 +1,174 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Genotypes read from the PLINK BED file by blocks of SNPs
+ *
+ * read_bed_stream() takes the layout of the BED file in place of
+ * read_bedfile(), so _snp_1 and _snp_2 are never filled: the allele
+ * frequencies, the GRM and the genotypes of make_XMat_subset() are then
+ * decoded from blocks of SNPs read as they are needed, and the memory for the
+ * genotypes is O(n * block) instead of O(n * m).
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file COPYING for more
+ * details
+ */
+
+#include "gcta.h"
+
+// SNPs per block read from the BED file
+static const int bed_block = 1024;
+
+void gcta::read_bed_stream(string bedfile)
+{
+    int i = 0;
+    vector<int> rindi, rsnp;
+    get_rindi(rindi);
+    get_rsnp(rsnp);
+
+    if (_include.size() == 0) LOGGER.e(0, "no SNP is retained for analysis.");
+    if (_keep.size() == 0) LOGGER.e(0, "no individual is retained for analysis.");
+
+    ifstream BIT(bedfile.c_str(), ios::in | ios::binary);
+    if (!BIT) LOGGER.e(0, "cannot open the file [" + bedfile + "] to read.");
+    BIT.seekg(0, ios::end);
+    uint64_t bed_size = BIT.tellg();
+    BIT.close();
+    uint64_t nbyte = (_indi_num + 3) / 4;
+    if (bed_size != 3 + nbyte * _snp_num) LOGGER.e(0, "problem with the BED file ... has the FAM/BIM file been changed?");
+
+    _bed_stream = bedfile;
+    _bed_raw_indi_num = _indi_num;
+    _bed_raw_indi.clear();
+    _bed_raw_snp.clear();
+    for (i = 0; i < _indi_num; i++) {
+        if (rindi[i]) _bed_raw_indi.push_back(i);
+    }
+    for (i = 0; i < _snp_num; i++) {
+        if (rsnp[i]) _bed_raw_snp.push_back(i);
+    }
+    LOGGER << "Genotypes of " << _bed_raw_indi.size() << " individuals and " << _bed_raw_snp.size() << " SNPs to be read from [" + bedfile + "] by blocks of " << bed_block << " SNPs." << endl;
+
+    update_fam(rindi);
+    update_bim(rsnp);
+}
+
+// the number of the reference alleles of the SNPs _include[snp_indx] for the
+// individuals in _keep, 1e6 if missing
+void gcta::read_bed_block(const vector<int> &snp_indx, MatrixXf &X)
+{
+    int n = _keep.size(), m = snp_indx.size();
+    uint64_t nbyte = (_bed_raw_indi_num + 3) / 4;
+    vector<char> buf(nbyte * m);
+    ifstream BIT(_bed_stream.c_str(), ios::in | ios::binary);
+    if (!BIT) LOGGER.e(0, "cannot open the file [" + _bed_stream + "] to read.");
+    for (int j = 0; j < m; j++) {
+        BIT.seekg(3 + nbyte * _bed_raw_snp[_include[snp_indx[j]]]);
+        BIT.read(&buf[nbyte * j], nbyte);
+        if (!BIT) LOGGER.e(0, "problem with the BED file ... has the FAM/BIM file been changed?");
+    }
+    BIT.close();
+
+    // by the 2-bit code (first individual in the low bits): two copies of
+    // allele1, missing, heterozygote, no copy
+    const float count_A1[4] = {2.0, 1e6, 1.0, 0.0};
+    X.resize(n, m);
+    #pragma omp parallel for
+    for (int j = 0; j < m; j++) {
+        int k = _include[snp_indx[j]];
+        bool flip = (_allele1[k] != _ref_A[k]);
+        const char *b = &buf[nbyte * j];
+        for (int i = 0; i < n; i++) {
+            int r = _bed_raw_indi[_keep[i]];
+            float x = count_A1[(b[r >> 2] >> ((r & 3) << 1)) & 3];
+            X(i, j) = (flip && x < 1e5) ? 2.0 - x : x;
+        }
+    }
+}
+
+void gcta::calcu_mu_stream(vector<double> &auto_fac, vector<double> &xfac, vector<double> &fac)
+{
+    int m = _include.size(), n = _keep.size();
+    MatrixXf X;
+    vector<int> indx;
+    for (int start = 0; start < m; start += bed_block) {
+        int size = min(bed_block, m - start);
+        indx.resize(size);
+        for (int l = 0; l < size; l++) indx[l] = start + l;
+        read_bed_block(indx, X);
+        #pragma omp parallel for
+        for (int l = 0; l < size; l++) {
+            int k = _include[start + l];
+            const vector<double> &f = (_chr[k] < _autosome_num + 1) ? auto_fac : ((_chr[k] == _autosome_num + 1) ? xfac : fac);
+            double fcount = 0.0, sum = 0.0;
+            for (int i = 0; i < n; i++) {
+                if (X(i, l) < 1e5) {
+                    sum += f[i] * X(i, l);
+                    fcount += f[i];
+                }
+            }
+            if (fcount > 0.0) _mu[k] = sum / fcount;
+        }
+    }
+}
+
+// the GRM of make_grm_mkl() for --mlma (lower triangle by rows in _grm_mkl),
+// accumulated over the blocks of SNPs; the pairs with a missing genotype are
+// counted by the missing indicators of the blocks that have one
+void gcta::make_grm_stream(bool inbred)
+{
+    check_autosome();
+    if (_mu.empty()) calcu_mu();
+
+    unsigned long n = _keep.size(), m = _include.size();
+    LOGGER << "\nCalculating the genetic relationship matrix (GRM) by blocks of " << bed_block << " SNPs ... " << endl;
+    _grm_mkl = new float[n * n];
+    // by columns, so that the upper triangle is the lower triangle by rows
+    Map<MatrixXf> A(_grm_mkl, n, n);
+    A.setZero();
+    _grm_N = MatrixXf::Zero(n, n);
+    VectorXf miss_num = VectorXf::Zero(n);
+    bool miss_flag = false;
+
+    MatrixXf X, M;
+    vector<int> indx;
+    for (int start = 0; start < m; start += bed_block) {
+        int size = min(bed_block, (int)m - start);
+        indx.resize(size);
+        for (int l = 0; l < size; l++) indx[l] = start + l;
+        read_bed_block(indx, X);
+        M = MatrixXf::Zero(n, size);
+        int block_miss = 0;
+        #pragma omp parallel for reduction(+:block_miss)
+        for (int l = 0; l < size; l++) {
+            double mu = _mu[_include[start + l]], sd = mu * (1.0 - 0.5 * mu);
+            float sd_i = (fabs(sd) < 1.0e-50) ? 0.0 : sqrt(1.0 / sd);
+            for (int r = 0; r < n; r++) {
+                if (X(r, l) < 1e5) X(r, l) = (X(r, l) - mu) * sd_i;
+                else {
+                    X(r, l) = 0.0;
+                    M(r, l) = 1.0;
+                    block_miss++;
+                }
+            }
+        }
+        A.selfadjointView<Upper>().rankUpdate(X);
+        if (block_miss > 0) {
+            miss_num += M.rowwise().sum();
+            _grm_N.selfadjointView<Upper>().rankUpdate(M);
+            miss_flag = true;
+        }
+    }
+
+    // the number of SNPs without a missing genotype in either of a pair, in the
+    // lower triangle of _grm_N as make_grm_mkl()
+    #pragma omp parallel for
+    for (int j = 0; j < n; j++) {
+        for (int k = 0; k <= j; k++) {
+            float N = m - miss_num[j] - miss_num[k] + (miss_flag ? _grm_N(k, j) : 0.0);
+            _grm_N(j, k) = N;
+            A(k, j) = (N > 0.0) ? A(k, j) / N : 0.0;
+            if (inbred) A(k, j) *= 0.5;
+        }
+    }
+}
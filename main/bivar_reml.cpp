@@ -202,6 +202,7 @@ void gcta::fit_bivar_reml(string grm_file, string phen_file, string qcovar_file,
         //LOGGER << "Fill Matrix " << pos << " part2 finished" << endl; 
         pos++;
 
+        if (_reml_eigen) bivar_eigen_decomp(nms1, nms2);
         _grm.resize(0, 0);
         //LOGGER << "Transform the data finished" << endl;
     } 
@@ -465,6 +466,8 @@ double gcta::lgL_fix_rg(eigenVector &prev_varcmp, bool no_constrain) {
         varcmp[i] = fabs(prev_varcmp[_r_indx[i]]);
         if (varcmp[i] < 1.0e-30) varcmp[i] = 0.1;
     }
+    // the loadings of the genetic variances change with each iteration
+    _bv_eig_active = false;
     double lgL = reml_iteration(Vi_X, Xt_Vi_X_i, Hi, Py, varcmp, false, no_constrain, true);
     _r_indx = r_indx_buf;
     _bivar_pos = _bivar_pos_prev;
@@ -1585,17 +1585,25 @@ void gcta::calcu_mu(bool ssq_flag) {
     _mu.clear();
     _mu.resize(_snp_num);
 
-    #pragma omp parallel for
-    for (int j = 0; j < _include.size(); j++) {
-        if (_chr[_include[j]]<(_autosome_num + 1)) {
-            mu_func(j, auto_fac);
-        }else if (_chr[_include[j]] == (_autosome_num + 1)) {
-            if(no_sex_info){
-                flag_x_problem = true;
+    if (!_bed_stream.empty()) {
+        for (i = 0; i < _include.size() && no_sex_info && !flag_x_problem; i++) {
+            if (_chr[_include[i]] == (_autosome_num + 1)) flag_x_problem = true;
+        }
+        calcu_mu_stream(auto_fac, xfac, fac);
+    }
+    else {
+        #pragma omp parallel for
+        for (int j = 0; j < _include.size(); j++) {
+            if (_chr[_include[j]]<(_autosome_num + 1)) {
+                mu_func(j, auto_fac);
+            }else if (_chr[_include[j]] == (_autosome_num + 1)) {
+                if(no_sex_info){
+                    flag_x_problem = true;
+                }
+                mu_func(j, xfac);
+            }else{
+                mu_func(j, fac);
             }
-            mu_func(j, xfac);
-        }else{
-            mu_func(j, fac);
         }
     }
 
@@ -2044,17 +2052,27 @@ bool gcta::make_XMat_subset(MatrixXf &X, vector<int> &snp_indx, bool divid_by_st
 
     int i = 0, j = 0, k = 0, n = _keep.size(), m = snp_indx.size();
 
-    X.resize(n, m);
-    #pragma omp parallel for private(j, k)
-    for (i = 0; i < n; i++) {
+    if (!_bed_stream.empty()) {
+        read_bed_block(snp_indx, X);
+        #pragma omp parallel for private(i, k)
         for (j = 0; j < m; j++) {
             k = _include[snp_indx[j]];
-            if (!_snp_1[k][_keep[i]] || _snp_2[k][_keep[i]]) {
-                if (_allele1[k] == _ref_A[k]) X(i,j) = _snp_1[k][_keep[i]] + _snp_2[k][_keep[i]];
-                else X(i,j) = 2.0 - (_snp_1[k][_keep[i]] + _snp_2[k][_keep[i]]);
-                X(i,j) -= _mu[k];
-            } 
-            else X(i,j) = 0.0;
+            for (i = 0; i < n; i++) X(i,j) = (X(i,j) < 1e5) ? X(i,j) - _mu[k] : 0.0;
+        }
+    }
+    else {
+        X.resize(n, m);
+        #pragma omp parallel for private(j, k)
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < m; j++) {
+                k = _include[snp_indx[j]];
+                if (!_snp_1[k][_keep[i]] || _snp_2[k][_keep[i]]) {
+                    if (_allele1[k] == _ref_A[k]) X(i,j) = _snp_1[k][_keep[i]] + _snp_2[k][_keep[i]];
+                    else X(i,j) = 2.0 - (_snp_1[k][_keep[i]] + _snp_2[k][_keep[i]]);
+                    X(i,j) -= _mu[k];
+                } 
+                else X(i,j) = 0.0;
+            }
         }
     }
 
@@ -57,6 +57,10 @@ void gcta::set_reml_mtd(int reml_mtd)
 void gcta::set_reml_inv_method(int method){
     _reml_inv_mtd = method;
 }
+
+void gcta::set_reml_float(){
+    _reml_float = true;
+}
     
 
 void gcta::read_phen(string phen_file, vector<string> &phen_ID, vector< vector<string> > &phen_buf, int mphen, int mphen2) {
@@ -73,6 +77,10 @@ void gcta::read_phen(string phen_file, vector<string> &phen_ID, vector< vector<s
     getline(in_phen, str_buf);
     int phen_num = StrFunc::split_string(str_buf, vs_buf) - 2;
     if (phen_num <= 0) LOGGER.e(0, "no phenotype data is found.");
+    // an optional header line "FID IID <trait names>"
+    bool header_flag = ((vs_buf[0] == "FID" || vs_buf[0] == "#FID") && vs_buf[1] == "IID");
+    _phen_name.clear();
+    if (header_flag) _phen_name.assign(vs_buf.begin() + 2, vs_buf.end());
     if (phen_num > 1) LOGGER << "There are " << phen_num << " traits specified in the file [" + phen_file + "]." << endl;
     if (mphen > phen_num) {
         stringstream errmsg;
@@ -89,6 +97,7 @@ void gcta::read_phen(string phen_file, vector<string> &phen_ID, vector< vector<s
         if (phen_num > 1) LOGGER << "Trait #" << mphen << " is included for analysis." << endl;
     }
     in_phen.seekg(ios::beg);
+    if (header_flag) getline(in_phen, str_buf);
     mphen--;
     mphen2--;
     int line = 1;
@@ -266,6 +275,23 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
         }
     }
     read_phen(phen_file, phen_ID, phen_buf, mphen);
+    if (_reml_batch) {
+        // the traits share one eigenbasis, so only the individuals without missing values in all the traits are kept
+        int num_kept = 0;
+        for (int i = 0; i < phen_ID.size(); i++) {
+            bool missing = false;
+            for (int j = 0; j < phen_buf[i].size(); j++) {
+                if (phen_buf[i][j] == "-9" || phen_buf[i][j] == "NA") missing = true;
+            }
+            if (missing) continue;
+            phen_ID[num_kept] = phen_ID[i];
+            phen_buf[num_kept] = phen_buf[i];
+            num_kept++;
+        }
+        phen_ID.resize(num_kept);
+        phen_buf.resize(num_kept);
+        LOGGER << num_kept << " individuals have non-missing values of all the " << (phen_buf.empty() ? 0 : phen_buf[0].size()) << " traits for --reml-batch." << endl;
+    }
     update_id_map_kp(phen_ID, _id_map, _keep);
     if (qcovar_flag) {
         qcovar_num = read_covar(qcovar_file, qcovar_ID, qcovar, true);
@@ -344,11 +370,14 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
         _A.resize(_r_indx.size());
         if (mlmassoc) StrFunc::match(uni_id, grm_id, kp);
         else kp = _keep;
-        (_A[0]) = eigenMatrix::Zero(_n, _n);
+        if (ooc_reml_init(1, qGE_flag || GE_flag, mlmassoc, reml_bending)) ooc_store_grm(0, kp);
+        else {
+            (_A[0]) = eigenMatrix::Zero(_n, _n);
 
-        #pragma omp parallel for
-        for (int i = 0; i < _n; i++) {
-            for (int j = 0; j <= i; j++) (_A[0])(j, i) = (_A[0])(i, j) = _grm(kp[i], kp[j]);
+            #pragma omp parallel for
+            for (int i = 0; i < _n; i++) {
+                for (int j = 0; j <= i; j++) (_A[0])(j, i) = (_A[0])(i, j) = _grm(kp[i], kp[j]);
+            }
         }
         if (_reml_diag_one) {
             double diag_mean = (_A[0]).diagonal().mean();
@@ -373,12 +402,17 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
         string prev_file = grm_files[0];
         vector<string> prev_grm_id(grm_id);
         LOGGER << "There are " << grm_files.size() << " GRM file names specified in the file [" + grm_file + "]." << endl;
+        bool ooc_flag = ooc_reml_init(grm_files.size(), qGE_flag || GE_flag, mlmassoc, reml_bending);
         for (int i = 0; i < grm_files.size(); i++, pos++) {
             LOGGER << "Reading the GRM from the " << i + 1 << "th file ..." << endl;
             read_grm(grm_files[i], grm_id, true, false, !(adj_grm_fac > -1.0));
             if (adj_grm_fac>-1.0) adj_grm(adj_grm_fac);
             if (dosage_compen>-1) dc(dosage_compen);
             StrFunc::match(uni_id, grm_id, kp);
+            if (ooc_flag) {
+                ooc_store_grm(pos, kp);
+                continue;
+            }
             (_A[pos]) = eigenMatrix::Zero(_n, _n);
 
             #pragma omp parallel for
@@ -412,7 +446,9 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
         _r_indx.push_back(0);
         _A.resize(_r_indx.size());
     }
-    _A[_r_indx.size() - 1] = eigenMatrix::Identity(_n, _n);
+    if (_ooc_active) _ooc_res = eigenVector::Ones(_n);
+    else _A[_r_indx.size() - 1] = eigenMatrix::Identity(_n, _n);
+    _eig_indx = -1;
     if(!weight_file.empty()){
         // contruct weight
         VectorXd v_weight(_n);
@@ -431,7 +467,8 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
         o_test.close();
         */
 
-        _A[_r_indx.size() - 1].diagonal() = v_weight;
+        if (_ooc_active) _ooc_res = v_weight;
+        else _A[_r_indx.size() - 1].diagonal() = v_weight;
     }
 
     // GE interaction
@@ -516,6 +553,16 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
     //LOGGER << "Prepare time: " << LOGGER.tp("main") << std::endl;
 
     // run REML algorithm
+    if (_reml_batch) {
+        eigenMatrix Y(_n, phen_buf.empty() ? 0 : phen_buf[0].size());
+        for (int i = 0; i < phen_ID.size(); i++) {
+            iter = uni_id_map.find(phen_ID[i]);
+            if (iter == uni_id_map.end()) continue;
+            for (int j = 0; j < Y.cols(); j++) Y(iter->second, j) = atof(phen_buf[i][j].c_str());
+        }
+        reml_batch(Y, no_constrain);
+        return;
+    }
     reml(pred_rand_eff, est_fix_eff, reml_priors, reml_priors_var, prevalence, -2.0, no_constrain, no_lrt, mlmassoc);
 }
 
@@ -701,16 +748,25 @@ int gcta::constrain_varcmp(eigenVector &varcmp) {
         return num;
     }
 
-    for (i = 0; i < _r_indx.size(); i++) {
+    return constrain_varcmp(varcmp, _y_Ssq);
+}
+
+// univariate analysis, y_Ssq is the phenotypic variance
+int gcta::constrain_varcmp(eigenVector &varcmp, double y_Ssq) {
+    double delta = 0.0, constr_scale = 1e-6;
+    int i = 0, num = 0;
+    vector<int> constrain(varcmp.size());
+
+    for (i = 0; i < varcmp.size(); i++) {
         if (varcmp[i] < 0) {
-            delta += _y_Ssq * constr_scale - varcmp[i];
-            varcmp[i] = _y_Ssq * constr_scale;
+            delta += y_Ssq * constr_scale - varcmp[i];
+            varcmp[i] = y_Ssq * constr_scale;
             constrain[i] = 1;
             num++;
         }
     }
-    delta /= (_r_indx.size() - num);
-    for (i = 0; i < _r_indx.size(); i++) {
+    delta /= (varcmp.size() - num);
+    for (i = 0; i < varcmp.size(); i++) {
         if (constrain[i] < 1 && varcmp[i] > delta) varcmp[i] -= delta;
     }
 
@@ -742,17 +798,30 @@ void gcta::reml(bool pred_rand_eff, bool est_fix_eff, vector<double> &reml_prior
 
     LOGGER << "\nPerforming " << (_bivar_reml ? "bivariate" : "") << " REML analysis ... (Note: may take hours depending on sample size)." << endl;
     if (_n < 10) LOGGER.e(0, "sample size is too small.");
+    if (_reml_rand_probes > 0 && (mlmassoc || _cv_blup)) LOGGER.e(0, "the randomized REML (--reml-rand) doesn't form V^-1, which is needed by --mlma and --cv-blup.");
     LOGGER << _n << " observations, " << _X_c << " fixed effect(s), and " << _r_indx.size() << " variance component(s)(including residual variance)." << endl;
     eigenMatrix Vi_X(_n, _X_c), Xt_Vi_X_i(_X_c, _X_c), Hi(_r_indx.size(), _r_indx.size());
     eigenVector Py(_n), varcmp;
     init_varcomp(reml_priors_var, reml_priors, varcmp);
+    // a checkpoint of this run, or else the estimates of a previous run
+    _reml_ckpt_iter = 0;
+    bool warm_flag = reml_ckpt_read(varcmp) || reml_warm_start(varcmp);
     //LOGGER << "REML begin reml iteration" << endl;
-    double lgL = reml_iteration(Vi_X, Xt_Vi_X_i, Hi, Py, varcmp, reml_priors_var_flag | reml_priors_flag, no_constrain);
+    _reml_ckpt_active = _reml_ckpt;
+    double lgL = reml_iteration(Vi_X, Xt_Vi_X_i, Hi, Py, varcmp, reml_priors_var_flag | reml_priors_flag | warm_flag, no_constrain);
+    _reml_ckpt_active = false;
+    if (_reml_eigen && !_eig_active && !_bv_eig_active) LOGGER.w(0, "--reml-eigen only applies to a single GRM with an unweighted residual, the standard REML was used.");
+    if (mlmassoc && _eig_active) eigen_reml_Vi();
     eigenMatrix u;
     if (pred_rand_eff) {
         u.resize(_n, _r_indx.size());
         for (i = 0; i < _r_indx.size(); i++) {
             if (_bivar_reml || _within_family)(u.col(i)) = (((_Asp[_r_indx[i]]) * Py) * varcmp[i]);
+            else if (_ooc_active || _rand_active) {
+                eigenMatrix APy;
+                calcu_AZ(i, Py, APy);
+                u.col(i) = APy.col(0) * varcmp[i];
+            }
             else (u.col(i)) = (((_A[_r_indx[i]]) * Py) * varcmp[i]);
         }
     }
@@ -1065,6 +1134,16 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
     double logdet = 0.0, logdet_Xt_Vi_X = 0.0, prev_lgL = -1e20, lgL = -1e20, dlogL = 1000.0;
     eigenVector prev_prev_varcmp(varcmp), prev_varcmp(varcmp), varcomp_init(varcmp);
     bool converged_flag = false;
+    // by tiles (--memory), randomized (--reml-rand) or spectral bivariate, V^-1
+    // is only applied to vectors
+    bool op_flag = !reml_bivar_fix_rg && (rand_reml_init() || _ooc_active || bivar_eigen_init());
+    bool eigen_flag = !op_flag && !reml_bivar_fix_rg && eigen_reml_init();
+    // Fisher scoring needs P itself, which --reml-float does not form
+    if (_reml_float && (op_flag || eigen_flag || _bivar_reml || _within_family || _reml_mtd == 1)) {
+        LOGGER.w(0, "--reml-float only applies to the standard AI-REML or EM-REML of a univariate model, double precision is used.");
+        _reml_float = false;
+    }
+    bool header_flag = false;
     for (iter = 0; iter < _reml_max_iter; iter++) {
         if (reml_bivar_fix_rg) update_A(prev_varcmp);
         if (iter == 0) {
@@ -1080,20 +1159,47 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
         }
         if (iter == 1) {
             _reml_mtd = reml_mtd_tmp;
-            LOGGER << "Running " << mtd_str[_reml_mtd] << " algorithm ..." << "\nIter.\tlogL\t";
-            for (i = 0; i < _r_indx.size(); i++) LOGGER << _var_name[_r_indx[i]] << "\t";
-            LOGGER << endl;
+            if (!header_flag) {
+                LOGGER << "Running " << mtd_str[_reml_mtd] << " algorithm ..." << "\nIter.\tlogL\t";
+                for (i = 0; i < _r_indx.size(); i++) LOGGER << _var_name[_r_indx[i]] << "\t";
+                LOGGER << endl;
+                header_flag = true;
+            }
         }
         //LOGGER << "Iter " << iter << endl;
         float time_vi = 0;
         LOGGER.ts("DBGtime");
-        if (_bivar_reml) calcu_Vi_bivar(_Vi, prev_varcmp, logdet, iter); // Calculate Vi, bivariate analysis //very slow
+        if (op_flag) {
+            if (!calcu_Vi_op(prev_varcmp, logdet)) {
+                LOGGER<<"Warning: V matrix is not positive-definite.\n";
+                varcmp = prev_prev_varcmp;
+                if(!calcu_Vi_op(varcmp, logdet)) LOGGER.e(0, "V matrix is not positive-definite.");
+                calcu_P_op(Vi_X, Xt_Vi_X_i, Py);
+                if (!calcu_Hi_op(Vi_X, Xt_Vi_X_i, Py, Hi)) eigen_H_not_invertible();
+                Hi = 2 * Hi;
+                break;
+            }
+        }
+        else if (eigen_flag) {
+            if (!calcu_Vi_eigen(_eig_st, prev_varcmp, logdet)) {
+                LOGGER<<"Warning: V matrix is not positive-definite.\n";
+                varcmp = prev_prev_varcmp;
+                if(!calcu_Vi_eigen(_eig_st, varcmp, logdet)) LOGGER.e(0, "V matrix is not positive-definite.");
+                calcu_P_eigen(_eig_st);
+                if (!calcu_Hi_eigen(_eig_st, Hi)) eigen_H_not_invertible();
+                Hi = 2 * Hi;
+                break;
+            }
+        }
+        else if (_bivar_reml) calcu_Vi_bivar(_Vi, prev_varcmp, logdet, iter); // Calculate Vi, bivariate analysis //very slow
         else if (_within_family) calcu_Vi_within_family(_Vi, prev_varcmp, logdet, iter); // within-family REML
         else {
             if (!calcu_Vi(_Vi, prev_varcmp, logdet, iter)){ // Calculate Vi
                 LOGGER<<"Warning: V matrix is not positive-definite.\n";
                 varcmp = prev_prev_varcmp;
                 if(!calcu_Vi(_Vi, varcmp, logdet, iter)) LOGGER.e(0, "V matrix is not positive-definite.");
+                // no P from the single precision iterations
+                if (_P.size() == 0) calcu_P(_Vi, Vi_X, Xt_Vi_X_i, _P);
                 calcu_Hi(_P, Hi);
                 Hi = 2 * Hi;
                 break;
@@ -1103,16 +1209,35 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
         //LOGGER << "calcu_vi_bivar returned" << endl;
         float time_p = 0;
         LOGGER.ts("DBGtime");
-        logdet_Xt_Vi_X = calcu_P(_Vi, Vi_X, Xt_Vi_X_i, _P); // Calculate P  //quick
+        if (op_flag) logdet_Xt_Vi_X = calcu_P_op(Vi_X, Xt_Vi_X_i, Py);
+        else if (eigen_flag) logdet_Xt_Vi_X = calcu_P_eigen(_eig_st);
+        else logdet_Xt_Vi_X = calcu_P(_Vi, Vi_X, Xt_Vi_X_i, _P); // Calculate P  //quick
         time_p = LOGGER.tp("DBGtime");
         
         float time_reml = 0;
         LOGGER.ts("DBGtime");
-        if (_reml_mtd == 0) ai_reml(_P, Hi, Py, prev_varcmp, varcmp, dlogL);
+        if (op_flag) {
+            if (!reml_step_op(Vi_X, Xt_Vi_X_i, Py, Hi, prev_varcmp, varcmp, dlogL)) eigen_H_not_invertible();
+        }
+        else if (eigen_flag) {
+            if (!reml_step_eigen(_eig_st, Hi, prev_varcmp, varcmp, dlogL, _reml_mtd)) eigen_H_not_invertible();
+        }
+        else if (_reml_mtd == 0) ai_reml(_P, Hi, Py, prev_varcmp, varcmp, dlogL);
         else if (_reml_mtd == 1) reml_equation(_P, Hi, Py, varcmp);
         else if (_reml_mtd == 2) em_reml(_P, Py, prev_varcmp, varcmp);  //slow ++
         time_reml = LOGGER.tp("DBGtime");
-        lgL = -0.5 * (logdet_Xt_Vi_X + logdet + (_y.transpose() * Py)(0, 0));
+        if (_reml_float_stall) {
+            // redo this iteration in double precision
+            LOGGER.w(0, "the iterative refinement of the single precision V^-1 stalled, switched to double precision (--reml-float is off).");
+            _reml_float = false;
+            _reml_float_stall = false;
+            _Vi_f.resize(0, 0);
+            varcmp = prev_varcmp;
+            iter--;
+            continue;
+        }
+        if (eigen_flag) lgL = -0.5 * (logdet_Xt_Vi_X + logdet + _eig_st.y.dot(_eig_st.Py));
+        else lgL = -0.5 * (logdet_Xt_Vi_X + logdet + (_y.transpose() * Py)(0, 0));
 
         if(_reml_force_converge && _reml_AI_not_invertible) break;
             /*{
@@ -1143,6 +1268,7 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
             LOGGER << "logL: " << lgL << endl;
             //if(_reml_max_iter==1) LOGGER<<"logL: "<<lgL<<endl;
         }
+        if (_reml_ckpt_active) reml_ckpt_write(_reml_ckpt_iter + iter, lgL, varcmp, Hi);
         if(_reml_fixed_var){
             varcmp = prev_varcmp; 
             break;
@@ -1159,17 +1285,40 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
 
         if((_reml_force_converge || _reml_no_converge) && prev_lgL > lgL){
             varcmp = prev_varcmp;
-            calcu_Hi(_P, Hi);
+            if (op_flag) {
+                if (!calcu_Hi_op(Vi_X, Xt_Vi_X_i, Py, Hi)) eigen_H_not_invertible();
+            }
+            else if (eigen_flag) {
+                if (!calcu_Hi_eigen(_eig_st, Hi)) eigen_H_not_invertible();
+            }
+            else {
+                if (_Vi_f.size() > 0) reml_float_off(varcmp, Vi_X, Xt_Vi_X_i);
+                calcu_Hi(_P, Hi);
+            }
             Hi = 2 * Hi;
             break;
         }
 
         // convergence
         dlogL = lgL - prev_lgL;
-        if ((varcmp - prev_varcmp).squaredNorm() / varcmp.squaredNorm() < 1e-8 && (fabs(dlogL) < 1e-4 || (fabs(dlogL) < 1e-2 && dlogL < 0))) {
+        bool converge_cond = (varcmp - prev_varcmp).squaredNorm() / varcmp.squaredNorm() < 1e-8 && (fabs(dlogL) < 1e-4 || (fabs(dlogL) < 1e-2 && dlogL < 0));
+        if (converge_cond && _Vi_f.size() > 0) {
+            // log|V| and tr(PA) are from the single precision V^-1, so the
+            // estimates are only final after iterations in double precision
+            LOGGER << "Converged with --reml-float, continuing in double precision ..." << endl;
+            _Vi_f.resize(0, 0);
+            _reml_float = false;
+        }
+        else if (converge_cond) {
             converged_flag = true;
             if (_reml_mtd == 2) {
-                calcu_Hi(_P, Hi);
+                if (op_flag) {
+                    if (!calcu_Hi_op(Vi_X, Xt_Vi_X_i, Py, Hi)) eigen_H_not_invertible();
+                }
+                else if (eigen_flag) {
+                    if (!calcu_Hi_eigen(_eig_st, Hi)) eigen_H_not_invertible();
+                }
+                else calcu_Hi(_P, Hi);
                 Hi = 2 * Hi;
             } // for calculation of SE
             break;
@@ -1178,6 +1327,10 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
         prev_varcmp = varcmp;
         prev_lgL = lgL;
     }
+    // V^-1 and P in double for what follows (e.g. --mlma) when the loop stops
+    // in single precision
+    if (_Vi_f.size() > 0) reml_float_off(varcmp, Vi_X, Xt_Vi_X_i);
+    if (eigen_flag) eigen_reml_output(Vi_X, Xt_Vi_X_i, Py);
     
     if(_reml_fixed_var) LOGGER << "Warning: the model is evaluated at fixed variance components. The (log-)likelihood might not be maximised." <<endl;
     else {
@@ -1269,6 +1422,12 @@ bool gcta::calcu_Vi(eigenMatrix &Vi, eigenVector &prev_varcmp, double &logdet, i
     int i = 0, j = 0, k = 0;
     string errmsg = "\n  the V (variance-covariance) matrix is not invertible.";
 
+    if (_reml_float && _r_indx.size() > 1) {
+        Vi.resize(0, 0);
+        if (calcu_Vi_float(prev_varcmp, logdet)) return true;
+        LOGGER.w(0, "V is not positive definite in single precision, switched to double precision (--reml-float is off).");
+        _reml_float = false;
+    }
     Vi = eigenMatrix::Zero(_n, _n);
     if (_r_indx.size() == 1) {
         Vi.diagonal() = eigenVector::Constant(_n, 1.0 / prev_varcmp[0]);
@@ -1512,47 +1671,115 @@ bool gcta::inverse_H(eigenMatrix &H)
 
 double gcta::calcu_P(eigenMatrix &Vi, eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatrix &P)
 {
-    Vi_X = Vi*_X;
+    bool float_flag = (_Vi_f.size() > 0);
+    if (float_flag) {
+        if (!solve_V_refine(_X, Vi_X)) _reml_float_stall = true;
+    }
+    else Vi_X = Vi*_X;
     Xt_Vi_X_i = _X.transpose() * Vi_X;
     double logdet_Xt_Vi_X = 0.0;
     int rank = 0; 
     INVmethod method = (_reml_inv_mtd == 0) ? INV_LLT : static_cast<INVmethod>(_reml_inv_mtd);
     if(!SquareMatrixInverse(Xt_Vi_X_i, logdet_Xt_Vi_X, rank, method)) LOGGER.e(0, "\n  the X^t * V^-1 * X matrix is not invertible. Please check the covariate(s) and/or the environmental factor(s).");
-    P = Vi - Vi_X * Xt_Vi_X_i * Vi_X.transpose();
+    if (float_flag) {
+        // P is not formed, see calcu_Pz and calcu_tr_PA
+        P.resize(0, 0);
+        _Vf_Vi_X = Vi_X;
+        _Vf_Xt_Vi_X_i = Xt_Vi_X_i;
+    }
+    else P = Vi - Vi_X * Xt_Vi_X_i * Vi_X.transpose();
     return logdet_Xt_Vi_X;
 }
 
-// input P, calculate PA and Hi
-void gcta::calcu_Hi(eigenMatrix &P, eigenMatrix &Hi)
+// V^-1 * B by iterative refinement: the single precision V^-1 in _Vi_f
+// corrects the residual B - V * Z, which is formed from the components in
+// double. false if the residual stops shrinking before it reaches double
+// precision
+bool gcta::solve_V_refine(const eigenMatrix &B, eigenMatrix &Z)
 {
-    double d_buf = 0.0;
-    //LOGGER << "Before calcu_Hi: " << getVMemKB() << " " << getMemKB() << ", "; 
+    double b_norm = B.norm(), prev_rel = 1e30;
+    Z = (_Vi_f * B.cast<float>()).cast<eigenMatrix::Scalar>();
+    if (b_norm == 0.0) return true;
+    eigenMatrix R;
+    for (int iter = 0; iter < 10; iter++) {
+        R = B;
+        for (int i = 0; i < _r_indx.size(); i++) R.noalias() -= _Vf_varcmp[i] * ((_A[_r_indx[i]]) * Z);
+        double rel = R.norm() / b_norm;
+        if (rel < 1e-12) return true;
+        if (rel > 0.5 * prev_rel) return rel < 1e-9;
+        prev_rel = rel;
+        Z += (_Vi_f * R.cast<float>()).cast<eigenMatrix::Scalar>();
+    }
+    return false;
+}
 
-    // Calculate PA
-    vector<eigenMatrix> PA(_r_indx.size());
-    for (int i = 0; i < _r_indx.size(); i++) {
-        (PA[i]).resize(_n, _n);
-        if (_bivar_reml || _within_family) (PA[i]) = P * (_Asp[_r_indx[i]]);
-        else (PA[i]) = P * (_A[_r_indx[i]]);
+// P * Z; with --reml-float, from the refined V^-1 * Z and V^-1 * X as P is
+// not formed
+void gcta::calcu_Pz(eigenMatrix &P, const eigenMatrix &Z, eigenMatrix &PZ)
+{
+    if (_Vi_f.size() == 0) {
+        PZ.noalias() = P * Z;
+        return;
     }
+    if (!solve_V_refine(Z, PZ)) _reml_float_stall = true;
+    PZ.noalias() -= _Vf_Vi_X * (_Vf_Xt_Vi_X_i * (_Vf_Vi_X.transpose() * Z));
+}
 
+// sum of the elementwise product of M with the columns [start, start + M.cols())
+// of the symmetric A_i, i.e. the contribution of these columns to tr(M^t * A_i)
+double gcta::frob_A(int i, const eigenMatrix &M, int start)
+{
+    double sum = 0.0;
+    int cols = M.cols();
+    if (_bivar_reml || _within_family) {
+        eigenSparseMat &A = _Asp[_r_indx[i]];
+        #pragma omp parallel for reduction(+:sum)
+        for (int k = 0; k < cols; k++) {
+            for (eigenSparseMat::InnerIterator it(A, start + k); it; ++it) sum += M(it.row(), k) * it.value();
+        }
+    }
+    else {
+        eigenMatrix &A = _A[_r_indx[i]];
+        #pragma omp parallel for reduction(+:sum)
+        for (int k = 0; k < cols; k++) sum += A.col(start + k).dot(M.col(k));
+    }
+    return sum;
+}
 
-    // Calculate Hi
-    //double d_bufs[_n];
-    double *d_bufs = new double[_n];
-    for (int i = 0; i < _r_indx.size(); i++) {
-        for (int j = 0; j <= i; j++) {
-            memset(d_bufs, 0, _n * sizeof(double));
-            d_buf = 0.0;
-            #pragma omp parallel for 
-            for (int k = 0; k < _n; k++) {
-                for (int l = 0; l < _n; l++) d_bufs[k] += (PA[i])(k, l)*(PA[j])(l, k);
+// input P, calculate Hi
+// tr(P * A_i * P * A_j) = <P * A_i, A_j * P> as P and A_j are symmetric. Both
+// are formed by tiles of columns, C_i = P * A_i[:, tile] and
+// R_j = A_j * P[:, tile], and contracted at once, so no n x n matrix of P * A_i
+// is kept; the extra memory is 2r blocks of n x tile.
+void gcta::calcu_Hi(eigenMatrix &P, eigenMatrix &Hi)
+{
+    const int tile = 512;
+    int r = _r_indx.size();
+    Hi.setZero(r, r);
+    vector<eigenMatrix> C(r), R(r);
+    for (int start = 0; start < _n; start += tile) {
+        int cols = std::min(tile, _n - start);
+        for (int i = 0; i < r; i++) {
+            if (_bivar_reml || _within_family) {
+                C[i] = P * (_Asp[_r_indx[i]]).middleCols(start, cols);
+                R[i] = (_Asp[_r_indx[i]]) * P.middleCols(start, cols);
             }
-            for(int k = 0; k < _n; k++){
-                d_buf += d_bufs[k];
+            else {
+                C[i].noalias() = P * (_A[_r_indx[i]]).middleCols(start, cols);
+                R[i].noalias() = (_A[_r_indx[i]]) * P.middleCols(start, cols);
             }
-            Hi(i, j) = Hi(j, i) = d_buf;
         }
+        for (int i = 0; i < r; i++) {
+            for (int j = 0; j <= i; j++) {
+                double sum = 0.0;
+                #pragma omp parallel for reduction(+:sum)
+                for (int k = 0; k < cols; k++) sum += C[i].col(k).dot(R[j].col(k));
+                Hi(i, j) += sum;
+            }
+        }
+    }
+    for (int i = 0; i < r; i++) {
+        for (int j = 0; j < i; j++) Hi(j, i) = Hi(i, j);
     }
 
     if (!inverse_H(Hi)){
@@ -1562,7 +1789,6 @@ void gcta::calcu_Hi(eigenMatrix &P, eigenMatrix &Hi)
         }
         else LOGGER.e(0, "the information matrix is not invertible.");
     }
-    delete[] d_bufs;
 }
 
 // use Fisher-scoring to estimate variance component
@@ -1575,7 +1801,9 @@ void gcta::reml_equation(eigenMatrix &P, eigenMatrix &Hi, eigenVector &Py, eigen
     if(_reml_AI_not_invertible) return;
 
     // Calculate R
-    Py = P*_y;
+    eigenMatrix PY;
+    calcu_Pz(P, _y, PY);
+    Py = PY.col(0);
     eigenVector R(_r_indx.size());
     for (int i = 0; i < _r_indx.size(); i++) {
         if (_bivar_reml || _within_family) R(i) = (Py.transpose()*(_Asp[_r_indx[i]]) * Py)(0, 0);
@@ -1592,7 +1820,9 @@ void gcta::reml_equation(eigenMatrix &P, eigenMatrix &Hi, eigenVector &Py, eigen
 
 void gcta::ai_reml(eigenMatrix &P, eigenMatrix &Hi, eigenVector &Py, eigenVector &prev_varcmp, eigenVector &varcmp, double dlogL)
 {
-    Py = P*_y;
+    eigenMatrix PY;
+    calcu_Pz(P, _y, PY);
+    Py = PY.col(0);
     //eigenVector cvec(_n);
     eigenMatrix APy(_n, _r_indx.size());
     //LOGGER << "AI reml 1 start" << endl;
@@ -1605,12 +1835,12 @@ void gcta::ai_reml(eigenMatrix &P, eigenMatrix &Hi, eigenVector &Py, eigenVector
     //LOGGER << "AI reml 2 start" << endl;
     // Calculate Hi
     eigenVector R(_r_indx.size());
-    #pragma omp parallel for
+    eigenMatrix PAPy;
+    calcu_Pz(P, APy, PAPy);
     for (int i = 0; i < _r_indx.size(); i++) {
         R(i) = (Py.transpose()*(APy.col(i)))(0, 0);
-        eigenVector cvec = P * (APy.col(i));
-        Hi(i, i) = ((APy.col(i)).transpose() * cvec)(0, 0);
-        for (int j = 0; j < i; j++) Hi(j, i) = Hi(i, j) = ((APy.col(j)).transpose() * cvec)(0, 0);
+        Hi(i, i) = ((APy.col(i)).transpose() * PAPy.col(i))(0, 0);
+        for (int j = 0; j < i; j++) Hi(j, i) = Hi(i, j) = ((APy.col(j)).transpose() * PAPy.col(i))(0, 0);
     }
     //LOGGER << "AI reml 2 end" << endl;
     Hi = 0.5 * Hi;
@@ -1646,7 +1876,9 @@ void gcta::em_reml(eigenMatrix &P, eigenVector &Py, eigenVector &prev_varcmp, ei
     calcu_tr_PA(P, tr_PA);  // extremely slow
     //LOGGER << "calcu_tr_PA returned" << endl;
     // Calculate R
-    Py = P*_y;
+    eigenMatrix PY;
+    calcu_Pz(P, _y, PY);
+    Py = PY.col(0);
     eigenVector R(_r_indx.size());
 
     #pragma omp parallel for
@@ -1666,50 +1898,34 @@ void gcta::em_reml(eigenMatrix &P, eigenVector &Py, eigenVector &prev_varcmp, ei
     //varcmp = (varcmp.array() - prev_varcmp.array())*2 + prev_varcmp.array();        
 }
 
-// input P, calculate tr(PA)
+// input P, calculate tr(PA) = <P, A> for symmetric A; with --reml-float,
+// tr(PA) = <V^-1, A> - tr((X^t V^-1 X)^-1 * (V^-1 X)^t * A * V^-1 X), summed
+// in double from the single precision V^-1 and the refined V^-1 * X
 void gcta::calcu_tr_PA(eigenMatrix &P, eigenVector &tr_PA) {
-    //LOGGER << "Before calcu_tr_PA: " << getVMemKB() << " " << getMemKB() << ", "; 
-
-    // Calculate trace(PA)
     tr_PA.resize(_r_indx.size());
-    //double d_bufs[_n];
-    double *d_bufs = new double[_n];
+    if (_Vi_f.size() == 0) {
+        for (int i = 0; i < _r_indx.size(); i++) tr_PA(i) = frob_A(i, P, 0);
+        return;
+    }
     for (int i = 0; i < _r_indx.size(); i++) {
-        //LOGGER << "calcu_tr_PA " << i << endl;
-        if (_bivar_reml || _within_family){
-            //eigenMatrix temp = P * (_Asp[_r_indx[i]]);
-            //LOGGER << "   matrix product finished" << endl;
-            //tr_PA(i) = (P * (_Asp[_r_indx[i]])).diagonal().sum();   ///extremely slow
-            int cur_r_indx_size = _Asp[_r_indx[i]].outerSize();
-            VectorXd v(cur_r_indx_size);
-            v.setZero(cur_r_indx_size);
-            #pragma omp parallel for
-            for(int k = 0; k < cur_r_indx_size; ++k){
-                for(eigenSparseMat::InnerIterator it(_Asp[_r_indx[i]], k); it; ++it){
-                    v(k) += P(it.col(),it.row()) * it.value();
-                }
-            }
-            tr_PA(i) = v.sum();
-            v.resize(0);
-            //tr_PA(i) = temp.diagonal().sum();   ///extremely slow
-            //LOGGER << "diag sum finished" << endl;
-            //temp.resize(0,0);
-        }
-        else {
-            double d_buf = 0.0;
-            memset(d_bufs, 0, _n * sizeof(double));
-            #pragma omp parallel for
-            for (int k = 0; k < _n; k++) {
-                for (int l = 0; l < _n; l++) d_bufs[k] += P(k, l)*(_A[_r_indx[i]])(k, l);
-            }
-            for(int k = 0; k < _n; k++){
-                d_buf += d_bufs[k];
-            }
-            tr_PA(i) = d_buf;
-        }
+        eigenMatrix &A = _A[_r_indx[i]];
+        double sum = 0.0;
+        #pragma omp parallel for reduction(+:sum)
+        for (int k = 0; k < _n; k++) sum += A.col(k).dot(_Vi_f.col(k).cast<eigenMatrix::Scalar>());
+        eigenMatrix Xt_Vi_A_Vi_X = _Vf_Vi_X.transpose() * (A * _Vf_Vi_X);
+        tr_PA(i) = sum - _Vf_Xt_Vi_X_i.cwiseProduct(Xt_Vi_A_Vi_X).sum();
     }
-    delete[] d_bufs;
+}
 
+// leaves --reml-float: V^-1 and P of varcmp in double, as the standard REML
+void gcta::reml_float_off(eigenVector &varcmp, eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i)
+{
+    int iter = 0;
+    double logdet = 0.0;
+    _Vi_f.resize(0, 0);
+    _reml_float = false;
+    if (!calcu_Vi(_Vi, varcmp, logdet, iter)) LOGGER.e(0, "V matrix is not positive-definite.");
+    calcu_P(_Vi, Vi_X, Xt_Vi_X_i, _P);
 }
 
 // blue estimate of SNP effect
@@ -1797,7 +2013,7 @@ void gcta::output_blup_snp(eigenMatrix &b_SNP) {
 void gcta::HE_reg(string grm_file, bool m_grm_flag, string phen_file, string keep_indi_file, string remove_indi_file, int mphen) {
     // a memory-efficient HE regression that can fit multiple GRMs
     
-    int i=0, j=0, k=0, l=0, r=0, c=0, ii=0, jj=0;
+    int i=0;
     stringstream errmsg;
     vector<string> phen_ID, grm_id, grm_files;
     vector< vector<string> > phen_buf; // save individuals by column
@@ -1816,8 +2032,6 @@ void gcta::HE_reg(string grm_file, bool m_grm_flag, string phen_file, string kee
     
     // Find common individuals in GRM and phenotype files
     // first read in grm.id, which determins the order of model equations
-    vector<ifstream*> A_bin;
-    A_bin.resize(n_grm);
     int size_grm = 0;
     for (i = 0; i < n_grm; i++) {
         if (i==0) {
@@ -1828,9 +2042,6 @@ void gcta::HE_reg(string grm_file, bool m_grm_flag, string phen_file, string kee
                 LOGGER.e(0, "file [" + grm_files[i] + "] contains a different number of individuals from other GRM files.");
             }
         }
-        string grm_binfile = grm_files[i] + ".grm.bin";
-        A_bin[i] = new ifstream(grm_binfile.c_str(), ios::in | ios::binary);
-        if ((*A_bin[i]).bad()) LOGGER.e(0, "cannot open the file [" + grm_binfile + "] to read.");
     }
     update_id_map_kp(grm_id, _id_map, _keep);
 
@@ -1874,98 +2085,18 @@ void gcta::HE_reg(string grm_file, bool m_grm_flag, string phen_file, string kee
     StrFunc::match(uni_id, grm_id, grm_kp);
  
     
-    // initialize OLS normal equations for each individual
-    // to use jackknife to estimate SE of heritability estimate
-    int long n_obs = 0.5*long(_n)*(long(_n)-1);
-    double z_cp=0, z_sd=0, totalSS_cp=0, totalSS_sd=0;
-    
-    eigenMatrix Lhs;    // X'X
-    eigenVector Rhs_cp; // X'(yi*yj)
-    eigenVector Rhs_sd; // X'(yi-yj)^2
-    Lhs.setZero(n_term, n_term);
-    Rhs_cp.setZero(n_term);
-    Rhs_sd.setZero(n_term);
-    
-    vector<eigenMatrix> LhsVec(_n);
-    vector<eigenVector> RhsCpVec(_n);
-    vector<eigenVector> RhsSdVec(_n);
-    
-    Lhs(0,0) = n_obs; // X'X for intercept
-    for (i = 0; i < _n; ++i) {
-        LhsVec[i].setZero(n_term, n_term);
-        LhsVec[i](0,0) = _n-1;
-        RhsCpVec[i].setZero(n_term);
-        RhsSdVec[i].setZero(n_term);
-        for (j = 0; j < i; ++j) {
-            z_cp = _y[i]*_y[j];
-            z_sd = (_y[i] - _y[j])*(_y[i] - _y[j]);
-            Rhs_cp[0] += z_cp;
-            Rhs_sd[0] += z_sd;
-            RhsCpVec[i][0] += z_cp;
-            RhsSdVec[i][0] += z_sd;
-            RhsCpVec[j][0] += z_cp;
-            RhsSdVec[j][0] += z_sd;
-            totalSS_cp += z_cp * z_cp;
-            totalSS_sd += z_sd * z_sd;
-        }
-    }
-    
-    
-    // Fill GRMij into the ordinary least squares equations without reading the whole GRM(s) into memory
-    LOGGER << "Constructing ordinary least squares equations ..." << endl;
-    eigenVector aij(n_grm);
-    int size = sizeof (float);
-    float f_buf = 0.0;
-    float grm_cp, r_cp, r_sd;
-    for (i = 0, ii = 0; i < size_grm; i++) {
-        if (i != grm_kp[ii]) {
-            for (j = 0; j <= i; j++) {
-                for (k = 0; k < n_grm; k++) {
-                    (*A_bin[k]).read((char*) &f_buf, size);
-                }
-            }
-        }
-        else {
-            for (j = 0, jj = 0; j <= i; j++) {
-                if (j != grm_kp[jj] || j==i) {
-                    for (k = 0; k < n_grm; k++) {
-                        (*A_bin[k]).read((char*) &f_buf, size);
-                    }
-                }
-                else {
-                    for (k = 0; k < n_grm; k++) {
-                        (*A_bin[k]).read((char*) &f_buf, size);
-                        aij[k] = f_buf;
-                        r = k + 1;
-                        Lhs(0,r) = Lhs(r,0) += aij[k];
-                        LhsVec[ii](0,r) = LhsVec[ii](r,0) += aij[k];
-                        LhsVec[jj](0,r) = LhsVec[jj](r,0) += aij[k];
-                        for (l = 0; l <= k; l++) {
-                            c = l + 1;
-                            grm_cp = aij[k] * aij[l];
-                            Lhs(c,r) = Lhs(r,c) += grm_cp;
-                            LhsVec[ii](c,r) = LhsVec[ii](r,c) += grm_cp;
-                            LhsVec[jj](c,r) = LhsVec[jj](r,c) += grm_cp;
-                        }
-                        r_cp = aij[k] * _y[ii] * _y[jj];
-                        r_sd = aij[k] *(_y[ii] - _y[jj])*(_y[ii] - _y[jj]);
-                        Rhs_cp[r] += r_cp;
-                        Rhs_sd[r] += r_sd;
-                        RhsCpVec[ii][r] += r_cp;
-                        RhsCpVec[jj][r] += r_cp;
-                        RhsSdVec[ii][r] += r_sd;
-                        RhsSdVec[jj][r] += r_sd;
-                    }
-                    ++jj;
-                }
-            }
-            ++ii;
-        }
-    }
+    // OLS normal equations of HE-CP and HE-SD, and those leaving out each
+    // block of individuals for the jackknife, in one pass over the GRM(s)
+    eigenMatrix Y = _y, M = eigenMatrix::Ones(_n, 1);
+    vector<he_term> terms = {{0, 0, false}, {0, 0, true}};
+    vector<he_equations> eqs;
+    HE_stream(grm_files, grm_kp, Y, M, terms, eqs);
 
-    for (k = 0; k < n_grm; k++) {
-        (*A_bin[k]).close();
-    }
+    eigenMatrix Lhs = eqs[0].Lhs;    // X'X
+    eigenVector Rhs_cp = eqs[0].Rhs; // X'(yi*yj)
+    eigenVector Rhs_sd = eqs[1].Rhs; // X'(yi-yj)^2
+    double totalSS_cp = eqs[0].totalSS, totalSS_sd = eqs[1].totalSS;
+    long int n_obs = 0.5*long(_n)*(long(_n)-1);
     
     // compute OLS SE and p-value
     eigenMatrix invLhs = Lhs.inverse();
@@ -2006,22 +2137,18 @@ void gcta::HE_reg(string grm_file, bool m_grm_flag, string phen_file, string kee
     
     
     // compute jackknife SE and p-value
-    eigenMatrix betaCpMat(_n, n_term);
-    eigenMatrix betaSdMat(_n, n_term);
-    for (i=0; i<_n; ++i) {
-        eigenMatrix invLhsi = (Lhs - LhsVec[i]).inverse();
-        betaCpMat.row(i) = invLhsi*(Rhs_cp - RhsCpVec[i]);
-        betaSdMat.row(i) = invLhsi*(Rhs_sd - RhsSdVec[i]);
-    }
+    eigenMatrix betaCpMat = HE_jackknife(eqs[0]);
+    eigenMatrix betaSdMat = HE_jackknife(eqs[1]);
+    int n_jk = betaCpMat.rows();
     
-    eigenVector ones = eigenVector::Ones(_n);
+    eigenVector ones = eigenVector::Ones(n_jk);
     eigenVector jk_mean_cp = betaCpMat.colwise().mean();
     eigenVector jk_mean_sd = betaSdMat.colwise().mean();
     eigenVector jk_se_cp = (betaCpMat - ones*jk_mean_cp.transpose()).colwise().squaredNorm();
     eigenVector jk_se_sd = (betaSdMat - ones*jk_mean_sd.transpose()).colwise().squaredNorm();
     
-    jk_se_cp *= (_n-1.0)/double(_n);
-    jk_se_sd *= (_n-1.0)/double(_n);
+    jk_se_cp *= (n_jk-1.0)/double(n_jk);
+    jk_se_sd *= (n_jk-1.0)/double(n_jk);
     
     jk_se_cp = jk_se_cp.array().sqrt();
     jk_se_sd = jk_se_sd.array().sqrt();
@@ -2037,8 +2164,8 @@ void gcta::HE_reg(string grm_file, bool m_grm_flag, string phen_file, string kee
     double jk_sum_se_cp = (betaSumCp.array() - jk_sum_mean_cp).matrix().squaredNorm();
     double jk_sum_se_sd = (betaSumSd.array() - jk_sum_mean_sd).matrix().squaredNorm();
     
-    jk_sum_se_cp = sqrt((_n-1.0)/double(_n)*jk_sum_se_cp);
-    jk_sum_se_sd = sqrt((_n-1.0)/double(_n)*jk_sum_se_sd);
+    jk_sum_se_cp = sqrt((n_jk-1.0)/double(n_jk)*jk_sum_se_cp);
+    jk_sum_se_sd = sqrt((n_jk-1.0)/double(n_jk)*jk_sum_se_sd);
     
     eigenVector jk_pval_cp(n_term);
     eigenVector jk_pval_sd(n_term);
@@ -2098,7 +2225,7 @@ void gcta::HE_reg(string grm_file, bool m_grm_flag, string phen_file, string kee
 void gcta::HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, string keep_indi_file, string remove_indi_file, int mphen, int mphen2) {
     // bivariate HE regression for two traits
     
-    int i=0, j=0, k=0, l=0, r=0, c=0, ii=0, jj=0, t=0;
+    int i=0, j=0, t=0;
     stringstream errmsg;
     vector<string> phen_ID, grm_id, grm_files;
     vector< vector<string> > phen_buf; // save individuals by column
@@ -2117,8 +2244,6 @@ void gcta::HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, stri
     
     // Find common individuals in GRM and phenotype files
     // first read in grm.id, which determins the order of model equations
-    vector<ifstream*> A_bin;
-    A_bin.resize(n_grm);
     int size_grm = 0;
     for (i = 0; i < n_grm; i++) {
         if (i==0) {
@@ -2129,9 +2254,6 @@ void gcta::HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, stri
                 LOGGER.e(0, "file [" + grm_files[i] + "] contains a different number of individuals from other GRM files.");
             }
         }
-        string grm_binfile = grm_files[i] + ".grm.bin";
-        A_bin[i] = new ifstream(grm_binfile.c_str(), ios::in | ios::binary);
-        if ((*A_bin[i]).bad()) LOGGER.e(0, "cannot open the file [" + grm_binfile + "] to read.");
     }
     update_id_map_kp(grm_id, _id_map, _keep);
     
@@ -2160,15 +2282,11 @@ void gcta::HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, stri
     LOGGER << _n << " individuals are in common in these files." << endl;
     
     
-    // find out matched unique ID for each trait
-    // ans store phenotypes separately for each trait based on their own unique id order
+    // phenotypes of both traits in the order of uni_id, with the masks of
+    // their non-missing values
     unsigned long n1 = 0, n2 = 0;
-    eigenVector y1 = eigenVector::Zero(_n);
-    eigenVector y2 = eigenVector::Zero(_n);
-    
-    vector<string> uni_id_tr1;
-    vector<string> uni_id_tr2;
-    
+    eigenMatrix Y = eigenMatrix::Zero(_n, 2);
+    eigenMatrix M = eigenMatrix::Zero(_n, 2);
     vector<int> phen_kp;  // index of phenotyped individuals
     
     mphen--;
@@ -2177,272 +2295,65 @@ void gcta::HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, stri
     StrFunc::match(uni_id, phen_ID, phen_kp);
     for (i=0; i < phen_kp.size(); i++) {
         int idx = phen_kp[i];
+        if (idx < 0) continue;
         if (phen_buf[idx][mphen] != "NA" && phen_buf[idx][mphen] != "-9") {
-            uni_id_tr1.push_back(uni_id[i]);
-            y1[n1++] = atof(phen_buf[idx][mphen].c_str());
-            //LOGGER << i << " " << idx << " " << phen_buf[idx][mphen] << " " << atof(phen_buf[idx][mphen].c_str()) << endl;
+            Y(i,0) = atof(phen_buf[idx][mphen].c_str());
+            M(i,0) = 1.0;
+            ++n1;
         }
         if (phen_buf[idx][mphen2] != "NA" && phen_buf[idx][mphen2] != "-9") {
-            uni_id_tr2.push_back(uni_id[i]);
-            y2[n2++] = atof(phen_buf[idx][mphen2].c_str());
+            Y(i,1) = atof(phen_buf[idx][mphen2].c_str());
+            M(i,1) = 1.0;
+            ++n2;
         }
-        ++ii;
     }
-    y1.conservativeResize(n1);
-    y2.conservativeResize(n2);
     
-    LOGGER << y1.size() << " non-missing phenotypes for trait #1 and " << y2.size() << " for trait #2" << endl;
-    if (y1.size()==0) LOGGER.e(0, "no non-missing phenotypes for trait 1.");
-    if (y2.size()==0) LOGGER.e(0, "no non-missing phenotypes for trait 2.");
+    LOGGER << n1 << " non-missing phenotypes for trait #1 and " << n2 << " for trait #2" << endl;
+    if (n1==0) LOGGER.e(0, "no non-missing phenotypes for trait 1.");
+    if (n2==0) LOGGER.e(0, "no non-missing phenotypes for trait 2.");
 
     // grm_kp contains the rows of grm_id to keep in order of uni_id, which is a subset of and in the same order of grm_id
-    vector<int> grm_kp_tr1;
-    vector<int> grm_kp_tr2;
-    
-    StrFunc::match(uni_id_tr1, grm_id, grm_kp_tr1);
-    StrFunc::match(uni_id_tr2, grm_id, grm_kp_tr2);
+    vector<int> grm_kp;
+    StrFunc::match(uni_id, grm_id, grm_kp);
     
     
     LOGGER << "\nPerforming Haseman-Elston regression ...\n" << endl;
     
-    // normalise phenotype
+    // normalise phenotype over the non-missing values
     LOGGER << "Standardising the phenotype ..." << endl;
-    y1.array() -= y1.mean();
-    y2.array() -= y2.mean();
-    y1.array() /= sqrt(y1.squaredNorm() / (n1 - 1.0));
-    y2.array() /= sqrt(y2.squaredNorm() / (n2 - 1.0));
+    for (t = 0; t < 2; ++t) {
+        double n_t = M.col(t).sum();
+        double mean = Y.col(t).sum() / n_t;
+        Y.col(t) = ((Y.col(t).array() - mean) * M.col(t).array()).matrix();
+        Y.col(t) /= sqrt(Y.col(t).squaredNorm() / (n_t - 1.0));
+    }
     
 
-    // initialize OLS normal equations for each individual
-    // to use jackknife to estimate SE of heritability estimate
+    // OLS normal equations for trait 1, 2 and their covariance, and those
+    // leaving out each block of individuals for the jackknife, in one pass
+    // over the GRM(s). The pairs of the covariance are (trait 1 of i, trait 2
+    // of j) for i != j in both orders
+    vector<he_term> terms = {{0, 0, false}, {1, 1, false}, {0, 1, false}};
+    vector<he_equations> eqs;
+    HE_stream(grm_files, grm_kp, Y, M, terms, eqs);
+    
     vector<eigenMatrix> Lhs(3);  // X'X       for trait 1, 2 and their covariance
     vector<eigenVector> Rhs(3);  // X'(yi*yj) for trait 1, 2 and their covariance
-    vector<vector<eigenMatrix> > LhsJk(3);  // Leave-one-individual-out (Jackknife) Lhs for the 3 var-cov componenets
-    vector<vector<eigenVector> > RhsJk(3);  // Leave-one-individual-out (Jackknife) Rhs for the 3 var-cov componenets
-
-    unsigned long minn = min(n1,n2);
-    unsigned long maxn = max(n1,n2);
-
-    vector<unsigned long> nObs = {n1*(n1-1)/2, n2*(n2-1)/2, n1*n2};
-    vector<unsigned long> nJk  = {n1, n2, minn};
-    
-    double z = 0.0;
-    vector<double> totalSS = {0, 0, 0};
-
+    vector<double> totalSS(3);
+    vector<unsigned long> nObs(3);
     for (t = 0; t < 3; ++t) {
-        Lhs[t].setZero(n_term, n_term);
-        Lhs[t](0,0) = nObs[t];   // X'X for intercept
-        Rhs[t].setZero(n_term);
-        LhsJk[t].resize(nJk[t]);
-        RhsJk[t].resize(nJk[t]);
-    }
-    
-    for (i=0; i<n1; ++i) {  // for trait 1
-        LhsJk[0][i].setZero(n_term, n_term);
-        LhsJk[0][i](0,0) = n1-1;
-        RhsJk[0][i].setZero(n_term);
-        for (j=0; j<i; ++j) {
-            z = y1[i]*y1[j];
-            Rhs[0][0] += z;
-            RhsJk[0][i][0] += z;
-            RhsJk[0][j][0] += z;
-            totalSS[0] += z*z;
-        }
-    }
-    
-    for (i=0; i<n2; ++i) {  // for trait 2
-        LhsJk[1][i].setZero(n_term, n_term);
-        LhsJk[1][i](0,0) = n2-1;
-        RhsJk[1][i].setZero(n_term);
-        for (j=0; j<i; ++j) {
-            z = y2[i]*y2[j];
-            Rhs[1][0] += z;
-            RhsJk[1][i][0] += z;
-            RhsJk[1][j][0] += z;
-            totalSS[1] += z*z;
-        }
-    }
-    
-    eigenVector *ymin = minn == n1 ? &y1 : &y2;
-    eigenVector *ymax = maxn == n1 ? &y1 : &y2;
-    
-    for (i=0; i<minn; ++i) {  // for covariance between trait 1 and trait 2
-        LhsJk[2][i].setZero(n_term, n_term);
-        LhsJk[2][i](0,0) = n1+n2-1;
-        RhsJk[2][i].setZero(n_term);
-    }
-    for (i=0; i<minn; ++i) {
-        for (j=0; j<maxn; ++j) {
-            z = (*ymin)[i]*(*ymax)[j];
-            Rhs[2][0] += z;
-            if (j<minn) {
-                RhsJk[2][i][0] += z;
-                RhsJk[2][j][0] += z;
-            }
-            if (i==j) RhsJk[2][i][0] -= z;
-            totalSS[2] += z*z;
-        }
-    }
-    
-    
-    // Fill GRMij into the ordinary least squares equations without reading the whole GRM(s) into memory
-    LOGGER << "Constructing ordinary least squares equations ..." << endl;
-    eigenVector aij(n_grm);
-    int size = sizeof (float);
-    float f_buf = 0.0;
-    float lhs, rhs;
-    long t1i=0, t2i=0, t12i=0, t21i=0;
-    long t1j=0, t2j=0, t12j=0, t21j=0;
-    
-    unsigned long count[] = {0,0,0};
-    
-    for (i = 0; i < size_grm; ++i) {
-        t1j = t2j = t12j = t21j = 0;
-        for (j = 0; j <= i; ++j) {
-            for (k = 0; k < n_grm; k++) {
-                (*A_bin[k]).read((char*) &f_buf, size);
-                if (i == j) continue;
-                
-                if (i == grm_kp_tr1[t1i] && j == grm_kp_tr1[t1j]) {   // Trait 1
-                    aij[k] = f_buf;
-                    r = k + 1;   // first one is intercept
-                    Lhs[0](0,r) = Lhs[0](r,0) += aij[k];   // symetric
-                    LhsJk[0][t1i](0,r) = LhsJk[0][t1i](r,0) += aij[k];
-                    LhsJk[0][t1j](0,r) = LhsJk[0][t1j](r,0) += aij[k];
-                    for (l = 0; l <= k; l++) {
-                        c = l + 1;
-                        lhs = aij[k] * aij[l];
-                        Lhs[0](c,r) = Lhs[0](r,c) += lhs;
-                        LhsJk[0][t1i](c,r) = LhsJk[0][t1i](r,c) += lhs;
-                        LhsJk[0][t1j](c,r) = LhsJk[0][t1j](r,c) += lhs;
-                    }
-                    rhs = aij[k] * y1[t1i] * y1[t1j];
-                    Rhs[0][r] += rhs;
-                    RhsJk[0][t1i][r] += rhs;
-                    RhsJk[0][t1j][r] += rhs;
-                    if (k == n_grm-1) {
-                        ++t1j;
-                        ++count[0];
-                    }
-                }
-                
-                if (i == grm_kp_tr2[t2i] && j == grm_kp_tr2[t2j]) {   // Trait 2
-                    aij[k] = f_buf;
-                    r = k + 1;   // first one is intercept
-                    Lhs[1](0,r) = Lhs[1](r,0) += aij[k];   // symetric
-                    LhsJk[1][t2i](0,r) = LhsJk[1][t2i](r,0) += aij[k];
-                    LhsJk[1][t2j](0,r) = LhsJk[1][t2j](r,0) += aij[k];
-                    for (l = 0; l <= k; l++) {
-                        c = l + 1;
-                        lhs = aij[k] * aij[l];
-                        Lhs[1](c,r) = Lhs[1](r,c) += lhs;
-                        LhsJk[1][t2i](c,r) = LhsJk[1][t2i](r,c) += lhs;
-                        LhsJk[1][t2j](c,r) = LhsJk[1][t2j](r,c) += lhs;
-                    }
-                    rhs = aij[k] * y2[t2i] * y2[t2j];
-                    Rhs[1][r] += rhs;
-                    RhsJk[1][t2i][r] += rhs;
-                    RhsJk[1][t2j][r] += rhs;
-                    if (k == n_grm-1) {
-                        ++t2j;
-                        ++count[1];
-                    }
-                }
-                
-                if (i == grm_kp_tr1[t12i] && j == grm_kp_tr2[t21j]) {  // Trait 1 x Trait 2
-                    aij[k] = f_buf;
-                    r = k + 1;
-                    Lhs[2](0,r) = Lhs[2](r,0) += aij[k];
-                    if (t12i < minn && t21j < minn) {  // square matrix of size of min(n1, n2)
-                        LhsJk[2][t12i](0,r) = LhsJk[2][t12i](r,0) += aij[k];
-                        LhsJk[2][t21j](0,r) = LhsJk[2][t21j](r,0) += aij[k];  // crossout the row and the column
-                    }
-                    if (t12i == t21j) {
-                        LhsJk[2][t12i](0,r) = LhsJk[2][t12i](r,0) -= aij[k];  // the cross-point is double counted
-                    }
-                    for (l = 0; l <= k; l++) {
-                        c = l + 1;
-                        lhs = aij[k] * aij[l];
-                        Lhs[2](c,r) = Lhs[2](r,c) += lhs;
-                        if (t12i < minn && t21j < minn) {
-                            LhsJk[2][t12i](c,r) = LhsJk[2][t12i](r,c) += lhs;
-                            LhsJk[2][t21j](c,r) = LhsJk[2][t21j](r,c) += lhs;
-                        }
-                        if (t12i == t21j) {
-                            LhsJk[2][t12i](c,r) = LhsJk[2][t12i](r,c) -= lhs;
-                        }
-                    }
-                    rhs = aij[k] * y1[t12i] * y2[t21j];
-                    Rhs[2][r] += rhs;
-                    if (t12i < minn && t21j < minn) {
-                        RhsJk[2][t12i][r] += rhs;
-                        RhsJk[2][t21j][r] += rhs;
-                    }
-                    if (t12i == t21j) {
-                        RhsJk[2][t12i][r] -= rhs;
-                    }
-                    if (k == n_grm-1) {
-                        ++t21j;
-                        ++count[2];
-                    }
-                }
-                else if (i == grm_kp_tr2[t21i] && j == grm_kp_tr1[t12j]) {  // Trait 2 x Trait 1
-                    aij[k] = f_buf;
-                    r = k + 1;
-                    Lhs[2](0,r) = Lhs[2](r,0) += aij[k];
-                    if (t21i < minn && t12j < minn) {
-                        LhsJk[2][t12j](0,r) = LhsJk[2][t12j](r,0) += aij[k];
-                        LhsJk[2][t21i](0,r) = LhsJk[2][t21i](r,0) += aij[k];
-                    }
-                    if (t21i == t12j) {
-                        LhsJk[2][t12j](0,r) = LhsJk[2][t12j](r,0) -= aij[k];
-                    }
-                    for (l = 0; l <= k; l++) {
-                        c = l + 1;
-                        lhs = aij[k] * aij[l];
-                        Lhs[2](c,r) = Lhs[2](r,c) += lhs;
-                        if (t21i < minn && t12j < minn) {
-                            LhsJk[2][t12j](c,r) = LhsJk[2][t12j](r,c) += lhs;
-                            LhsJk[2][t21i](c,r) = LhsJk[2][t21i](r,c) += lhs;
-                        }
-                        if (t21i == t12j) {
-                            LhsJk[2][t12j](c,r) = LhsJk[2][t12j](r,c) -= lhs;
-                        }
-                    }
-                    rhs = aij[k] * y1[t12j] * y2[t21i];
-                    Rhs[2][r] += rhs;
-                    if (t21i < minn && t12j < minn) {
-                        RhsJk[2][t12j][r] += rhs;
-                        RhsJk[2][t21i][r] += rhs;
-                    }
-                    if (t21i == t12j) {
-                        RhsJk[2][t12j][r] -= rhs;
-                    }
-                    if (k == n_grm-1) {
-                        ++t12j;
-                        ++count[2];
-                    }
-                }
-            }
-        }
-        
-        if (i == grm_kp_tr1[t1i] && t1i < n1-1) ++t1i;
-        if (i == grm_kp_tr2[t2i] && t2i < n2-1) ++t2i;
-        if (i == grm_kp_tr1[t12i]) ++t12i;
-        if (i == grm_kp_tr2[t21i]) ++t21i;
+        Lhs[t] = eqs[t].Lhs;
+        Rhs[t] = eqs[t].Rhs;
+        totalSS[t] = eqs[t].totalSS;
+        nObs[t] = (unsigned long)(Lhs[t](0,0) + 0.5);
     }
     
-    
     LOGGER << "\n length of covariates:" << endl;
-    LOGGER << "\t trait1:  " << count[0] << endl;
-    LOGGER << "\t trait2:  " << count[1] << endl;
-    LOGGER << "\t trait12: " << count[2] << endl;
+    LOGGER << "\t trait1:  " << nObs[0] << endl;
+    LOGGER << "\t trait2:  " << nObs[1] << endl;
+    LOGGER << "\t trait12: " << nObs[2] << endl;
     
     
-    for (k = 0; k < n_grm; k++) {
-        (*A_bin[k]).close();
-    }
-    
     // print X'X
     eigenMatrix LhsAll;
     LhsAll.setZero(3*n_term, 3*n_term);
@@ -2490,24 +2401,20 @@ void gcta::HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, stri
     vector<eigenVector> betaSumJk(3);
     vector<double> seSumJk(3);
     vector<double> pvalSumJk(3);
-    eigenMatrix invLhsi;
+    unsigned long n_jk = eqs[0].LhsJk.size();
     for (t=0; t<3; ++t) {
-        betaJk[t].setZero(nJk[t], n_term);
-        for (i=0; i<nJk[t]; ++i) {
-            invLhsi = (Lhs[t] - LhsJk[t][i]).inverse();
-            betaJk[t].row(i) = invLhsi*(Rhs[t]-RhsJk[t][i]);
-        }
-        eigenVector ones = eigenVector::Ones(nJk[t]);
+        betaJk[t] = HE_jackknife(eqs[t]);
+        eigenVector ones = eigenVector::Ones(n_jk);
         eigenVector betaMeanJk = betaJk[t].colwise().mean();
         seJk[t] = (betaJk[t] - ones*betaMeanJk.transpose()).colwise().squaredNorm();
-        seJk[t] *= (nJk[t]-1)/double(nJk[t]);
+        seJk[t] *= (n_jk-1)/double(n_jk);
         seJk[t] = seJk[t].array().sqrt();
         
         betaSumJk[t] = betaJk[t].transpose().colwise().sum();
         betaSumJk[t] -= betaJk[t].col(0);  // subtract intercept
         double betaSumMeanJk = betaSumJk[t].mean();
         seSumJk[t] = (betaSumJk[t].array() - betaSumMeanJk).matrix().squaredNorm();
-        seSumJk[t] = sqrt((nJk[t]-1)/double(nJk[t])*seSumJk[t]);
+        seSumJk[t] = sqrt((n_jk-1)/double(n_jk)*seSumJk[t]);
         
         eigenVector tstat = (betaMeanJk.array()/seJk[t].array()).abs();
         pvalJk[t].setZero(n_term);
@@ -2534,9 +2441,9 @@ void gcta::HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, stri
         rG_se[i] = sqrt(rG[i]*rG[i]*(varC/(C*C) + varV1/(4*V1*V1) + varV2/(4*V2*V2)));   // OLS estimate with Talor serial
         
         // Jackknife estimate of SE of rG
-        eigenVector rgJk = betaJk[2].col(i+1).head(minn).array() / (betaJk[0].col(i+1).head(minn).array() * betaJk[1].col(i+1).head(minn).array()).sqrt();
+        eigenVector rgJk = betaJk[2].col(i+1).array() / (betaJk[0].col(i+1).array() * betaJk[1].col(i+1).array()).sqrt();
         rG_seJk[i] = (rgJk.array() - rgJk.mean()).matrix().squaredNorm();
-        rG_seJk[i] = sqrt((minn-1)/double(minn)*rG_seJk[i]);
+        rG_seJk[i] = sqrt((n_jk-1)/double(n_jk)*rG_seJk[i]);
     }
     V1 = betaSum[0];
     V2 = betaSum[1];
@@ -2546,14 +2453,14 @@ void gcta::HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, stri
     varC  = seSum[2]*seSum[2];
     double rG_sum = C/sqrt(V1*V2);
     double rG_sum_se = sqrt(rG_sum*rG_sum*(varC/(C*C) + varV1/(4*V1*V1) + varV2/(4*V2*V2)));
-    eigenVector rgJk = betaSumJk[2].head(minn).array() / (betaSumJk[0].head(minn).array() * betaSumJk[1].head(minn).array()).sqrt();
+    eigenVector rgJk = betaSumJk[2].array() / (betaSumJk[0].array() * betaSumJk[1].array()).sqrt();
     double rG_sum_seJk = (rgJk.array() - rgJk.mean()).matrix().squaredNorm();
-    rG_sum_seJk = sqrt((minn-1)/double(minn)*rG_sum_seJk);
+    rG_sum_seJk = sqrt((n_jk-1)/double(n_jk)*rG_sum_seJk);
 
     
     // sampling variance-covariance of estimates of variance components
     LOGGER << "\nJackknife sampling variance/covariance of the estimates of heritability:" << endl;
-    eigenMatrix betaGJk(minn, 3*n_grm);
+    eigenMatrix betaGJk(n_jk, 3*n_grm);
     j = 0;
     for (i=0; i<n_grm; ++i) {
         for (t=0; t<3; ++t) {
@@ -2561,8 +2468,8 @@ void gcta::HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, stri
         }
     }
     eigenMatrix centered = betaGJk.rowwise() - betaGJk.colwise().mean();
-    eigenMatrix varcov = (centered.adjoint() * centered) / double(minn);
-    varcov *= double(minn-1);
+    eigenMatrix varcov = (centered.adjoint() * centered) / double(n_jk);
+    varcov *= double(n_jk-1);
     
     LOGGER << varcov << endl << endl;
     
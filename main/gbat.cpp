@@ -230,7 +230,7 @@ void gcta::gbat(string sAssoc_file, string gAnno_file, int wind, int simu_num)
     for (i = 0; i < gene_num; i++) {
         if(gene_pval[i]>1.5) continue;
         ofile << gene_name[i] << "\t" << gene_chr[i] << "\t" << gene_bp1[i] << "\t" << gene_bp2[i] << "\t";
-        ofile << snp_num_in_gene[i] << "\t" << gene2snp_1[i] << "\t" << gene2snp_2[i] << "\t" << chisq_o[i] << "\t" << gene_pval[i] << endl;
+        ofile << snp_num_in_gene[i] << "\t" << gene2snp_1[i] << "\t" << gene2snp_2[i] << "\t" << chisq_o[i] << "\t" << StatFunc::pchisq_text(gene_pval[i], snp_num_in_gene[i] == 1 ? chisq_o[i] : -1.0) << endl;
         //else ofile << "0\tNA\tNA\tNA\tNA" << endl;
     }
     ofile.close();
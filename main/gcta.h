@@ -36,6 +36,8 @@
 #include <omp.h>
 #include "Logger.h"
 #include "Matrix.hpp"
+#include "TiledMatrix.h"
+#include <memory>
 
 #ifdef SINGLE_PRECISION
 typedef Eigen::SparseMatrix<float, Eigen::ColMajor, long long> eigenSparseMat;
@@ -59,6 +61,34 @@ typedef VectorXd eigenVector;
 typedef DynamicSparseMatrix<double> eigenDynSparseMat;
 #endif
 
+// per-phenotype quantities of the spectral REML, in the eigenbasis of the GRM
+struct eigen_reml_state {
+    eigenVector y;
+    eigenVector vi; // diagonal of V^-1
+    eigenMatrix Vi_X;
+    eigenMatrix Xt_Vi_X_i;
+    eigenVector Py;
+};
+
+// a response of the HE regression on the pairs (i, j) of individuals from the
+// phenotype columns u and v: y_u,i * y_v,j (and y_u,j * y_v,i if u != v), or
+// (y_u,i - y_u,j)^2 if sd
+struct he_term {
+    int u;
+    int v;
+    bool sd;
+};
+
+// least squares equations of a HE response, in whole and with each block of
+// individuals left out
+struct he_equations {
+    eigenMatrix Lhs; // X'X
+    eigenVector Rhs; // X'z
+    double totalSS;  // z'z
+    vector<eigenMatrix> LhsJk;
+    vector<eigenVector> RhsJk;
+};
+
 class gcta {
 public:
     gcta(int autosome_num, double rm_ld_cutoff, string out);
@@ -68,6 +98,7 @@ public:
     void read_famfile(string famfile);
     void read_bimfile(string bimfile);
     void read_bedfile(string bedfile);
+    void read_bed_stream(string bedfile);
     vector<string> read_bfile_list(string bfile_list);
     void read_multi_famfiles(vector<string> multi_bfiles);
     void read_multi_bimfiles(vector<string> multi_bfiles);
@@ -116,6 +147,7 @@ public:
     //void HE_reg(string grm_file, string phen_file, string keep_indi_file, string remove_indi_file, int mphen); // old HE regression method
     void HE_reg(string grm_file, bool m_grm_flag, string phen_file, string keep_indi_file, string remove_indi_file, int mphen); // allow multiple regression
     void HE_reg_bivar(string grm_file, bool m_grm_flag, string phen_file, string keep_indi_file, string remove_indi_file, int mphen, int mphen2); // estimate genetic covariance between two traits
+    void set_HE_jk_blocks(int num_blocks);
     void blup_snp_geno();
     void blup_snp_dosage();
     void set_reml_force_inv();
@@ -128,6 +160,13 @@ public:
     void set_reml_diag_mul(double value);
     void set_reml_diagV_adj(int method);
     void set_reml_inv_method(int method);
+    void set_reml_eigen();
+    void set_reml_batch();
+    void set_reml_memory(double mem_gb);
+    void set_reml_float();
+    void set_reml_rand(int num_probes);
+    void set_reml_checkpoint();
+    void set_reml_warm_start(string hsq_file);
 
     // bivariate REML analysis
     void fit_bivar_reml(string grm_file, string phen_file, string qcovar_file, string covar_file, string keep_indi_file, string remove_indi_file, string sex_file, int mphen, int mphen2, double grm_cutoff, double adj_grm_fac, int dosage_compen, bool m_grm_flag, bool pred_rand_eff, bool est_fix_eff, int reml_mtd, int MaxIter, vector<double> reml_priors, vector<double> reml_priors_var, vector<int> drop, bool no_lrt, double prevalence, double prevalence2, bool no_constrain, bool ignore_Ce, vector<double> &fixed_rg_val, bool bivar_no_constrain);
@@ -263,6 +302,9 @@ private:
     void calcu_mu(bool ssq_flag = false);
     void calcu_maf();
     void mu_func(int j, vector<double> &fac);
+    void calcu_mu_stream(vector<double> &auto_fac, vector<double> &xfac, vector<double> &fac);
+    void read_bed_block(const vector<int> &snp_indx, MatrixXf &X);
+    void make_grm_stream(bool inbred);
     void check_autosome();
     void check_chrX();
     void check_sex();
@@ -290,6 +332,7 @@ private:
     bool check_case_control(double &ncase, eigenVector &y);
     double transform_hsq_L(double P, double K, double hsq);
     int constrain_varcmp(eigenVector &varcmp);
+    int constrain_varcmp(eigenVector &varcmp, double y_Ssq);
     void drop_comp(vector<int> &drop);
     void construct_X(int n, map<string, int> &uni_id_map, bool qcovar_flag, int qcovar_num, vector<string> &qcovar_ID, vector< vector<string> > &qcovar, bool covar_flag, int covar_num, vector<string> &covar_ID, vector< vector<string> > &covar, vector<eigenMatrix> &E_float, eigenMatrix &qE_float);
     void coeff_mat(const vector<string> &vec, eigenMatrix &coeff_mat, string errmsg1, string errmsg2);
@@ -311,11 +354,72 @@ private:
     void em_reml(eigenMatrix &P, eigenVector &Py, eigenVector &prev_varcmp, eigenVector &varcmp);
     void ai_reml(eigenMatrix &P, eigenMatrix &Hi, eigenVector &Py, eigenVector &prev_varcmp, eigenVector &varcmp, double dlogL);
     void calcu_tr_PA(eigenMatrix &P, eigenVector &tr_PA);
+    double frob_A(int i, const eigenMatrix &M, int start);
+    bool solve_V_refine(const eigenMatrix &B, eigenMatrix &Z);
+    void calcu_Pz(eigenMatrix &P, const eigenMatrix &Z, eigenMatrix &PZ);
+    void reml_float_off(eigenVector &varcmp, eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i);
     void calcu_Vp(double &Vp, double &Vp2, double &VarVp, double &VarVp2, eigenVector &varcmp, eigenMatrix &Hi);
     void calcu_hsq(int i, double Vp, double Vp2, double VarVp, double VarVp2, double &hsq, double &var_hsq, eigenVector &varcmp, eigenMatrix &Hi);
     void calcu_sum_hsq(double Vp, double VarVp, double &sum_hsq, double &var_sum_hsq, eigenVector &varcmp, eigenMatrix &Hi);
     void output_blup_snp(eigenMatrix &b_SNP);
 
+    // spectral REML analysis for a single GRM
+    bool eigen_reml_init();
+    bool calcu_Vi_eigen(eigen_reml_state &st, eigenVector &prev_varcmp, double &logdet);
+    double calcu_P_eigen(eigen_reml_state &st);
+    void calcu_Pz_eigen(const eigen_reml_state &st, const eigenVector &z, eigenVector &Pz);
+    void calcu_tr_PA_eigen(const eigen_reml_state &st, eigenVector &tr_PA);
+    bool calcu_Hi_eigen(const eigen_reml_state &st, eigenMatrix &Hi);
+    bool reml_step_eigen(eigen_reml_state &st, eigenMatrix &Hi, eigenVector &prev_varcmp, eigenVector &varcmp, double dlogL, int reml_mtd);
+    void eigen_H_not_invertible();
+    void eigen_reml_output(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenVector &Py);
+    void eigen_reml_Vi();
+    bool reml_eigen_fit(eigen_reml_state &st, double y_Ssq, bool no_constrain, eigenVector &varcmp, eigenMatrix &Hi, double &lgL, int &iter);
+    void reml_batch(eigenMatrix &Y, bool no_constrain);
+
+    // REML by tiles of V, for samples whose dense matrices exceed --memory
+    bool ooc_reml_init(int num_grm, bool ge_flag, bool mlmassoc, bool reml_bending);
+    void ooc_store_grm(int pos, const vector<int> &kp);
+    void calcu_AZ(int i, const eigenMatrix &Z, eigenMatrix &AZ);
+    bool calcu_Vi_ooc(eigenVector &prev_varcmp, double &logdet);
+    double calcu_P_ooc(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenVector &Py);
+    void calcu_Pz_op(const eigenMatrix &Vi_X, const eigenMatrix &Xt_Vi_X_i, const eigenMatrix &Z, eigenMatrix &PZ);
+    void calcu_tr_PA_op(const eigenMatrix &Vi_X, const eigenMatrix &Xt_Vi_X_i, eigenVector &tr_PA);
+    bool calcu_Hi_op(const eigenMatrix &Vi_X, const eigenMatrix &Xt_Vi_X_i, const eigenVector &Py, eigenMatrix &Hi);
+    bool reml_step_op(const eigenMatrix &Vi_X, const eigenMatrix &Xt_Vi_X_i, const eigenVector &Py, eigenMatrix &Hi, eigenVector &prev_varcmp, eigenVector &varcmp, double dlogL);
+    bool calcu_Vi_op(eigenVector &prev_varcmp, double &logdet);
+    double calcu_P_op(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenVector &Py);
+    void calcu_ViZ_op(const eigenMatrix &Z, eigenMatrix &ViZ);
+
+    // randomized REML, V^-1 by block CG and the traces by Hutchinson probes
+    bool rand_reml_init();
+    void calcu_VZ_rand(const eigenMatrix &Z, eigenMatrix &VZ);
+    bool calcu_Vi_rand(eigenVector &prev_varcmp, double &logdet);
+    void solve_V_rand(const eigenMatrix &B, eigenMatrix &X);
+    double calcu_P_rand(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenVector &Py);
+    double calcu_tr_ViA_rand(int i);
+
+    // spectral bivariate REML for a single GRM
+    void bivar_eigen_decomp(const vector<int> &nms1, const vector<int> &nms2);
+    bool bivar_eigen_init();
+    void bivar_eigen_pad(const eigenMatrix &Z, eigenMatrix &F);
+    void bivar_eigen_Vfi(eigenMatrix &F);
+    void bivar_eigen_AF(int i, eigenMatrix &F);
+    bool calcu_Vi_bivar_eigen(eigenVector &prev_varcmp, double &logdet);
+    void calcu_ViZ_bivar(const eigenMatrix &Z, eigenMatrix &ViZ);
+    void calcu_AZ_bivar(int i, const eigenMatrix &Z, eigenMatrix &AZ);
+    double calcu_tr_ViA_bivar(int i);
+
+    // checkpoints of the REML iterations and warm starts from a .hsq file
+    string reml_ckpt_key();
+    bool reml_ckpt_read(eigenVector &varcmp);
+    void reml_ckpt_write(int iter, double lgL, const eigenVector &varcmp, const eigenMatrix &Hi);
+    bool reml_warm_start(eigenVector &varcmp);
+
+    // HE regression in one pass over the GRM files
+    void HE_stream(const vector<string> &grm_files, const vector<int> &grm_kp, const eigenMatrix &Y, const eigenMatrix &M, const vector<he_term> &terms, vector<he_equations> &eqs);
+    eigenMatrix HE_jackknife(const he_equations &eq);
+
     // within-family reml analysis
     void detect_family();
     bool calcu_Vi_within_family(eigenMatrix &Vi, eigenVector &prev_varcmp, double &logdet, int &iter);
@@ -373,6 +477,7 @@ private:
     bool massoc_sblup(double lambda, eigenVector &bJ);
     void massoc_slct_output(bool joint_only, vector<int> &slct, eigenVector &bJ, eigenVector &bJ_se, eigenVector &pJ, eigenMatrix &rval);
     void massoc_cond_output(vector<int> &remain, eigenVector &bC, eigenVector &bC_se, eigenVector &pC);
+    string massoc_p_text(double p, double b, double se);
 
     // read raw genotype data (Illumina)
     char flip_allele(char a);
@@ -385,6 +490,7 @@ private:
     void output_grm_mkl(float* A, bool output_grm_bin);
     bool comput_inverse_logdet_LDLT_mkl(eigenMatrix &Vi, double &logdet);
     bool comput_inverse_logdet_LU_mkl(eigenMatrix &Vi, double &logdet);
+    bool calcu_Vi_float(eigenVector &prev_varcmp, double &logdet);
     bool comput_inverse_logdet_LU_mkl_array(int n, float *Vi, double &logdet);
     void LD_pruning_blk_mkl(float *X, vector<int> &brk_pnt, double rsq_cutoff, vector<int> &rm_snp_ID1);
     void calcu_ssx_sqrt_i_mkl(float *X_std, vector<double> &ssx);
@@ -393,8 +499,7 @@ private:
     
 
     // mlma
-    void mlma_calcu_stat(float *y, float *geno_mkl, unsigned long n, unsigned long m, eigenVector &beta, eigenVector &se, eigenVector &pval);
-    void mlma_calcu_stat_covar(float *y, float *geno_mkl, unsigned long n, unsigned long m, eigenVector &beta, eigenVector &se, eigenVector &pval);
+    void mlma_calcu_stat(const eigenVector &y, bool joint_covar, eigenVector &beta, eigenVector &se, eigenVector &pval);
     void grm_minus_grm(float *grm, float *sub_grm);
 
     // population
@@ -525,6 +630,12 @@ private:
     // bed file
     vector< vector<bool> > _snp_1;
     vector< vector<bool> > _snp_2;
+    // --mlma with --bfile: the BED file read by blocks of SNPs (bed_stream.cpp),
+    //   with the raw indices of the individuals and SNPs kept
+    string _bed_stream;
+    int _bed_raw_indi_num = 0;
+    vector<int> _bed_raw_indi;
+    vector<int> _bed_raw_snp;
 
     // imputed data
     bool _dosage_flag;
@@ -577,6 +688,78 @@ private:
     bool _reml_no_converge;
     bool _reml_fixed_var;
     bool _reml_allow_constrain_run = false;
+    // --reml-float: V^-1 in single precision in _Vi_f (_Vi and _P are not
+    //   formed), with V^-1 * X, P * y and the AI terms refined in double against
+    //   the V of _Vf_varcmp; P * z and tr(PA) need V^-1 * X and
+    //   (X^t V^-1 X)^-1 of the iteration. Dropped to double for the iterations
+    //   after convergence, or when the refinement stalls
+    bool _reml_float = false;
+    bool _reml_float_stall = false;
+    MatrixXf _Vi_f;
+    eigenVector _Vf_varcmp;
+    eigenMatrix _Vf_Vi_X;
+    eigenMatrix _Vf_Xt_Vi_X_i;
+
+    // spectral REML: A = U * diag(d) * U^t of the GRM _A[_eig_indx], decomposed
+    //   once; X is kept in the eigenbasis, _eig_K holds the diagonals of the
+    //   variance components in that basis and _eig_st the phenotype
+    bool _reml_eigen = false;
+    bool _eig_active = false;
+    int _eig_indx = -1;
+    eigenMatrix _eig_U;
+    eigenVector _eig_d;
+    eigenMatrix _eig_X;
+    eigenMatrix _eig_K;
+    eigen_reml_state _eig_st;
+    // --reml-batch: fit all the traits of the phenotype file
+    bool _reml_batch = false;
+    // trait names from the header of the phenotype file, if any
+    vector<string> _phen_name;
+    // --memory: the GRMs and V^-1 are kept by tiles (TiledMatrix), in scratch
+    //   files next to --out when they don't fit; the residual is the diagonal
+    //   _ooc_res and _A only keeps the place of the components
+    double _reml_mem_gb = -1.0;
+    bool _ooc_active = false;
+    vector<std::unique_ptr<TiledMatrix>> _A_tiled;
+    std::unique_ptr<TiledMatrix> _Vi_tiled;
+    eigenVector _ooc_res;
+    // --reml-rand: the probes _rand_Z, A * Z by the index of _A, V^-1 * [X y Z]
+    //   of the last iteration as the start of the next, and V (its components
+    //   and diagonal) of the iteration
+    int _reml_rand_probes = 0;
+    bool _rand_active = false;
+    eigenMatrix _rand_Z;
+    vector<eigenMatrix> _rand_AZ;
+    eigenMatrix _rand_ViB;
+    eigenVector _rand_varcmp;
+    eigenVector _rand_diag;
+    // spectral bivariate REML (--reml-eigen): both traits of the _bv_N
+    //   individuals in the eigenbasis _eig_U of the GRM, _bv_obs and _bv_miss
+    //   the observed and missing phenotypes in the vector of both traits.
+    //   _bv_S holds the 2 x 2 loadings (s11, s22, s12) of the components,
+    //   _bv_Bi the inverse blocks (by eigenvalue) and _bv_ViE, _bv_Mi the
+    //   Schur complement on the missing phenotypes. _bv_AE is kept for the
+    //   components in _bv_AE_indx
+    bool _bv_eig_active = false;
+    int _bv_N = 0;
+    vector<int> _bv_obs;
+    vector<int> _bv_miss;
+    eigenMatrix _bv_S;
+    vector<char> _bv_grm;
+    vector<eigenMatrix> _bv_AE;
+    vector<int> _bv_AE_indx;
+    eigenMatrix _bv_Bi;
+    eigenMatrix _bv_ViE;
+    eigenMatrix _bv_Mi;
+    // --reml-checkpoint: the iterations of the main fit (not the reduced
+    //   models) are saved in [out].reml.ckpt, numbered from _reml_ckpt_iter
+    //   when resumed; --reml-warm-start: the .hsq file to start from
+    bool _reml_ckpt = false;
+    bool _reml_ckpt_active = false;
+    int _reml_ckpt_iter = 0;
+    string _reml_warm_file;
+    // HE regression: number of blocks of individuals of the jackknife
+    int _HE_jk_blocks = 200;
 
     // within-family reml analysis
     bool _within_family;
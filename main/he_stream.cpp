@@ -0,0 +1,190 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Haseman-Elston regression in one pass over the .grm.bin files
+ *
+ * The GRMs are memory mapped and the rows of their lower triangles are
+ * processed in parallel. Each pair (i, j) adds its GRM values to the normal
+ * equations X'X, X'z and z'z of all the responses at once, so nothing of size
+ * n^2 is built and the GRMs are read once whatever the number of components
+ * and responses. The jackknife leaves out blocks of individuals: the pairs of
+ * a block are summed as they pass, which keeps the memory at
+ * O(blocks * k^2) rather than O(n * k^2).
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file COPYING for more
+ * details
+ */
+
+#include "gcta.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+void gcta::set_HE_jk_blocks(int num_blocks)
+{
+    _HE_jk_blocks = num_blocks;
+}
+
+void gcta::HE_stream(const vector<string> &grm_files, const vector<int> &grm_kp, const eigenMatrix &Y, const eigenMatrix &M, const vector<he_term> &terms, vector<he_equations> &eqs)
+{
+    int k = 0, t = 0;
+    int n = grm_kp.size(), m = Y.cols(), n_grm = grm_files.size(), K = n_grm + 1, T = terms.size();
+
+    // the GRMs, lower triangles by rows in float
+    vector<const float *> grm(n_grm);
+    vector<size_t> grm_bytes(n_grm);
+    uint64_t n_val = (uint64_t)(grm_kp[n - 1] + 1) * (grm_kp[n - 1] + 2) / 2;
+    for (k = 0; k < n_grm; k++) {
+        string grm_binfile = grm_files[k] + ".grm.bin";
+        int fd = open(grm_binfile.c_str(), O_RDONLY);
+        if (fd < 0) LOGGER.e(0, "cannot open the file [" + grm_binfile + "] to read.");
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < n_val * sizeof(float)) {
+            ::close(fd);
+            LOGGER.e(0, "the size of the file [" + grm_binfile + "] doesn't match the number of individuals in [" + grm_files[k] + ".grm.id].");
+        }
+        grm_bytes[k] = st.st_size;
+        void *ptr = mmap(NULL, grm_bytes[k], PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) LOGGER.e(0, "cannot map the file [" + grm_binfile + "].");
+        madvise(ptr, grm_bytes[k], MADV_SEQUENTIAL);
+        grm[k] = static_cast<const float *>(ptr);
+    }
+
+    // a weight per distinct pair of phenotype columns (u, v): the number of
+    // observations of the pair, which scales its row of X
+    vector<int> term_grp(T);
+    vector< pair<int, int> > grp;
+    for (t = 0; t < T; t++) {
+        pair<int, int> uv(terms[t].u, terms[t].v);
+        int g = find(grp.begin(), grp.end(), uv) - grp.begin();
+        if (g == grp.size()) grp.push_back(uv);
+        term_grp[t] = g;
+    }
+    int G = grp.size();
+
+    // accumulators: X'X of each weight, then X'z and z'z of each response
+    int L_size = G * K * K, S = L_size + T * (K + 1);
+    int n_blk = min(_HE_jk_blocks, n);
+    vector<double> y(Y.data(), Y.data() + (size_t)n * m), msk(M.data(), M.data() + (size_t)n * m);
+    vector<double> total(S, 0.0), blk_total((size_t)n_blk * S, 0.0);
+
+    LOGGER << "Accumulating the least squares equations over " << (uint64_t)n * (n - 1) / 2 << " pairs of individuals (" << n_grm << " GRM(s), " << T << " response(s), "
+           << n_blk << " jackknife blocks) ..." << endl;
+
+    #pragma omp parallel
+    {
+        vector<double> acc(S), row(S), tot(S, 0.0), blk((size_t)n_blk * S, 0.0), x(K);
+        x[0] = 1.0;
+        // the heavy rows first
+        #pragma omp for schedule(dynamic, 16)
+        for (int r = 0; r < n; r++) {
+            int ii = n - 1 - r, bi = (int)((int64_t)ii * n_blk / n), b = -1;
+            vector<const float *> grm_row(n_grm);
+            for (int l = 0; l < n_grm; l++) grm_row[l] = grm[l] + (uint64_t)grm_kp[ii] * (grm_kp[ii] + 1) / 2;
+            std::fill(row.begin(), row.end(), 0.0);
+            std::fill(acc.begin(), acc.end(), 0.0);
+            for (int jj = 0; jj < ii; jj++) {
+                int bj = (int)((int64_t)jj * n_blk / n);
+                if (bj != b) {
+                    if (b >= 0) {
+                        for (int s = 0; s < S; s++) row[s] += acc[s];
+                        if (b != bi) for (int s = 0; s < S; s++) blk[(size_t)b * S + s] += acc[s];
+                        std::fill(acc.begin(), acc.end(), 0.0);
+                    }
+                    b = bj;
+                }
+                int gj = grm_kp[jj];
+                for (int l = 0; l < n_grm; l++) x[l + 1] = grm_row[l][gj];
+                const double *yi = &y[ii], *yj = &y[jj], *mi = &msk[ii], *mj = &msk[jj];
+                for (int g = 0; g < G; g++) {
+                    int u = grp[g].first * n, v = grp[g].second * n;
+                    double w = mi[u] * mj[v];
+                    if (u != v) w += mj[u] * mi[v];
+                    if (w == 0.0) continue;
+                    double *L = &acc[g * K * K];
+                    for (int c = 0; c < K; c++) {
+                        double wx = w * x[c];
+                        for (int d = c; d < K; d++) L[c * K + d] += wx * x[d];
+                    }
+                }
+                for (int s = 0; s < T; s++) {
+                    int u = terms[s].u * n, v = terms[s].v * n;
+                    double w1 = mi[u] * mj[v], z1 = 0.0, w2 = 0.0, z2 = 0.0;
+                    if (terms[s].sd) z1 = (yi[u] - yj[u]) * (yi[u] - yj[u]);
+                    else {
+                        z1 = yi[u] * yj[v];
+                        if (u != v) {
+                            w2 = mj[u] * mi[v];
+                            z2 = yj[u] * yi[v];
+                        }
+                    }
+                    double z = w1 * z1 + w2 * z2;
+                    if (w1 == 0.0 && w2 == 0.0) continue;
+                    double *R = &acc[L_size + s * (K + 1)];
+                    for (int c = 0; c < K; c++) R[c] += z * x[c];
+                    R[K] += w1 * z1 * z1 + w2 * z2 * z2;
+                }
+            }
+            if (b >= 0) {
+                for (int s = 0; s < S; s++) row[s] += acc[s];
+                if (b != bi) for (int s = 0; s < S; s++) blk[(size_t)b * S + s] += acc[s];
+            }
+            // the pairs of ii are left out with its block
+            for (int s = 0; s < S; s++) {
+                blk[(size_t)bi * S + s] += row[s];
+                tot[s] += row[s];
+            }
+        }
+        #pragma omp critical
+        {
+            for (int s = 0; s < S; s++) total[s] += tot[s];
+            for (size_t s = 0; s < blk.size(); s++) blk_total[s] += blk[s];
+        }
+    }
+
+    for (k = 0; k < n_grm; k++) munmap((void *)grm[k], grm_bytes[k]);
+
+    // the leave-one-block-out equations: a pair is in the blocks of both of
+    // its individuals
+    eqs.resize(T);
+    for (t = 0; t < T; t++) {
+        int L_off = term_grp[t] * K * K, R_off = L_size + t * (K + 1);
+        he_equations &eq = eqs[t];
+        eq.Lhs.resize(K, K);
+        eq.Rhs.resize(K);
+        eq.LhsJk.resize(n_blk);
+        eq.RhsJk.resize(n_blk);
+        for (int c = 0; c < K; c++) {
+            for (int d = c; d < K; d++) eq.Lhs(c, d) = eq.Lhs(d, c) = total[L_off + c * K + d];
+            eq.Rhs(c) = total[R_off + c];
+        }
+        eq.totalSS = total[R_off + K];
+        for (int b = 0; b < n_blk; b++) {
+            const double *B = &blk_total[(size_t)b * S];
+            eq.LhsJk[b] = eq.Lhs;
+            eq.RhsJk[b] = eq.Rhs;
+            for (int c = 0; c < K; c++) {
+                for (int d = c; d < K; d++) {
+                    eq.LhsJk[b](c, d) -= B[L_off + c * K + d];
+                    if (d != c) eq.LhsJk[b](d, c) = eq.LhsJk[b](c, d);
+                }
+                eq.RhsJk[b](c) -= B[R_off + c];
+            }
+        }
+    }
+}
+
+// estimates with each block of individuals left out, by rows
+eigenMatrix gcta::HE_jackknife(const he_equations &eq)
+{
+    int n_blk = eq.LhsJk.size();
+    eigenMatrix beta(n_blk, eq.Rhs.size());
+    #pragma omp parallel for
+    for (int b = 0; b < n_blk; b++) {
+        beta.row(b) = eq.LhsJk[b].inverse() * eq.RhsJk[b];
+    }
+    return beta;
+}
@@ -308,7 +308,7 @@ void gcta::run_massoc_cond(string metafile, string snplistfile, int wind_size, d
     int i = 0, j = 0;
     for (i = 0; i < pgiven.size(); i++) {
         j = pgiven[i];
-        ofile << _chr[_include[j]] << "\t" << _snp_name[_include[j]] << "\t" << _bp[_include[j]] << "\t" << _ref_A[_include[j]] << "\t" << _freq[j] << "\t" << _beta[j] << "\t" << _beta_se[j] << "\t" << _pval[j] << endl;
+        ofile << _chr[_include[j]] << "\t" << _snp_name[_include[j]] << "\t" << _bp[_include[j]] << "\t" << _ref_A[_include[j]] << "\t" << _freq[j] << "\t" << _beta[j] << "\t" << _beta_se[j] << "\t" << massoc_p_text(_pval[j], _beta[j], _beta_se[j]) << endl;
     }
     ofile.close();
     
@@ -329,7 +329,7 @@ void gcta::massoc_slct_output(bool joint_only, vector<int> &slct, eigenVector &b
         j = slct[i];
         ofile << _chr[_include[j]] << "\t" << _snp_name[_include[j]] << "\t" << _bp[_include[j]] << "\t";
         ofile << _ref_A[_include[j]] << "\t" << _freq[j] << "\t" << _beta[j] << "\t" << _beta_se[j] << "\t";
-        ofile << _pval[j] << "\t" << _Nd[j] << "\t" << 0.5 * _mu[_include[j]] << "\t" << bJ[i] << "\t" << bJ_se[i] << "\t" << pJ[i] << "\t";
+        ofile << massoc_p_text(_pval[j], _beta[j], _beta_se[j]) << "\t" << _Nd[j] << "\t" << 0.5 * _mu[_include[j]] << "\t" << bJ[i] << "\t" << bJ_se[i] << "\t" << massoc_p_text(pJ[i], bJ[i], bJ_se[i]) << "\t";
         if (i == slct.size() - 1) ofile << 0 << endl;
         else ofile << rval(i, i + 1) << endl;
     }
@@ -351,6 +351,15 @@ void gcta::massoc_slct_output(bool joint_only, vector<int> &slct, eigenVector &b
     ofile.close();
 }
 
+// p of the effect b with the standard error se as printed, from the log of
+// the tail when p has underflowed
+string gcta::massoc_p_text(double p, double b, double se)
+{
+    double chisq = (b / se) * (b / se);
+    if (_GC_val > 0) chisq /= _GC_val;
+    return StatFunc::pchisq_text(p, se > 0.0 ? chisq : -1.0);
+}
+
 void gcta::set_massoc_pC_thresh(double thresh){
     g_massoc_out_thresh = thresh;
 }
@@ -370,9 +379,9 @@ void gcta::massoc_cond_output(vector<int> &remain, eigenVector &bC, eigenVector
             j = remain[i];
             ofile << _chr[_include[j]] << "\t" << _snp_name[_include[j]] << "\t" << _bp[_include[j]] << "\t";
             ofile << _ref_A[_include[j]] << "\t" << _freq[j] << "\t" << _beta[j] << "\t" << _beta_se[j] << "\t";
-            ofile << _pval[j] << "\t" << _Nd[j] << "\t" << 0.5 * _mu[_include[j]] << "\t";
+            ofile << massoc_p_text(_pval[j], _beta[j], _beta_se[j]) << "\t" << _Nd[j] << "\t" << 0.5 * _mu[_include[j]] << "\t";
             if (pC[i] > 1.5) ofile << "NA\tNA\tNA" << endl;
-            else ofile << bC[i] << "\t" << bC_se[i] << "\t" << pC[i] << endl;
+            else ofile << bC[i] << "\t" << bC_se[i] << "\t" << massoc_p_text(pC[i], bC[i], bC_se[i]) << endl;
         }
     }else{
         LOGGER << "Restricting output threshold to " << out_thresh << "." << endl;
@@ -381,8 +390,8 @@ void gcta::massoc_cond_output(vector<int> &remain, eigenVector &bC, eigenVector
                 j = remain[i];
                 ofile << _chr[_include[j]] << "\t" << _snp_name[_include[j]] << "\t" << _bp[_include[j]] << "\t";
                 ofile << _ref_A[_include[j]] << "\t" << _freq[j] << "\t" << _beta[j] << "\t" << _beta_se[j] << "\t";
-                ofile << _pval[j] << "\t" << _Nd[j] << "\t" << 0.5 * _mu[_include[j]] << "\t";
-                ofile << bC[i] << "\t" << bC_se[i] << "\t" << pC[i] << endl;
+                ofile << massoc_p_text(_pval[j], _beta[j], _beta_se[j]) << "\t" << _Nd[j] << "\t" << 0.5 * _mu[_include[j]] << "\t";
+                ofile << bC[i] << "\t" << bC_se[i] << "\t" << massoc_p_text(pC[i], bC[i], bC_se[i]) << endl;
             }
         }
     }
@@ -411,6 +411,48 @@ bool gcta::comput_inverse_logdet_LDLT_mkl(eigenMatrix &Vi, double &logdet)
 
 }
 
+// --reml-float: V is formed, factorized and inverted in single precision in
+// _Vi_f, so the only n x n matrix of the iteration is in float. The refined
+// solves (solve_V_refine) keep the components to form V * Z in double. log|V|
+// is summed in double from the single precision factor. false if V is not
+// positive definite in single precision
+bool gcta::calcu_Vi_float(eigenVector &prev_varcmp, double &logdet)
+{
+    int i = 0, info = 0, int_n = _n;
+    char uplo = 'L';
+    _Vi_f.setZero(_n, _n);
+    #pragma omp parallel for private(i)
+    for (int j = 0; j < _n; j++) {
+        for (i = 0; i < _r_indx.size(); i++) _Vi_f.col(j) += ((_A[_r_indx[i]]).col(j) * prev_varcmp[i]).cast<float>();
+    }
+
+#if GCTA_CPU_x86
+    spotrf(&uplo, &int_n, _Vi_f.data(), &int_n, &info);
+#else
+    spotrf_(&uplo, &int_n, _Vi_f.data(), &int_n, &info);
+#endif
+    if (info < 0) LOGGER.e(0, "Cholesky decomposition failed. Invalid values found in the matrix.\n");
+    if (info > 0) {
+        _Vi_f.resize(0, 0);
+        return false;
+    }
+    logdet = 0.0;
+    for (int j = 0; j < _n; j++) logdet += 2.0 * log((double)_Vi_f(j, j));
+
+#if GCTA_CPU_x86
+    spotri(&uplo, &int_n, _Vi_f.data(), &int_n, &info);
+#else
+    spotri_(&uplo, &int_n, _Vi_f.data(), &int_n, &info);
+#endif
+    if (info != 0) {
+        _Vi_f.resize(0, 0);
+        return false;
+    }
+    _Vi_f.triangularView<StrictlyUpper>() = _Vi_f.transpose();
+    _Vf_varcmp = prev_varcmp;
+    return true;
+}
+
 bool gcta::comput_inverse_logdet_LU_mkl(eigenMatrix &Vi, double &logdet)
 {
     unsigned long n = Vi.cols();
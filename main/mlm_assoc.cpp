@@ -72,7 +72,12 @@ void gcta::mlma(string grm_file, bool m_grm_flag, string subtract_grm_file, stri
         }
         else{
             grm_files.push_back("NA");
-            make_grm_mkl(false, false, inbred, true, 0, true);
+            if (!_bed_stream.empty()) make_grm_stream(inbred);
+            else {
+                make_grm_mkl(false, false, inbred, true, 0, true);
+                // the tests read the genotypes by blocks
+                delete[] _geno_mkl;
+            }
             for(i=0; i<_keep.size(); i++) grm_id.push_back(_fid[_keep[i]]+":"+_pid[_keep[i]]);
         }
     }
@@ -196,35 +201,16 @@ void gcta::mlma(string grm_file, bool m_grm_flag, string subtract_grm_file, stri
     
     // run REML algorithm
     LOGGER << "\nPerforming MLM association analyses" << (subtract_grm_flag?"":" (including the candidate SNP)") << " ..."<<endl;
-    unsigned long n=_keep.size(), m=_include.size();
+    unsigned long m=_include.size();
 	reml(false, true, reml_priors, reml_priors_var, -2.0, -2.0, no_constrain, true, true);
     _P.resize(0,0);
     _A.clear();
-    float *y=new float[n];
     eigenVector y_buf=_y;
     if(!no_adj_covar) y_buf=_y.array()-(_X*_b).array(); // adjust phenotype for covariates
-    for(i=0; i<n; i++) y[i]=y_buf[i];
-    
-/*    if(grm_flag || m_grm_flag){
-        LOGGER<<endl;
-        _geno_mkl=new float[n*m];
-        make_XMat_mkl(_geno_mkl, false);
-        #pragma omp parallel for private(j, k)
-        for(i=0; i<n; i++){
-            for(j=0; j<m; j++){
-                k=i*m+j;
-                if(_geno_mkl[k]<1e5) _geno_mkl[k]-=_mu[_include[j]];
-                else _geno_mkl[k]=0.0;
-            }
-        }
-    }*/
     
     if (_mu.empty()) calcu_mu();
     eigenVector beta, se, pval;
-    if(no_adj_covar) mlma_calcu_stat_covar(y, _geno_mkl, n, m, beta, se, pval);
-    else mlma_calcu_stat(y, _geno_mkl, n, m, beta, se, pval);
-    delete[] y;
-    delete[] _geno_mkl;
+    mlma_calcu_stat(y_buf, no_adj_covar, beta, se, pval);
     
     string filename=_out+".mlma";
     LOGGER<<"\nSaving the results of the mixed linear model association analyses of "<<m<<" SNPs to ["+filename+"] ..."<<endl;
@@ -240,120 +226,65 @@ void gcta::mlma(string grm_file, bool m_grm_flag, string subtract_grm_file, stri
     ofile.close();
 }
 
-void gcta::mlma_calcu_stat(float *y, float *geno_mkl, unsigned long n, unsigned long m, eigenVector &beta, eigenVector &se, eigenVector &pval)
+// V^-1 * y, or P * y with the covariates fitted jointly (--mlma-no-preadj-covar),
+// is computed once and the SNPs of a block are tested together by GEMM: the
+// effect of x is x^t P y / x^t P x, where x^t P x = x^t V^-1 x -
+// (X^t V^-1 x)^t (X^t V^-1 X)^-1 X^t V^-1 x is the inverse of its sampling
+// variance in the joint fit
+void gcta::mlma_calcu_stat(const eigenVector &y, bool joint_covar, eigenVector &beta, eigenVector &se, eigenVector &pval)
 {
-    int max_block_size = 10000;
-    unsigned long i=0, j=0;
-    double Xt_Vi_X=0.0, chisq=0.0;
-    float *X=new float[n];
-    float *Vi_X=new float[n];
-    float *Vi=new float[n*n];
-    #pragma omp parallel for private(j)
-    for(i=0; i<n; i++){
-        for(j=0; j<n; j++) Vi[i*n+j]=_Vi(i,j);
+    int max_block_size = 2048;
+    unsigned long i = 0, m = _include.size();
+    double chisq = 0.0, d_buf = 0.0;
+    VectorXf Py;
+    MatrixXf Vi_X, Xt_Vi_X_i;
+    if (joint_covar) {
+        eigenMatrix Vi_X_d = _Vi * _X, Xt_Vi_X = _X.transpose() * Vi_X_d;
+        if (!comput_inverse_logdet_LU(Xt_Vi_X, d_buf)) LOGGER.e(0, "Xt_Vi_X is not invertible.");
+        Py = (_Vi * y - Vi_X_d * (Xt_Vi_X * (Vi_X_d.transpose() * y))).cast<float>();
+        Vi_X = Vi_X_d.cast<float>();
+        Xt_Vi_X_i = Xt_Vi_X.cast<float>();
     }
+    else Py = (_Vi * y).cast<float>();
+    MatrixXf Vi = _Vi.cast<float>();
     _Vi.resize(0,0);
-    
-    beta.resize(m);
-    se=eigenVector::Zero(m);
-    pval=eigenVector::Constant(m,2);
-    LOGGER<<"\nRunning association tests for "<<m<<" SNPs ..."<<endl;
-    int new_start = 0, block_size = 0, block_col = 0, k = 0, l = 0;
-    MatrixXf X_block;
-    vector<int> indx;
-    for(i = 0; i < m; i++, block_col++){
-        // get a block of SNPs
-        if(i == new_start){
-            block_col = 0;
-            new_start = i + max_block_size;
-            block_size = max_block_size;
-            if(new_start > m) block_size = m - i;
-            indx.resize(block_size);
-            for(k = i, l = 0; l < block_size; k++, l++) indx[l] = k;
-            make_XMat_subset(X_block, indx, false);
-        }
-
-        for(j = 0; j < n; j++) X[j] = X_block(j, block_col);
-        cblas_sgemv(CblasRowMajor, CblasNoTrans, n, n, 1.0, Vi, n, X, 1, 0.0, Vi_X, 1);
-        Xt_Vi_X=cblas_sdot(n, X, 1, Vi_X, 1);
-        se[i]=1.0/Xt_Vi_X;
-        beta[i]=se[i]*cblas_sdot(n, y, 1, Vi_X, 1);
-        if(se[i]>1.0e-30){
-            se[i]=sqrt(se[i]);
-            chisq=beta[i]/se[i];
-            pval[i]=StatFunc::pchisq(chisq*chisq, 1);
-        }
-    }
-    delete[] X;
-    delete[] Vi_X;
-    delete[] Vi;
-}
-
-void gcta::mlma_calcu_stat_covar(float *y, float *geno_mkl, unsigned long n, unsigned long m, eigenVector &beta, eigenVector &se, eigenVector &pval)
-{
-    int max_block_size = 10000;
-    unsigned long i=0, j=0, col_num=_X_c+1;
-    double chisq=0.0, d_buf=0.0;
-    float *Vi=new float[n*n];
-    float *X=new float[n*col_num];
-    float *Vi_X=new float[n*col_num];
-    float *Xt_Vi_X=new float[col_num*col_num];
-    float *Xt_Vi_y=new float[col_num];
-    float *b_vec=new float[col_num];
-    #pragma omp parallel for private(j)
-    for(i=0; i<n; i++){
-        for(j=0; j<n; j++) Vi[i*n+j]=_Vi(i,j);
-    }
-    _Vi.resize(0,0);
-    for(i=0; i<n; i++){
-        for(j=0; j<_X_c; j++) X[i*col_num+j]=_X(i,j);
-        X[i*col_num+_X_c]=0.0;
-    }
 
     beta.resize(m);
     se=eigenVector::Zero(m);
     pval=eigenVector::Constant(m,2);
     LOGGER<<"\nRunning association tests for "<<m<<" SNPs ..."<<endl;
-    int new_start = 0, block_size = 0, block_col = 0, k = 0, l = 0;
-    MatrixXf X_block;
+    int block_size = 0, l = 0;
+    MatrixXf X_block, Vi_X_block, Xt_Vi_X_block;
+    VectorXf xPx, xPy;
     vector<int> indx;
-    for(i = 0; i < m; i++, block_col++){
-        // get a block of SNPs
-        if(i == new_start){
-            block_col = 0;
-            new_start = i + max_block_size;
-            block_size = max_block_size;
-            if(new_start > m) block_size = m - i;
-            indx.resize(block_size);
-            for(k = i, l = 0; l < block_size; k++, l++) indx[l] = k;
-            make_XMat_subset(X_block, indx, false);
-        }
+    for(unsigned long start = 0; start < m; start += max_block_size){
+        block_size = min((unsigned long)max_block_size, m - start);
+        indx.resize(block_size);
+        for(l = 0; l < block_size; l++) indx[l] = start + l;
+        make_XMat_subset(X_block, indx, false);
 
-        for(j = 0; j < n; j++) X[j*col_num+_X_c] = X_block(j, block_col);
-        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, n, col_num, n, 1.0, Vi, n, X, col_num, 0.0, Vi_X, col_num);
-        cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, col_num, col_num, n, 1.0, X, col_num, Vi_X, col_num, 0.0, Xt_Vi_X, col_num);
-        if(!comput_inverse_logdet_LU_mkl_array(col_num, Xt_Vi_X, d_buf)) LOGGER.e(0, "Xt_Vi_X is not invertible.");
-        cblas_sgemv(CblasRowMajor, CblasTrans, n, col_num, 1.0, Vi_X, col_num, y, 1, 0.0, Xt_Vi_y, 1);
-        cblas_sgemv(CblasRowMajor, CblasNoTrans, col_num, col_num, 1.0, Xt_Vi_X, col_num, Xt_Vi_y, 1, 0.0, b_vec, 1);
-        se[i]=Xt_Vi_X[_X_c*col_num+_X_c];
-        beta[i]=b_vec[_X_c];
-        if(se[i]>1.0e-30){
+        Vi_X_block.noalias() = Vi * X_block;
+        xPx = X_block.cwiseProduct(Vi_X_block).colwise().sum().transpose();
+        xPy.noalias() = X_block.transpose() * Py;
+        if(joint_covar){
+            Xt_Vi_X_block.noalias() = Vi_X.transpose() * X_block;
+            xPx -= (Xt_Vi_X_i * Xt_Vi_X_block).cwiseProduct(Xt_Vi_X_block).colwise().sum().transpose();
+        }
+        for(l = 0; l < block_size; l++){
+            i = start + l;
+            if(xPx[l] < 1.0e-30) continue;
+            se[i]=1.0/xPx[l];
+            beta[i]=se[i]*xPy[l];
             se[i]=sqrt(se[i]);
             chisq=beta[i]/se[i];
             pval[i]=StatFunc::pchisq(chisq*chisq, 1);
         }
     }
-    delete[] Vi;
-    delete[] X;
-    delete[] Vi_X;
-    delete[] Xt_Vi_X;
-    delete[] Xt_Vi_y;
-    delete[] b_vec;
 }
 
 void gcta::mlma_loco(string phen_file, string qcovar_file, string covar_file, int mphen, int MaxIter, vector<double> reml_priors, vector<double> reml_priors_var, bool no_constrain, bool inbred, bool no_adj_covar)
 {
-    unsigned long i=0, j=0, k=0, c1=0, c2=0, n=0;
+    unsigned long i=0, j=0, k=0, c1=0, c2=0;
     _reml_max_iter=MaxIter;
     bool qcovar_flag=(!qcovar_file.empty());
     bool covar_flag=(!covar_file.empty());
@@ -378,7 +309,6 @@ void gcta::mlma_loco(string phen_file, string qcovar_file, string covar_file, in
         covar_num=read_covar(covar_file, covar_ID, covar, false);
         update_id_map_kp(covar_ID, _id_map, _keep);
     }
-    n=_keep.size();
     _n=_keep.size();
     if(_n<1) LOGGER.e(0, "no individual is in common among the input files.");
     LOGGER<<_n<<" individuals are in common in these files."<<endl;
@@ -394,7 +324,6 @@ void gcta::mlma_loco(string phen_file, string qcovar_file, string covar_file, in
     map<string, int> snp_name_map_o(_snp_name_map);
     vector<float> m_chrs_f(chrs.size());
     vector<float *> grm_chrs(chrs.size());
-    vector<float *> geno_chrs(chrs.size());
     vector< vector<int> > icld_chrs(chrs.size());
     LOGGER<<endl;
     if(_mu.empty()) calcu_mu();
@@ -402,15 +331,18 @@ void gcta::mlma_loco(string phen_file, string qcovar_file, string covar_file, in
     for(c1=0; c1<chrs.size(); c1++){
         LOGGER<<"Chr "<<chrs[c1]<<":"<<endl;
         extract_chr(chrs[c1], chrs[c1]);
-        make_grm_mkl(false, false, inbred, true, 0, true);
+        if (!_bed_stream.empty()) make_grm_stream(inbred);
+        else {
+            make_grm_mkl(false, false, inbred, true, 0, true);
+            delete[] _geno_mkl;
+            _geno_mkl=NULL;
+        }
         
         m_chrs_f[c1]=(float)_include.size();
         icld_chrs[c1]=_include;
         _include=include_o;
         _snp_name_map=snp_name_map_o;
         
-        geno_chrs[c1]=_geno_mkl;
-        _geno_mkl=NULL;
         grm_chrs[c1]=_grm_mkl;
         _grm_mkl=NULL;
     }
@@ -453,13 +385,13 @@ void gcta::mlma_loco(string phen_file, string qcovar_file, string covar_file, in
     _A[1]=eigenMatrix::Identity(_n, _n);
     
     eigenVector y_buf=_y;
-    float *y=new float[_n];
     vector<eigenVector> beta(chrs.size()), se(chrs.size()), pval(chrs.size());
     for(c1=0; c1<chrs.size(); c1++){
         LOGGER<<"\n-----------------------------------\n#Chr "<<chrs[c1]<<":"<<endl;
         extract_chr(chrs[c1], chrs[c1]);
         
         _A[0]=eigenMatrix::Zero(_n, _n);
+        _eig_indx=-1; // a new GRM for each chromosome
         double d_buf=0;
         for(c2=0; c2<chrs.size(); c2++){
             if(chrs[c1]==chrs[c2]) continue;
@@ -483,25 +415,20 @@ void gcta::mlma_loco(string phen_file, string qcovar_file, string covar_file, in
         // run REML algorithm
         reml(false, true, reml_priors, reml_priors_var, -2.0, -2.0, no_constrain, true, true);
         if(!no_adj_covar) y_buf=_y.array()-(_X*_b).array(); // adjust phenotype for covariates
-        for(i=0; i<_n; i++) y[i]=y_buf[i];
         reml_priors.clear();
         reml_priors_var=_varcmp;
         _P.resize(0,0);
         _A[0].resize(0,0);
 
-        if(no_adj_covar)  mlma_calcu_stat_covar(y, (geno_chrs[c1]), n, _include.size(), beta[c1], se[c1], pval[c1]);
-        else mlma_calcu_stat(y, (geno_chrs[c1]), n, _include.size(), beta[c1], se[c1], pval[c1]);
+        // V^-1 of the GRM without the chromosome, by blocks of its SNPs
+        mlma_calcu_stat(y_buf, no_adj_covar, beta[c1], se[c1], pval[c1]);
         
         _include=include_o;
         _snp_name_map=snp_name_map_o;
         LOGGER<<"-----------------------------------"<<endl;
     }
     
-    delete[] y;
-    for(c1=0; c1<chrs.size(); c1++){
-        delete[] (grm_chrs[c1]);
-        delete[] (geno_chrs[c1]);
-    }
+    for(c1=0; c1<chrs.size(); c1++) delete[] (grm_chrs[c1]);
     
     string filename=_out+".loco.mlma";
     LOGGER<<"\nSaving the results of the mixed linear model association analyses of "<<_include.size()<<" SNPs to ["+filename+"] ..."<<endl;
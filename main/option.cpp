@@ -116,9 +116,17 @@ void option(int option_num, char* option_str[])
     int reml_diagV_adj = 0;
     double reml_diag_mul = 0.01;
     int reml_inv_method = 0;
+    bool reml_eigen_flag = false;
+    bool reml_batch_flag = false;
+    double reml_mem_gb = -1.0;
+    bool reml_float_flag = false;
+    int reml_rand_probes = 0;
+    bool reml_ckpt_flag = false;
+    string reml_warm_file = "";
 
     bool cv_blup = false;
     bool HE_reg_bivar_flag = false;
+    int HE_jk_blocks = 0;
     string weight_file = "";
     string phen_file = "", qcovar_file = "", covar_file = "", qgxe_file = "", gxe_file = "", blup_indi_file = "";
     vector<double> reml_priors, reml_priors_var, fixed_rg_val;
@@ -636,6 +644,10 @@ void option(int option_num, char* option_str[])
             }
             if (mphen < 1 || mphen2 < 1 || mphen == mphen2) LOGGER.e(0, "\n --HEreg-bivar. Invalid input parameters.");
             LOGGER << "--HEreg-bivar " << mphen << " " << mphen2 << endl;
+        } else if (strcmp(argv[i], "--HEreg-jk-blocks") == 0) {
+            HE_jk_blocks = atoi(argv[++i]);
+            LOGGER << "--HEreg-jk-blocks " << HE_jk_blocks << endl;
+            if (HE_jk_blocks < 2) LOGGER.e(0, "--HEreg-jk-blocks should be at least 2.");
         } else if (strcmp(argv[i], "--reml") == 0) {
             reml_flag = true;
             thread_flag = true;
@@ -738,6 +750,30 @@ void option(int option_num, char* option_str[])
         } else if (strcmp(argv[i], "--reml-diag-one") == 0) {
             reml_diag_one = true;
             LOGGER << "--reml-diag-one " << endl;
+        } else if (strcmp(argv[i], "--reml-eigen") == 0) {
+            reml_eigen_flag = true;
+            LOGGER << "--reml-eigen " << endl;
+        } else if (strcmp(argv[i], "--reml-batch") == 0) {
+            reml_batch_flag = true;
+            LOGGER << "--reml-batch " << endl;
+        } else if (strcmp(argv[i], "--reml-float") == 0) {
+            reml_float_flag = true;
+            LOGGER << "--reml-float " << endl;
+        } else if (strcmp(argv[i], "--reml-rand") == 0) {
+            reml_rand_probes = atoi(argv[++i]);
+            LOGGER << "--reml-rand " << reml_rand_probes << endl;
+            if (reml_rand_probes < 1 || reml_rand_probes > 1000) LOGGER.e(0, "--reml-rand should be the number of random probes, from 1 to 1000.");
+        } else if (strcmp(argv[i], "--reml-checkpoint") == 0) {
+            reml_ckpt_flag = true;
+            LOGGER << "--reml-checkpoint " << endl;
+        } else if (strcmp(argv[i], "--reml-warm-start") == 0) {
+            reml_warm_file = argv[++i];
+            LOGGER << "--reml-warm-start " << reml_warm_file << endl;
+            CommFunc::FileExist(reml_warm_file);
+        } else if (strcmp(argv[i], "--memory") == 0) {
+            reml_mem_gb = atof(argv[++i]);
+            LOGGER << "--memory " << reml_mem_gb << endl;
+            if (reml_mem_gb <= 0) LOGGER.e(0, "--memory should be the memory budget in GB, a positive value.");
         } else if (strcmp(argv[i], "--reml-diagV-adj") == 0) {
             reml_diagV_adj = atoi(argv[++i]);
             LOGGER << "--reml-diagV-adj " << reml_diagV_adj << endl;
@@ -1311,6 +1347,14 @@ void option(int option_num, char* option_str[])
     if(reml_allow_constrain_run) pter_gcta->set_reml_allow_constrain_run();
     if(reml_mtd != 0) pter_gcta->set_reml_mtd(reml_mtd);
     if(reml_inv_method != 0) pter_gcta->set_reml_inv_method(reml_inv_method);
+    if(reml_eigen_flag) pter_gcta->set_reml_eigen();
+    if(reml_batch_flag) pter_gcta->set_reml_batch();
+    if(reml_mem_gb > 0) pter_gcta->set_reml_memory(reml_mem_gb);
+    if(reml_float_flag) pter_gcta->set_reml_float();
+    if(reml_rand_probes > 0) pter_gcta->set_reml_rand(reml_rand_probes);
+    if(reml_ckpt_flag) pter_gcta->set_reml_checkpoint();
+    if(!reml_warm_file.empty()) pter_gcta->set_reml_warm_start(reml_warm_file);
+    if(HE_jk_blocks > 0) pter_gcta->set_HE_jk_blocks(HE_jk_blocks);
     pter_gcta->set_reml_diagV_adj(reml_diagV_adj);
     pter_gcta->set_reml_diag_mul(reml_diag_mul);
     pter_gcta->set_diff_freq(freq_thresh); 
@@ -1370,7 +1414,14 @@ void option(int option_num, char* option_str[])
                 else pter_gcta->read_multi_bedfiles(multi_bfiles);
             }
             if(!mtcojo_flag){
-                if(bfile_flag==1) pter_gcta->read_bedfile(bfile + ".bed");
+                // --mlma and --mlma-loco read the genotypes by blocks of SNPs, unless
+                // an analysis before them in the chain below is the one to run, as
+                // those need all the genotypes in memory
+                bool mlma_dispatch = (mlma_flag || mlma_loco_flag) && !(out_freq_flag || !paa_file.empty() || ibc || make_grm_flag
+                        || recode || recode_nomiss || recode_std || LD || LD_prune_rsq > -1.0 || ld_score_flag || ld_mean_rsq_seg_flag
+                        || ld_max_rsq_flag || blup_snp_flag);
+                if(bfile_flag==1 && mlma_dispatch) pter_gcta->read_bed_stream(bfile + ".bed");
+                else if(bfile_flag==1) pter_gcta->read_bedfile(bfile + ".bed");
                 else pter_gcta->read_multi_bedfiles(multi_bfiles);
             }
 
@@ -0,0 +1,214 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Spectral bivariate REML analysis for a single GRM
+ *
+ * With both traits on the N individuals, V = G (x) A + R (x) I for the 2 x 2
+ * genetic and residual matrices G and R, so in the eigenbasis A = U diag(d) U^t
+ * V is block diagonal with the 2 x 2 blocks G * d_k + R, inverted in closed
+ * form. When some phenotypes are missing, V of the observed ones is a
+ * submatrix of this V, and its inverse is H_oo - H_om (H_mm)^-1 H_mo with
+ * H = V^-1 and m the missing phenotypes (Schur complement), which only needs
+ * H applied to the m unit vectors. After the decomposition of the GRM, each
+ * iteration is O(N^2 * (m + c + r)) instead of O((n1 + n2)^3), and the steps
+ * follow the tiled REML (reml_ooc.cpp).
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file COPYING for more
+ * details
+ */
+
+#include "gcta.h"
+
+// the GRM of the individuals in _keep (from _grm) and the positions of the
+// observed phenotypes in the vector of both traits of all of them
+void gcta::bivar_eigen_decomp(const vector<int> &nms1, const vector<int> &nms2)
+{
+    int i = 0, j = 0, N = _keep.size();
+    _bv_N = N;
+    _bv_obs.clear();
+    for (i = 0; i < nms1.size(); i++) _bv_obs.push_back(nms1[i]);
+    for (i = 0; i < nms2.size(); i++) _bv_obs.push_back(N + nms2[i]);
+    vector<char> obs_flag(2 * N, 0);
+    for (i = 0; i < _bv_obs.size(); i++) obs_flag[_bv_obs[i]] = 1;
+    _bv_miss.clear();
+    for (i = 0; i < 2 * N; i++) {
+        if (!obs_flag[i]) _bv_miss.push_back(i);
+    }
+    // the Schur complement costs O(N^2) per missing phenotype and iteration
+    if (_bv_miss.size() > N / 4) {
+        LOGGER << "Note: " << _bv_miss.size() << " of the " << 2 * N << " phenotypes are missing, the spectral bivariate REML isn't used." << endl;
+        _bv_N = 0;
+        return;
+    }
+
+    LOGGER << "Eigen-decomposition of the GRM (" << N << " x " << N << ") for the spectral bivariate REML ..." << endl;
+    eigenMatrix A(N, N);
+    #pragma omp parallel for private(i)
+    for (j = 0; j < N; j++) {
+        for (i = 0; i < N; i++) A(i, j) = _grm(_keep[i], _keep[j]);
+    }
+    SelfAdjointEigenSolver<eigenMatrix> eigensolver(A);
+    if (eigensolver.info() != Eigen::Success) LOGGER.e(0, "failed to eigen-decompose the GRM.");
+    _eig_d = eigensolver.eigenvalues();
+    _eig_U = eigensolver.eigenvectors();
+    _eig_indx = -1;
+    _bv_AE.clear();
+    _bv_AE_indx.clear();
+    LOGGER << "Eigenvalues of the GRM range from " << _eig_d.minCoeff() << " to " << _eig_d.maxCoeff() << "." << endl;
+}
+
+// the 2 x 2 loading (s11, s22, s12) and the kernel (GRM or I) of each
+// component in _r_indx, from its position in _bivar_pos; the reduced models
+// of the LRT keep only some of them
+bool gcta::bivar_eigen_init()
+{
+    _bv_eig_active = false;
+    if (!_bivar_reml || _bv_N == 0 || _bv_obs.size() != _n || _eig_U.rows() != _bv_N) return false;
+    if (_bivar_pos[0].size() != 2 || _reml_mtd == 1) return false;
+    int i = 0, r = _r_indx.size();
+    _bv_S = eigenMatrix::Zero(r, 3);
+    _bv_grm.assign(r, 0);
+    for (i = 0; i < r; i++) {
+        for (int t = 0; t < 3; t++) {
+            for (int c = 0; c < _bivar_pos[t].size(); c++) {
+                if (_bivar_pos[t][c] != _r_indx[i]) continue;
+                _bv_S(i, t) = 1.0;
+                // the genetic component comes first
+                _bv_grm[i] = (c == 0);
+            }
+        }
+    }
+    // A_i at the missing phenotypes, for the traces
+    int m = _bv_miss.size();
+    if (m > 0 && _bv_AE_indx != _r_indx) {
+        _bv_AE_indx = _r_indx;
+        _bv_AE.resize(r);
+        for (i = 0; i < r; i++) {
+            _bv_AE[i] = eigenMatrix::Zero(2 * _bv_N, m);
+            for (int a = 0; a < m; a++) _bv_AE[i](_bv_miss[a], a) = 1.0;
+            bivar_eigen_AF(i, _bv_AE[i]);
+        }
+    }
+    if (_bv_Bi.rows() != _bv_N) LOGGER << "Spectral bivariate REML: V^-1 by 2 x 2 blocks in the eigenbasis of the GRM" << (m > 0 ? ", with a Schur complement for " + to_string(m) + " missing phenotypes." : ".") << endl;
+    _bv_eig_active = true;
+    return true;
+}
+
+// observed phenotypes to the vector of both traits of all the individuals
+void gcta::bivar_eigen_pad(const eigenMatrix &Z, eigenMatrix &F)
+{
+    F = eigenMatrix::Zero(2 * _bv_N, Z.cols());
+    for (int a = 0; a < _bv_obs.size(); a++) F.row(_bv_obs[a]) = Z.row(a);
+}
+
+// F = V^-1 * F of all the individuals, by the blocks of the eigenvalues
+void gcta::bivar_eigen_Vfi(eigenMatrix &F)
+{
+    int N = _bv_N;
+    eigenMatrix R1 = _eig_U.transpose() * F.topRows(N), R2 = _eig_U.transpose() * F.bottomRows(N);
+    eigenMatrix T1 = (R1.array().colwise() * _bv_Bi.col(0).array() + R2.array().colwise() * _bv_Bi.col(2).array()).matrix();
+    eigenMatrix T2 = (R1.array().colwise() * _bv_Bi.col(2).array() + R2.array().colwise() * _bv_Bi.col(1).array()).matrix();
+    F.topRows(N).noalias() = _eig_U * T1;
+    F.bottomRows(N).noalias() = _eig_U * T2;
+}
+
+// F = A_i * F of all the individuals
+void gcta::bivar_eigen_AF(int i, eigenMatrix &F)
+{
+    int N = _bv_N;
+    double s11 = _bv_S(i, 0), s22 = _bv_S(i, 1), s12 = _bv_S(i, 2);
+    eigenMatrix F1 = F.topRows(N), F2 = F.bottomRows(N);
+    if (_bv_grm[i]) {
+        eigenMatrix R1 = _eig_d.asDiagonal() * (_eig_U.transpose() * F1), R2 = _eig_d.asDiagonal() * (_eig_U.transpose() * F2);
+        F.topRows(N).noalias() = _eig_U * (s11 * R1 + s12 * R2);
+        F.bottomRows(N).noalias() = _eig_U * (s12 * R1 + s22 * R2);
+    } else {
+        F.topRows(N) = s11 * F1 + s12 * F2;
+        F.bottomRows(N) = s12 * F1 + s22 * F2;
+    }
+}
+
+bool gcta::calcu_Vi_bivar_eigen(eigenVector &prev_varcmp, double &logdet)
+{
+    int i = 0, k = 0, N = _bv_N, m = _bv_miss.size();
+    eigenVector ones = eigenVector::Ones(N);
+    eigenMatrix B = eigenMatrix::Zero(N, 3);
+    for (i = 0; i < _r_indx.size(); i++) {
+        const eigenVector &K = _bv_grm[i] ? _eig_d : ones;
+        for (int t = 0; t < 3; t++) {
+            if (_bv_S(i, t) != 0.0) B.col(t) += (prev_varcmp[i] * _bv_S(i, t)) * K;
+        }
+    }
+    _bv_Bi.resize(N, 3);
+    logdet = 0.0;
+    for (k = 0; k < N; k++) {
+        double det = B(k, 0) * B(k, 1) - B(k, 2) * B(k, 2);
+        if (B(k, 0) <= 0.0 || det <= 0.0) return false;
+        _bv_Bi(k, 0) = B(k, 1) / det;
+        _bv_Bi(k, 1) = B(k, 0) / det;
+        _bv_Bi(k, 2) = -B(k, 2) / det;
+        logdet += log(det);
+    }
+    if (m == 0) return true;
+
+    // |V_oo| = |V| * |H_mm|
+    _bv_ViE = eigenMatrix::Zero(2 * N, m);
+    for (int a = 0; a < m; a++) _bv_ViE(_bv_miss[a], a) = 1.0;
+    bivar_eigen_Vfi(_bv_ViE);
+    _bv_Mi.resize(m, m);
+    for (int a = 0; a < m; a++) _bv_Mi.row(a) = _bv_ViE.row(_bv_miss[a]);
+    LLT<eigenMatrix> llt(_bv_Mi);
+    if (llt.info() != Eigen::Success) return false;
+    logdet += 2.0 * llt.matrixLLT().diagonal().array().log().sum();
+    _bv_Mi = llt.solve(eigenMatrix::Identity(m, m));
+    return true;
+}
+
+// V^-1 * Z of the observed phenotypes
+void gcta::calcu_ViZ_bivar(const eigenMatrix &Z, eigenMatrix &ViZ)
+{
+    int m = _bv_miss.size();
+    eigenMatrix F;
+    bivar_eigen_pad(Z, F);
+    bivar_eigen_Vfi(F);
+    if (m > 0) {
+        eigenMatrix Fm(m, F.cols());
+        for (int a = 0; a < m; a++) Fm.row(a) = F.row(_bv_miss[a]);
+        F.noalias() -= _bv_ViE * (_bv_Mi * Fm);
+    }
+    ViZ.resize(Z.rows(), Z.cols());
+    for (int a = 0; a < _bv_obs.size(); a++) ViZ.row(a) = F.row(_bv_obs[a]);
+}
+
+void gcta::calcu_AZ_bivar(int i, const eigenMatrix &Z, eigenMatrix &AZ)
+{
+    eigenMatrix F;
+    bivar_eigen_pad(Z, F);
+    bivar_eigen_AF(i, F);
+    AZ.resize(Z.rows(), Z.cols());
+    for (int a = 0; a < _bv_obs.size(); a++) AZ.row(a) = F.row(_bv_obs[a]);
+}
+
+// tr(V_oo^-1 * A_i,oo) = tr(H_oo A_oo) - tr(H_mm^-1 * H_mo A_oo H_om), where
+// tr(H_oo A_oo) is tr(H A) in the eigenbasis less the terms of the missing rows
+// and columns
+double gcta::calcu_tr_ViA_bivar(int i)
+{
+    int m = _bv_miss.size();
+    const eigenVector ones = eigenVector::Ones(_bv_N);
+    const eigenVector &K = _bv_grm[i] ? _eig_d : ones;
+    double tr = K.dot(_bv_S(i, 0) * _bv_Bi.col(0) + _bv_S(i, 1) * _bv_Bi.col(1) + 2.0 * _bv_S(i, 2) * _bv_Bi.col(2));
+    if (m == 0) return tr;
+
+    const eigenMatrix &AE = _bv_AE[i];
+    eigenMatrix ViE_o(_bv_obs.size(), m), AViE_o;
+    for (int a = 0; a < m; a++) {
+        tr -= 2.0 * _bv_ViE.col(a).dot(AE.col(a));
+        for (int b = 0; b < m; b++) tr += _bv_ViE(_bv_miss[a], b) * AE(_bv_miss[b], a);
+    }
+    for (int a = 0; a < _bv_obs.size(); a++) ViE_o.row(a) = _bv_ViE.row(_bv_obs[a]);
+    calcu_AZ_bivar(i, ViE_o, AViE_o);
+    tr -= (_bv_Mi * (ViE_o.transpose() * AViE_o)).trace();
+    return tr;
+}
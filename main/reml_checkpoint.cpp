@@ -0,0 +1,127 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Checkpoints of the REML iterations and warm starts from a previous run
+ *
+ * With --reml-checkpoint, the variance components, the information matrix
+ * and the log-likelihood of each iteration are saved in [out].reml.ckpt; a
+ * run of the same model on the same data resumes from the last iteration
+ * saved. --reml-warm-start starts from the estimates in the .hsq file of a
+ * previous run, matched by the names of the components, and goes straight
+ * to the chosen algorithm without the EM-REML step for the priors.
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file COPYING for more
+ * details
+ */
+
+#include "gcta.h"
+
+void gcta::set_reml_checkpoint()
+{
+    _reml_ckpt = true;
+}
+
+void gcta::set_reml_warm_start(string hsq_file)
+{
+    _reml_warm_file = hsq_file;
+}
+
+// the model and the data of the run: a checkpoint of another run isn't used
+string gcta::reml_ckpt_key()
+{
+    stringstream ss;
+    ss << setprecision(17) << (_bivar_reml ? "bivar" : "univar") << "\t" << _n << "\t" << _X_c << "\t" << _y.sum() << "\t" << _y.squaredNorm();
+    if (_bivar_reml) ss << "\t" << _y2_Ssq;
+    for (int i = 0; i < _r_indx.size(); i++) ss << "\t" << _var_name[_r_indx[i]];
+    return ss.str();
+}
+
+// the variance components of the last iteration saved for this run
+bool gcta::reml_ckpt_read(eigenVector &varcmp)
+{
+    if (!_reml_ckpt) return false;
+    string ckpt_file = _out + ".reml.ckpt";
+    ifstream ickpt(ckpt_file.c_str());
+    if (!ickpt) return false;
+
+    string line, key, label;
+    int iter = 0, i = 0;
+    double lgL = 0.0;
+    getline(ickpt, line);
+    if (!getline(ickpt, key) || key != "key\t" + reml_ckpt_key()) {
+        LOGGER.w(0, "the checkpoint [" + ckpt_file + "] is from another model or phenotype, REML starts from the beginning.");
+        return false;
+    }
+    eigenVector buf(_r_indx.size());
+    ickpt >> label >> iter >> label >> lgL >> label;
+    for (i = 0; i < buf.size(); i++) ickpt >> buf[i];
+    if (ickpt.fail()) {
+        LOGGER.w(0, "the checkpoint [" + ckpt_file + "] is incomplete, REML starts from the beginning.");
+        return false;
+    }
+    varcmp = buf;
+    _reml_ckpt_iter = iter + 1;
+    LOGGER << "Resuming REML after iteration " << iter << " (logL " << std::fixed << LOGGER.setprecision(3) << lgL << ") of the checkpoint [" + ckpt_file + "]." << endl;
+    return true;
+}
+
+// written to a temporary file and renamed, so that a job killed in the middle
+// of the write keeps the checkpoint of the previous iteration
+void gcta::reml_ckpt_write(int iter, double lgL, const eigenVector &varcmp, const eigenMatrix &Hi)
+{
+    string ckpt_file = _out + ".reml.ckpt", tmp_file = ckpt_file + ".tmp";
+    ofstream ockpt(tmp_file.c_str());
+    if (!ockpt) LOGGER.e(0, "cannot open the file [" + tmp_file + "] to write.");
+    int i = 0, j = 0, r = varcmp.size();
+    ockpt << "# GCTA REML checkpoint" << endl;
+    ockpt << "key\t" << reml_ckpt_key() << endl;
+    ockpt << setprecision(17) << "iter\t" << iter << endl << "logL\t" << lgL << endl << "varcmp";
+    for (i = 0; i < r; i++) ockpt << "\t" << varcmp[i];
+    ockpt << endl << "Hi";
+    // the information matrix isn't computed by the EM-REML steps
+    if (_reml_mtd != 2 && Hi.rows() == r && Hi.cols() == r) {
+        for (i = 0; i < r; i++) {
+            for (j = 0; j < r; j++) ockpt << "\t" << Hi(i, j);
+        }
+    }
+    ockpt << endl;
+    ockpt.close();
+    if (ockpt.fail() || rename(tmp_file.c_str(), ckpt_file.c_str()) != 0) LOGGER.e(0, "cannot write the checkpoint [" + ckpt_file + "].");
+}
+
+// the variance components of the .hsq file of a previous run; for a
+// univariate model they are scaled to the phenotypic variance of this one
+bool gcta::reml_warm_start(eigenVector &varcmp)
+{
+    if (_reml_warm_file.empty()) return false;
+    ifstream ihsq(_reml_warm_file.c_str());
+    if (!ihsq) LOGGER.e(0, "cannot open the file [" + _reml_warm_file + "] to read.");
+
+    map<string, double> hsq_var;
+    string line, name;
+    double var = 0.0;
+    getline(ihsq, line);
+    while (getline(ihsq, line)) {
+        stringstream ss(line);
+        if (!(ss >> name >> var)) break;
+        if (name == "Vp" || name == "Vp_tr1") break;
+        hsq_var[name] = var;
+    }
+
+    int i = 0, r = _r_indx.size();
+    eigenVector buf(r);
+    for (i = 0; i < r; i++) {
+        map<string, double>::iterator iter = hsq_var.find(_var_name[_r_indx[i]]);
+        if (iter == hsq_var.end()) LOGGER.e(0, "there is no estimate of " + _var_name[_r_indx[i]] + " in the file [" + _reml_warm_file + "] for --reml-warm-start.");
+        buf[i] = iter->second;
+    }
+    if (!_bivar_reml) {
+        double Vp = buf.sum();
+        if (!(Vp > 0.0)) LOGGER.e(0, "the variance components in the file [" + _reml_warm_file + "] don't sum to a positive Vp.");
+        buf *= _y_Ssq / Vp;
+    }
+    varcmp = buf;
+    LOGGER << "Starting REML from the estimates in [" + _reml_warm_file + "]." << endl;
+    return true;
+}
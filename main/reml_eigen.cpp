@@ -0,0 +1,267 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Spectral REML analysis for a single GRM
+ *
+ * With A = U diag(d) U^t, V = Vg * A + Ve * I = U diag(Vg * d + Ve) U^t,
+ * so after rotating y and X by U^t once, V^-1, P*z, tr(PA) and the AI
+ * matrix are diagonal or low-rank updates of diagonal matrices and each
+ * REML iteration is O(n * c^2) instead of O(n^3).
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file COPYING for more
+ * details
+ */
+
+#include "gcta.h"
+
+void gcta::set_reml_eigen()
+{
+    _reml_eigen = true;
+}
+
+void gcta::set_reml_batch()
+{
+    _reml_batch = true;
+    _reml_eigen = true;
+}
+
+// V is diagonal in the eigenbasis of the GRM with one GRM (or none in the
+// reduced model) and an unweighted residual
+bool gcta::eigen_reml_init()
+{
+    _eig_active = false;
+    if (!_reml_eigen || _bivar_reml || _within_family || _r_indx.size() > 2) return false;
+    int res_indx = _r_indx[_r_indx.size() - 1];
+    if (res_indx != _A.size() - 1 || !(_A[res_indx].diagonal().array() == 1.0).all()) return false;
+
+    if (_r_indx.size() == 2 && (_eig_indx != _r_indx[0] || _eig_U.rows() != _n)) {
+        LOGGER << "Eigen-decomposition of the GRM (" << _n << " x " << _n << ") for the spectral REML ..." << endl;
+        SelfAdjointEigenSolver<eigenMatrix> eigensolver(_A[_r_indx[0]]);
+        if (eigensolver.info() != Eigen::Success) LOGGER.e(0, "failed to eigen-decompose the GRM.");
+        _eig_d = eigensolver.eigenvalues();
+        _eig_U = eigensolver.eigenvectors();
+        _eig_indx = _r_indx[0];
+        LOGGER << "Eigenvalues of the GRM range from " << _eig_d.minCoeff() << " to " << _eig_d.maxCoeff() << "." << endl;
+    }
+    // the residual-only model reuses the basis of the full model
+    if (_eig_indx < 0 || _eig_U.rows() != _n) return false;
+
+    _eig_st.y = _eig_U.transpose() * _y;
+    _eig_X = _eig_U.transpose() * _X;
+    _eig_K.resize(_n, _r_indx.size());
+    if (_r_indx.size() == 2) _eig_K.col(0) = _eig_d;
+    _eig_K.col(_r_indx.size() - 1).setOnes();
+    _eig_active = true;
+    return true;
+}
+
+bool gcta::calcu_Vi_eigen(eigen_reml_state &st, eigenVector &prev_varcmp, double &logdet)
+{
+    eigenVector v = _eig_K * prev_varcmp;
+    if (v.minCoeff() <= 0) return false;
+    st.vi = v.cwiseInverse();
+    logdet = v.array().log().sum();
+    return true;
+}
+
+double gcta::calcu_P_eigen(eigen_reml_state &st)
+{
+    st.Vi_X = st.vi.asDiagonal() * _eig_X;
+    st.Xt_Vi_X_i = _eig_X.transpose() * st.Vi_X;
+    double logdet_Xt_Vi_X = 0.0;
+    int rank = 0;
+    INVmethod method = (_reml_inv_mtd == 0) ? INV_LLT : static_cast<INVmethod>(_reml_inv_mtd);
+    if(!SquareMatrixInverse(st.Xt_Vi_X_i, logdet_Xt_Vi_X, rank, method)) LOGGER.e(0, "\n  the X^t * V^-1 * X matrix is not invertible. Please check the covariate(s) and/or the environmental factor(s).");
+    calcu_Pz_eigen(st, st.y, st.Py);
+    return logdet_Xt_Vi_X;
+}
+
+// P * z = V^-1 * z - V^-1 * X * (X^t * V^-1 * X)^-1 * X^t * V^-1 * z, without forming P
+void gcta::calcu_Pz_eigen(const eigen_reml_state &st, const eigenVector &z, eigenVector &Pz)
+{
+    Pz = st.vi.cwiseProduct(z) - st.Vi_X * (st.Xt_Vi_X_i * (st.Vi_X.transpose() * z));
+}
+
+void gcta::calcu_tr_PA_eigen(const eigen_reml_state &st, eigenVector &tr_PA)
+{
+    eigenVector diag_P = st.vi - (st.Vi_X * st.Xt_Vi_X_i).cwiseProduct(st.Vi_X).rowwise().sum();
+    tr_PA = _eig_K.transpose() * diag_P;
+}
+
+// Fisher information tr(P * A_i * P * A_j) from the expansion of P = V^-1 - W * C * W^t,
+// with W = V^-1 * X and C = (X^t * V^-1 * X)^-1. Returns false if it is not invertible
+bool gcta::calcu_Hi_eigen(const eigen_reml_state &st, eigenMatrix &Hi)
+{
+    int r = _eig_K.cols();
+    vector<eigenMatrix> CM(r);
+    for (int i = 0; i < r; i++) CM[i] = st.Xt_Vi_X_i * (st.Vi_X.transpose() * _eig_K.col(i).asDiagonal() * st.Vi_X);
+    for (int i = 0; i < r; i++) {
+        for (int j = 0; j <= i; j++) {
+            eigenVector w = _eig_K.col(i).cwiseProduct(_eig_K.col(j)).cwiseProduct(st.vi);
+            double d_buf = w.dot(st.vi);
+            d_buf -= 2.0 * (st.Xt_Vi_X_i * (st.Vi_X.transpose() * w.asDiagonal() * st.Vi_X)).trace();
+            d_buf += (CM[i] * CM[j]).trace();
+            Hi(i, j) = Hi(j, i) = d_buf;
+        }
+    }
+    return inverse_H(Hi);
+}
+
+// one step of AI-REML, Fisher-scoring or EM-REML as in ai_reml, reml_equation and
+// em_reml. Returns false if the information matrix is not invertible
+bool gcta::reml_step_eigen(eigen_reml_state &st, eigenMatrix &Hi, eigenVector &prev_varcmp, eigenVector &varcmp, double dlogL, int reml_mtd)
+{
+    int i = 0, j = 0, r = _eig_K.cols();
+    eigenVector R = _eig_K.transpose() * st.Py.cwiseAbs2();
+
+    if (reml_mtd == 1) {
+        if (!calcu_Hi_eigen(st, Hi)) return false;
+        varcmp = Hi*R;
+        Hi = 2 * Hi;
+        return true;
+    }
+
+    eigenVector tr_PA;
+    calcu_tr_PA_eigen(st, tr_PA);
+    if (reml_mtd == 2) {
+        for (i = 0; i < r; i++) varcmp(i) = prev_varcmp(i) - prev_varcmp(i) * prev_varcmp(i) * (tr_PA(i) - R(i)) / _n;
+        return true;
+    }
+
+    eigenMatrix APy = (_eig_K.array().colwise() * st.Py.array()).matrix();
+    eigenVector cvec;
+    for (i = 0; i < r; i++) {
+        calcu_Pz_eigen(st, APy.col(i), cvec);
+        Hi(i, i) = APy.col(i).dot(cvec);
+        for (j = 0; j < i; j++) Hi(j, i) = Hi(i, j) = APy.col(j).dot(cvec);
+    }
+    Hi = 0.5 * Hi;
+    R = -0.5 * (tr_PA - R);
+    if (!inverse_H(Hi)) return false;
+
+    eigenVector delta = Hi*R;
+    if (dlogL > 1.0) varcmp = prev_varcmp + 0.316 * delta;
+    else varcmp = prev_varcmp + delta;
+    return true;
+}
+
+void gcta::eigen_H_not_invertible()
+{
+    if(_reml_force_converge){
+        LOGGER << "Warning: the information matrix is not invertible." << endl;
+        _reml_AI_not_invertible = true;
+    }
+    else LOGGER.e(0, "the information matrix is not invertible.");
+}
+
+// back to the original basis for the BLUP and the fixed effects
+void gcta::eigen_reml_output(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenVector &Py)
+{
+    Vi_X = _eig_U * _eig_st.Vi_X;
+    Xt_Vi_X_i = _eig_st.Xt_Vi_X_i;
+    Py = _eig_U * _eig_st.Py;
+}
+
+// the dense V^-1 is only formed for --mlma, which uses it after REML
+void gcta::eigen_reml_Vi()
+{
+    _Vi = _eig_U * _eig_st.vi.asDiagonal() * _eig_U.transpose();
+}
+
+// the iterations of reml_iteration without the log, so that the phenotypes
+// of a batch can be fitted in parallel. Returns true if converged
+bool gcta::reml_eigen_fit(eigen_reml_state &st, double y_Ssq, bool no_constrain, eigenVector &varcmp, eigenMatrix &Hi, double &lgL, int &iter)
+{
+    int r = _eig_K.cols();
+    double logdet = 0.0, logdet_Xt_Vi_X = 0.0, prev_lgL = -1e20, dlogL = 1000.0;
+    varcmp = eigenVector::Constant(r, y_Ssq / r);
+    eigenVector prev_varcmp(varcmp);
+    Hi.resize(r, r);
+    lgL = -1e20;
+    for (iter = 0; iter < _reml_max_iter; iter++) {
+        int reml_mtd = (iter == 0) ? 2 : _reml_mtd;
+        if (!calcu_Vi_eigen(st, prev_varcmp, logdet)) return false;
+        logdet_Xt_Vi_X = calcu_P_eigen(st);
+        if (!reml_step_eigen(st, Hi, prev_varcmp, varcmp, dlogL, reml_mtd)) return false;
+        lgL = -0.5 * (logdet_Xt_Vi_X + logdet + st.y.dot(st.Py));
+        if (!no_constrain) constrain_varcmp(varcmp, y_Ssq);
+
+        dlogL = lgL - prev_lgL;
+        if ((varcmp - prev_varcmp).squaredNorm() / varcmp.squaredNorm() < 1e-8 && (fabs(dlogL) < 1e-4 || (fabs(dlogL) < 1e-2 && dlogL < 0))) {
+            if (reml_mtd == 2) {
+                if (!calcu_Hi_eigen(st, Hi)) return false;
+                Hi = 2 * Hi;
+            }
+            return true;
+        }
+        prev_varcmp = varcmp;
+        prev_lgL = lgL;
+    }
+    return false;
+}
+
+// --reml-batch: all the traits in the phenotype file share the GRM, the
+// covariates and the eigenbasis, which are loaded and computed once; the
+// traits are then fitted in parallel and summarised in one .hsq table
+void gcta::reml_batch(eigenMatrix &Y, bool no_constrain)
+{
+    int num_trait = Y.cols();
+    if (!eigen_reml_init() || _r_indx.size() != 2) LOGGER.e(0, "--reml-batch only supports a single GRM without GxE terms or weights.");
+    LOGGER << "\nPerforming REML analysis of " << num_trait << " traits in the eigenbasis of the GRM ..." << endl;
+    LOGGER << _n << " observations, " << _X_c << " fixed effect(s), and " << _r_indx.size() << " variance component(s)(including residual variance)." << endl;
+
+    eigenMatrix Y_rot = _eig_U.transpose() * Y;
+
+    // the residual-only model has a closed form: Ve = y^t M y / (n - c)
+    eigenMatrix XtX_i = _X.transpose() * _X;
+    double logdet_XtX = 0.0;
+    int rank = 0;
+    INVmethod method = (_reml_inv_mtd == 0) ? INV_LLT : static_cast<INVmethod>(_reml_inv_mtd);
+    if(!SquareMatrixInverse(XtX_i, logdet_XtX, rank, method)) LOGGER.e(0, "\n  the X^t * X matrix is not invertible. Please check the covariate(s).");
+    int df_res = _n - _X_c;
+
+    vector<eigenVector> varcmp(num_trait);
+    vector<eigenMatrix> Hi(num_trait);
+    vector<double> lgL(num_trait), lgL0(num_trait);
+    vector<int> num_iter(num_trait);
+    vector<char> converged(num_trait);
+    #pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < num_trait; t++) {
+        eigen_reml_state st;
+        st.y = Y_rot.col(t);
+        double y_Ssq = (Y.col(t).array() - Y.col(t).mean()).matrix().squaredNorm() / (_n - 1.0);
+        converged[t] = reml_eigen_fit(st, y_Ssq, no_constrain, varcmp[t], Hi[t], lgL[t], num_iter[t]);
+
+        eigenVector Xty = _X.transpose() * Y.col(t);
+        double Ve = (Y.col(t).squaredNorm() - Xty.dot(XtX_i * Xty)) / df_res;
+        lgL0[t] = -0.5 * (logdet_XtX + df_res * log(Ve) + df_res);
+    }
+
+    string reml_rst_file = _out + ".hsq";
+    ofstream o_reml(reml_rst_file.c_str());
+    if (!o_reml) LOGGER.e(0, "cannot open the file [" + reml_rst_file + "] to write.");
+    o_reml << "Trait\tn\t" << _var_name[0] << "\tSE\t" << _var_name[1] << "\tSE\tVp\tSE\t" << _hsq_name[0] << "\tSE\tlogL\tlogL0\tLRT\tPval\tIter\tConverged" << endl;
+    int num_failed = 0;
+    for (int t = 0; t < num_trait; t++) {
+        // the name from the header of the phenotype file, otherwise the column
+        o_reml << (t < _phen_name.size() ? _phen_name[t] : to_string(t + 1)) << "\t" << _n << "\t";
+        if (!converged[t]) num_failed++;
+        if ((!converged[t] && num_iter[t] < _reml_max_iter) || !varcmp[t].allFinite() || !Hi[t].allFinite()) {
+            o_reml << "NA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\t" << num_iter[t] << "\t0" << endl;
+            continue;
+        }
+        double Vp = 0.0, Vp2 = 0.0, VarVp = 0.0, VarVp2 = 0.0, hsq = 0.0, var_hsq = 0.0;
+        calcu_Vp(Vp, Vp2, VarVp, VarVp2, varcmp[t], Hi[t]);
+        calcu_hsq(0, Vp, Vp2, VarVp, VarVp2, hsq, var_hsq, varcmp[t], Hi[t]);
+        double LRT = 2.0 * (lgL[t] - lgL0[t]);
+        if (LRT < 0.0) LRT = 0.0;
+        o_reml << std::fixed << setprecision(6) << varcmp[t][0] << "\t" << sqrt(Hi[t](0, 0)) << "\t" << varcmp[t][1] << "\t" << sqrt(Hi[t](1, 1)) << "\t";
+        o_reml << Vp << "\t" << sqrt(VarVp) << "\t" << hsq << "\t" << sqrt(var_hsq) << "\t";
+        o_reml << setprecision(3) << lgL[t] << "\t" << lgL0[t] << "\t" << LRT << "\t";
+        o_reml << std::scientific << setprecision(4) << 0.5 * StatFunc::chi_prob(1, LRT) << std::fixed << "\t" << num_iter[t] << "\t" << (converged[t] ? 1 : 0) << endl;
+    }
+    o_reml.close();
+    if (num_failed > 0) LOGGER.w(0, to_string(num_failed) + " trait(s) didn't converge (Converged = 0), their results are not reliable.");
+    LOGGER << "Summary results of REML analysis of " << num_trait << " traits have been saved in the file [" + reml_rst_file + "]." << endl;
+}
@@ -0,0 +1,227 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * REML analysis with V larger than the memory
+ *
+ * The GRMs and V^-1 are kept by tiles (TiledMatrix), in scratch files when
+ * they don't fit in --memory. V is factorized and inverted in place by tiles,
+ * P is never formed: P * z = V^-1 * z - V^-1 X (X^t V^-1 X)^-1 X^t V^-1 z, and
+ * tr(P * A) = <V^-1, A> - tr((X^t V^-1 X)^-1 (V^-1 X)^t A V^-1 X), so the
+ * matrices in memory are n x c or n x r besides the tiles in use.
+ *
+ * The steps from P * z and tr(P * A) (the *_op functions) are shared with
+ * the randomized REML (reml_rand.cpp), which solves V by block CG instead,
+ * and the spectral bivariate REML (reml_bivar_eigen.cpp).
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file COPYING for more
+ * details
+ */
+
+#include "gcta.h"
+
+// 8 MB per tile of double
+static const int ooc_tile = 1024;
+
+void gcta::set_reml_memory(double mem_gb)
+{
+    _reml_mem_gb = mem_gb;
+}
+
+// decided before the GRMs are expanded: the dense REML keeps the GRMs, the
+// residual, V^-1 and P as n x n matrices, the randomized REML only the first two
+bool gcta::ooc_reml_init(int num_grm, bool ge_flag, bool mlmassoc, bool reml_bending)
+{
+    _ooc_active = false;
+    if (_reml_mem_gb <= 0 || num_grm < 1) return false;
+    double GB = 1024.0 * 1024.0 * 1024.0;
+    double dense_gb = (num_grm + (_reml_rand_probes > 0 ? 1.0 : 3.0)) * _n * (double)_n * sizeof(double) / GB;
+    if (dense_gb <= _reml_mem_gb) return false;
+
+    if (ge_flag || mlmassoc || reml_bending || _reml_diag_one || _within_family || _bivar_reml || _cv_blup || _reml_batch) {
+        LOGGER.e(0, "REML by tiles (--memory) doesn't support GxE, --mlma, --reml-bending, --reml-diag-one, --reml-wfam, bivariate REML, --cv-blup or --reml-batch.");
+    }
+    if (_reml_mtd == 1) LOGGER.e(0, "REML by tiles (--memory) doesn't support Fisher-scoring (--reml-alg 1).");
+
+    double tiled_gb = TiledMatrix::storageSize(_n, ooc_tile) / GB;
+    bool rand_flag = _reml_rand_probes > 0;
+    bool grm_file = (num_grm + (rand_flag ? 0 : 1)) * tiled_gb > _reml_mem_gb;
+    bool vi_file = tiled_gb > _reml_mem_gb;
+    LOGGER << "The dense REML needs about " << std::fixed << setprecision(1) << dense_gb << " GB, more than --memory " << _reml_mem_gb << " GB." << endl;
+    LOGGER << "Keeping the matrices by tiles of " << ooc_tile << " x " << ooc_tile << ", " << tiled_gb << " GB per matrix; the GRMs are "
+           << (grm_file ? "in scratch files" : "in memory");
+    if (rand_flag) LOGGER << "." << endl;
+    else LOGGER << ", V^-1 is " << (vi_file ? "in a scratch file." : "in memory.") << endl;
+
+    _A_tiled.clear();
+    for (int i = 0; i < num_grm; i++) {
+        _A_tiled.emplace_back(new TiledMatrix(_n, ooc_tile, grm_file ? _out + ".reml.tmp" + to_string(i) : ""));
+    }
+    // the randomized REML only multiplies by the GRMs
+    if (rand_flag) _Vi_tiled.reset();
+    else _Vi_tiled.reset(new TiledMatrix(_n, ooc_tile, vi_file ? _out + ".reml.tmpV" : ""));
+    _ooc_res = eigenVector::Ones(_n);
+    _ooc_active = true;
+    return true;
+}
+
+// the GRM of the individuals kp from the lower triangle of _grm
+void gcta::ooc_store_grm(int pos, const vector<int> &kp)
+{
+    TiledMatrix &A = *_A_tiled[pos];
+    int nt = A.numTiles();
+    #pragma omp parallel for schedule(dynamic)
+    for (int ti = 0; ti < nt; ti++) {
+        for (int tj = 0; tj <= ti; tj++) {
+            Map<MatrixXd> block = A.block(ti, tj);
+            for (int c = 0; c < block.cols(); c++) {
+                int gj = kp[A.tileStart(tj) + c];
+                for (int r = 0; r < block.rows(); r++) {
+                    int gi = kp[A.tileStart(ti) + r];
+                    block(r, c) = (gi >= gj) ? _grm(gi, gj) : _grm(gj, gi);
+                }
+            }
+        }
+    }
+    A.evict();
+}
+
+// A_i * Z for the ith component of _r_indx, by tiles or dense
+void gcta::calcu_AZ(int i, const eigenMatrix &Z, eigenMatrix &AZ)
+{
+    if (_bv_eig_active) {
+        calcu_AZ_bivar(i, Z, AZ);
+        return;
+    }
+    int pos = _r_indx[i];
+    if (pos == _A.size() - 1) AZ = (_ooc_active ? _ooc_res : eigenVector(_A[pos].diagonal())).asDiagonal() * Z;
+    else if (_ooc_active) {
+        _A_tiled[pos]->multiply(Z, AZ);
+        _A_tiled[pos]->evict();
+    }
+    else AZ.noalias() = (_A[pos]) * Z;
+}
+
+bool gcta::calcu_Vi_op(eigenVector &prev_varcmp, double &logdet)
+{
+    if (_rand_active) return calcu_Vi_rand(prev_varcmp, logdet);
+    if (_bv_eig_active) return calcu_Vi_bivar_eigen(prev_varcmp, logdet);
+    return calcu_Vi_ooc(prev_varcmp, logdet);
+}
+
+double gcta::calcu_P_op(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenVector &Py)
+{
+    if (_rand_active) return calcu_P_rand(Vi_X, Xt_Vi_X_i, Py);
+    return calcu_P_ooc(Vi_X, Xt_Vi_X_i, Py);
+}
+
+bool gcta::calcu_Vi_ooc(eigenVector &prev_varcmp, double &logdet)
+{
+    TiledMatrix &V = *_Vi_tiled;
+    eigenVector res_diag = eigenVector::Zero(_n);
+    V.setZero();
+    for (int i = 0; i < _r_indx.size(); i++) {
+        if (_r_indx[i] == _A.size() - 1) res_diag += prev_varcmp[i] * _ooc_res;
+        else {
+            V.add(prev_varcmp[i], *_A_tiled[_r_indx[i]]);
+            _A_tiled[_r_indx[i]]->evict();
+        }
+    }
+    if (_r_indx.size() == 1) {
+        // the residual-only model: V is diagonal
+        if (res_diag.minCoeff() <= 0) return false;
+        V.addDiagonal(res_diag.cwiseInverse());
+        logdet = res_diag.array().log().sum();
+        return true;
+    }
+    V.addDiagonal(res_diag);
+    if (!V.cholesky(logdet)) return false;
+    V.inverse();
+    return true;
+}
+
+double gcta::calcu_P_ooc(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenVector &Py)
+{
+    calcu_ViZ_op(_X, Vi_X);
+    Xt_Vi_X_i = _X.transpose() * Vi_X;
+    double logdet_Xt_Vi_X = 0.0;
+    int rank = 0;
+    INVmethod method = (_reml_inv_mtd == 0) ? INV_LLT : static_cast<INVmethod>(_reml_inv_mtd);
+    if(!SquareMatrixInverse(Xt_Vi_X_i, logdet_Xt_Vi_X, rank, method)) LOGGER.e(0, "\n  the X^t * V^-1 * X matrix is not invertible. Please check the covariate(s) and/or the environmental factor(s).");
+    eigenMatrix PY;
+    calcu_Pz_op(Vi_X, Xt_Vi_X_i, _y, PY);
+    Py = PY.col(0);
+    return logdet_Xt_Vi_X;
+}
+
+// V^-1 * Z by block CG, the spectral bivariate blocks or the tiles of V^-1
+void gcta::calcu_ViZ_op(const eigenMatrix &Z, eigenMatrix &ViZ)
+{
+    if (_rand_active) solve_V_rand(Z, ViZ);
+    else if (_bv_eig_active) calcu_ViZ_bivar(Z, ViZ);
+    else _Vi_tiled->multiply(Z, ViZ);
+}
+
+void gcta::calcu_Pz_op(const eigenMatrix &Vi_X, const eigenMatrix &Xt_Vi_X_i, const eigenMatrix &Z, eigenMatrix &PZ)
+{
+    calcu_ViZ_op(Z, PZ);
+    PZ.noalias() -= Vi_X * (Xt_Vi_X_i * (Vi_X.transpose() * Z));
+}
+
+void gcta::calcu_tr_PA_op(const eigenMatrix &Vi_X, const eigenMatrix &Xt_Vi_X_i, eigenVector &tr_PA)
+{
+    tr_PA.resize(_r_indx.size());
+    eigenMatrix A_Vi_X;
+    for (int i = 0; i < _r_indx.size(); i++) {
+        if (_rand_active) tr_PA(i) = calcu_tr_ViA_rand(i);
+        else if (_bv_eig_active) tr_PA(i) = calcu_tr_ViA_bivar(i);
+        else if (_r_indx[i] == _A.size() - 1) tr_PA(i) = _Vi_tiled->diagonal().dot(_ooc_res);
+        else tr_PA(i) = _Vi_tiled->frobenius(*_A_tiled[_r_indx[i]]);
+        calcu_AZ(i, Vi_X, A_Vi_X);
+        tr_PA(i) -= (Xt_Vi_X_i * (Vi_X.transpose() * A_Vi_X)).trace();
+    }
+}
+
+// inverse of the average information (A_i P y)^t P (A_j P y), the counterpart
+// of calcu_Hi for the standard errors. Returns false if it is not invertible
+bool gcta::calcu_Hi_op(const eigenMatrix &Vi_X, const eigenMatrix &Xt_Vi_X_i, const eigenVector &Py, eigenMatrix &Hi)
+{
+    eigenMatrix APy(_n, _r_indx.size()), PAPy, buf;
+    for (int i = 0; i < _r_indx.size(); i++) {
+        calcu_AZ(i, Py, buf);
+        APy.col(i) = buf.col(0);
+    }
+    calcu_Pz_op(Vi_X, Xt_Vi_X_i, APy, PAPy);
+    Hi = APy.transpose() * PAPy;
+    return inverse_H(Hi);
+}
+
+// one step of AI-REML or EM-REML as in ai_reml and em_reml. Returns false if
+// the information matrix is not invertible
+bool gcta::reml_step_op(const eigenMatrix &Vi_X, const eigenMatrix &Xt_Vi_X_i, const eigenVector &Py, eigenMatrix &Hi, eigenVector &prev_varcmp, eigenVector &varcmp, double dlogL)
+{
+    int i = 0, r = _r_indx.size();
+    eigenMatrix APy(_n, r), PAPy, buf;
+    for (i = 0; i < r; i++) {
+        calcu_AZ(i, Py, buf);
+        APy.col(i) = buf.col(0);
+    }
+    eigenVector R = APy.transpose() * Py;
+    eigenVector tr_PA;
+    calcu_tr_PA_op(Vi_X, Xt_Vi_X_i, tr_PA);
+
+    if (_reml_mtd == 2) {
+        for (i = 0; i < r; i++) varcmp(i) = prev_varcmp(i) - prev_varcmp(i) * prev_varcmp(i) * (tr_PA(i) - R(i)) / _n;
+        return true;
+    }
+
+    calcu_Pz_op(Vi_X, Xt_Vi_X_i, APy, PAPy);
+    Hi = 0.5 * APy.transpose() * PAPy;
+    R = -0.5 * (tr_PA - R);
+    if (!inverse_H(Hi)) return false;
+
+    eigenVector delta = Hi*R;
+    if (dlogL > 1.0) varcmp = prev_varcmp + 0.316 * delta;
+    else varcmp = prev_varcmp + delta;
+    return true;
+}
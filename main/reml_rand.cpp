@@ -0,0 +1,118 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Randomized REML analysis for many variance components
+ *
+ * V is only used by products V * Z = sum_i varcmp_i * A_i * Z. V^-1 is applied
+ * by block CG (Jacobi preconditioned) to the covariates, the phenotype and a
+ * fixed set of Rademacher probes at once, tr(V^-1 * A_i) is estimated by
+ * Hutchinson from the probes and log|V| by stochastic Lanczos quadrature on
+ * the same probes. The AI matrix and the score then follow the tiled REML
+ * (reml_ooc.cpp), so no n x n matrix other than the GRMs is formed and each
+ * iteration is O(n^2 * (probes + c + r) * r) instead of O(n^3 + r * n^3).
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file COPYING for more
+ * details
+ */
+
+#include "gcta.h"
+#include "StochasticTrace.h"
+
+// Lanczos steps of the log-determinant
+static const int rand_slq_steps = 50;
+// the probes are the same in all the runs
+static const uint32_t rand_seed = 20211016;
+
+void gcta::set_reml_rand(int num_probes)
+{
+    _reml_rand_probes = num_probes;
+}
+
+bool gcta::rand_reml_init()
+{
+    _rand_active = false;
+    if (_reml_rand_probes <= 0 || _bivar_reml || _within_family) return false;
+    if (_reml_mtd == 1) LOGGER.e(0, "the randomized REML (--reml-rand) doesn't support Fisher-scoring (--reml-alg 1).");
+    if (_rand_Z.rows() != _n || _rand_Z.cols() != _reml_rand_probes) {
+        LOGGER << "Randomized REML: V^-1 by block conjugate gradient, tr(V^-1 * A) and log|V| from " << _reml_rand_probes << " Rademacher probes." << endl;
+        _rand_Z.resize(_n, _reml_rand_probes);
+        StochasticTrace::rademacher(_rand_Z, rand_seed);
+        _rand_AZ.clear();
+        _rand_ViB.resize(0, 0);
+    }
+    _rand_AZ.resize(_A.size());
+    _rand_active = true;
+    return true;
+}
+
+void gcta::calcu_VZ_rand(const eigenMatrix &Z, eigenMatrix &VZ)
+{
+    eigenMatrix AZ;
+    VZ.setZero(Z.rows(), Z.cols());
+    for (int i = 0; i < _r_indx.size(); i++) {
+        calcu_AZ(i, Z, AZ);
+        VZ += _rand_varcmp[i] * AZ;
+    }
+}
+
+// V at prev_varcmp: the preconditioner diag(V) and the SLQ estimate of log|V|.
+// false if V is not positive definite
+bool gcta::calcu_Vi_rand(eigenVector &prev_varcmp, double &logdet)
+{
+    _rand_varcmp = prev_varcmp;
+    _rand_diag = eigenVector::Zero(_n);
+    for (int i = 0; i < _r_indx.size(); i++) {
+        int pos = _r_indx[i];
+        if (pos == _A.size() - 1) _rand_diag += prev_varcmp[i] * (_ooc_active ? _ooc_res : eigenVector(_A[pos].diagonal()));
+        else if (_ooc_active) _rand_diag += prev_varcmp[i] * _A_tiled[pos]->diagonal();
+        else _rand_diag += prev_varcmp[i] * _A[pos].diagonal();
+    }
+    if (_rand_diag.minCoeff() <= 0) return false;
+    // the residual-only model: V is diagonal
+    if (_r_indx.size() == 1) {
+        logdet = _rand_diag.array().log().sum();
+        return true;
+    }
+    StochasticTrace::BlockOp op = [this](const MatrixXd &Z, MatrixXd &VZ){ calcu_VZ_rand(Z, VZ); };
+    logdet = StochasticTrace::slqLogDet(op, _rand_Z, rand_slq_steps);
+    return std::isfinite(logdet);
+}
+
+// V^-1 * B, from zero
+void gcta::solve_V_rand(const eigenMatrix &B, eigenMatrix &X)
+{
+    StochasticTrace::BlockOp op = [this](const MatrixXd &Z, MatrixXd &VZ){ calcu_VZ_rand(Z, VZ); };
+    X.resize(0, 0);
+    if (StochasticTrace::blockCG(op, _rand_diag, B, X) < 0) LOGGER.e(0, "the conjugate gradient solver of V doesn't converge.");
+}
+
+// the covariates, the phenotype and the probes in one block solve, started
+// from the solutions of the last iteration
+double gcta::calcu_P_rand(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenVector &Py)
+{
+    int c = _X.cols();
+    eigenMatrix B(_n, c + 1 + _reml_rand_probes);
+    B << _X, _y, _rand_Z;
+    StochasticTrace::BlockOp op = [this](const MatrixXd &Z, MatrixXd &VZ){ calcu_VZ_rand(Z, VZ); };
+    if (StochasticTrace::blockCG(op, _rand_diag, B, _rand_ViB) < 0) LOGGER.e(0, "the conjugate gradient solver of V doesn't converge.");
+
+    Vi_X = _rand_ViB.leftCols(c);
+    Xt_Vi_X_i = _X.transpose() * Vi_X;
+    double logdet_Xt_Vi_X = 0.0;
+    int rank = 0;
+    INVmethod method = (_reml_inv_mtd == 0) ? INV_LLT : static_cast<INVmethod>(_reml_inv_mtd);
+    if(!SquareMatrixInverse(Xt_Vi_X_i, logdet_Xt_Vi_X, rank, method)) LOGGER.e(0, "\n  the X^t * V^-1 * X matrix is not invertible. Please check the covariate(s) and/or the environmental factor(s).");
+    Py = _rand_ViB.col(c) - Vi_X * (Xt_Vi_X_i * (Vi_X.transpose() * _y));
+    return logdet_Xt_Vi_X;
+}
+
+// Hutchinson estimate of tr(V^-1 * A_i) = E[(V^-1 z)^t (A_i z)]; A_i * Z doesn't
+// change between the iterations and is kept
+double gcta::calcu_tr_ViA_rand(int i)
+{
+    int pos = _r_indx[i];
+    if (_r_indx.size() == 1) return _rand_diag.cwiseInverse().dot(_ooc_active ? _ooc_res : eigenVector(_A[pos].diagonal()));
+    if (_rand_AZ[pos].cols() != _reml_rand_probes) calcu_AZ(i, _rand_Z, _rand_AZ[pos]);
+    return StochasticTrace::hutchinson(_rand_ViB.rightCols(_reml_rand_probes), _rand_AZ[pos]);
+}
@@ -253,7 +253,7 @@ void gcta::sbat_gene(string sAssoc_file, string gAnno_file, int wind, double sba
         if(gene_pval[i]>1.5) continue;
         ofile << gene_name[i] << "\t" << gene_chr[i] << "\t" << gene_bp1[i] << "\t" << gene_bp2[i] << "\t";
         ofile << snp_num_in_gene[i] << "\t" << gene2snp_1[i] << "\t" << gene2snp_2[i] << "\t" << chisq_o[i]; // << "\t" << eigenval_fastbat[i];
-        ofile << "\t" << gene_pval[i] << "\t" << min_snp_pval[i] << "\t" << min_snp_name[i] << endl;
+        ofile << "\t" << StatFunc::pchisq_text(gene_pval[i], snp_num_in_gene[i] == 1 ? chisq_o[i] : -1.0) << "\t" << min_snp_pval[i] << "\t" << min_snp_name[i] << endl;
         //else ofile << "0\tNA\tNA\tNA\tNA" << endl;
     }
     ofile.close();
@@ -413,7 +413,7 @@ void gcta::sbat(string sAssoc_file, string snpset_file, double sbat_ld_cutoff, b
     for (i = 0; i < set_num; i++) {
         if(set_pval[i]>1.5) continue;
         ofile << set_name[i] << "\t" << snp_num_in_set[i] << "\t" << chisq_o[i] << "\t";
-        ofile << set_pval[i] << "\t" << min_snp_pval[i] << "\t" << min_snp_name[i] << endl;
+        ofile << StatFunc::pchisq_text(set_pval[i], snp_num_in_set[i] == 1 ? chisq_o[i] : -1.0) << "\t" << min_snp_pval[i] << "\t" << min_snp_name[i] << endl;
     }
     ofile.close();
     if (sbat_write_snpset) {
@@ -523,7 +523,7 @@ void gcta::sbat_seg(string sAssoc_file, int seg_size, double sbat_ld_cutoff, boo
     for (i = 0; i < set_num; i++) {
         if(set_pval[i]>1.5) continue;
         ofile << set_chr[i] << "\t" << set_start_bp[i] << "\t"<< set_end_bp[i] << "\t";
-        ofile << snp_num_in_set[i] << "\t" << chisq_o[i] << "\t" << set_pval[i] << "\t";
+        ofile << snp_num_in_set[i] << "\t" << chisq_o[i] << "\t" << StatFunc::pchisq_text(set_pval[i], snp_num_in_set[i] == 1 ? chisq_o[i] : -1.0) << "\t";
         ofile << min_snp_pval[i] << "\t" << min_snp_name[i] << endl;
  
     }
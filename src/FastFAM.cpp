@@ -17,7 +17,9 @@
 */
 #include "FastFAM.h"
 #include "OptionIO.h"
+#include "ResultStore.h"
 #include "StatLib.h"
+#include "StochasticTrace.h"
 #include <cmath>
 #include <algorithm>
 #include <Eigen/SparseCholesky>
@@ -43,6 +45,8 @@
 #include <iomanip>
 #include "Covar.h"
 #include <cstdio>
+#include <cstring>
+#include <numeric>
 #include <random>
 #include <chrono>
 
@@ -106,6 +110,7 @@ private:
     double q, qinv;
     double gPos, gNeg;
     static ArrayXd mu;
+    static ArrayXd mu1mu;
     static int nSample;
     ArrayXd mu1muG;
     ArrayXd geno;
@@ -116,26 +121,20 @@ private:
     double NAmu;
     double NAsigma;
 
-    double K1adj(double t1, double q){
-        //ArrayXd temp1 = mu1 * (-geno * t1).exp() + mu;
-        //ArrayXd temp2 = mu * geno;
-        if(bFast){
-            double temp2dtemp1 = ((muNZ * gNZ)/((1.0 - muNZ) * (-gNZ * t1).exp() + muNZ)).sum();
-            return temp2dtemp1 + NAmu + NAsigma * t1 - q;
-        }else{
-            return ((mu * geno)/((1.0 - mu) * (-geno * t1).exp() + mu)).sum() - q;
-        }
-    }
-
-    double K2(double t1){
+    // K1 adjusted by q and K2 at the same t1, the exponentials are shared
+    inline void K1K2(double t1, double q, double &k1, double &k2){
         if(bFast){
             ArrayXd genot1exp = (-gNZ * t1).exp();
-            ArrayXd div21 = (mu1muNZG * genot1exp) / ((1.0 - muNZ) * genot1exp + muNZ).square();
-            return ((!div21.isNaN()).select(div21, 0)).sum() + NAsigma;
+            ArrayXd denom = (1.0 - muNZ) * genot1exp + muNZ;
+            ArrayXd div21 = (mu1muNZG * genot1exp) / denom.square();
+            k1 = ((muNZ * gNZ) / denom).sum() + NAmu + NAsigma * t1 - q;
+            k2 = ((!div21.isNaN()).select(div21, 0)).sum() + NAsigma;
         }else{
             ArrayXd genot1exp = (-geno * t1).exp();
-            ArrayXd div21 = (mu1muG * genot1exp) / ((1.0 - mu) * genot1exp + mu).square();
-            return ((!div21.isNaN()).select(div21, 0)).sum();
+            ArrayXd denom = (1.0 - mu) * genot1exp + mu;
+            ArrayXd div21 = (mu1muG * genot1exp) / denom.square();
+            k1 = ((mu * geno) / denom).sum() - q;
+            k2 = ((!div21.isNaN()).select(div21, 0)).sum();
         }
     }
 
@@ -191,11 +190,11 @@ private:
             return(res);
         }else{
             double t1 = init;
-            double K1eval = K1adj(t1, q);
+            double K1eval, K2eval;
+            K1K2(t1, q, K1eval, K2eval);
             double prevJump = std::numeric_limits<double>::infinity();
             int nIter = 1;
             while(true){
-                double K2eval = K2(t1);
                 double tnew = t1 - K1eval / K2eval;
                 if(!std::isfinite(tnew)){
                     res.bConverge = false;
@@ -209,12 +208,13 @@ private:
                     res.bConverge = false;
                     break;
                 }
-                double newK1 = K1adj(tnew, q);
+                double newK1, newK2;
+                K1K2(tnew, q, newK1, newK2);
                 if(sgn(K1eval) != sgn(newK1)){
                     double absTnewT1 = std::abs(tnew - t1);
                     if(absTnewT1 > prevJump - thresh){
                         tnew = t1 + sgn(newK1 - K1eval) * prevJump * 0.5;
-                        newK1 = K1adj(tnew, q);
+                        K1K2(tnew, q, newK1, newK2);
                         prevJump = prevJump * 0.5;
                     }else{
                         prevJump = absTnewT1;
@@ -223,6 +223,7 @@ private:
                 nIter++;
                 t1 = tnew;
                 K1eval = newK1;
+                K2eval = newK2;
             }
             res.root = t1;
             res.nIter = nIter;
@@ -243,53 +244,54 @@ private:
 public:
     static void setMu(VectorXd mu){
         SPA::mu = mu.array();
+        SPA::mu1mu = SPA::mu * (1.0 - SPA::mu);
         //SPA::mu1 = 1.0 - SPA::mu;
         //SPA::mu1mu = SPA::mu1 * SPA::mu;
         SPA::nSample = mu.size();
     }
 
+    // index: samples with non-zero genotypes (carriers). When they are less than
+    //   half of the samples, only the carriers enter the CGF exactly, the
+    //   non-carriers are cached as a normal approximation (NAmu, NAsigma), and
+    //   the full genotype vector is not copied.
     SPA(double q, double qinv, Ref<VectorXd> rgen, const vector<uint32_t> &index){
         this->q = q;
         this->qinv = qinv;
-        //new (&geno) Map<VectorXd>(xp, nSample);
-        this->geno = rgen.array();
-        //LOGGER << "geno address: " << static_cast<void *>(geno.data()) << std::endl;
-        //LOGGER << "orig address: " << static_cast<void *>(rgen.data()) << std::endl;
-        //LOGGER.e(0, "debug");
-        //double gPos = (geno.array()>0).select(geno, 0).sum();
-        //double gNeg = (geno.array()<0).select(geno, 0).sum();
+        int nNZ = index.size();
+        bFast = (double)nNZ / nSample < 0.5;
+
         gPos = 0;
         gNeg = 0;
+        double sumMu1muG = 0;
+        const double *g = rgen.data();
+        const double *m1m = mu1mu.data();
         for(int i = 0; i < nSample; i++){
-            double tgeno = geno[i];
+            double tgeno = g[i];
             if(tgeno > 0){
                 gPos+=tgeno;
             }else{
                 gNeg+=tgeno;
             }
+            sumMu1muG += m1m[i] * tgeno * tgeno;
         }
 
-        mu1muG = mu * (1.0 - mu) * geno.square();
-
-        int nNZ = index.size();
-        bFast = false;
-        if((double)nNZ / nSample < 0.5){
-            bFast = true;
+        if(bFast){
             muNZ.resize(nNZ);
             mu1muNZG.resize(nNZ);
             gNZ.resize(nNZ);
-            int curIndex = 0;
-            for(int i=0; i < nNZ; i++){
+            for(int i = 0; i < nNZ; i++){
                 int tempIndex = index[i];
-                muNZ[curIndex] = mu[tempIndex];
-                mu1muNZG[curIndex] = mu1muG[tempIndex];
-                gNZ[curIndex] = geno[tempIndex];
-                curIndex++;
+                double tgeno = g[tempIndex];
+                muNZ[i] = mu[tempIndex];
+                mu1muNZG[i] = mu1mu[tempIndex] * tgeno * tgeno;
+                gNZ[i] = tgeno;
             }
 
             NAmu = (qinv + q) * 0.5 - (gNZ * muNZ).sum();
-            NAsigma = mu1muG.sum() - mu1muNZG.sum();
-
+            NAsigma = sumMu1muG - mu1muNZG.sum();
+        }else{
+            this->geno = rgen.array();
+            mu1muG = mu1mu * geno.square();
         }
     }
 
@@ -314,6 +316,7 @@ public:
 
 };
 ArrayXd SPA::mu;
+ArrayXd SPA::mu1mu;
 int SPA::nSample = 0;
 
 void FastFAM::loadBinModel(){
@@ -603,6 +606,205 @@ void FastFAM::loadModel(){
         LOGGER << "  loaded successfully." << std::endl;
 }
 
+// reorder the rows of a mapped column major matrix to the samples kept
+static void copyRowsMapped(const double *src, uint64_t num_row, uint64_t num_col, const vector<uint32_t> &id2, MatrixXd &dst){
+    dst.resize(id2.size(), num_col);
+    for(uint64_t i = 0; i < num_col; i++){
+        const double *cur_base = src + i * num_row;
+        for(uint64_t j = 0; j < id2.size(); j++){
+            dst(j, i) = cur_base[id2[j]];
+        }
+    }
+}
+
+void FastFAM::loadModelMap(const string &bin_file){
+    LOGGER << "Loading saved model file [" << bin_file << "]..." << std::endl;
+    LOGGER << "Note: phenotype, covariates, sparse GRM and association test methods are included in the model file, thus these flags will be ignored." << std::endl;
+    modelMap.reset(new ModelFile(bin_file));
+    const ModelFileHeader &head = modelMap->getHeader();
+    num_indi = head.numIndi;
+    uint64_t num_col = head.numCovar;
+    LOGGER << "  method: " << head.method << ", phenotype: " << (head.phenoName[0] ? head.phenoName : "NA") << std::endl;
+
+    // the IDs are checked at once if the samples are in the same order as the model
+    uint64_t id_size;
+    const char *id_ptr = modelMap->section<char>(MODEL_SEC_IDS, id_size);
+    uint32_t sample_keep_geno = pheno->count_keep();
+    vector<string> sampleIDs = pheno->get_id(0, sample_keep_geno - 1, "\t");
+    string joinIDs;
+    joinIDs.reserve(id_size);
+    for(const auto &id : sampleIDs){
+        joinIDs += id;
+        joinIDs += '\n';
+    }
+    bool bSameOrder = sample_keep_geno == num_indi && joinIDs.size() == id_size &&
+        memcmp(joinIDs.data(), id_ptr, id_size) == 0;
+    vector<uint32_t> id1, id2;
+    if(bSameOrder){
+        id2.resize(num_indi);
+        std::iota(id2.begin(), id2.end(), 0);
+    }else{
+        vector<string> modelIDs = modelMap->sampleIDs();
+        vector_commonIndex_sorted1(sampleIDs, modelIDs, id1, id2);
+        if(id2.size() != num_indi){
+            LOGGER.e(0, "some sample IDs in the saved model file do not exist in the genotype file.");
+        }
+        pheno->filter_keep_index(id1);
+    }
+    joinIDs.clear();
+    joinIDs.shrink_to_fit();
+    LOGGER << "  " << num_indi << " valid individuals to be included." << std::endl;
+
+    fam_flag = head.flags & MODEL_FAM;
+    bGrammar = head.flags & MODEL_GRAMMAR;
+    covarFlag = head.flags & MODEL_COVAR;
+    has_envir = head.flags & MODEL_ENVIR;
+    bPreciseCovar = head.flags & MODEL_PRECISE_COVAR;
+    c_inf = head.c_inf;
+    VR_copy = head.VR;
+    taoVal = head.tao;
+    num_covar = num_col;
+    if(fam_flag){
+        options["grmsparse_file"] = "demo";
+    }
+    if(fam_flag && bGrammar){
+        options["grammar"] = "yes";
+    }
+    if(has_envir){
+        options["envir"] = "yes";
+    }
+
+    uint64_t count;
+    MatrixXd temp;
+    const double *pheno_ptr = modelMap->section<double>(MODEL_SEC_PHENO, count);
+    copyRowsMapped(pheno_ptr, num_indi, 1, id2, temp);
+    VectorXd *phenoTarget = &phenoVec;
+    if(head.type == MODEL_LINEAR){
+        if(has_envir){
+            phenoTarget = &Vi_y;
+        }else if(fam_flag && bGrammar){
+            phenoTarget = &Vi_y_cinf;
+        }
+    }
+    *phenoTarget = temp.col(0);
+
+    if(modelMap->hasSection(MODEL_SEC_COVAR)){
+        const double *covar_ptr = modelMap->section<double>(MODEL_SEC_COVAR, count);
+        copyRowsMapped(covar_ptr, num_indi, num_col, id2, covar);
+    }
+    if(modelMap->hasSection(MODEL_SEC_H)){
+        // c x n, reorder the columns
+        const double *H_ptr = modelMap->section<double>(MODEL_SEC_H, count);
+        H.resize(num_col, num_indi);
+        for(uint64_t i = 0; i < num_indi; i++){
+            const double *cur_base = H_ptr + (uint64_t)id2[i] * num_col;
+            for(uint64_t j = 0; j < num_col; j++){
+                H(j, i) = cur_base[j];
+            }
+        }
+    }
+    if(has_envir){
+        const double *envir_ptr = modelMap->section<double>(MODEL_SEC_ENVIR, count);
+        copyRowsMapped(envir_ptr, num_indi, 1, id2, temp);
+        envirVec_scaled = temp.col(0);
+    }
+
+    if(head.type == MODEL_GLMM){
+        const double *mu_ptr = modelMap->section<double>(MODEL_SEC_MU, count);
+        copyRowsMapped(mu_ptr, num_indi, 1, id2, temp);
+        mu = temp.col(0);
+        initVar();
+    }else if(fam_flag && (!bGrammar)){
+        LOGGER << "  loading V matrix..." << std::endl;
+        uint64_t num_outer, num_inner, num_value;
+        const int64_t *outer = modelMap->section<int64_t>(MODEL_SEC_VI_OUTER, num_outer);
+        const int64_t *inner = modelMap->section<int64_t>(MODEL_SEC_VI_INNER, num_inner);
+        const double *value = modelMap->section<double>(MODEL_SEC_VI_VALUE, num_value);
+        if(num_outer != num_indi + 1 || num_inner != num_value || (uint64_t)outer[num_indi] != num_value){
+            LOGGER.e(0, "the V inverse in [" + bin_file + "] is corrupted.");
+        }
+        Map<const SpMat> V_map(num_indi, num_indi, num_value, (const long long*)outer, (const long long*)inner, value);
+        if(bSameOrder){
+            // zero copy, the pages are shared with other jobs on the node
+            V_inverse_map.reset(new Map<const SpMat>(V_map));
+        }else{
+            Eigen::PermutationMatrix<Dynamic, Dynamic, long long> perm(num_indi);
+            for(uint64_t i = 0; i < num_indi; i++){
+                perm.indices()[id2[i]] = i;
+            }
+            V_inverse = V_map.twistedBy(perm);
+            V_inverse.makeCompressed();
+        }
+    }
+    LOGGER << "  loaded successfully." << std::endl;
+}
+
+void FastFAM::saveModelMap(const string &bin_file){
+    ModelFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = bBinary ? MODEL_GLMM : MODEL_LINEAR;
+    header.numIndi = num_indi;
+    header.numCovar = covar.cols();
+    header.flags = (fam_flag ? MODEL_FAM : 0) | (bGrammar ? MODEL_GRAMMAR : 0) | (covarFlag ? MODEL_COVAR : 0) |
+        (has_envir ? MODEL_ENVIR : 0) | (bPreciseCovar ? MODEL_PRECISE_COVAR : 0);
+    header.c_inf = c_inf;
+    header.VR = VR_copy;
+    header.tao = taoVal;
+    string phenoName = pheno->getPhenoName();
+    strncpy(header.phenoName, phenoName.c_str(), sizeof(header.phenoName) - 1);
+    string method;
+    if(bBinary){
+        method = "fastGWA-GLMM";
+    }else if(!fam_flag){
+        method = "fastGWA-lr";
+    }else if(bGrammar){
+        method = "fastGWA-grammar";
+    }else{
+        method = "fastGWA-mlm";
+    }
+    if(has_envir) method += "-GE";
+    strncpy(header.method, method.c_str(), sizeof(header.method) - 1);
+
+    ModelFileWriter writer(bin_file, header);
+    vector<string> sampleIDs = pheno->get_id(0, num_indi - 1, "\t");
+    string joinIDs;
+    for(const auto &id : sampleIDs){
+        joinIDs += id;
+        joinIDs += '\n';
+    }
+    writer.addSection(MODEL_SEC_IDS, joinIDs.data(), joinIDs.size());
+
+    const VectorXd *phenoSource = &phenoVec;
+    if(!bBinary){
+        if(has_envir){
+            phenoSource = &Vi_y;
+        }else if(fam_flag && bGrammar){
+            phenoSource = &Vi_y_cinf;
+        }
+    }
+    uint64_t vec_size = (uint64_t)num_indi * sizeof(double);
+    writer.addSection(MODEL_SEC_PHENO, phenoSource->data(), vec_size);
+    if(bBinary){
+        writer.addSection(MODEL_SEC_MU, mu.data(), vec_size);
+    }
+    uint64_t covar_size = (uint64_t)covar.size() * sizeof(double);
+    writer.addSection(MODEL_SEC_COVAR, covar.data(), covar_size);
+    if(covarFlag && H.size()){
+        writer.addSection(MODEL_SEC_H, H.data(), (uint64_t)H.size() * sizeof(double));
+    }
+    if(has_envir){
+        writer.addSection(MODEL_SEC_ENVIR, envirVec_scaled.data(), vec_size);
+    }
+    if(!bBinary && fam_flag && !bGrammar){
+        V_inverse.makeCompressed();
+        uint64_t nnz = V_inverse.nonZeros();
+        writer.addSection(MODEL_SEC_VI_OUTER, V_inverse.outerIndexPtr(), (uint64_t)(V_inverse.outerSize() + 1) * sizeof(int64_t));
+        writer.addSection(MODEL_SEC_VI_INNER, V_inverse.innerIndexPtr(), nnz * sizeof(int64_t));
+        writer.addSection(MODEL_SEC_VI_VALUE, V_inverse.valuePtr(), nnz * sizeof(double));
+    }
+    writer.close();
+}
+
 FastFAM::FastFAM(){
     //Eigen::setNbThreads(THREADS.getThreadCount() + 1);
     //Eigen::setNbThreads(1);
@@ -618,6 +820,10 @@ FastFAM::FastFAM(){
         bBinary = true;
     }
  
+    if(options.find("model_map") != options.end()){
+        loadModelMap(options["model_map"]);
+        return;
+    }
     if(options["model_file"] != ""){
         if(bBinary){
             loadBinModel();
@@ -639,6 +845,12 @@ FastFAM::FastFAM(){
         LOGGER << "Using random seed: " << seed << std::endl;
     }
 
+    if(options.find("slq") != options.end()){
+        bSLQ = true;
+        LOGGER.i(0, "log|V| will be estimated by stochastic Lanczos quadrature with " + to_string((int)options_d["slq_probes"])
+                + " probes and " + to_string((int)options_d["slq_steps"]) + " Lanczos steps.");
+    }
+
     double VG;
     double VR;
     bool flag_est_GE = true;
@@ -1215,88 +1427,8 @@ saveRes:
         inv_id.close();
         LOGGER << "Sample information has been saved to [" << id_file << "]." << std::endl;
 
-        MDLHeader header;
-        header.magic[0] = 'f';
-        header.magic[1] = 'G';
-        header.magic[2] = 'W';
-        header.magic[3] = 'A';
-        header.magic[4] = '\0';
-        header.num_indi = num_indi;
-        header.fam_flag = fam_flag;
-        header.isGrammar = bGrammar;
-        header.phenoVec_start = 512;
-        header.covarFlag = covarFlag;
-        header.covarVec_start = header.phenoVec_start + header.num_indi * 8;
-        header.covarVec_cols = this->covar.cols();
-        uint64_t covar_size = header.covarVec_cols * header.num_indi * 8;
-        header.has_envir = has_envir;
-        header.envirVec_start = header.covarVec_start + covar_size + (header.covarFlag ? covar_size : 0);
-        header.V_inverse_start = header.envirVec_start + (header.has_envir ? header.num_indi * 8 : 0);
-        if(header.fam_flag & (!header.isGrammar)) header.V_inverse_items = V_inverse.nonZeros();
-        header.c_inf = c_inf;
-        header.VR_copy = VR_copy;
-
-        string bin_file = options["out"] + ".mdl.bin";
-        FILE* obin = fopen(bin_file.c_str(), "wb");
-        if(!obin){
-            LOGGER.e(0, "can't open " + bin_file + " to write.");
-        }
-
-        if(fwrite(&header, sizeof(header), 1, obin) != 1){
-            LOGGER.e(0, "can't write headers to " + bin_file + ".");
-        }
-
-        fseek(obin, header.phenoVec_start, SEEK_SET);
-        if (header.has_envir){
-            if(fwrite(Vi_y.data(), sizeof(double), header.num_indi, obin) != header.num_indi){
-                LOGGER.e(0, "can't write phenotype data to " + bin_file + ".");
-            }
-        }else if(fam_flag && header.isGrammar){
-            if(fwrite(Vi_y_cinf.data(), sizeof(double), header.num_indi, obin) != header.num_indi){
-                LOGGER.e(0, "can't write phenotype data to " + bin_file + ".");
-            }
-        }else{
-            if(fwrite(this->phenoVec.data(), sizeof(double), header.num_indi, obin) != header.num_indi){
-                LOGGER.e(0, "can't write phenotype data to " + bin_file + ".");
-            }
-        }
-
-        uint64_t num_covar_elements = (uint64_t)header.num_indi * header.covarVec_cols;
-        fseek(obin, header.covarVec_start, SEEK_SET);
-        if(fwrite(this->covar.data(), sizeof(double), num_covar_elements, obin)
-                != num_covar_elements){
-            LOGGER.e(0, "can't write covariates to " + bin_file + ".");
-        }
-
-        if(header.covarFlag){
-            if(fwrite(this->H.data(), sizeof(double), num_covar_elements, obin)
-                    != num_covar_elements){
-                LOGGER.e(0, "can't write covariates to " + bin_file + ".");
-            }
-        }
-
-        fseek(obin, header.envirVec_start, SEEK_SET);
-        if(header.has_envir){
-            if(fwrite(envirVec_scaled.data(), sizeof(double), header.num_indi, obin) != header.num_indi){
-                LOGGER.e(0, "can't write phenotype data to " + bin_file + ".");
-            }
-        }
-
-        fseek(obin, header.V_inverse_start, SEEK_SET);
-        if(header.fam_flag && (!header.isGrammar)){
-            InvItem item;
-            for(int k = 0; k < V_inverse.outerSize(); ++k){
-                for(SpMat::InnerIterator it(V_inverse, k); it; ++it){
-                    item.row = it.row();
-                    item.col = it.col();
-                    item.val = it.value();
-                    if(fwrite(&item, sizeof(item), 1, obin) != 1){
-                        LOGGER.e(0, "can't write V inverse to " + bin_file + ".");
-                    }
-                }
-            }
-        }
-        fclose(obin);
+        string bin_file = options["out"] + ".mdl.bin3";
+        saveModelMap(bin_file);
         LOGGER << "Model has been saved to [" << bin_file << "]." << std::endl;
     }
 
@@ -1364,11 +1496,11 @@ void FastFAM::conditionCovarReg(Eigen::Ref<VectorXd> y){
     }
  }
 
-void generateRandom(Ref<MatrixXd> mat){
+void generateRandom(Ref<MatrixXd> mat, uint32_t seed){
     uint64_t row = mat.rows();
     uint64_t col = mat.cols();
     
-    boost::mt19937 rng( std::chrono::system_clock::now().time_since_epoch().count() + 77 );
+    boost::mt19937 rng(seed);
     boost::variate_generator<boost::mt19937&, boost::normal_distribution<> >
         randn(rng, boost::normal_distribution<>(0.0, 1.0));
     for(int i = 0; i < col; i++){
@@ -1424,9 +1556,11 @@ double FastFAM::fitREML(double logdet, const SpMat &fam, const VectorXd &pheno){
     //solve the V
     SpMat V = fam + det * eye;
     Eigen::SimplicialLDLT<SpMat> solver;
-    solver.compute(V);
-    if(solver.info() != Eigen::Success){
-        LOGGER.e(0, "the V matrix is not invertible.");
+    if(!bSLQ){
+        solver.compute(V);
+        if(solver.info() != Eigen::Success){
+            LOGGER.e(0, "the V matrix is not invertible.");
+        }
     }
     
     vector<uint32_t> marker_index = marker->get_extract_index();
@@ -1443,15 +1577,34 @@ double FastFAM::fitREML(double logdet, const SpMat &fam, const VectorXd &pheno){
 
     VectorXd sum_e2_rand(mcTrails); // sum e rand ^ 2
     double det2 = det * det;
-    #pragma omp parallel for
-    for(int i = 0; i < mcTrails; i++){
-        rand_y.col(i) = rand_y.col(i) + sqrt_det * rand_e.col(i);
-        randVinvY.col(i) = solver.solve(rand_y.col(i));
-        sum_e2_rand(i) = det2 * (randVinvY.col(i).squaredNorm());
-    }
+    if(bSLQ){
+        // all the random phenotypes and the phenotype in one block solve
+        MatrixXd B(n, mcTrails + 1);
+        B.leftCols(mcTrails) = rand_y + sqrt_det * rand_e;
+        B.col(mcTrails) = pheno;
+        MatrixXd ViB;
+        auto op = [&V](const MatrixXd &X, MatrixXd &Y){ Y = V * X; };
+        LOGGER << "solve VinvY by block PCG" << std::endl;
+        if(StochasticTrace::blockCG(op, V.diagonal(), B, ViB) < 0){
+            LOGGER.e(0, "the conjugate gradient solver of the V matrix doesn't converge.");
+        }
+        rand_y = B.leftCols(mcTrails);
+        randVinvY = ViB.leftCols(mcTrails);
+        VinvY = ViB.col(mcTrails);
+        for(int i = 0; i < mcTrails; i++){
+            sum_e2_rand(i) = det2 * (randVinvY.col(i).squaredNorm());
+        }
+    }else{
+        #pragma omp parallel for
+        for(int i = 0; i < mcTrails; i++){
+            rand_y.col(i) = rand_y.col(i) + sqrt_det * rand_e.col(i);
+            randVinvY.col(i) = solver.solve(rand_y.col(i));
+            sum_e2_rand(i) = det2 * (randVinvY.col(i).squaredNorm());
+        }
 
-    LOGGER << "solve VinvY" << std::endl;
-    VinvY = solver.solve(pheno);
+        LOGGER << "solve VinvY" << std::endl;
+        VinvY = solver.solve(pheno);
+    }
     double sum_e2 = det2 * (VinvY.squaredNorm()); 
 
     finished_rand_marker = 0;
@@ -1494,10 +1647,10 @@ double FastFAM::MCREML(const Ref<const SpMat> fam, const Ref<const VectorXd> phe
 
     rand_beta.resize(m, mcTrails);
     rand_e.resize(n, mcTrails); 
-    generateRandom(rand_beta);
+    generateRandom(rand_beta, seed);
     rand_beta = rand_beta.array() * sqrt(1.0/m);
 
-    generateRandom(rand_e);
+    generateRandom(rand_e, seed + 1);
 
     randVinvY.resize(n, mcTrails);
     VinvY.resize(n);
@@ -1629,7 +1782,26 @@ double FastFAM::HEreg(const Ref<const SpMat> fam, const Ref<const VectorXd> phen
     return hsq;
 }
 
+void FastFAM::resetGridSolvers(){
+    gridSolvers.clear();
+    gridSolvers.resize(omp_get_max_threads());
+}
+
+Eigen::SimplicialLDLT<SpMat>& FastFAM::factorizeGridV(const SpMat &V){
+    std::unique_ptr<Eigen::SimplicialLDLT<SpMat>> &solver = gridSolvers[omp_get_thread_num()];
+    if(!solver){
+        solver.reset(new Eigen::SimplicialLDLT<SpMat>());
+        solver->analyzePattern(V);
+    }
+    solver->factorize(V);
+    return *solver;
+}
+
 void FastFAM::logLREML(const Ref<const VectorXd> pheno, vector<double> &varcomp, double &logL, double *Hinv){
+    if(bSLQ){
+        logLREMLSLQ(pheno, varcomp, logL, Hinv);
+        return;
+    }
     int n_comp = varcomp.size();
     int n = A[0].cols();
 
@@ -1639,8 +1811,7 @@ void FastFAM::logLREML(const Ref<const VectorXd> pheno, vector<double> &varcomp,
     }
     //LOGGER << "Non zeros V: " << V.nonZeros() << std::endl;
 
-    Eigen::SimplicialLDLT<SpMat> solverV;
-    solverV.compute(V);
+    Eigen::SimplicialLDLT<SpMat> &solverV = factorizeGridV(V);
     if(solverV.info() != Eigen::Success){
         LOGGER.e(0, "the V matrix is not invertible.");
     }
@@ -1693,6 +1864,100 @@ void FastFAM::logLREML(const Ref<const VectorXd> pheno, vector<double> &varcomp,
 }
 
 
+void FastFAM::initSLQProbes(int n){
+    int numProbe = options_d["slq_probes"];
+    slqSteps = options_d["slq_steps"];
+    slqProbes.resize(n, numProbe);
+    StochasticTrace::rademacher(slqProbes, seed);
+}
+
+void FastFAM::logLREMLSLQ(const Ref<const VectorXd> pheno, vector<double> &varcomp, double &logL, double *Hinv){
+    int n_comp = varcomp.size();
+    int n = A[0].cols();
+    int n_covar = covar.cols();
+
+    SpMat V(n, n);
+    for(int j = 0; j < n_comp; j++){
+        V += varcomp[j] * A[j];
+    }
+    auto op = [&V](const MatrixXd &X, MatrixXd &Y){ Y = V * X; };
+    VectorXd diagV = V.diagonal();
+
+    // V is not positive definite at this grid point
+    double logdet_V = StochasticTrace::slqLogDet(op, slqProbes, slqSteps);
+    if(!std::isfinite(logdet_V) || diagV.minCoeff() <= 0){
+        logL = std::numeric_limits<double>::quiet_NaN();
+        if(Hinv) LOGGER.e(0, "the V matrix is not positive definite.");
+        return;
+    }
+
+    // covariates and phenotype in one block solve
+    MatrixXd B(n, n_covar + 1);
+    B.leftCols(n_covar) = covar;
+    B.col(n_covar) = pheno;
+    MatrixXd ViB;
+    if(StochasticTrace::blockCG(op, diagV, B, ViB) < 0){
+        logL = std::numeric_limits<double>::quiet_NaN();
+        if(Hinv) LOGGER.e(0, "the conjugate gradient solver of the V matrix doesn't converge.");
+        return;
+    }
+    MatrixXd ViX = ViB.leftCols(n_covar);
+
+    MatrixXd XtViX = covar.transpose() * ViX; // c*c
+    INVmethod method = INV_FQR;
+    double logdet_XtViX;
+    int rank;
+    if(!SquareMatrixInverse(XtViX, logdet_XtViX, rank, method)){
+        LOGGER.e(0, "the XtViX matrix is not invertible.");
+    }
+
+    MatrixXd b_proj_t = ViX * XtViX; //n*c
+    VectorXd b2 = b_proj_t.transpose() * pheno; // c*1
+    VectorXd Py = ViB.col(n_covar) - ViX * b2;
+
+    logL = -0.5 * (logdet_V + logdet_XtViX + pheno.dot(Py));
+
+    if(Hinv){
+        // A_i Py and the probes A_i z for the traces, solved together
+        int numProbe = slqProbes.cols();
+        MatrixXd APy(n, n_comp);
+        MatrixXd AZ(n, n_comp * numProbe);
+        for(int i = 0; i < n_comp; i++){
+            APy.col(i) = A[i] * Py;
+            AZ.middleCols(i * numProbe, numProbe) = A[i] * slqProbes;
+        }
+        MatrixXd ViAPy, ViZ;
+        if(StochasticTrace::blockCG(op, diagV, APy, ViAPy) < 0 ||
+                StochasticTrace::blockCG(op, diagV, slqProbes, ViZ) < 0){
+            LOGGER.e(0, "the conjugate gradient solver of the V matrix doesn't converge.");
+        }
+
+        MatrixXd Hi(n_comp, n_comp);
+        VectorXd score(n_comp);
+        for(int i = 0; i < n_comp; i++){
+            VectorXd cvec = ViAPy.col(i) - ViX * (b_proj_t.transpose() * APy.col(i));
+            Hi(i, i) = 0.5 * APy.col(i).dot(cvec);
+            for(int j = 0; j < i; j++){
+                Hi(j, i) = 0.5 * APy.col(j).dot(cvec);
+                Hi(i, j) = Hi(j, i);
+            }
+            // tr(PA) = tr(Vi A) - tr((XtViX)^-1 XtVi A ViX), the first by Hutchinson
+            double tr_ViA = StochasticTrace::hutchinson(ViZ, AZ.middleCols(i * numProbe, numProbe));
+            double tr_proj = (XtViX * (ViX.transpose() * (A[i] * ViX))).trace();
+            score(i) = -0.5 * (tr_ViA - tr_proj - Py.dot(APy.col(i)));
+        }
+        LOGGER << "REML score at the estimates (Hutchinson trace, " << numProbe << " probes): "
+            << score.transpose() << std::endl;
+
+        INVmethod mtd_hi = INV_FQR;
+        double logdet_hi;
+        if(!SquareMatrixInverse(Hi, logdet_hi, rank, mtd_hi)){
+            LOGGER.e(0, "the Hi matrix is not invertible.");
+        }
+        memcpy(Hinv, Hi.data(), n_comp * n_comp * sizeof(double));
+    }
+}
+
 double FastFAM::spREML(const Ref<const SpMat> fam, const Ref<const VectorXd> pheno, bool &isSig){
     int n_comp = 2;
 
@@ -1703,6 +1968,8 @@ double FastFAM::spREML(const Ref<const SpMat> fam, const Ref<const VectorXd> phe
     A[0] = fam;
     A[1].resize(n, n); 
     A[1].setIdentity();
+    resetGridSolvers();
+    if(bSLQ) initSLQProbes(n);
 
     double Vp = pheno.array().square().sum() / (n - 1);
 
@@ -1858,6 +2125,7 @@ double FastFAM::spREML(const Ref<const SpMat> fam, const Ref<const VectorXd> phe
         A[i].resize(0, 0);
     }
     A.resize(0);
+    gridSolvers.clear();
 
     double zsq = Vg * Vg / Hinv(0, 0);
     double p = StatLib::pchisqd1(zsq);
@@ -1883,6 +2151,8 @@ double FastFAM::spREML_2df(const Ref<const SpMat> fam, const Ref<const VectorXd>
     A[0] = fam;
     A[1].resize(n, n);
     A[1].setIdentity();
+    resetGridSolvers();
+    if(bSLQ) initSLQProbes(n);
     
     double Vp = pheno.array().square().sum() / (n - 1);
     
@@ -2041,6 +2311,7 @@ double FastFAM::spREML_2df(const Ref<const SpMat> fam, const Ref<const VectorXd>
         A[i].resize(0, 0);
     }
     A.resize(0);
+    gridSolvers.clear();
     
     double zsq = Vg * Vg / Hinv(0, 0);
     double p = StatLib::pchisqd1(zsq);
@@ -2377,7 +2648,22 @@ void FastFAM::grammar(SpMat& fam, double VG, double VR){
  
 
 void FastFAM::inverseFAM(SpMat& fam, double VG, double VR){
-    LOGGER.i(0, "\nInverting the variance-covariance matrix by " + options["inv_method"] + " (This may take a long time)...");
+    string method = options["inv_method"];
+#if !GCTA_CPU_x86
+    if(method == "pardiso"){
+        LOGGER.w(0, "--pardiso is not available in this build, using --llt instead.");
+        method = "llt";
+        options["inv_method"] = method;
+    }
+#endif
+    if(method == "ldlt"){
+        LOGGER.i(0, "\nInverting the variance-covariance matrix by " + method + " (This may take a long time)...");
+    }else{
+        if(options.find("save_inv") != options.end() || options.find("model_only") != options.end()){
+            LOGGER.e(0, "--save-inv and --model-only need the inverse of V matrix, which is only computed by --ldlt.");
+        }
+        LOGGER.i(0, "\nFactorizing the variance-covariance matrix by " + method + ", V inverse will be applied by solving...");
+    }
     //LOGGER.i(0, "DEUBG: Inverse Threads " + to_string(Eigen::nbThreads()));
     LOGGER.ts("INVERSE_FAM");
     SpMat eye(fam.rows(), fam.cols());
@@ -2390,7 +2676,7 @@ void FastFAM::inverseFAM(SpMat& fam, double VG, double VR){
     fam += eye * VR;
 
     // inverse
-    if(options["inv_method"] == "ldlt"){
+    if(method == "ldlt"){
         Eigen::SimplicialLDLT<SpMat> solver;
         solver.compute(fam);
 
@@ -2399,18 +2685,83 @@ void FastFAM::inverseFAM(SpMat& fam, double VG, double VR){
         }
 
         V_inverse = solver.solve(eye); 
+    }else if(method == "llt"){
+        // AMD ordering keeps the fill of the factor low
+        solverLLT.compute(fam);
+        if(solverLLT.info() != Eigen::Success){
+            LOGGER.e(0, "the sparse GRM is not invertible.");
+        }
+        bSolveV = true;
+        LOGGER.i(0, "Non-zero elements in the Cholesky factor: " + to_string(solverLLT.matrixL().nestedExpression().nonZeros()) + ".");
+    }else if(method == "pardiso"){
+#if GCTA_CPU_x86
+        // supernodal factorization, multiple right hand sides are solved together
+        solverPardiso.compute(fam);
+        if(solverPardiso.info() != Eigen::Success){
+            LOGGER.e(0, "the sparse GRM is not invertible.");
+        }
+        bSolveV = true;
+#endif
+    }else if(method == "cg"){
+        // the solver keeps a reference to V
+        V_sp = fam;
+        solverPCG.setTolerance(1e-8);
+        solverPCG.compute(V_sp);
+        if(solverPCG.info() != Eigen::Success){
+            LOGGER.e(0, "failed to build the incomplete Cholesky preconditioner of V matrix.");
+        }
+        bSolveV = true;
     }else{
         LOGGER.e(0, "unknown matrix inverse method.");
     }
 
 
-    LOGGER.i(0, "The V matrix inverted in " + to_string(LOGGER.tp("INVERSE_FAM")) + " sec.");
+    if(bSolveV){
+        LOGGER.i(0, "The V matrix factorized in " + to_string(LOGGER.tp("INVERSE_FAM")) + " sec.");
+    }else{
+        LOGGER.i(0, "The V matrix inverted in " + to_string(LOGGER.tp("INVERSE_FAM")) + " sec.");
+    }
+}
+
+void FastFAM::solveV(const MatrixXd &X, MatrixXd &ViX){
+    ViX.resize(X.rows(), X.cols());
+#if GCTA_CPU_x86
+    if(options["inv_method"] == "pardiso"){
+        // all columns in one call, pardiso is threaded internally
+        ViX = solverPardiso.solve(X);
+        return;
+    }
+#endif
+    int nCol = X.cols();
+    if(options["inv_method"] == "cg"){
+        // one column at a time: the solver keeps the state of the last solve,
+        //   and its sparse products are threaded internally
+        for(int i = 0; i < nCol; i++){
+            ViX.col(i) = solverPCG.solve(X.col(i));
+            if(solverPCG.info() != Eigen::Success){
+                LOGGER.e(0, "the conjugate gradient solve of the V matrix did not converge in " + to_string(solverPCG.iterations()) + " iterations (error " + to_string(solverPCG.error()) + "). Try --ldlt or --llt instead of --cg.");
+            }
+        }
+        return;
+    }
+    int step = 8;
+    #pragma omp parallel for schedule(dynamic)
+    for(int start = 0; start < nCol; start += step){
+        int num = std::min(step, nCol - start);
+        ViX.middleCols(start, num) = solverLLT.solve(X.middleCols(start, num));
+    }
 }
 
 void FastFAM::calculate_gwa(uintptr_t * genobuf, const vector<uint32_t> &markerIndex){
 
     static double iN = 1.0 /(num_indi - (covarFlag ? covar.cols() : 1.0) - 1.0);
     static double SSy = phenoVec.dot(phenoVec);
+    // for the sparse markers and the PGEN dosages: y has the covariates
+    //   regressed out, so x'y is kept
+    //   and x'x loses h'C'Ch with h = Hx
+    static double sumY = phenoVec.sum();
+    static VectorXd sumH = covarFlag ? VectorXd(H.rowwise().sum()) : VectorXd();
+    static MatrixXd CtC = covarFlag ? MatrixXd(covar.transpose() * covar) : MatrixXd();
 
     int num_marker = markerIndex.size();
     vector<uint8_t> isValids(num_marker);
@@ -2420,6 +2771,8 @@ void FastFAM::calculate_gwa(uintptr_t * genobuf, const vector<uint32_t> &markerI
         uint32_t cur_marker = markerIndex[i];
         GenoBufItem item;
         item.extractedMarkerIndex = cur_marker;
+        item.bSparse = true;
+        item.bDosage = true;
 
         geno->getGenoDouble(genobuf, i, &item);
 
@@ -2428,13 +2781,24 @@ void FastFAM::calculate_gwa(uintptr_t * genobuf, const vector<uint32_t> &markerI
             continue;
         }
 
-        Map< VectorXd > xMat(item.geno.data(), num_indi);
-
-        conditionCovarReg(xMat);
+        double xMat_V_x, xMat_V_p;
+        if(item.isSparse || item.isDosage){
+            double xx = genoSquaredNorm(item, num_indi);
+            if(covarFlag){
+                VectorXd h(H.rows());
+                genoMultiply(item, H.data(), H.rows(), sumH.data(), h.data());
+                xx -= h.dot(CtC * h);
+            }
+            xMat_V_x = 1.0 / xx;
+            xMat_V_p = genoDot(item, phenoVec.data(), sumY);
+        }else{
+            Map< VectorXd > xMat(item.geno.data(), num_indi);
 
+            conditionCovarReg(xMat);
 
-        double xMat_V_x = 1.0 / xMat.dot(xMat);
-        double xMat_V_p = xMat.dot(phenoVec);
+            xMat_V_x = 1.0 / xMat.dot(xMat);
+            xMat_V_p = xMat.dot(phenoVec);
+        }
 
         double temp_beta =  xMat_V_x * xMat_V_p;
         double sse = (SSy - temp_beta * xMat_V_p) * iN;
@@ -2445,7 +2809,7 @@ void FastFAM::calculate_gwa(uintptr_t * genobuf, const vector<uint32_t> &markerI
 
         beta[i] = (float)temp_beta; //* geno->RDev[cur_raw_marker]; 
         se[i] = (float)temp_se;
-        p[i] = StatLib::pchisqd1(temp_z * temp_z); 
+        p[i] = temp_z * temp_z; // chi-square, to p-values by block
 
         af[i] = (float)item.af;
         countMarkers[i] = item.nValidN;
@@ -2457,6 +2821,8 @@ void FastFAM::calculate_gwa(uintptr_t * genobuf, const vector<uint32_t> &markerI
         //}
     }
 
+    StatLib::lpchisqd1(p, p, num_marker); // ln p, see output_res
+
     output_res(isValids, markerIndex);
    /*
         std::ofstream o_geno(options["out"] + "_geno.txt");
@@ -2530,37 +2896,28 @@ void FastFAM::calculate_gwa_2df(uintptr_t * genobuf, const vector<uint32_t> &mar
         beta_geno[i]=(float)temp_beta(0);
         se_geno[i]=(float)temp_se(0);
         score_geno[i]=(float)temp_chisq_x;
-        
-        if (temp_chisq_x > 0){
-          p_geno[i] = StatLib::pchisqd1(temp_chisq_x);
-        }else{
-          p_geno[i] = 1;
-        }
+        // chi-squares here, to p below; p = 1 if not positive
+        p_geno[i] = temp_chisq_x > 0 ? temp_chisq_x : 0;
         
         beta_interaction[i]=(float)temp_beta[1];
         se_interaction[i]=(float)temp_se[1];
         score_interaction[i]=(float)temp_chisq_xenvir;
-        
-        if (temp_chisq_xenvir > 0){
-          p_interaction[i] = StatLib::pchisqd1(temp_chisq_xenvir);
-        }else{
-          p_interaction[i] = 1;
-        }
+        p_interaction[i] = temp_chisq_xenvir > 0 ? temp_chisq_xenvir : 0;
         
         cov_geno_interaction[i] = (float)(sse * ngtv_2nd_deri_inv(0,1)) ;
         
         score[i] = (float)temp_chisq;
-        if (temp_chisq > 0){
-            p[i] = StatLib::pchisqd2(temp_chisq);
-        }else{
-            p[i] = 1;
-        }
+        p[i] = temp_chisq > 0 ? temp_chisq : 0;
         
         af[i] = (float)item.af;
         countMarkers[i] = item.nValidN;
         info[i] = item.info; 
 
     }
+
+    StatLib::pchisqd1(p_geno, p_geno, num_marker);
+    StatLib::pchisqd1(p_interaction, p_interaction, num_marker);
+    StatLib::pchisqd2(p, p, num_marker);
   
     output_res_2df(isValids, markerIndex);
 }
@@ -2649,38 +3006,31 @@ void FastFAM::calculate_gwa_2df_sandwich(uintptr_t * genobuf, const vector<uint3
             beta_geno[i]=(float)temp_beta(0);
             se_geno[i]=(float)temp_se(0);
             score_geno[i]=(float)temp_chisq_x;
-            
-            if (temp_chisq_x > 0){
-                p_geno[i] = StatLib::pchisqd1(temp_chisq_x);
-            }else{
-                p_geno[i] = 1;
-            }
+            // chi-squares here, to p below; p = 1 if not positive
+            p_geno[i] = temp_chisq_x > 0 ? temp_chisq_x : 0;
             
             beta_interaction[i]=(float)temp_beta[1];
             se_interaction[i]=(float)temp_se[1];
             score_interaction[i]=(float)temp_chisq_xenvir;
-            
-            if (temp_chisq_xenvir > 0){
-                p_interaction[i] = StatLib::pchisqd1(temp_chisq_xenvir);
-            }else{
-                p_interaction[i] = 1;
-            }
+            p_interaction[i] = temp_chisq_xenvir > 0 ? temp_chisq_xenvir : 0;
             
             cov_geno_interaction[i] = (float)sandwich_variance(0,1) ;
             
             score[i] = (float)temp_chisq;
-            if (temp_chisq > 0){
-                p[i] = StatLib::pchisqd2(temp_chisq);
-            }else{
-                p[i] = 1;
-            }
+            p[i] = temp_chisq > 0 ? temp_chisq : 0;
             
+        }else{
+            p_geno[i] = p_interaction[i] = p[i] = std::numeric_limits<double>::quiet_NaN();
         }
 
         af[i] = (float)item.af;
         countMarkers[i] = item.nValidN;
         info[i] = item.info; 
     }
+
+    StatLib::pchisqd1(p_geno, p_geno, num_marker);
+    StatLib::pchisqd1(p_interaction, p_interaction, num_marker);
+    StatLib::pchisqd2(p, p, num_marker);
     
     output_res_2df(isValids, markerIndex);
 }
@@ -2688,12 +3038,35 @@ void FastFAM::calculate_gwa_2df_sandwich(uintptr_t * genobuf, const vector<uint3
 void FastFAM::output_res_spa(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex){
     int numKept = 0;
     int num_marker = markerIndex.size();
-    if(bSaveBin){
-        int num_write = 1;
+    if(resStore){
         for(int i = 0; i != num_marker; i++){
             if(isValids[i]){
                 numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\n";
+                int col = resStore->putMarker(marker, markerIndex[i]);
+                resStore->put(col++, countMarkers[i]);
+                resStore->put(col++, af[i]);
+                resStore->put(col++, Tscore[i]);
+                resStore->put(col++, Tse[i]);
+                resStore->put(col++, p[i]);
+                resStore->put(col++, beta[i]);
+                resStore->put(col++, se[i]);
+                resStore->put(col++, padj[i]);
+                resStore->put(col++, rConverge[i]);
+                if(hasInfo) resStore->put(col++, info[i]);
+                resStore->endRow();
+            }
+        }
+    }else if(bSaveBin){
+        int num_write = 1;
+        numKept = resWriter.write(num_marker, osOut, [&](uint32_t i, TextBuffer &buf){
+            if(!isValids[i]) return false;
+            uint32_t len;
+            buf.add(marker->getMarkerStrBuf(markerIndex[i], len), len);
+            buf.add('\n');
+            return true;
+        });
+        for(int i = 0; i != num_marker; i++){
+            if(isValids[i]){
                 if(fwrite(&af[i], sizeof(float), num_write, bOut) != num_write){
                     LOGGER.e(0, "can't write allele frequency to [" + sFileName + ".bin].");
                 }
@@ -2724,29 +3097,29 @@ void FastFAM::output_res_spa(const vector<uint8_t> &isValids, const vector<uint3
             }
         }
     }else{
-        for(int i = 0; i != num_marker; i++){
+        numKept = resWriter.write(num_marker, osOut, [&](uint32_t i, TextBuffer &buf){
+            if(!isValids[i] && !bOutResAll) return false;
+            uint32_t len;
+            buf.add(marker->getMarkerStrBuf(markerIndex[i], len), len);
+            buf.addFieldUInt(countMarkers[i]);
+            buf.addFieldNum(af[i]);
             if(isValids[i]){
-                numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\t" << Tscore[i] << "\t" << Tse[i] << "\t" << p[i] 
-                    << "\t" << beta[i] << "\t" << se[i] << "\t" << padj[i] << "\t" << ((int)rConverge[i]);
-                if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
+                buf.addFieldNum(Tscore[i]);
+                buf.addFieldNum(Tse[i]);
+                buf.addFieldNum(p[i]);
+                buf.addFieldNum(beta[i]);
+                buf.addFieldNum(se[i]);
+                buf.addFieldNum(padj[i]);
+                buf.addFieldUInt(rConverge[i]);
             }else{
-                if(bOutResAll){
-                    numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\tNA\tNA\tNA\tNA\tNA\tNA\tNA";
-                if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
- 
-                }
+                buf.addNA(7);
             }
-        }
+            if(hasInfo){
+                buf.addFieldNum(info[i]);
+            }
+            buf.add('\n');
+            return true;
+        });
     }
 
     numMarkerOutput += numKept;
@@ -2754,15 +3127,36 @@ void FastFAM::output_res_spa(const vector<uint8_t> &isValids, const vector<uint3
  
 
 
+// p holds ln p here, so that p-values below the double range are still
+//   printed (the binary outputs keep p itself, 0 for those)
 void FastFAM::output_res(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex){
     int numKept = 0;
     int num_marker = markerIndex.size();
-    if(bSaveBin){
-        int num_write = 1;
+    if(resStore){
         for(int i = 0; i != num_marker; i++){
             if(isValids[i]){
                 numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\n";
+                int col = resStore->putMarker(marker, markerIndex[i]);
+                resStore->put(col++, countMarkers[i]);
+                resStore->put(col++, af[i]);
+                resStore->put(col++, beta[i]);
+                resStore->put(col++, se[i]);
+                resStore->put(col++, std::exp(p[i]));
+                if(hasInfo) resStore->put(col++, info[i]);
+                resStore->endRow();
+            }
+        }
+    }else if(bSaveBin){
+        int num_write = 1;
+        numKept = resWriter.write(num_marker, osOut, [&](uint32_t i, TextBuffer &buf){
+            if(!isValids[i]) return false;
+            uint32_t len;
+            buf.add(marker->getMarkerStrBuf(markerIndex[i], len), len);
+            buf.add('\n');
+            return true;
+        });
+        for(int i = 0; i != num_marker; i++){
+            if(isValids[i]){
                 if(fwrite(&af[i], sizeof(float), num_write, bOut) != num_write){
                     LOGGER.e(0, "can't write allele frequency to [" + sFileName + ".bin].");
                 }
@@ -2773,7 +3167,8 @@ void FastFAM::output_res(const vector<uint8_t> &isValids, const vector<uint32_t>
                 if(fwrite(&se[i], sizeof(float), num_write, bOut) != num_write){
                     LOGGER.e(0, "can't write se to [" + sFileName + ".bin].");
                 }
-                if(fwrite(&p[i], sizeof(double), num_write, bOut) != num_write){
+                double pval = std::exp(p[i]);
+                if(fwrite(&pval, sizeof(double), num_write, bOut) != num_write){
                     LOGGER.e(0, "can't write p to [" + sFileName + ".bin].");
                 }
 
@@ -2790,28 +3185,25 @@ void FastFAM::output_res(const vector<uint8_t> &isValids, const vector<uint32_t>
             }
         }
     }else{
-        for(int i = 0; i != num_marker; i++){
+        numKept = resWriter.write(num_marker, osOut, [&](uint32_t i, TextBuffer &buf){
+            if(!isValids[i] && !bOutResAll) return false;
+            uint32_t len;
+            buf.add(marker->getMarkerStrBuf(markerIndex[i], len), len);
+            buf.addFieldUInt(countMarkers[i]);
+            buf.addFieldNum(af[i]);
             if(isValids[i]){
-                numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\t" << beta[i] << "\t" << se[i] << "\t" << p[i];
-                if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
+                buf.addFieldNum(beta[i]);
+                buf.addFieldNum(se[i]);
+                buf.addFieldLogP(p[i]);
             }else{
-                if(bOutResAll){
-                    numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\tNA\tNA\tNA";
-                if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
- 
-                }
+                buf.addNA(3);
             }
-        }
+            if(hasInfo){
+                buf.addFieldNum(info[i]);
+            }
+            buf.add('\n');
+            return true;
+        });
     }
 
     numMarkerOutput += numKept;
@@ -2821,12 +3213,39 @@ void FastFAM::output_res(const vector<uint8_t> &isValids, const vector<uint32_t>
 void FastFAM::output_res_2df(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex){
     int numKept = 0;
     int num_marker = markerIndex.size();
-    if(bSaveBin){
-        int num_write = 1;
+    if(resStore){
         for(int i = 0; i != num_marker; i++){
             if(isValids[i]){
                 numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\n";
+                int col = resStore->putMarker(marker, markerIndex[i]);
+                resStore->put(col++, countMarkers[i]);
+                resStore->put(col++, af[i]);
+                resStore->put(col++, beta_geno[i]);
+                resStore->put(col++, beta_interaction[i]);
+                resStore->put(col++, se_geno[i]);
+                resStore->put(col++, se_interaction[i]);
+                resStore->put(col++, cov_geno_interaction[i]);
+                resStore->put(col++, score_geno[i]);
+                resStore->put(col++, score_interaction[i]);
+                resStore->put(col++, score[i]);
+                resStore->put(col++, p_geno[i]);
+                resStore->put(col++, p_interaction[i]);
+                resStore->put(col++, p[i]);
+                if(hasInfo) resStore->put(col++, info[i]);
+                resStore->endRow();
+            }
+        }
+    }else if(bSaveBin){
+        int num_write = 1;
+        numKept = resWriter.write(num_marker, osOut, [&](uint32_t i, TextBuffer &buf){
+            if(!isValids[i]) return false;
+            uint32_t len;
+            buf.add(marker->getMarkerStrBuf(markerIndex[i], len), len);
+            buf.add('\n');
+            return true;
+        });
+        for(int i = 0; i != num_marker; i++){
+            if(isValids[i]){
                 if(fwrite(&af[i], sizeof(float), num_write, bOut) != num_write){
                     LOGGER.e(0, "can't write allele frequency to [" + sFileName + ".bin].");
                 }
@@ -2878,28 +3297,33 @@ void FastFAM::output_res_2df(const vector<uint8_t> &isValids, const vector<uint3
             }
         }
     }else{
-        for(int i = 0; i != num_marker; i++){
+        numKept = resWriter.write(num_marker, osOut, [&](uint32_t i, TextBuffer &buf){
+            if(!isValids[i] && !bOutResAll) return false;
+            uint32_t len;
+            buf.add(marker->getMarkerStrBuf(markerIndex[i], len), len);
+            buf.addFieldUInt(countMarkers[i]);
+            buf.addFieldNum(af[i]);
             if(isValids[i]){
-                numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\t" << beta_geno[i] << "\t" << beta_interaction[i]  << "\t" << se_geno[i] << "\t" << se_interaction[i] << "\t" << cov_geno_interaction[i] << "\t" << score_geno[i] << "\t" << score_interaction[i] << "\t" << score[i] << "\t" << p_geno[i] << "\t" << p_interaction[i] << "\t" << p[i];
-                if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
+                buf.addFieldNum(beta_geno[i]);
+                buf.addFieldNum(beta_interaction[i]);
+                buf.addFieldNum(se_geno[i]);
+                buf.addFieldNum(se_interaction[i]);
+                buf.addFieldNum(cov_geno_interaction[i]);
+                buf.addFieldNum(score_geno[i]);
+                buf.addFieldNum(score_interaction[i]);
+                buf.addFieldNum(score[i]);
+                buf.addFieldNum(p_geno[i]);
+                buf.addFieldNum(p_interaction[i]);
+                buf.addFieldNum(p[i]);
             }else{
-                if(bOutResAll){
-                    numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA";
-                if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
- 
-                }
+                buf.addNA(11);
             }
-        }
+            if(hasInfo){
+                buf.addFieldNum(info[i]);
+            }
+            buf.add('\n');
+            return true;
+        });
     }
 
     numMarkerOutput += numKept;
@@ -2912,6 +3336,56 @@ void FastFAM::calculate_fam(uintptr_t *genobuf, const vector<uint32_t> &markerIn
     int num_marker = markerIndex.size();
     vector<uint8_t> isValids(num_marker);
 
+    if(bSolveV){
+        // blocks of markers, V inverse applied to all genotypes of a block by solving
+        int nBlock = 64;
+        MatrixXd X, ViX;
+        for(int start = 0; start < num_marker; start += nBlock){
+            int num = std::min(nBlock, num_marker - start);
+            X.setZero(num_indi, num);
+            #pragma omp parallel for schedule(dynamic)
+            for(int j = 0; j < num; j++){
+                int i = start + j;
+                GenoBufItem item;
+                item.extractedMarkerIndex = markerIndex[i];
+
+                geno->getGenoDouble(genobuf, i, &item);
+
+                isValids[i] = item.valid;
+                if(!item.valid) {
+                    continue;
+                }
+                X.col(j) = Map<VectorXd>(item.geno.data(), num_indi);
+                conditionCovarReg(X.col(j));
+
+                af[i] = (float)item.af;
+                countMarkers[i] = item.nValidN;
+                info[i] = item.info;
+            }
+
+            solveV(X, ViX);
+
+            #pragma omp parallel for
+            for(int j = 0; j < num; j++){
+                int i = start + j;
+                if(!isValids[i]) continue;
+                double xMat_V_x = 1.0 / ViX.col(j).dot(X.col(j));
+                double xMat_V_p = ViX.col(j).dot(phenoVec);
+
+                double temp_beta =  xMat_V_x * xMat_V_p;
+                double temp_se = sqrt(xMat_V_x);
+                double temp_z = temp_beta / temp_se;
+
+                beta[i] = (float)temp_beta;
+                se[i] = (float)temp_se;
+                p[i] = temp_z * temp_z; // chi-square, to p-values by block
+            }
+        }
+        StatLib::lpchisqd1(p, p, num_marker); // ln p, see output_res
+        output_res(isValids, markerIndex);
+        return;
+    }
+
     #pragma omp parallel for schedule(dynamic)
     for(int i = 0; i < num_marker; i++){
         uint32_t cur_marker = markerIndex[i];
@@ -2929,7 +3403,12 @@ void FastFAM::calculate_fam(uintptr_t *genobuf, const vector<uint32_t> &markerIn
 
         conditionCovarReg(xMat);
 
-        VectorXd xMat_V = V_inverse * xMat;
+        VectorXd xMat_V;
+        if(V_inverse_map){
+            xMat_V = (*V_inverse_map) * xMat;
+        }else{
+            xMat_V = V_inverse * xMat;
+        }
         double xMat_V_x = 1.0 / xMat_V.dot(xMat);
         double xMat_V_p = xMat_V.dot(phenoVec);
 
@@ -2940,12 +3419,13 @@ void FastFAM::calculate_fam(uintptr_t *genobuf, const vector<uint32_t> &markerIn
 
         beta[i] = (float)temp_beta; //* geno->RDev[cur_raw_marker]; 
         se[i] = (float)temp_se;
-        p[i] = StatLib::pchisqd1(temp_z * temp_z); 
+        p[i] = temp_z * temp_z; // chi-square, to p-values by block
 
         af[i] = (float)item.af;
         countMarkers[i] = item.nValidN;
         info[i] = item.info;
     }
+    StatLib::lpchisqd1(p, p, num_marker); // ln p, see output_res
     output_res(isValids, markerIndex);
 }
 
@@ -2980,12 +3460,14 @@ void FastFAM::calculate_grammar(uintptr_t *genobuf, const vector<uint32_t> &mark
 
         beta[i] = (float)temp_beta; //* geno->RDev[cur_raw_marker]; 
         se[i] = (float)temp_se;
-        p[i] = StatLib::pchisqd1(temp_chisq); 
+        p[i] = temp_chisq; // chi-square, to p-values by block
         af[i] = (float)item.af;
         countMarkers[i] = item.nValidN;
         info[i] = item.info;
     }
 
+    StatLib::lpchisqd1(p, p, num_marker); // ln p, see output_res
+
     output_res(isValids, markerIndex);
 }
 
@@ -3013,7 +3495,38 @@ void FastFAM::processFAM(vector<function<void (uintptr_t *, const vector<uint32_
     int buf_size = 23068672;
     osBuf.resize(buf_size);
     osOut.rdbuf()->pubsetbuf(&osBuf[0], buf_size);
-    if(options.find("save_bin") == options.end()){
+
+    vector<uint32_t> extractIndex(marker->count_extract());
+    std::iota(extractIndex.begin(), extractIndex.end(), 0);
+    numMarkerOutput = 0;
+    string resumeOutput;
+    bool bResume = geno->setCheckpoint("fastGWA", extractIndex, {{"output",
+            [this](std::ostream &os){
+                CheckpointIO::write(os, numMarkerOutput);
+                if(resStore){
+                    resStore->saveState(os);
+                }else{
+                    osOut.flush();
+                    CheckpointIO::write(os, (uint64_t)osOut.tellp());
+                    if(bOut){
+                        fflush(bOut);
+                        CheckpointIO::write(os, (uint64_t)ftell(bOut));
+                    }
+                }
+            },
+            [this, &resumeOutput](std::istream &is){
+                CheckpointIO::read(is, numMarkerOutput);
+                resumeOutput.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+            }}});
+    std::istringstream resumeState(resumeOutput);
+
+    if(options.find("save_bin") == options.end() && bResume){
+        bSaveBin = false;
+        LOGGER << "fastGWA results will be appended to [" << sFileName << "]." << std::endl;
+        uint64_t offset;
+        CheckpointIO::read(resumeState, offset);
+        CheckpointIO::reopenText(osOut, sFileName, offset);
+    }else if(options.find("save_bin") == options.end()){
         bSaveBin = false;
         LOGGER << "fastGWA results will be saved in text format to [" << sFileName << "]." << std::endl;
         osOut.open(sFileName.c_str());
@@ -3032,17 +3545,50 @@ void FastFAM::processFAM(vector<function<void (uintptr_t *, const vector<uint32_
             LOGGER.e(0, "can't open [" + sFileName + "] to write.");
         }
         osOut << header_string << std::endl;
-    }else{
+    }else if(options["save_bin"] == "yes"){
         bSaveBin = true;
         LOGGER << "fastGWA results will be saved in binary format to [" << sFileName << "(.snpinfo, .bin)]" << std::endl;
-        osOut.open((sFileName + ".snpinfo").c_str());
-        if(osOut.bad()){
-            LOGGER.e(0, "can't open [" + sFileName + ".snpinfo] to write.");
+        if(bResume){
+            uint64_t offset, bin_offset;
+            CheckpointIO::read(resumeState, offset);
+            CheckpointIO::read(resumeState, bin_offset);
+            CheckpointIO::reopenText(osOut, sFileName + ".snpinfo", offset);
+            bOut = CheckpointIO::reopenBinary(sFileName + ".bin", bin_offset);
+        }else{
+            osOut.open((sFileName + ".snpinfo").c_str());
+            if(osOut.bad()){
+                LOGGER.e(0, "can't open [" + sFileName + ".snpinfo] to write.");
+            }
+            osOut << "CHR\tSNP\tPOS\tA1\tA2" << std::endl;
+            bOut = fopen((sFileName + ".bin").c_str(), "wb");
+            if(bOut == NULL){
+                LOGGER.e(0, "can't open [" + sFileName + ".bin] to write.");
+            }
+        }
+    }else{
+        bSaveBin = true;
+        vector<ResultColumn> columns = ResultStoreWriter::markerColumns();
+        string pColumn = "P";
+        if(has_envir){
+            columns.insert(columns.end(), {{"N", RES_U32}, {"AF1", RES_F32}, {"BETA_G", RES_F32}, {"BETA_G_by_E", RES_F32},
+                    {"SE_G", RES_F32}, {"SE_G_by_E", RES_F32}, {"Cov_BETA_G_and_G_by_E", RES_F32}, {"chisq_G", RES_F32},
+                    {"chisq_G_by_E", RES_F32}, {"chisq_2df", RES_F32}, {"P_G", RES_F64}, {"P_G_by_E", RES_F64}, {"P_2df", RES_F64}});
+            pColumn = "P_2df";
+        }else if(bBinary){
+            columns.insert(columns.end(), {{"N", RES_U32}, {"AF1", RES_F32}, {"T", RES_F32}, {"SE_T", RES_F32}, {"P_noSPA", RES_F64},
+                    {"BETA", RES_F32}, {"SE", RES_F32}, {"P", RES_F64}, {"CONVERGE", RES_U8}});
+        }else{
+            columns.insert(columns.end(), {{"N", RES_U32}, {"AF1", RES_F32}, {"BETA", RES_F32}, {"SE", RES_F32}, {"P", RES_F64}});
         }
-        osOut << "CHR\tSNP\tPOS\tA1\tA2" << std::endl;
-        bOut = fopen((sFileName + ".bin").c_str(), "wb");
-        if(bOut == NULL){
-            LOGGER.e(0, "can't open [" + sFileName + ".bin] to write.");
+        if(hasInfo) columns.push_back({"INFO", RES_F32});
+
+        bool bCompress = options["save_bin"] == "zstd";
+        LOGGER << "fastGWA results will be saved in binary format to [" << sFileName << ".bin]"
+            << (bCompress ? ", compressed by zstd" : "") << "." << std::endl;
+        if(bResume){
+            resStore = new ResultStoreWriter(sFileName + ".bin", columns, bCompress, pColumn, resumeState);
+        }else{
+            resStore = new ResultStoreWriter(sFileName + ".bin", columns, bCompress, pColumn);
         }
     }
 
@@ -3070,8 +3616,7 @@ void FastFAM::processFAM(vector<function<void (uintptr_t *, const vector<uint32_
         bOutResAll = true;
     }
 
-    vector<uint32_t> extractIndex(marker->count_extract());
-    std::iota(extractIndex.begin(), extractIndex.end(), 0);
+    marker->buildMarkerStr();
 
     int nMarker = 1024;
  
@@ -3083,8 +3628,6 @@ void FastFAM::processFAM(vector<function<void (uintptr_t *, const vector<uint32_
     af = new float[nMarker];
     info = new float[nMarker];
 
-    numMarkerOutput = 0;
-
     bool bCenter = true;
     if(bBinary){
         Tscore = new float[nMarker];
@@ -3106,12 +3649,20 @@ void FastFAM::processFAM(vector<function<void (uintptr_t *, const vector<uint32_
     }
     geno->loopDouble(extractIndex, nMarker, true, bCenter, false, false, callBacks);
 
-    osOut.flush();
-    osOut.close();
+    if(resStore){
+        resStore->close();
+        delete resStore;
+        resStore = NULL;
+    }else{
+        osOut.flush();
+        osOut.close();
+    }
     if(bOut){
         fflush(bOut);
         fclose(bOut);
+        bOut = NULL;
     }
+    geno->finishCheckpoint();
     LOGGER << "Saved " << numMarkerOutput << " SNPs." << std::endl;
 
     delete[] beta;
@@ -3249,9 +3800,9 @@ int FastFAM::registerOption(map<string, vector<string>>& options_in){
     vector<string> flags = {"--cg", "--ldlt", "--llt", "--pardiso", "--tcg", "--lscg", "--inv-t1"};
     for(auto curFlag : flags){
         if(options_in.find(curFlag) != options_in.end()){
+            options_in.erase(curFlag);
             boost::erase_all(curFlag, "--");
             options["inv_method"] = curFlag;
-            options_in.erase(curFlag);
         }
     }
 
@@ -3272,7 +3823,14 @@ int FastFAM::registerOption(map<string, vector<string>>& options_in){
 
     curFlag = "--save-bin";
     if(options_in.find(curFlag) != options_in.end()){
+        // the .bin and .snpinfo by default, the result store (.fastGWA.bin) by
+        //   store, or zstd to compress it
         options["save_bin"] = "yes";
+        if(options_in[curFlag].size() == 1 && (options_in[curFlag][0] == "store" || options_in[curFlag][0] == "zstd")){
+            options["save_bin"] = options_in[curFlag][0];
+        }else if(options_in[curFlag].size() != 0){
+            LOGGER.e(0, curFlag + " can only be followed by store to save the results in the result store, or zstd to compress the store.");
+        }
         //options_in.erase(curFlag);
     }
 
@@ -3324,16 +3882,26 @@ int FastFAM::registerOption(map<string, vector<string>>& options_in){
     if(options_in.find(curFlag) != options_in.end()){
         if(options_in[curFlag].size() == 1){
            options["model_file"] = options_in[curFlag][0];
-           if(!checkFileReadable(options["model_file"] + ".mdl.id")){
-              LOGGER.e(0, "can't read " + options["model_file"] + ".mdl.id.");
-           }
-           if(checkFileReadable(options["model_file"] + ".mdl.bin")){
-              processFunctions.push_back("fast_fam");
-           }else if(checkFileReadable(options["model_file"] + ".mdl.bin2")){
+           ModelFileHeader mapHeader;
+           string map_file = options["model_file"] + ".mdl.bin3";
+           if(checkFileReadable(map_file) && ModelFile::readHeader(map_file, mapHeader)){
+              options["model_map"] = map_file;
               processFunctions.push_back("fast_fam");
-              options["binary"] = "yes";
+              if(mapHeader.type == MODEL_GLMM){
+                 options["binary"] = "yes";
+              }
            }else{
-              LOGGER.e(0, "can't read the model binary file.");
+              if(!checkFileReadable(options["model_file"] + ".mdl.id")){
+                 LOGGER.e(0, "can't read " + options["model_file"] + ".mdl.id.");
+              }
+              if(checkFileReadable(options["model_file"] + ".mdl.bin")){
+                 processFunctions.push_back("fast_fam");
+              }else if(checkFileReadable(options["model_file"] + ".mdl.bin2")){
+                 processFunctions.push_back("fast_fam");
+                 options["binary"] = "yes";
+              }else{
+                 LOGGER.e(0, "can't read the model binary file.");
+              }
            }
            returnValue++;
         }else{
@@ -3415,6 +3983,27 @@ int FastFAM::registerOption(map<string, vector<string>>& options_in){
         options_d["h2_limit"] = 1.6;
     }
 
+    curFlag = "--reml-slq";
+    options_d["slq_probes"] = 30;
+    options_d["slq_steps"] = 50;
+    if(options_in.find(curFlag) != options_in.end()){
+        options["slq"] = "yes";
+        auto cur_option = options_in[curFlag];
+        if(cur_option.size() > 2){
+            LOGGER.e(0, curFlag + " takes at most two values: the number of probes and the number of Lanczos steps.");
+        }
+        if(cur_option.size() >= 1){
+            options_d["slq_probes"] = stoi(cur_option[0]);
+        }
+        if(cur_option.size() == 2){
+            options_d["slq_steps"] = stoi(cur_option[1]);
+        }
+        if(options_d["slq_probes"] < 1 || options_d["slq_steps"] < 1){
+            LOGGER.e(0, curFlag + " needs positive numbers of probes and Lanczos steps.");
+        }
+        options_in.erase(curFlag);
+    }
+
     //random seed
     curFlag = "--seed";
     if(options_in.find(curFlag) != options_in.end()){
@@ -3485,13 +4074,117 @@ int FastFAM::registerOption(map<string, vector<string>>& options_in){
         options_d["grid_size"] = 11;
     }
 
+    if(options_in.find("--shard") != options_in.end() && !processFunctions.empty()){
+        if(model_only){
+            LOGGER.e(0, "--model-only can't be used with --shard, the model is fitted once for all the shards.");
+        }
+        if(options["model_file"] == ""){
+            LOGGER.w(0, "each shard fits the fastGWA model again. Fit it once by --model-only, and run the shards with --load-model.");
+        }
+    }
+
+    curFlag = "--merge-shards";
+    if(options_in.find(curFlag) != options_in.end()){
+        if(options_in[curFlag].size() != 1){
+            LOGGER.e(0, curFlag + " takes the number of shards.");
+        }
+        int num_shards = 0;
+        try{
+            num_shards = std::stoi(options_in[curFlag][0]);
+        }catch(std::exception&){
+            LOGGER.e(0, "invalid number of shards: " + options_in[curFlag][0] + ".");
+        }
+        if(num_shards < 1){
+            LOGGER.e(0, curFlag + " should be >= 1.");
+        }
+        options_d["merge_shards"] = num_shards;
+        options["merge_prefix"] = options_in["out"][0];
+        processFunctions.push_back("merge_shards");
+        options_in.erase(curFlag);
+        returnValue++;
+    }
+
     return returnValue;
 }
 
+// concatenates <out>.shard_N_i.fastGWA in the order of the shards. The shards
+//  must all be present, complete and have the same header
+void FastFAM::mergeShards(){
+    int num_shards = (int)options_d["merge_shards"];
+    string out_file = options["out"];
+    LOGGER << "Merging " << num_shards << " shards of fastGWA results into [" << out_file << "]..." << std::endl;
+
+    vector<string> files(num_shards);
+    for(int i = 0; i < num_shards; i++){
+        files[i] = options["merge_prefix"] + Marker::shardTag(num_shards, i + 1) + ".fastGWA";
+        if(!checkFileReadable(files[i])){
+            if(checkFileReadable(files[i] + ".bin")){
+                LOGGER.e(0, "binary results can't be merged, save the shards in text format to merge.");
+            }
+            LOGGER.e(0, "can't read the shard [" + files[i] + "].");
+        }
+    }
+
+    FILE *hOut = fopen(out_file.c_str(), "wb");
+    if(!hOut){
+        LOGGER.e(0, "can't open [" + out_file + "] to write.");
+    }
+    vector<char> buf(8 * 1024 * 1024);
+    string header;
+    uint64_t total_lines = 0;
+    for(int i = 0; i < num_shards; i++){
+        FILE *hIn = fopen(files[i].c_str(), "rb");
+        if(!hIn){
+            LOGGER.e(0, "can't open the shard [" + files[i] + "] to read.");
+        }
+        // header line
+        string cur_header;
+        int c;
+        while((c = fgetc(hIn)) != EOF && c != '\n'){
+            cur_header += (char)c;
+        }
+        if(c == EOF){
+            LOGGER.e(0, "the shard [" + files[i] + "] is empty or truncated.");
+        }
+        if(i == 0){
+            header = cur_header;
+            fputs((header + "\n").c_str(), hOut);
+        }else if(cur_header != header){
+            LOGGER.e(0, "the header of [" + files[i] + "] is different from that of [" + files[0] + "].");
+        }
+
+        uint64_t num_lines = 0;
+        char last_char = '\n';
+        size_t num_read;
+        while((num_read = fread(buf.data(), 1, buf.size(), hIn)) > 0){
+            num_lines += std::count(buf.data(), buf.data() + num_read, '\n');
+            last_char = buf[num_read - 1];
+            if(fwrite(buf.data(), 1, num_read, hOut) != num_read){
+                LOGGER.e(0, "can't write to [" + out_file + "].");
+            }
+        }
+        fclose(hIn);
+        // an interrupted job leaves a partial line
+        if(last_char != '\n'){
+            LOGGER.e(0, "the shard [" + files[i] + "] is truncated, please run this shard again.");
+        }
+        LOGGER << "  shard " << i + 1 << ": " << num_lines << " variants." << std::endl;
+        total_lines += num_lines;
+    }
+    if(fclose(hOut) != 0){
+        LOGGER.e(0, "can't write to [" + out_file + "].");
+    }
+    LOGGER << "Results of " << total_lines << " variants have been saved to [" << out_file << "]." << std::endl;
+}
+
 
 void FastFAM::processMain(){
     vector<function<void (uintptr_t *, const vector<uint32_t> &)>> callBacks;
     for(auto &process_function : processFunctions){
+        if(process_function == "merge_shards"){
+            mergeShards();
+            continue;
+        }
         if(process_function == "fast_fam"){
             FastFAM ffam;
             if(options.find("save_inv") != options.end()){
@@ -3562,9 +4255,9 @@ void FastFAM::processFAMreg(){
 
     LOGGER << "fastGWA-BB results will be saved in text format to [" << sFileName << "]." << std::endl;
     osOut.open(sFileName.c_str());
-    vector<string> header = {"GENE", "START", "END", "VAR_N", "MAF_MEAN", "BETA", "SE", "P"};
+    vector<string> header = {"GENE", "START", "END", "VAR_N", "MAF_MEAN", "BETA", "SE", "P", "P_SKAT", "P_ACATV", "P_ACATO"};
     if(bBinary){
-        header = {"GENE", "START", "END", "VAR_N", "MAF_MEAN", "T", "SE_T", "P_noSPA", "BETA", "SE",  "P",  "CONVERGE"};
+        header = {"GENE", "START", "END", "VAR_N", "MAF_MEAN", "T", "SE_T", "P_noSPA", "BETA", "SE",  "P",  "CONVERGE", "P_SKAT", "P_ACATV", "P_ACATO"};
     }
     string header_string = boost::algorithm::join(header, "\t");
     if(osOut.bad()){
@@ -3588,105 +4281,75 @@ void FastFAM::processFAMreg(){
         LOGGER << "  Filtering out variants with missingness rate > 0.10, or customise it with --geno flag." << std::endl;
     }
 
+    // the markers of a set are in positional order, sort the sets by span
+    vector<uint32_t> setOrder(numGeneBlock);
+    std::iota(setOrder.begin(), setOrder.end(), 0);
+    std::stable_sort(setOrder.begin(), setOrder.end(), [&genelist](uint32_t a, uint32_t b){
+            const vector<uint32_t> &ga = genelist[a].second, &gb = genelist[b].second;
+            return ga.front() < gb.front() || (ga.front() == gb.front() && ga.back() < gb.back());
+            });
+    vector<uint32_t> allMarkers;
+    for(auto &gene : genelist){
+        allMarkers.insert(allMarkers.end(), gene.second.begin(), gene.second.end());
+    }
+    std::sort(allMarkers.begin(), allMarkers.end());
+    allMarkers.erase(std::unique(allMarkers.begin(), allMarkers.end()), allMarkers.end());
+    LOGGER << "  " << allMarkers.size() << " variants in the sets are read once in positional order." << std::endl;
+
     //
     vector<function<void (uintptr_t *, const vector<uint32_t> &)>> calls;
-    calls.push_back(bind(&FastFAM::getX, this, _1, _2));
+    calls.push_back(bind(&FastFAM::cacheSetMarker, this, _1, _2));
     int nMarker = 100;
+    setCache.clear();
+    uint32_t nextLoad = 0;
+
+    // results are kept to write in the order of the set list
+    vector<string> results(numGeneBlock);
 
     LOGGER.ts("LOOP_SET_TOT");
  
     for(int i = 0; i < numGeneBlock; i++){
-        string genename = genelist[i].first;
-        vector<uint32_t> &glist = genelist[i].second;
-        int curNumMarker = glist.size();
-        gAF.resize(curNumMarker);
-        gX.resize(num_indi, curNumMarker);
-        bValids.resize(curNumMarker);
-        gN.resize(curNumMarker);
-        num_gene_index = 0;
-        geno->loopDouble(glist, nMarker, true, false, false, false, calls, false);
-        
-        int move_seg = 0;
-        vector<uint32_t> keptIndex;
-        for(int j = 0; j < curNumMarker; j++){
-            if(!bValids[j]){
-                move_seg++;
-            }else{
-                if(move_seg != 0){
-                    gX.col(j - move_seg) = gX.col(j);
-                    gAF[j - move_seg] = gAF(j);
-                    gN[j - move_seg] = gN(j);
-                }
-                keptIndex.push_back(glist[j]);
+        uint32_t setIndex = setOrder[i];
+        string genename = genelist[setIndex].first;
+        vector<uint32_t> &glist = genelist[setIndex].second;
+
+        while(!setCache.empty() && setCache.front().index < glist.front()){
+            setCache.pop_front();
+        }
+        if(nextLoad < allMarkers.size() && allMarkers[nextLoad] <= glist.back()){
+            uint32_t loadEnd = std::upper_bound(allMarkers.begin() + nextLoad, allMarkers.end(), glist.back()) - allMarkers.begin();
+            // read ahead to keep the blocks of the loop full
+            loadEnd = std::max(loadEnd, std::min(nextLoad + nMarker, (uint32_t)allMarkers.size()));
+            vector<uint32_t> toLoad(allMarkers.begin() + nextLoad, allMarkers.begin() + loadEnd);
+            geno->loopDouble(toLoad, nMarker, true, false, false, false, calls, false);
+            nextLoad = loadEnd;
+        }
+
+        vector<const SetMarker *> kept;
+        kept.reserve(glist.size());
+        for(uint32_t index : glist){
+            auto it = std::lower_bound(setCache.begin(), setCache.end(), index,
+                    [](const SetMarker &item, uint32_t val){ return item.index < val; });
+            if(it != setCache.end() && it->index == index && it->valid){
+                kept.push_back(&(*it));
             }
         }
-        int nValidMarker = curNumMarker - move_seg;
-        if(nValidMarker == 0){
-            continue;
-        }
-        gAF.conservativeResize(nValidMarker);
-        gX.conservativeResize(num_indi, nValidMarker);
-        gN.conservativeResize(nValidMarker);
-
-        vector<bool> bFlip(nValidMarker, false);
-        for(int j = 0; j < nValidMarker; j++){
-            if(gAF(j) > 0.5){
-                double af = 1.0 - gAF(j);
-                gAF(j) = af;
-                gX.col(j) = -gX.col(j).array() + 2.0;
-                bFlip[j] = true;
-            }
-
-        }
-
-        VectorXd weight = StatLib::weightBetaMAF(gAF, 1, 25);
-        SpMat weights(nValidMarker, nValidMarker);
-        weights.setIdentity();
-        weights.diagonal() = weight; 
-
-        MatrixXd GW = gX * weights;
-
-        VectorXd GW1 = GW * MatrixXd::Ones(nValidMarker, 1);
-        VectorXd GW2 = GW1;
-        if(bPreciseCovar){
-            conditionCovarBinReg(GW1);
-        }else{
-            GW1 = GW1.array() - GW1.mean();
-        }
-        double varSNP = std::sqrt(GW1.dot(dWp.cwiseProduct(GW1)) * c_inf);
-        SPARes res;
-        res.score = GW1.dot(phenoVecMu);
-        double chisq = std::abs(res.score) / varSNP;
-        res.p = StatLib::pchisqd1(chisq * chisq);
-
-        res.bConverge = true;
-        if( chisq < spaCutOff){
-            res.p_adj = res.p;
-        }else{
-            vector<uint32_t> index0;
-            index0.reserve(num_indi);
-            double thresh = 1e-6;
-            for(uint32_t i = 0; i < num_indi; i++){
-                if(GW2[i] > thresh){
-                    index0.push_back(i);
-                }
+        int nValidMarker = kept.size();
+        if(nValidMarker != 0){
+            MatrixXd gX(num_indi, nValidMarker);
+            VectorXd gAF(nValidMarker);
+            #pragma omp parallel for
+            for(int j = 0; j < nValidMarker; j++){
+                genoToDense(kept[j]->geno, num_indi, gX.col(j).data());
+                gAF[j] = kept[j]->af;
             }
 
-            if(!bPreciseCovar) conditionCovarBinReg(GW1);
-            double q = GW1.dot(phenoVec);
-            double qinv = q - res.score - res.score;
-            SPA spa(q, qinv, GW1, index0);
-            spa.saddleProb(&res);
+            std::ostringstream os;
+            os << genename << "\t";
+            setTest(gX, gAF, os);
+            results[setIndex] = os.str();
         }
 
-        int rConverge = (int)res.bConverge;
-        double temp_beta = res.score / (varSNP *varSNP);
-        double se = std::abs(temp_beta) / sqrt(StatLib::qchisqd1(res.p_adj));
-
-        osOut << genename << "\t" << gAF.size() << "\t" << gAF.mean() << "\t"
-            << res.score << "\t" << varSNP << "\t" << res.p << "\t"
-            << temp_beta << "\t" << se << "\t" << res.p_adj << "\t" << rConverge << std::endl;
-
         int curNGene = i + 1;
         if(curNGene % 2000 == 0) {
             float elapse_time = LOGGER.tp("LOOP_SET_TOT");
@@ -3700,6 +4363,11 @@ void FastFAM::processFAMreg(){
         }
 
     }
+    setCache.clear();
+
+    for(auto &line : results){
+        osOut << line;
+    }
     osOut.close();
     //osSets.close();
 
@@ -3708,25 +4376,147 @@ void FastFAM::processFAMreg(){
     LOGGER.i(0, ss.str());
 }
 
-void FastFAM::getX(uintptr_t *genobuf, const vector<uint32_t> &markerIndex){
+void FastFAM::cacheSetMarker(uintptr_t *genobuf, const vector<uint32_t> &markerIndex){
     int num_marker = markerIndex.size();
-    vector<uint8_t> isValids(num_marker);
+    vector<SetMarker> items(num_marker);
+    #pragma omp parallel for schedule(dynamic)
     for(int i = 0; i < num_marker; i++){
-        int index_cur_marker = num_gene_index + i;
-        uint32_t cur_marker = markerIndex[i];
-        GenoBufItem item;
-        item.extractedMarkerIndex = cur_marker;
+        SetMarker &cur = items[i];
+        GenoBufItem &item = cur.geno;
+        item.extractedMarkerIndex = markerIndex[i];
+        item.bSparse = true;
         geno->getGenoDouble(genobuf, i, &item);
-        
-        bValids[index_cur_marker] = item.valid;
+
+        cur.index = markerIndex[i];
+        cur.valid = item.valid;
         if(item.valid){
-            Map< VectorXd > xvec(item.geno.data(), num_indi);
-            gX.col(index_cur_marker) = xvec;
-            gAF[index_cur_marker] = item.af;
-            gN[index_cur_marker] = item.nValidN;
+            cur.af = item.af;
+            if(cur.af > 0.5){
+                cur.af = 1.0 - cur.af;
+                if(item.isSparse){
+                    item.base = 2.0 - item.base;
+                    for(double &value : item.nzValue){
+                        value = 2.0 - value;
+                    }
+                }else{
+                    for(double &value : item.geno){
+                        value = 2.0 - value;
+                    }
+                }
+            }
         }
     }
-    num_gene_index += num_marker;
+    for(auto &cur : items){
+        setCache.push_back(std::move(cur));
+    }
+}
+
+// burden test with SPA, SKAT and ACAT of the variants with Beta(1, 25) weights,
+//   SKAT and ACAT-V are adjusted by the SPA of the single variant tests
+void FastFAM::setTest(const MatrixXd &gX, const VectorXd &gAF, std::ostream &os){
+    int nValidMarker = gX.cols();
+    VectorXd weight = StatLib::weightBetaMAF(gAF, 1, 25);
+    MatrixXd GW = gX * weight.asDiagonal();
+
+    VectorXd GW1 = GW.rowwise().sum();
+    VectorXd GW2 = GW1;
+    if(bPreciseCovar){
+        conditionCovarBinReg(GW1);
+    }else{
+        GW1 = GW1.array() - GW1.mean();
+    }
+    double varSNP = std::sqrt(GW1.dot(dWp.cwiseProduct(GW1)) * c_inf);
+    SPARes res;
+    res.score = GW1.dot(phenoVecMu);
+    double chisq = std::abs(res.score) / varSNP;
+    res.p = StatLib::pchisqd1(chisq * chisq);
+
+    res.bConverge = true;
+    if( chisq < spaCutOff){
+        res.p_adj = res.p;
+    }else{
+        vector<uint32_t> index0;
+        index0.reserve(num_indi);
+        double thresh = 1e-6;
+        for(uint32_t i = 0; i < num_indi; i++){
+            if(GW2[i] > thresh){
+                index0.push_back(i);
+            }
+        }
+
+        if(!bPreciseCovar) conditionCovarBinReg(GW1);
+        double q = GW1.dot(phenoVec);
+        double qinv = q - res.score - res.score;
+        SPA spa(q, qinv, GW1, index0);
+        spa.saddleProb(&res);
+    }
+
+    int rConverge = (int)res.bConverge;
+    double temp_beta = res.score / (varSNP *varSNP);
+    double se = std::abs(temp_beta) / sqrt(StatLib::qchisqd1(res.p_adj));
+
+    // SKAT: Q = sum of the squared weighted scores, a mixture of chi-squares
+    //   with the eigenvalues of the covariance of the scores
+    MatrixXd GWc = GW;
+    if(bPreciseCovar){
+        GWc -= covar * (H * GW);
+    }else{
+        GWc.rowwise() -= GW.colwise().mean();
+    }
+    VectorXd scores = GWc.transpose() * phenoVecMu;
+    MatrixXd covScore = c_inf * (GWc.transpose() * dWp.asDiagonal() * GWc);
+
+    // single variant score tests, with SPA beyond the cut-off as the burden
+    //   test; the variance of an SPA adjusted score is then taken as
+    //   score^2 / qchisq(p_SPA), and the covariance of the scores is rescaled
+    //   to it for SKAT (as SAIGE-GENE), so that case-control imbalance and
+    //   rare variants do not inflate SKAT and ACAT-V
+    VectorXd chisqs = scores.array().square() / covScore.diagonal().array();
+    VectorXd pVars(nValidMarker);
+    StatLib::pchisqd1(chisqs.data(), pVars.data(), nValidMarker);
+    VectorXd scaleVar = VectorXd::Ones(nValidMarker);
+    for(int j = 0; j < nValidMarker; j++){
+        if(!(std::sqrt(chisqs[j]) >= spaCutOff)) continue;
+        vector<uint32_t> index0;
+        for(uint32_t i = 0; i < num_indi; i++){
+            if(GW(i, j) > 1e-6){
+                index0.push_back(i);
+            }
+        }
+        VectorXd gj = GWc.col(j);
+        if(!bPreciseCovar) conditionCovarBinReg(gj);
+        SPARes resVar;
+        resVar.score = scores[j];
+        resVar.p = pVars[j];
+        double q = gj.dot(phenoVec);
+        SPA spa(q, q - 2.0 * scores[j], gj, index0);
+        spa.saddleProb(&resVar);
+        if(!resVar.bConverge || !(resVar.p_adj > 0)) continue;
+        pVars[j] = resVar.p_adj;
+        double chisqAdj = StatLib::qchisqd1(resVar.p_adj);
+        if(chisqAdj > 0 && std::isfinite(chisqAdj)){
+            scaleVar[j] = std::sqrt(chisqs[j] / chisqAdj);
+        }
+    }
+    covScore = scaleVar.asDiagonal() * covScore * scaleVar.asDiagonal();
+
+    Eigen::SelfAdjointEigenSolver<MatrixXd> eig(covScore, Eigen::EigenvaluesOnly);
+    VectorXd lambda = eig.eigenvalues();
+    double maxLambda = lambda.maxCoeff();
+    VectorXd lambdaKept = (lambda.array() > maxLambda * 1e-8).select(lambda, 0);
+    double pSKAT = StatLib::pchisqsum(scores.squaredNorm(), lambdaKept);
+
+    // ACAT-V: single variant score tests combined with the weights
+    double pACATV = StatLib::acat(pVars, weight);
+
+    VectorXd pOmni(3);
+    pOmni << res.p_adj, pSKAT, pACATV;
+    double pACATO = StatLib::acat(pOmni, VectorXd::Ones(3));
+
+    os << nValidMarker << "\t" << gAF.mean() << "\t"
+        << res.score << "\t" << varSNP << "\t" << res.p << "\t"
+        << temp_beta << "\t" << se << "\t" << res.p_adj << "\t" << rConverge << "\t"
+        << pSKAT << "\t" << pACATV << "\t" << pACATO << "\n";
 }
 
 bool FastFAM::covarGLM(const VectorXd& phenoVec, const MatrixXd& covar, Ref<VectorXd> est_beta, int maxIter, double thresh){
@@ -3773,8 +4563,7 @@ bool checkNAN(const MatrixXd &mat){
 
 double FastFAM::binLogL(double cur_tao, const SpMat& fam, const SpMat& W, const Ref<VectorXd> Y, const Ref<MatrixXd> X){
     SpMat V = W + cur_tao * fam;
-    Eigen::SimplicialLDLT<SpMat> solverV;
-    solverV.compute(V);
+    Eigen::SimplicialLDLT<SpMat> &solverV = factorizeGridV(V);
     if(solverV.info() != Eigen::Success){
         LOGGER.e(0, "the V matrix is not invertible.");
     }
@@ -3811,6 +4600,8 @@ bool FastFAM::binGridREML(const SpMat& fam, Ref<VectorXd> est_a, int maxIter, do
     SpMat W(num_indi, num_indi);
     W.setIdentity();
 
+    resetGridSolvers();
+
    //init first run
     VectorXd Xa_b = covar * est_a;
     VectorXd Xa_b_exp = Xa_b.array().exp();
@@ -3827,7 +4618,9 @@ bool FastFAM::binGridREML(const SpMat& fam, Ref<VectorXd> est_a, int maxIter, do
     
         W.diagonal() = var_mu_i;
         SpMat V = W + cur_tao * fam;
-        solverV.compute(V);
+        // the pattern of V = W + tao * fam stays the same in all iterations
+        solverV.analyzePattern(V);
+        solverV.factorize(V);
 
         if(solverV.info() != Eigen::Success){
             LOGGER.e(0, "can't invert the V matrix!");
@@ -4035,7 +4828,7 @@ bool FastFAM::binGridREML(const SpMat& fam, Ref<VectorXd> est_a, int maxIter, do
             numAbTol = 0;
         }
         SpMat V = W + cur_tao * fam;
-        solverV.compute(V);
+        solverV.factorize(V);
 
         if(solverV.info() != Eigen::Success){
             LOGGER.e(0, "can't invert the V matrix.");
@@ -4077,6 +4870,7 @@ bool FastFAM::binGridREML(const SpMat& fam, Ref<VectorXd> est_a, int maxIter, do
     if(b_reml){
         out.close();
     }
+    gridSolvers.clear();
 
     if(!bConverge){
         if(numAbTol >=5){
@@ -4100,7 +4894,7 @@ bool FastFAM::binGridREML(const SpMat& fam, Ref<VectorXd> est_a, int maxIter, do
     // for 
     W.diagonal() = var_mu_i;
     SpMat V = W + cur_tao * fam;
-    solverV.compute(V);
+    solverV.factorize(V);
 
     taoVal = cur_tao;
 
@@ -4167,29 +4961,8 @@ void FastFAM::initBinary(const SpMat &fam){
         inv_id.close();
         LOGGER << "Sample information have been saved to [" << id_file << "]." << std::endl;
 
-        char magic[5];
-        magic[0] = 'f';
-        magic[1] = 'G';
-        magic[2] = 'L';
-        magic[3] = 'M';
-        magic[4] = '\0';
- 
-        string bin_file = options["out"] + ".mdl.bin2";
-        FILE * pFile = fopen(bin_file.c_str(), "wb");
-        // TODO check the output
-        fwrite(magic, 5, sizeof(char), pFile);
-        fwrite(&num_indi, 1, sizeof(uint32_t), pFile);
-        uint32_t col_covar = covar.cols();
-        fwrite(&col_covar, 1, sizeof(uint32_t), pFile);
-        fwrite(&bPreciseCovar, 1, sizeof(bool), pFile);
-
-        fwrite(&taoVal, 1, sizeof(double), pFile);
-        fwrite(&c_inf, 1, sizeof(double), pFile);
-        fwrite(mu.data(), mu.size(), sizeof(double), pFile);
-        fwrite(phenoVec.data(), phenoVec.size(), sizeof(double), pFile);
-        fwrite(covar.data(), covar.rows() * covar.cols(), sizeof(double), pFile);
-        fwrite(H.data(), H.rows() * H.cols(), sizeof(double), pFile);
-        fclose(pFile);
+        string bin_file = options["out"] + ".mdl.bin3";
+        saveModelMap(bin_file);
         LOGGER << "Data for model have been saved to [" << bin_file << "]." << std::endl;
     }
     ViX.resize(0,0);
@@ -4199,24 +4972,46 @@ void FastFAM::initBinary(const SpMat &fam){
 
 void FastFAM::binGrammar_func(uintptr_t *genobuf, const vector<uint32_t> &markerIndex){
     int nMarker = markerIndex.size();
-    #pragma omp parallel for schedule(dynamic)
-    for(int i = 0; i < nMarker; i++){
-        int index_cur_marker = num_grammar_markers + i;
-        GenoBufItem item;
-        item.extractedMarkerIndex = markerIndex[i];
-        geno->getGenoDouble(genobuf, i, &item);
-        bValids[index_cur_marker] = item.valid;
-        if(item.valid){
-            Map< VectorXd > curGeno(item.geno.data(), num_indi);
-            if(bPreciseCovar) conditionCovarBinReg(curGeno);
-            //VectorXd PY = solverV.solve(Y) - ViX * inv_XtVX_ViX * Y;
-            VectorXd PG = solverV.solve(curGeno) - ViX * (inv_XtVX_ViX * curGeno);
+    // blocks of markers: multi-RHS solves with the factor of V, and GEMMs
+    //   for the covariates, instead of a pair of triangular solves per marker.
+    //   The solve itself is single threaded, each thread takes a slice
+    const int nSlice = 16;
+    int nBlock = nSlice * std::max(4, omp_get_max_threads());
+    MatrixXd G, PG;
+    for(int start = 0; start < nMarker; start += nBlock){
+        int num = std::min(nBlock, nMarker - start);
+        G.setZero(num_indi, num);
+        #pragma omp parallel for schedule(dynamic)
+        for(int j = 0; j < num; j++){
+            int i = start + j;
+            int index_cur_marker = num_grammar_markers + i;
+            GenoBufItem item;
+            item.extractedMarkerIndex = markerIndex[i];
+            geno->getGenoDouble(genobuf, i, &item);
+            bValids[index_cur_marker] = item.valid;
+            if(item.valid){
+                G.col(j) = Map<VectorXd>(item.geno.data(), num_indi);
+            }
+        }
+
+        if(bPreciseCovar) G -= covar * (H * G);
+        //PY = solverV.solve(Y) - ViX * inv_XtVX_ViX * Y;
+        PG.resize(num_indi, num);
+        #pragma omp parallel for schedule(dynamic)
+        for(int j = 0; j < num; j += nSlice){
+            int cols = std::min(nSlice, num - j);
+            PG.middleCols(j, cols) = solverV.solve(G.middleCols(j, cols));
+        }
+        PG.noalias() -= ViX * (inv_XtVX_ViX * G);
+
+        #pragma omp parallel for
+        for(int j = 0; j < num; j++){
+            int index_cur_marker = num_grammar_markers + start + j;
+            if(!bValids[index_cur_marker]) continue;
             //VectorXd centerGeno = curGeno.array() - curGeno.mean();
             //VectorXd WG = dWp.cwiseProduct(centerGeno);
             //double temp_gamma = curGeno.dot(PG) / centerGeno.dot(WG);
-            VectorXd WG = dWp.cwiseProduct(curGeno);
-            double temp_gamma = curGeno.dot(PG) / curGeno.dot(WG);
-
+            double temp_gamma = G.col(j).dot(PG.col(j)) / G.col(j).dot(dWp.cwiseProduct(G.col(j)));
             v_c_infs[index_cur_marker] = temp_gamma;
         }
     }
@@ -4349,64 +5144,102 @@ void FastFAM::estBinGamma(){
 void FastFAM::calculate_spa(uintptr_t *genobuf, const vector<uint32_t> &markerIndex){
     int num_marker = markerIndex.size();
     vector<uint8_t> isValids(num_marker);
-    #pragma omp parallel for schedule(dynamic)
-    for(int i = 0; i < num_marker; i++){
-        uint32_t cur_marker = markerIndex[i];
-        GenoBufItem item;
-        item.extractedMarkerIndex = cur_marker;
-        geno->getGenoDouble(genobuf, i, &item);
-        
-        isValids[i] = item.valid;
-        if(!item.valid){
-            continue;
+    // blocks of markers, the covariates are regressed out of a block by GEMMs
+    int nBlock = 64;
+    MatrixXd X, X0;
+    vector<double> means(nBlock);
+    // without the precise covariates, the sparse markers are tested on their
+    //   carriers and only expanded for the saddle point
+    static double sumDWp = dWp.sum();
+    static double sumMu = phenoVecMu.sum();
+    vector<GenoBufItem> items(nBlock);
+    for(int start = 0; start < num_marker; start += nBlock){
+        int num = std::min(nBlock, num_marker - start);
+        X0.setZero(num_indi, num);
+        #pragma omp parallel for schedule(dynamic)
+        for(int j = 0; j < num; j++){
+            int i = start + j;
+            GenoBufItem &item = items[j];
+            item.extractedMarkerIndex = markerIndex[i];
+            item.bSparse = !bPreciseCovar;
+            item.bDosage = true;
+            geno->getGenoDouble(genobuf, i, &item);
+
+            isValids[i] = item.valid;
+            if(!item.valid){
+                continue;
+            }
+            if(!item.isSparse){
+                genoToDense(item, num_indi, X0.col(j).data());
+            }
+            means[j] = item.mean;
+            af[i] = (float)item.af;
+            countMarkers[i] = item.nValidN;
+            info[i] = item.info;
         }
 
-        Map< VectorXd > xvec(item.geno.data(), num_indi);
-        VectorXd xvec2 = xvec;
+        X = X0;
+        if(bPreciseCovar) X -= covar * (H * X0);
 
-        if(bPreciseCovar) conditionCovarBinReg(xvec);
+        #pragma omp parallel for schedule(dynamic)
+        for(int j = 0; j < num; j++){
+            int i = start + j;
+            if(!isValids[i]){
+                continue;
+            }
 
-        double varSNP = std::sqrt(xvec.dot(dWp.cwiseProduct(xvec)) * c_inf);
- 
-        SPARes res;
-        res.score = xvec.dot(phenoVecMu);
-        double chisq = std::abs(res.score) / varSNP;
+            Ref<VectorXd> xvec = X.col(j);
+            Ref<VectorXd> xvec2 = X0.col(j);
+            const GenoBufItem &item = items[j];
 
-        res.p = StatLib::pchisqd1(chisq * chisq);
+            double varSNP;
+            SPARes res;
+            if(item.isSparse){
+                varSNP = std::sqrt(genoWeightedSquaredNorm(item, dWp.data(), sumDWp) * c_inf);
+                res.score = genoDot(item, phenoVecMu.data(), sumMu);
+            }else{
+                varSNP = std::sqrt(xvec.dot(dWp.cwiseProduct(xvec)) * c_inf);
+                res.score = xvec.dot(phenoVecMu);
+            }
+            double chisq = std::abs(res.score) / varSNP;
 
-        res.bConverge = true;
-        if( chisq < spaCutOff){
-            res.p_adj = res.p;
-        }else{
-            vector<uint32_t> index0;
-            index0.reserve(num_indi);
-            double thresh = -item.mean + 1e-6;
-            //double thresh = 1e-6;
-            for(uint32_t i = 0; i < num_indi; i++){
-                if(xvec2[i] > thresh){
-                    index0.push_back(i);
+            res.p = StatLib::pchisqd1(chisq * chisq);
+
+            res.bConverge = true;
+            if( chisq < spaCutOff){
+                res.p_adj = res.p;
+            }else{
+                if(item.isSparse){
+                    genoToDense(item, num_indi, xvec.data());
+                    xvec2 = xvec;
+                }
+                vector<uint32_t> index0;
+                index0.reserve(num_indi);
+                double thresh = -means[j] + 1e-6;
+                //double thresh = 1e-6;
+                for(uint32_t k = 0; k < num_indi; k++){
+                    if(xvec2[k] > thresh){
+                        index0.push_back(k);
+                    }
                 }
-            }
 
-            if(!bPreciseCovar) conditionCovarBinReg(xvec);
+                if(!bPreciseCovar) conditionCovarBinReg(xvec);
 
-            double q = xvec.dot(phenoVec);
-            double qinv = q - res.score - res.score;
-            SPA spa(q, qinv, xvec, index0);
-            spa.saddleProb(&res);
-        }
+                double q = xvec.dot(phenoVec);
+                double qinv = q - res.score - res.score;
+                SPA spa(q, qinv, xvec, index0);
+                spa.saddleProb(&res);
+            }
 
-        Tscore[i] = (float)res.score; //* geno->RDev[cur_raw_marker]; 
-        Tse[i] = (float)varSNP;
-        p[i] = res.p; 
-        padj[i] = res.p_adj;
-        rConverge[i] = res.bConverge;
-        af[i] = (float)item.af;
-        countMarkers[i] = item.nValidN;
-        info[i] = item.info;
-        double temp_beta = res.score / (varSNP *varSNP);
-        beta[i] = (float) temp_beta;
-        se[i] = std::abs(temp_beta) / sqrt(StatLib::qchisqd1(res.p_adj));
+            Tscore[i] = (float)res.score; //* geno->RDev[cur_raw_marker]; 
+            Tse[i] = (float)varSNP;
+            p[i] = res.p; 
+            padj[i] = res.p_adj;
+            rConverge[i] = res.bConverge;
+            double temp_beta = res.score / (varSNP *varSNP);
+            beta[i] = (float) temp_beta;
+            se[i] = std::abs(temp_beta) / sqrt(StatLib::qchisqd1(res.p_adj));
+        }
     }
 
     output_res_spa(isValids, markerIndex);
@@ -100,6 +100,145 @@ GRM::GRM(){
 
 }
 
+// Sample parts (--make-grm-part) hold consecutive rows of the lower triangle and
+//  are concatenated. Marker shards (--shard) hold the whole GRM from disjoint
+//  markers, and are averaged with the number of SNPs of each pair as weights.
+void GRM::merge_shards(string out_file, int num_shards, bool bPart){
+    vector<string> files(num_shards);
+    string s_parts = to_string(num_shards);
+    for(int i = 0; i < num_shards; i++){
+        if(bPart){
+            string c_part = to_string(i + 1);
+            files[i] = out_file + ".part_" + s_parts + "_" + string(s_parts.length() - c_part.length(), '0') + c_part;
+        }else{
+            files[i] = out_file + Marker::shardTag(num_shards, i + 1);
+        }
+        if(!(checkFileReadable(files[i] + ".grm.id") && checkFileReadable(files[i] + ".grm.bin") &&
+                    checkFileReadable(files[i] + ".grm.N.bin"))){
+            LOGGER.e(0, "can't read GRM (*.grm.id, *.grm.bin, *.grm.N.bin) in [" + files[i] + "].");
+        }
+    }
+    LOGGER.i(0, "Merging " + to_string(num_shards) + (bPart ? " parts" : " shards") + " of GRM into [" + out_file + "]...");
+
+    vector<string> ids;
+    vector<uint64_t> row_starts(num_shards + 1, 0);
+    for(int i = 0; i < num_shards; i++){
+        vector<string> cur_ids = Pheno::read_sublist(files[i] + ".grm.id");
+        if(bPart){
+            ids.insert(ids.end(), cur_ids.begin(), cur_ids.end());
+            row_starts[i + 1] = ids.size();
+        }else if(i == 0){
+            ids = cur_ids;
+        }else if(cur_ids != ids){
+            LOGGER.e(0, "the sample IDs in [" + files[i] + ".grm.id] are different from those in the first shard.");
+        }
+    }
+
+    // the byte sizes tell whether each file is complete
+    auto checkSize = [&](int i, FILE *h, const string &suffix) {
+        uint64_t num_item;
+        if(bPart){
+            num_item = (row_starts[i] + 1 + row_starts[i + 1]) * (row_starts[i + 1] - row_starts[i]) / 2;
+        }else{
+            num_item = (1 + ids.size()) * ids.size() / 2;
+        }
+        if(!h || getFileSize(h) != num_item * sizeof(float)){
+            LOGGER.e(0, "the size of [" + files[i] + suffix + "] is not correct, the file may be truncated.");
+        }
+        return num_item;
+    };
+
+    FILE *ho_grm = fopen((out_file + ".grm.bin").c_str(), "wb");
+    FILE *ho_grmN = fopen((out_file + ".grm.N.bin").c_str(), "wb");
+    if(!ho_grm || !ho_grmN){
+        LOGGER.e(0, "can't open " + out_file + ".grm.bin or .grm.N.bin to write");
+    }
+
+    uint64_t itemRead = 26214400;
+    float *buf = new float[itemRead];
+    float *bufN = new float[itemRead];
+    if(bPart){
+        for(int i = 0; i < num_shards; i++){
+            LOGGER.i(2, "Part " + to_string(i + 1) + ": rows " + to_string(row_starts[i] + 1) + " to " + to_string(row_starts[i + 1]));
+            const char *suffixes[2] = {".grm.bin", ".grm.N.bin"};
+            FILE *ho[2] = {ho_grm, ho_grmN};
+            for(int k = 0; k < 2; k++){
+                FILE *hIn = fopen((files[i] + suffixes[k]).c_str(), "rb");
+                uint64_t remain = checkSize(i, hIn, suffixes[k]);
+                while(remain){
+                    uint64_t cur_read = std::min(remain, itemRead);
+                    readBytes(hIn, cur_read, buf);
+                    if(fwrite(buf, sizeof(float), cur_read, ho[k]) != cur_read){
+                        LOGGER.e(0, "can't write to [" + out_file + suffixes[k] + "].");
+                    }
+                    remain -= cur_read;
+                }
+                fclose(hIn);
+            }
+        }
+    }else{
+        uint64_t grm_size = 0;
+        for(int i = 0; i < num_shards; i++){
+            FILE *h_grm = fopen((files[i] + ".grm.bin").c_str(), "rb");
+            FILE *h_grmN = fopen((files[i] + ".grm.N.bin").c_str(), "rb");
+            grm_size = checkSize(i, h_grm, ".grm.bin");
+            checkSize(i, h_grmN, ".grm.N.bin");
+            fclose(h_grm);
+            fclose(h_grmN);
+        }
+        vector<double> sumGN(itemRead), sumN(itemRead);
+        float *bufS = new float[itemRead];
+        for(uint64_t start = 0; start < grm_size; start += itemRead){
+            uint64_t cur_read = std::min(grm_size - start, itemRead);
+            std::fill(sumGN.begin(), sumGN.end(), 0.0);
+            std::fill(sumN.begin(), sumN.end(), 0.0);
+            // the files are opened block by block, as hundreds of shards
+            //   would exceed the limit of open files
+            for(int i = 0; i < num_shards; i++){
+                FILE *h_grm = fopen((files[i] + ".grm.bin").c_str(), "rb");
+                FILE *h_grmN = fopen((files[i] + ".grm.N.bin").c_str(), "rb");
+                if(!h_grm || !h_grmN){
+                    LOGGER.e(0, "can't open GRM in [" + files[i] + "].");
+                }
+                fseek(h_grm, start * sizeof(float), SEEK_SET);
+                fseek(h_grmN, start * sizeof(float), SEEK_SET);
+                readBytes(h_grm, cur_read, bufS);
+                readBytes(h_grmN, cur_read, bufN);
+                fclose(h_grm);
+                fclose(h_grmN);
+                #pragma omp parallel for
+                for(uint64_t j = 0; j < cur_read; j++){
+                    sumGN[j] += (double)bufS[j] * bufN[j];
+                    sumN[j] += bufN[j];
+                }
+            }
+            #pragma omp parallel for
+            for(uint64_t j = 0; j < cur_read; j++){
+                bufN[j] = (float)sumN[j];
+                buf[j] = sumN[j] > 0 ? (float)(sumGN[j] / sumN[j]) : 0.0f;
+            }
+            if(fwrite(buf, sizeof(float), cur_read, ho_grm) != cur_read){
+                LOGGER.e(0, "can't write to [" + out_file + ".grm.bin].");
+            }
+            if(fwrite(bufN, sizeof(float), cur_read, ho_grmN) != cur_read){
+                LOGGER.e(0, "can't write to [" + out_file + ".grm.N.bin].");
+            }
+        }
+        delete[] bufS;
+    }
+    delete[] buf;
+    delete[] bufN;
+    if(fclose(ho_grm) != 0 || fclose(ho_grmN) != 0){
+        LOGGER.e(0, "can't write to [" + out_file + ".grm.bin, .grm.N.bin].");
+    }
+
+    std::ofstream o_id(out_file + ".grm.id");
+    if(!o_id) LOGGER.e(0, "can't write to [" + out_file + ".grm.id]");
+    std::copy(ids.begin(), ids.end(), std::ostream_iterator<string>(o_id, "\n"));
+    o_id.close();
+    LOGGER.i(0, "The merged GRM of " + to_string(ids.size()) + " individuals has been written to [" + out_file + ".grm.bin, .grm.N.bin, .grm.id].");
+}
+
 void GRM::subtract_grm(string mgrm_file, string out_file){
    std::ifstream mgrm(mgrm_file.c_str());
     if(!mgrm){
@@ -805,6 +944,8 @@ GRM::GRM(Pheno* pheno, Marker* marker) {
         fill_grm = (uint64_t)num_individual * (part_keep_indices.second + 1);
     }
 
+    num_fill_grm = fill_grm;
+    num_fill_N = fill_N;
     int ret_grm = posix_memalign((void **)&grm, 32, fill_grm * sizeof(double));
     if(ret_grm){
         LOGGER.e(0, "can't allocate enough memory to store the (parted) GRM: " + to_string(fill_grm*sizeof(double) / 1024.0/1024/1024) + "GB required.");
@@ -930,6 +1071,50 @@ uint32_t popcounts(uint64_t dw){
     return popcount(dw);
 }
 
+// x x' of the sparse markers, x = b + d with d nonzero at the carriers only:
+//   b^2 + b d_i + b d_j for all the pairs, and d_i d_j for the pairs of carriers
+void GRM::add_sparse_GRM(const vector<int> &sparseIndex){
+    uint32_t first = part_keep_indices.first;
+    uint32_t n = part_keep_indices.second + 1;
+    uint64_t m = n - first;
+
+    double sumBase2 = 0;
+    vector<double> sumBaseDelta(n, 0.0);
+    vector<uint32_t> carriers;
+    vector<double> deltas;
+    for(int index : sparseIndex){
+        const GenoBufItem &item = gbufitems[index];
+        sumBase2 += item.base * item.base;
+        carriers.clear();
+        deltas.clear();
+        for(uint32_t k = 0; k < item.nzIndex.size(); k++){
+            uint32_t sample = item.nzIndex[k];
+            if(sample >= n) break;
+            double delta = item.nzValue[k] - item.base;
+            carriers.push_back(sample);
+            deltas.push_back(delta);
+            sumBaseDelta[sample] += item.base * delta;
+        }
+        // carriers are ascending, so c <= r
+        for(uint32_t a = 0; a < carriers.size(); a++){
+            uint32_t r = carriers[a];
+            if(r < first) continue;
+            for(uint32_t b = 0; b <= a; b++){
+                grm[carriers[b] * m + r - first] += deltas[a] * deltas[b];
+            }
+        }
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for(uint32_t c = 0; c < n; c++){
+        double *col = grm + c * m;
+        double colValue = sumBase2 + sumBaseDelta[c];
+        for(uint32_t r = std::max(c, first); r < n; r++){
+            col[r - first] += colValue + sumBaseDelta[r];
+        }
+    }
+}
+
 void GRM::calculate_GRM_blas(uintptr_t *buf, const vector<uint32_t> &markerIndex){
     int num_marker = markerIndex.size();
 
@@ -937,7 +1122,6 @@ void GRM::calculate_GRM_blas(uintptr_t *buf, const vector<uint32_t> &markerIndex
     static int n = part_keep_indices.second + 1;
     static int n_sample = n;
     static int s_n = n - m;
-    static int bytesStdGeno = sizeof(double) * n_sample;
 
    // GenoBufItem items[num_marker];
  
@@ -945,6 +1129,8 @@ void GRM::calculate_GRM_blas(uintptr_t *buf, const vector<uint32_t> &markerIndex
     for(int i = 0; i < num_marker; i++){
         GenoBufItem &item = gbufitems[i];
         item.extractedMarkerIndex = markerIndex[i];
+        item.bSparse = true;
+        item.bDosage = true;
         geno->getGenoDouble(buf, i, &item);
     }
 
@@ -958,9 +1144,18 @@ void GRM::calculate_GRM_blas(uintptr_t *buf, const vector<uint32_t> &markerIndex
 
     int curNumValidMarkers = validIndex.size();
 
+    // dense markers go to the rank-k update, the sparse are added by carriers.
+    //   PGEN dosages are converted straight into the panel of the update
+    int curNumDense = 0;
+    vector<int> sparseIndex;
     for(int i = 0; i < curNumValidMarkers; i++){
         int curIndex = validIndex[i];
-        memcpy(stdGeno + i * n_sample, gbufitems[curIndex].geno.data(), bytesStdGeno);
+        if(gbufitems[curIndex].isSparse){
+            sparseIndex.push_back(curIndex);
+        }else{
+            genoToDense(gbufitems[curIndex], n_sample, stdGeno + curNumDense * n_sample);
+            curNumDense++;
+        }
         sd.push_back(gbufitems[curIndex].sd);
         /*
         if(gbufitems[i].missing[41/64] & (1UL << (41 %64))){
@@ -973,24 +1168,27 @@ void GRM::calculate_GRM_blas(uintptr_t *buf, const vector<uint32_t> &markerIndex
    // A * At 
     if(part_keep_indices.first == 0){
 #if GCTA_CPU_x86
-        dsyrk(&uplo, &notrans, &n, &curNumValidMarkers, &alpha, stdGeno, &n_sample, &beta, grm, &m);
+        dsyrk(&uplo, &notrans, &n, &curNumDense, &alpha, stdGeno, &n_sample, &beta, grm, &m);
 #else
-        dsyrk_(&uplo, &notrans, &n, &curNumValidMarkers, &alpha, stdGeno, &n_sample, &beta, grm, &m);
+        dsyrk_(&uplo, &notrans, &n, &curNumDense, &alpha, stdGeno, &n_sample, &beta, grm, &m);
 #endif
     }else{
         //dgemm(&notrans, &trans, &m, &n, &num_marker, &alpha, stdGeno + part_keep_indices.first, &n_sample, stdGeno, &n_sample, &beta, grm, &m);
 #if GCTA_CPU_x86
-        dgemm(&notrans, &trans, &m, &s_n, &curNumValidMarkers, &alpha, stdGeno + part_keep_indices.first, &n_sample, stdGeno, &n_sample, &beta, grm, &m);
+        dgemm(&notrans, &trans, &m, &s_n, &curNumDense, &alpha, stdGeno + part_keep_indices.first, &n_sample, stdGeno, &n_sample, &beta, grm, &m);
 #else
-        dgemm_(&notrans, &trans, &m, &s_n, &curNumValidMarkers, &alpha, stdGeno + part_keep_indices.first, &n_sample, stdGeno, &n_sample, &beta, grm, &m);
+        dgemm_(&notrans, &trans, &m, &s_n, &curNumDense, &alpha, stdGeno + part_keep_indices.first, &n_sample, stdGeno, &n_sample, &beta, grm, &m);
 #endif
         double * grm_start = grm + ((uint64_t)s_n) * m;
 #if GCTA_CPU_x86
-        dsyrk(&uplo, &notrans, &m, &curNumValidMarkers, &alpha, stdGeno + part_keep_indices.first, &n_sample, &beta, grm_start, &m); 
+        dsyrk(&uplo, &notrans, &m, &curNumDense, &alpha, stdGeno + part_keep_indices.first, &n_sample, &beta, grm_start, &m); 
 #else
-        dsyrk_(&uplo, &notrans, &m, &curNumValidMarkers, &alpha, stdGeno + part_keep_indices.first, &n_sample, &beta, grm_start, &m); 
+        dsyrk_(&uplo, &notrans, &m, &curNumDense, &alpha, stdGeno + part_keep_indices.first, &n_sample, &beta, grm_start, &m); 
 #endif
     }
+    if(!sparseIndex.empty()){
+        add_sparse_GRM(sparseIndex);
+    }
 
     //memset(this->cmask_buf, 0, num_byte_cmask);
 
@@ -1855,6 +2053,35 @@ int GRM::registerOption(map<string, vector<string>>& options_in) {
         return_value++;
     }
 
+    string op_merge = "--merge-shards";
+    if(options_in.find(op_merge) != options_in.end() && options_in[op_merge].size() == 1){
+        int num_shards = 0;
+        try{
+            num_shards = std::stoi(options_in[op_merge][0]);
+        }catch(std::exception&){
+            LOGGER.e(0, "invalid number of shards: " + options_in[op_merge][0] + ".");
+        }
+        if(num_shards < 1){
+            LOGGER.e(0, op_merge + " should be >= 1.");
+        }
+        // marker shards from --shard, or sample parts from --make-grm-part
+        string s_parts = to_string(num_shards);
+        string part_tag = ".part_" + s_parts + "_" + string(s_parts.length() - 1, '0') + "1";
+        string merge_type = "";
+        if(checkFileReadable(options["out"] + Marker::shardTag(num_shards, 1) + ".grm.bin")){
+            merge_type = "shard";
+        }else if(checkFileReadable(options["out"] + part_tag + ".grm.bin")){
+            merge_type = "part";
+        }
+        if(merge_type != ""){
+            options["merge_type"] = merge_type;
+            options_d["merge_shards"] = num_shards;
+            processFunctions.push_back("merge_shards");
+            options_in.erase(op_merge);
+            return_value++;
+        }
+    }
+
     string op_grm = "--subtract-grm";
     if(options_in.find(op_grm) != options_in.end()){
         processFunctions.push_back("subtract_grm");
@@ -1964,6 +2191,29 @@ int GRM::registerOption(map<string, vector<string>>& options_in) {
 
 }
 
+// the partial sums over the markers finished, which are all deduce_GRM needs
+void GRM::setCheckpoint(const string &name, const vector<uint32_t> &processIndex){
+    string ckpt_name = name + (isDominance ? "_d" : "");
+    uint64_t num_sub_miss = index_keep.size() + 64;
+    geno->setCheckpoint(ckpt_name, processIndex, {{"GRM",
+            [this, num_sub_miss](std::ostream &os){
+                CheckpointIO::write(os, numValidMarkers);
+                CheckpointIO::write(os, finished_marker);
+                CheckpointIO::writeVector(os, sd);
+                CheckpointIO::writeArray(os, sub_miss, num_sub_miss);
+                CheckpointIO::writeArray(os, N, num_fill_N);
+                CheckpointIO::writeArray(os, grm, num_fill_grm);
+            },
+            [this, num_sub_miss](std::istream &is){
+                CheckpointIO::read(is, numValidMarkers);
+                CheckpointIO::read(is, finished_marker);
+                CheckpointIO::readVector(is, sd);
+                CheckpointIO::readArray(is, sub_miss, num_sub_miss);
+                CheckpointIO::readArray(is, N, num_fill_N);
+                CheckpointIO::readArray(is, grm, num_fill_grm);
+            }}});
+}
+
 void GRM::processMakeGRM(){
     nMarkerBlock = 128;
     gbufitems = new GenoBufItem[nMarkerBlock];
@@ -1993,10 +2243,12 @@ void GRM::processMakeGRM(){
     if(isMtd) isSTD = false;
     vector<uint32_t> processIndex = marker->get_extract_index_autosome();
     sd.reserve(processIndex.size());
+    setCheckpoint("grm", processIndex);
     LOGGER << "Computing GRM..." << std::endl;
     geno->loopDouble(processIndex, nMarkerBlock, true, true, isSTD, true, callBacks);
     LOGGER << "  Used " << numValidMarkers << " valid SNPs."<< std::endl;
     deduce_GRM();
+    geno->finishCheckpoint();
     delete[] gbufitems;
     posix_mem_free(stdGeno);
     geno->setGRMMode(false, false);
@@ -2031,10 +2283,12 @@ void GRM::processMakeGRMX(){
     if(isMtd) isSTD = false;
     vector<uint32_t> processIndex = marker->get_extract_index_X();
     sd.reserve(processIndex.size());
+    setCheckpoint("grmx", processIndex);
     LOGGER << "Computing GRM..." << std::endl;
     geno->loopDouble(processIndex, nMarkerBlock, true, true, isSTD, true, callBacks);
     LOGGER << numValidMarkers << " valid SNPs are included."<< std::endl;
     deduce_GRM();
+    geno->finishCheckpoint();
     delete[] gbufitems;
     posix_mem_free(stdGeno);
     geno->setGRMMode(false, false);
@@ -2094,6 +2348,10 @@ void GRM::processMain() {
             GRM grm;
             grm.subtract_grm(options["mgrm"], options["out"]);
         }
+        if(process_function == "merge_shards"){
+            GRM grm;
+            grm.merge_shards(options["out"], (int)options_d["merge_shards"], options["merge_type"] == "part");
+        }
     }
 
 }
@@ -42,6 +42,7 @@
 #include <Eigen/Eigen>
 #include <algorithm>
 #include "submods/Pgenlib/PgenReader.h"
+#include "submods/Pgenlib/PgenWriter.h"
 #include <numeric>
 
 #ifdef _WIN64
@@ -182,20 +183,25 @@ Geno::Geno(Pheno* pheno, Marker* marker) {
 
     // register format handlers subset manner
     preGenoDoubleFuncs["BED"] = &Geno::preGenoDouble_bed;
-    preGenoDoubleFuncs["PGEN"] = &Geno::preGenoDouble_bed;
+    preGenoDoubleFuncs["PGEN"] = &Geno::preGenoDouble_pgen;
     preGenoDoubleFuncs["BGEN"] = &Geno::preGenoDouble_bgen;
 
     getGenoDoubleFuncs["BED"] = &Geno::getGenoDouble_bed;
-    getGenoDoubleFuncs["PGEN"] = &Geno::getGenoDouble_bed;
+    getGenoDoubleFuncs["PGEN"] = &Geno::getGenoDouble_pgen;
     getGenoDoubleFuncs["BGEN"] = &Geno::getGenoDouble_bgen;
 
     endGenoDoubleFuncs["BED"] = &Geno::endGenoDouble_bed;
-    endGenoDoubleFuncs["PGEN"] = &Geno::endGenoDouble_bed;
+    endGenoDoubleFuncs["PGEN"] = &Geno::endGenoDouble_pgen;
     endGenoDoubleFuncs["BGEN"] = &Geno::endGenoDouble_bgen;
 
     readGenoFuncs["BED"] = &Geno::readGeno_bed;
-    readGenoFuncs["PGEN"] = &Geno::readGeno_bed;
+    readGenoFuncs["PGEN"] = &Geno::readGeno_pgen;
     readGenoFuncs["BGEN"] = &Geno::readGeno_bgen;
+
+    // PGEN without dosages is read in the 2-bit hard calls as BED
+    if(genoFormat == "PGEN" && !hasPgenDosage()){
+        genoFormat = "BED";
+    }
     
     //BED legacy codes
     num_raw_sample = pheno->count_raw();
@@ -219,6 +225,10 @@ Geno::Geno(Pheno* pheno, Marker* marker) {
     setMaxMAF(options_d["max_maf"]);
     setFilterInfo(options_d["info_score"]);
     setFilterMiss(1.0 - options_d["geno_rate"]);
+    sparseMAF = options_d["sparse_maf"];
+    if(sparseMAF > 0 && genoFormat != "BED"){
+        LOGGER.w(0, "--sparse-geno only applies to the hard calls of BED and PGEN, the " + genoFormat + " dosages are kept dense.");
+    }
 
     string filterprompt = "Threshold to filter variants:";
     bool outFilterPrompt = false;
@@ -454,14 +464,17 @@ void Geno::out_freq(string filename){
     LOGGER.i(0, "Saving allele frequencies...");
     std::ofstream o_freq(name_frq.c_str());
     if (!o_freq) { LOGGER.e(0, "cannot open the file [" + name_frq + "] to write"); }
-    vector<string> out_contents;
-    out_contents.reserve(AFA1.size() + 1);
-    out_contents.push_back("CHR\tSNP\tPOS\tA1\tA2\tAF\tNCHROBS");
-    for(int i = 0; i != AFA1.size(); i++){
-        out_contents.push_back(marker->get_marker(marker->getRawIndex(i)) + "\t" + to_string(AFA1[i])
-                               + "\t" + to_string(countMarkers[i]));
-    }
-    std::copy(out_contents.begin(), out_contents.end(), std::ostream_iterator<string>(o_freq, "\n"));
+    o_freq << "CHR\tSNP\tPOS\tA1\tA2\tAF\tNCHROBS\n";
+    marker->buildMarkerStr();
+    outWriter.write(AFA1.size(), o_freq, [&](uint32_t i, TextBuffer &buf){
+        uint32_t len;
+        buf.add(marker->getMarkerStrBuf(i, len), len);
+        buf.add('\t');
+        buf.addFixed(AFA1[i]);
+        buf.addFieldUInt(countMarkers[i]);
+        buf.add('\n');
+        return true;
+    });
     o_freq.close();
     LOGGER.i(0, "Allele frequencies of " + to_string(AFA1.size()) + " SNPs have been saved in the file [" + name_frq + "]");
 }
@@ -819,9 +832,143 @@ void Geno::readGeno_pgen(const vector<uint32_t> &extractIndex){
 }
 
 void Geno::getGenoDouble(uintptr_t *buf, int bufIndex, GenoBufItem* gbuf){
+    gbuf->isSparse = false;
+    gbuf->isDosage = false;
     (this->*getGenoDoubleFuncs[genoFormat])(buf, bufIndex, gbuf);
 }
 
+// sum(d * y) of the 16-bit dosages, converted per element in the vector unit
+static double dosageDot(const uint16_t *dosage, const double *y, uint32_t n){
+    double sum = 0;
+    #pragma omp simd reduction(+:sum)
+    for(uint32_t i = 0; i < n; i++){
+        sum += dosage[i] * y[i];
+    }
+    return sum;
+}
+
+double genoDot(const GenoBufItem &item, const double *y, double sumY){
+    if(item.isDosage){
+        uint32_t n = item.nValidN;
+        return item.dosageScale * dosageDot(item.dosage, y, n) + item.dosageOffset * sumY;
+    }
+    if(!item.isSparse){
+        double sum = 0;
+        for(uint32_t i = 0; i < item.geno.size(); i++){
+            sum += item.geno[i] * y[i];
+        }
+        return sum;
+    }
+    double sum = item.base * sumY;
+    for(uint32_t k = 0; k < item.nzIndex.size(); k++){
+        sum += (item.nzValue[k] - item.base) * y[item.nzIndex[k]];
+    }
+    return sum;
+}
+
+double genoWeightedSquaredNorm(const GenoBufItem &item, const double *w, double sumW){
+    if(item.isDosage){
+        uint32_t n = item.nValidN;
+        double sumWD = 0, sumWD2 = 0;
+        #pragma omp simd reduction(+:sumWD,sumWD2)
+        for(uint32_t i = 0; i < n; i++){
+            double d = item.dosage[i];
+            sumWD += w[i] * d;
+            sumWD2 += w[i] * d * d;
+        }
+        double a = item.dosageScale, b = item.dosageOffset;
+        return a * a * sumWD2 + 2.0 * a * b * sumWD + b * b * sumW;
+    }
+    if(!item.isSparse){
+        double sum = 0;
+        for(uint32_t i = 0; i < item.geno.size(); i++){
+            sum += item.geno[i] * item.geno[i] * w[i];
+        }
+        return sum;
+    }
+    double base2 = item.base * item.base;
+    double sum = base2 * sumW;
+    for(uint32_t k = 0; k < item.nzIndex.size(); k++){
+        sum += (item.nzValue[k] * item.nzValue[k] - base2) * w[item.nzIndex[k]];
+    }
+    return sum;
+}
+
+double genoSquaredNorm(const GenoBufItem &item, uint32_t n){
+    if(item.isDosage){
+        double a = item.dosageScale, b = item.dosageOffset;
+        return a * a * item.dosageSumSq + 2.0 * a * b * item.dosageSum + b * b * n;
+    }
+    if(!item.isSparse){
+        double sum = 0;
+        for(uint32_t i = 0; i < n; i++){
+            sum += item.geno[i] * item.geno[i];
+        }
+        return sum;
+    }
+    double sum = item.base * item.base * (n - item.nzIndex.size());
+    for(double value : item.nzValue){
+        sum += value * value;
+    }
+    return sum;
+}
+
+void genoMultiply(const GenoBufItem &item, const double *M, uint32_t rows, const double *rowSum, double *out){
+    if(item.isDosage){
+        for(uint32_t r = 0; r < rows; r++){
+            out[r] = item.dosageOffset * rowSum[r];
+        }
+        for(uint64_t i = 0; i < item.nValidN; i++){
+            const double *col = M + i * rows;
+            double value = item.dosageScale * item.dosage[i];
+            for(uint32_t r = 0; r < rows; r++){
+                out[r] += col[r] * value;
+            }
+        }
+        return;
+    }
+    if(!item.isSparse){
+        std::fill(out, out + rows, 0.0);
+        for(uint64_t i = 0; i < item.geno.size(); i++){
+            const double *col = M + i * rows;
+            double value = item.geno[i];
+            for(uint32_t r = 0; r < rows; r++){
+                out[r] += col[r] * value;
+            }
+        }
+        return;
+    }
+    for(uint32_t r = 0; r < rows; r++){
+        out[r] = item.base * rowSum[r];
+    }
+    for(uint32_t k = 0; k < item.nzIndex.size(); k++){
+        const double *col = M + (uint64_t)item.nzIndex[k] * rows;
+        double delta = item.nzValue[k] - item.base;
+        for(uint32_t r = 0; r < rows; r++){
+            out[r] += col[r] * delta;
+        }
+    }
+}
+
+void genoToDense(const GenoBufItem &item, uint32_t n, double *out){
+    if(item.isDosage){
+        double a = item.dosageScale, b = item.dosageOffset;
+        #pragma omp simd
+        for(uint32_t i = 0; i < n; i++){
+            out[i] = a * item.dosage[i] + b;
+        }
+        return;
+    }
+    if(!item.isSparse){
+        std::copy(item.geno.begin(), item.geno.begin() + n, out);
+        return;
+    }
+    std::fill(out, out + n, item.base);
+    for(uint32_t k = 0; k < item.nzIndex.size(); k++){
+        out[item.nzIndex[k]] = item.nzValue[k];
+    }
+}
+
 void Geno::setGenoItemSize(uint32_t &genoSize, uint32_t &missSize){
     genoSize = keepSampleCT;
     missSize = missPtrSize;
@@ -833,18 +980,41 @@ void Geno::getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
     uintptr_t *geno_buf = cur_buf;
     uintptr_t *dosage_present = cur_buf + pgenGenoPtrSize;
     uint16_t *dosage_main = reinterpret_cast<uint16_t*>(cur_buf + pgenGenoPtrSize + pgenDosagePresentPtrSize);
-    uint32_t dosage_ct = cur_buf[pgenGenoBuf1PtrSize - 1];
+    // the reader puts the count right after the dosages, as uint32_t
+    uint32_t dosage_ct = *reinterpret_cast<uint32_t*>(cur_buf + pgenGenoPtrSize + pgenDosagePresentPtrSize + pgenDosageMainPtrSize);
     uint8_t isSexXY = isMarkersSexXYs[curBufferIndex];
 
+    // samples of hard calls only, or missing, in a file with dosages; the missing
+    //   take the mean dosage of the others
+    vector<uint32_t> missIndex;
+    PgenReader::ExpandDosage(geno_buf, dosage_present, dosage_main, dosage_ct, keepSampleCT, missIndex);
+    uint32_t nMiss = missIndex.size();
+    if(nMiss == keepSampleCT){
+        gbuf->valid = false;
+        return;
+    }
+    if(nMiss){
+        uint64_t sum = 0;
+        for(uint32_t i = 0; i < keepSampleCT; i++){
+            sum += dosage_main[i];
+        }
+        uint16_t meanDosage = (uint16_t)((double)sum / (keepSampleCT - nMiss) + 0.5);
+        for(uint32_t index : missIndex){
+            dosage_main[index] = meanDosage;
+        }
+    }
+
     const vector<uint32_t> *curMaleIndex = NULL;
     if(isSexXY == 1){
         curMaleIndex = &keepMaleExtractIndex;
     }
 
     string err;
-    if(!PgenReader::CountHardDosage(cur_buf, dosage_main, dosage_present, curMaleIndex, keepSampleCT, dosage_ct, &snpinfo, err)){
+    if(!PgenReader::CountHardDosage(cur_buf, dosage_main, dosage_present, curMaleIndex, keepSampleCT, keepSampleCT, &snpinfo, err)){
         LOGGER.e(0, err);
     }
+    snpinfo.N = keepSampleCT - nMiss;
+    snpinfo.nMissRate = 1.0 * snpinfo.N / keepSampleCT;
 
     double af = snpinfo.af;
     double std = snpinfo.std;
@@ -853,6 +1023,7 @@ void Geno::getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
         std = 2.0 * af * (1.0 - af);
     }
     double maf = std::min(af, 1.0 - af);
+    gbuf->valid = false;
     if(maf >= min_maf && maf <= max_maf && snpinfo.nMissRate >= dFilterMiss){
         gbuf->valid = true;
         gbuf->af = af;
@@ -862,7 +1033,39 @@ void Geno::getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
         gbuf->sd = std;
 
         if(bMakeGeno){
-            // get get genotype in lookup table
+            if(std < 1.0e-50){
+                gbuf->valid = false;
+                return;
+            }
+            // dosages are fixed point of 1/16384
+            double center_value = bGenoCenter ? gbuf->mean : 0.0;
+            double rdev = bGenoStd ? sqrt(1.0 / std) : 1.0;
+            double scale = rdev / 16384.0;
+            double offset = -center_value * rdev;
+
+            if(gbuf->bDosage && isSexXY != 1){
+                uint64_t sum = 0, sumsq = 0;
+                #pragma omp simd reduction(+:sum,sumsq)
+                for(uint32_t i = 0; i < keepSampleCT; i++){
+                    uint64_t d = dosage_main[i];
+                    sum += d;
+                    sumsq += d * d;
+                }
+                gbuf->isDosage = true;
+                gbuf->dosage = dosage_main;
+                gbuf->dosageScale = scale;
+                gbuf->dosageOffset = offset;
+                gbuf->dosageSum = sum;
+                gbuf->dosageSumSq = sumsq;
+                gbuf->geno.clear();
+            }else{
+                gbuf->geno.resize(keepSampleCT);
+                double *pgeno = gbuf->geno.data();
+                #pragma omp simd
+                for(uint32_t i = 0; i < keepSampleCT; i++){
+                    pgeno[i] = dosage_main[i] * scale + offset;
+                }
+            }
             
             if(isSexXY == 1){
                 double weight;
@@ -876,7 +1079,10 @@ void Geno::getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
             }
         }
         if(bMakeMiss){
-            gbuf->missing.resize(missPtrSize, 0);
+            gbuf->missing.assign(missPtrSize, 0);
+            for(uint32_t index : missIndex){
+                gbuf->missing[index / 64] |= ((uintptr_t)1 << (index % 64));
+            }
         }
 
     }
@@ -973,6 +1179,31 @@ void Geno::getGenoDouble_bed(uintptr_t *buf, int idx, GenoBufItem* gbuf){
                    na = (psq - center_value)*rdev;
                 }
 
+                // rare markers: only the samples not homozygous for the major allele
+                if(gbuf->bSparse && isSexXY != 1 && std::min(snpinfo.af, 1.0 - snpinfo.af) < sparseMAF){
+                    uint32_t commonCode = snpinfo.af < 0.5 ? 0 : 2;
+                    vector<uint8_t> codes;
+                    PgenReader::ExtractSparseExt(cur_buf, keepMaskPtr, rawSampleCT, keepSampleCT, commonCode, gbuf->nzIndex, codes);
+                    const double values[4] = {a0, a1, a2, na};
+                    gbuf->isSparse = true;
+                    gbuf->base = values[commonCode];
+                    gbuf->nzValue.resize(codes.size());
+                    for(uint32_t k = 0; k < codes.size(); k++){
+                        gbuf->nzValue[k] = values[codes[k]];
+                    }
+                    gbuf->geno.clear();
+                    if(bMakeMiss){
+                        gbuf->missing.assign(missPtrSize, 0);
+                        for(uint32_t k = 0; k < codes.size(); k++){
+                            if(codes[k] == 3){
+                                uint32_t index = gbuf->nzIndex[k];
+                                gbuf->missing[index / 64] |= (1UL << (index % 64));
+                            }
+                        }
+                    }
+                    return;
+                }
+
                 const double lookup[32] __attribute__ ((aligned (16))) = GET_TABLE16(a0, a1, a2, na);
                 gbuf->geno.resize(keepSampleCT);
                 uintptr_t * pmiss = NULL;
@@ -1027,6 +1258,12 @@ void Geno::readGeno_bgen(const vector<uint32_t> &extractIndex){
             [&raw_marker_index](size_t pos){return raw_marker_index[pos];});
 
     openGFiles();
+    // records of consecutive markers are adjacent, large buffers turn them
+    //   into few reads and the seek is skipped when already in place
+    vector<uint64_t> nextPos(gFiles.size(), 0);
+    for(auto &hFile : gFiles){
+        setvbuf(hFile, NULL, _IOFBF, 8 * 1024 * 1024);
+    }
 
     uintptr_t *g_buf = NULL;
     uint32_t numMarker = extractIndex.size();
@@ -1045,7 +1282,10 @@ void Geno::readGeno_bgen(const vector<uint32_t> &extractIndex){
 
             uint64_t pos, size;
             marker->getStartPosSize(rawIndex, pos, size);
-            fseek(bgenFile, pos, SEEK_SET);
+            if(pos != nextPos[fileIndex]){
+                fseek(bgenFile, pos, SEEK_SET);
+            }
+            nextPos[fileIndex] = pos + size;
             if(fread(g_buf, sizeof(char), size, bgenFile) != size){
                 int lag_index = rawIndex - baseIndexLookup[fileIndex];
                 LOGGER.e(0, "can't read " + to_string(lag_index) + "th SNP in [" + geno_files[fileIndex] + "].");
@@ -1105,15 +1345,10 @@ void calDosagePhase_bgen(uint32_t prob1, uint32_t prob2, uint64_t &dosage, uint3
 }
 
 
-void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
-    SNPInfo snpinfo;
-    uintptr_t *cur_buf = buf + idx * bgenRawGenoBuf1PtrSize;
-    // skip the header
-    uint8_t *curbuf = (uint8_t*)cur_buf;
-    int fileIndex = fileIndexBuf[curBufferIndex];
-
+// skips the variant identifying data of a BGEN record and decompresses the
+//   genotype block; the block is to delete[] if the file is compressed
+uint8_t* Geno::decodeBgenRecord(uint8_t *curbuf, int fileIndex, const string &error_promp, uint32_t &len_decomp){
     int compressFormat = compressFormats[fileIndex];
-
     uint16_t L16;
     uint32_t L32;
     //skip Lid
@@ -1139,7 +1374,7 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
         curbuf += sizeof(L32) + L32;
     }
 
-    uint32_t len_comp, len_decomp;
+    uint32_t len_comp;
     memcpy(&len_comp, curbuf, sizeof(len_comp));
     curbuf += sizeof(len_comp);
 
@@ -1151,7 +1386,6 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
         curbuf += sizeof(len_decomp);
     }
 
-    string error_promp = to_string(gbuf->extractedMarkerIndex) + "th SNP of [" + geno_files[fileIndex] + "]."; 
     uint8_t *dec_data;
     if(compressFormat != 0){
         dec_data = new uint8_t[len_decomp + 8];
@@ -1188,6 +1422,22 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
         dec_data = curbuf;
     }
 
+    return dec_data;
+}
+
+void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
+    SNPInfo snpinfo;
+    uintptr_t *cur_buf = buf + idx * bgenRawGenoBuf1PtrSize;
+    // skip the header
+    uint8_t *curbuf = (uint8_t*)cur_buf;
+    int fileIndex = fileIndexBuf[curBufferIndex];
+
+    int compressFormat = compressFormats[fileIndex];
+
+    string error_promp = to_string(gbuf->extractedMarkerIndex) + "th SNP of [" + geno_files[fileIndex] + "]."; 
+    uint32_t len_decomp;
+    uint8_t *dec_data = decodeBgenRecord(curbuf, fileIndex, error_promp, len_decomp);
+
     uint32_t n_sample = *(uint32_t *)dec_data;
     if(n_sample != rawCountSamples[fileIndex]){
         LOGGER.e(0, "inconsistent number of individuals in " + error_promp);
@@ -1494,16 +1744,55 @@ bool Geno::getGenoHasInfo(){
     return hasInfo;
 }
 
+bool Geno::setCheckpoint(const string &name, const vector<uint32_t> &extractIndex, const vector<CheckpointItem> &items){
+    checkpoint.reset();
+    resumeMarker = 0;
+    bCheckpointLooped = false;
+    if(options.find("checkpoint_file") == options.end()){
+        return false;
+    }
+    string ckpt_file = options["checkpoint_file"] + "." + name + ".ckpt";
+    checkpoint.reset(new LoopCheckpoint(ckpt_file, name, extractIndex, pheno->count_keep(), items,
+                options_d["checkpoint_interval"]));
+    LOGGER.i(0, "Checkpoints will be saved to [" + ckpt_file + "] every "
+            + to_string(options_d["checkpoint_interval"] / 60) + " minutes.");
+    if(options.find("resume") != options.end()){
+        resumeMarker = checkpoint->restore();
+    }
+    return resumeMarker > 0;
+}
+
+void Geno::finishCheckpoint(){
+    if(checkpoint){
+        checkpoint->remove();
+        checkpoint.reset();
+    }
+}
+
 void Geno::loopDouble(const vector<uint32_t> &extractIndex, int numMarkerBuf, bool bMakeGeno, bool bGenoCenter, bool bGenoStd, bool bMakeMiss, vector<function<void (uintptr_t *buf, const vector<uint32_t> &exIndex)>> callbacks, bool showLog){
+    // the checkpoint is only for the first loop over the markers it's set with
+    LoopCheckpoint *curCheckpoint = NULL;
+    if(checkpoint && !bCheckpointLooped && checkpoint->matches(extractIndex)){
+        curCheckpoint = checkpoint.get();
+        bCheckpointLooped = true;
+    }
+    uint32_t nSkipMarker = curCheckpoint ? resumeMarker : 0;
+    // kept by the object, the reading thread is detached
+    loopIndex.assign(extractIndex.begin() + nSkipMarker, extractIndex.end());
+    const vector<uint32_t> &remainIndex = loopIndex;
+    if(remainIndex.empty()){
+        if(showLog) LOGGER << "All the " << extractIndex.size() << " SNPs have been processed." << std::endl;
+        return;
+    }
    
     preGenoDouble(numMarkerBuf, bMakeGeno, bGenoCenter, bGenoStd, bMakeMiss);
-    thread read_thread([this, &extractIndex](){this->readGeno(extractIndex);});
+    thread read_thread([this, &remainIndex](){this->readGeno(remainIndex);});
     read_thread.detach();
     // main loop
     
     LOGGER.ts("LOOP_GENO_PRE");
     LOGGER.ts("LOOP_GENO_TOT");
-    int nTMarker = extractIndex.size();
+    int nTMarker = remainIndex.size();
     uint32_t nFinishedMarker = 0;
 
     int pre_block = 0;
@@ -1520,8 +1809,8 @@ void Geno::loopDouble(const vector<uint32_t> &extractIndex, int numMarkerBuf, bo
        int nMarker = numMarkersReadBlocks[curBufferIndex];
        uint32_t endIndex = nFinishedMarker + nMarker;
        endIndex = endIndex > nTMarker ? nTMarker : endIndex;
-       vector<uint32_t> curExtractIndex(extractIndex.begin() + nFinishedMarker, 
-              extractIndex.begin() + endIndex);
+       vector<uint32_t> curExtractIndex(remainIndex.begin() + nFinishedMarker, 
+              remainIndex.begin() + endIndex);
 
        for(auto callback : callbacks){
           callback(r_buf, curExtractIndex);
@@ -1530,6 +1819,9 @@ void Geno::loopDouble(const vector<uint32_t> &extractIndex, int numMarkerBuf, bo
 
        nFinishedMarker += nMarker;
        curBufferIndex = nextBufIndex(curBufferIndex);
+       if(curCheckpoint){
+           curCheckpoint->update(nSkipMarker + std::min(nFinishedMarker, (uint32_t)nTMarker), nFinishedMarker >= nTMarker);
+       }
 
         // show progress
        if(showLog){
@@ -2499,6 +2791,19 @@ void Geno::endProcess_bed(){
     }
 }
 
+bool Geno::hasPgenDosage(){
+    uint32_t raw_sample_ct = pheno->count_raw();
+    for(int i = 0; i < geno_files.size(); i++){
+        uint32_t raw_marker_ct = marker->getMarkerParams(i).rawCountSNP;
+        PgenReader reader;
+        reader.Load(geno_files[i], &raw_sample_ct, &raw_marker_ct, vector<uint32_t>());
+        if(reader.DosagePresent()){
+            return true;
+        }
+    }
+    return false;
+}
+
 void Geno::openGFiles(){
     closeGFiles();
     gFiles.resize(geno_files.size());
@@ -2759,224 +3064,195 @@ union Geno_prob{
 };
 
 
-void Geno::bgen2bed(const vector<uint32_t> &raw_marker_index){
-    LOGGER << "Old bgen 2 bed" << std::endl;
-    LOGGER.ts("LOOP_BGEN_BED");
-    LOGGER.ts("LOOP_BGEN_TOT");
-    vector<uint32_t>& index_keep = pheno->get_index_keep();
+// BGEN to BED or PGEN: the records are read by the thread of loopDouble,
+//   decompressed and converted by all threads into a block of fixed size
+//   slots in the marker order, and the blocks are written by another thread
+void Geno::convertBgen(bool bPgen){
+    string filename = options["out"] + (bPgen ? ".pgen" : ".bed");
+    uint32_t numMarker = marker->count_extract();
+    uint32_t sampleCT = pheno->count_keep();
+    int nMarkerBlock = 1024;
 
-    /*
-    std::ofstream out((options["out"] + "_sample_index.txt").c_str());
-    for(auto & item : index_keep){
-        out << item << std::endl;
+    uint64_t slotPtrSize;
+    if(bPgen){
+        slotPtrSize = 1 + PgenReader::GetGenoBufPtrSize(sampleCT) + PgenReader::GetDosagePresentSize(sampleCT)
+            + PgenReader::GetDosageMainSize(sampleCT);
+    }else{
+        slotPtrSize = (sampleCT + 31) / 32;
+    }
+    AsyncBuffer<uintptr_t> outBuf(1 + slotPtrSize * nMarkerBlock);
+    if(!outBuf.init_status()){
+        LOGGER.e(0, "can't allocate enough memory to convert the genotype.");
     }
-    out.close();
-    */
-    
-    auto buf_size = (num_raw_sample + 31) / 32;
-    size_t buf_size_byte = buf_size * 8;
-
-    int num_marker = 1;
-    int num_markers = raw_marker_index.size();
-    LOGGER << "samples: " << num_raw_sample << ", keep_sample: " << index_keep.size() << std::endl;
-    LOGGER << "Markers: " << num_markers << std::endl;
 
-    FILE * h_bgen = fopen(options["bgen_file"].c_str(), "rb");
-    /*
-    std::ofstream infos("exmaple.txt");
-    infos << "index\traw_index\tpos\tLen_comp\tLen_decomp" << std::endl;
-    */
-    #pragma omp parallel for schedule(static) ordered
-    for(uint32_t index = 0; index < num_markers; index++){
-        //LOGGER.i(0, to_string(index) + "NUM_thread: " + to_string(omp_get_max_threads()));
-        auto raw_index = raw_marker_index[index];
-        uint64_t *buf = new uint64_t[buf_size]();
-        uint64_t byte_pos, byte_size;
-        this->marker->getStartPosSize(raw_index, byte_pos, byte_size);
-        uint32_t len_comp, len_decomp;
-        char * snp_data;
-
-        #pragma omp ordered
-        {
-            fseek(h_bgen, byte_pos, SEEK_SET);
-            len_comp = read1Byte<uint32_t>(h_bgen) - 4;
-            len_decomp = read1Byte<uint32_t>(h_bgen);
-            snp_data = new char[len_comp];
-            readBytes(h_bgen, len_comp, snp_data);
-            //infos << index << "\t" << raw_index << "\t" << byte_pos << "\t" << len_comp << "\t" << len_decomp << std::endl;
-        }
-        uLongf dec_size = len_decomp;
-
-        char * dec_data =  new char[len_decomp];
-        int z_result = uncompress((Bytef*)dec_data, &dec_size, (Bytef*)snp_data, len_comp);
-        delete[] snp_data;
-        if(z_result == Z_MEM_ERROR || z_result == Z_BUF_ERROR || dec_size != len_decomp){
-            LOGGER.e(0, "decompressing genotype data error in " + to_string(raw_index) + "th SNP."); 
-        }
-
-        uint32_t n_sample = *(uint32_t *)dec_data;
-        if(n_sample != num_raw_sample){
-            LOGGER.e(0, "inconsistent number of samples in " + to_string(raw_index) + "th SNP." );
-        }
-        uint16_t num_alleles = *(uint16_t *)(dec_data + 4);
-        if(num_alleles != 2){
-            LOGGER.e(0, "multi-allelic SNPs detected likely because the bgen file is malformed.");
+    thread write_thread([&outBuf, &filename, bPgen, slotPtrSize, sampleCT, numMarker](){
+        string err;
+        FILE *hBed = NULL;
+        PgenWriter pgenWriter;
+        if(bPgen){
+            if(!pgenWriter.Open(filename, sampleCT, numMarker, true, err)){
+                LOGGER.e(0, "can't open [" + filename + "] to write, " + err);
+            }
+        }else{
+            hBed = fopen(filename.c_str(), "wb");
+            const uint8_t magic[3] = {0x6c, 0x1b, 0x01};
+            if(hBed == NULL || fwrite(magic, 1, 3, hBed) != 3){
+                LOGGER.e(0, "can't write to [" + filename + "].");
+            }
         }
-
-        uint8_t min_ploidy = *(uint8_t *)(dec_data + 6);//2
-        uint8_t max_ploidy = *(uint8_t *)(dec_data + 7); //2
-        uint8_t * sample_ploidy = (uint8_t *)(dec_data + 8);
-
-        uint8_t *geno_prob = sample_ploidy + n_sample;
-        uint8_t is_phased = *(geno_prob);
-        uint8_t bits_prob = *(geno_prob+1);
-        uint8_t* X_prob = geno_prob + 2;
-        uint32_t len_prob = len_decomp - n_sample - 10;
-        if(is_phased){
-            LOGGER.e(0, "GCTA does not support phased data currently.");
+        uint32_t genoPtrSize = PgenReader::GetGenoBufPtrSize(sampleCT);
+        uint32_t presentPtrSize = PgenReader::GetDosagePresentSize(sampleCT);
+        uint32_t bedBytes = (sampleCT + 3) / 4;
+        while(true){
+            uintptr_t *r_buf;
+            bool isEOF;
+            std::tie(r_buf, isEOF) = outBuf.start_read();
+            if(isEOF) break;
+            uint32_t num = r_buf[0];
+            for(uint32_t i = 0; i < num; i++){
+                uintptr_t *slot = r_buf + 1 + i * slotPtrSize;
+                if(bPgen){
+                    uintptr_t *genovec = slot + 1;
+                    uintptr_t *dosage_present = genovec + genoPtrSize;
+                    uint16_t *dosage_main = reinterpret_cast<uint16_t*>(dosage_present + presentPtrSize);
+                    if(!pgenWriter.AppendDosage16(genovec, dosage_present, dosage_main, slot[0], err)){
+                        LOGGER.e(0, "can't write to [" + filename + "], " + err);
+                    }
+                }else if(fwrite(slot, 1, bedBytes, hBed) != bedBytes){
+                    LOGGER.e(0, "can't write to [" + filename + "].");
+                }
+            }
+            outBuf.end_read();
         }
-
-        int byte_per_prob = bits_prob / 8;
-        int double_byte_per_prob = byte_per_prob * 2;
-        if(bits_prob % 8 != 0){
-            LOGGER.e(0, "GCTA does not support probability bits other than in byte units.");
+        if(bPgen){
+            if(!pgenWriter.Close(err)){
+                LOGGER.e(0, "can't write to [" + filename + "], " + err);
+            }
+        }else if(fclose(hBed) != 0){
+            LOGGER.e(0, "can't write to [" + filename + "].");
         }
+    });
 
-        if(len_prob != double_byte_per_prob * n_sample){
-            LOGGER.e(0, "malformed data in " + to_string(raw_index) + "th SNP.");
+    auto convertBlock = [this, &outBuf, bPgen, slotPtrSize](uintptr_t *buf, const vector<uint32_t> &markerIndex){
+        int num = markerIndex.size();
+        uintptr_t *w_buf = outBuf.start_write();
+        w_buf[0] = num;
+        #pragma omp parallel for schedule(dynamic)
+        for(int i = 0; i < num; i++){
+            convertBgenMarker(buf, i, markerIndex[i], bPgen, w_buf + 1 + i * slotPtrSize);
         }
-        /*
-        infos << index << "_2\t" << raw_index << "\t" << byte_pos << "\t" << len_comp << "\t" << len_prob << std::endl;
-        FILE *obgen = fopen((to_string(index) + ".bin").c_str(), "wb");
-        fwrite(snp_data, sizeof(char), len_comp, obgen);
-        fwrite(X_prob, sizeof(char), len_prob, obgen);
-        fclose(obgen);
-        */
+        outBuf.end_write();
+    };
 
-        uint32_t base_value = (1 << bits_prob) - 1;
-
-        uint8_t *buf_ptr = (uint8_t *)buf;
-        if(options.find("dosage_call") == options.end()){
-            uint32_t cut_value = ceil(base_value * options_d["hard_call_thresh"]);
-            for(uint32_t i = 0; i < num_keep_sample; i++){
-                uint32_t item_byte = i >> 2;
-                uint32_t move_byte = (i & 3) << 1;
-
-                uint32_t sindex = index_keep[i];
-                uint8_t item_ploidy = sample_ploidy[sindex];
-
-                uint8_t geno_value;
-                if(item_ploidy > 128){
-                    geno_value = 1;
-                }else if(item_ploidy == 2){
-                    auto base = sindex * double_byte_per_prob;
-                    auto base1 = base + byte_per_prob;
-                    Geno_prob prob_item;
-                    Geno_prob prob_item1;
-                    /*
-                       memcpy(prob_item.byte, X_prob + base,  byte_per_prob); 
-                       memcpy(prob_item1.byte, X_prob + base1, byte_per_prob); 
-                       */
-                    for(int i = 0 ; i != byte_per_prob; i++){
-                        prob_item.byte[i] = X_prob[base + i];
-                        prob_item1.byte[i] = X_prob[base1 + i];
-                    }
+    vector<uint32_t> extractIndex(numMarker);
+    std::iota(extractIndex.begin(), extractIndex.end(), 0);
+    vector<function<void (uintptr_t *, const vector<uint32_t> &)>> callBacks;
+    callBacks.push_back(convertBlock);
+    loopDouble(extractIndex, nMarkerBlock, false, false, false, false, callBacks);
 
-                    uint32_t t1 = prob_item.value;
-                    uint32_t t2 = prob_item1.value;
-                    uint32_t t3 = base_value - t1 - t2;
-                    if(t1 >= cut_value){
-                        geno_value = 0;
-                    }else if(t2 >= cut_value){
-                        geno_value = 2;
-                    }else if(t3 >= cut_value){
-                        geno_value = 3;
-                    }else{
-                        geno_value = 1;
-                    }
-                }else{
-                    LOGGER.e(0, "multi-allelic SNPs detected in the " + to_string(raw_index) + "th SNP.");
-                }
-                buf_ptr[item_byte] += geno_value << move_byte;
-            }
-        }else{
-            uint32_t A1U = floor(base_value * 1.5);
-            uint32_t A1L = ceil(base_value * 0.5);
-
-
-            for(uint32_t i = 0; i < num_keep_sample; i++){
-                uint32_t item_byte = i >> 2;
-                uint32_t move_byte = (i & 3) << 1;
-
-                uint32_t sindex = index_keep[i];
-                uint8_t item_ploidy = sample_ploidy[sindex];
-
-                uint8_t geno_value;
-                if(item_ploidy > 128){
-                    //missing
-                    geno_value = 1;
-                }else if(item_ploidy == 2){
-                    auto base = sindex * double_byte_per_prob;
-                    auto base1 = base + byte_per_prob;
-                    Geno_prob prob_item;
-                    Geno_prob prob_item1;
-                    /*
-                       memcpy(prob_item.byte, X_prob + base,  byte_per_prob); 
-                       memcpy(prob_item1.byte, X_prob + base1, byte_per_prob); 
-                       */
-                    for(int i = 0 ; i != byte_per_prob; i++){
-                        prob_item.byte[i] = X_prob[base + i];
-                        prob_item1.byte[i] = X_prob[base1 + i];
-                    }
+    outBuf.start_write();
+    outBuf.setEOF();
+    outBuf.end_write();
+    write_thread.join();
+}
 
-                    uint32_t t1 = prob_item.value;
-                    uint32_t t2 = prob_item1.value;
-                    uint32_t dosageA = 2 * t1 + t2;
-                    if(dosageA > A1U){
-                        geno_value = 0;
-                    }else if(dosageA < A1L){
-                        geno_value = 3;
-                    }else{
-                        geno_value = 2;
-                    }
-                }else{
-                    LOGGER.e(0, " multi-allelic SNPs detected in the " + to_string(raw_index) + "th SNP.");
-                }
-                buf_ptr[item_byte] += geno_value << move_byte;
-            }
- 
-        }
-        //LOGGER.i(0, "MIDDLE: " + to_string(index) + "NUM_thread: " + to_string(omp_get_max_threads()));
+// one record to the 2-bit hard calls of BED or to the PGEN slot: dosage_ct,
+//   genovec, dosage_present and dosage_main. The dosage is of the first allele,
+//   A1 in the .bim
+void Geno::convertBgenMarker(uintptr_t *buf, int idx, uint32_t extractedIndex, bool bPgen, uintptr_t *out){
+    uint8_t *curbuf = (uint8_t*)(buf + idx * bgenRawGenoBuf1PtrSize);
+    int fileIndex = fileIndexBuf[curBufferIndex];
+    string error_promp = to_string(extractedIndex) + "th SNP of [" + geno_files[fileIndex] + "]."; 
+    uint32_t len_decomp;
+    uint8_t *dec_data = decodeBgenRecord(curbuf, fileIndex, error_promp, len_decomp);
 
-        #pragma omp ordered
-        save_bed(buf, num_marker);
-        delete[] buf;
-        delete[] dec_data;
-        //#pragma omp ordered
-        //LOGGER.i(0, "Finished " + to_string(index) + "NUM_thread: " + to_string(omp_get_max_threads()));
-        if(index % 10000 == 0){
-            float time_p = LOGGER.tp("LOOP_BGEN_BED");
-            if(time_p > 300){
-                LOGGER.ts("LOOP_BGEN_BED");
-                float elapse_time = LOGGER.tp("LOOP_BGEN_TOT");
-                float finished_percent = (float) index / num_markers;
-                float remain_time = (1.0 / finished_percent - 1) * elapse_time / 60;
+    uint32_t n_sample = *(uint32_t *)dec_data;
+    if(n_sample != rawCountSamples[fileIndex]){
+        LOGGER.e(0, "inconsistent number of individuals in " + error_promp);
+    }
+    uint16_t num_alleles = *(uint16_t *)(dec_data + 4);
+    if(num_alleles != 2){
+        LOGGER.e(0, "multi-allelic SNPs detected in " + error_promp);
+    }
+    uint8_t * sample_ploidy = (uint8_t *)(dec_data + 8);
+    uint8_t *geno_prob = sample_ploidy + n_sample;
+    uint8_t is_phased = *(geno_prob);
+    uint8_t bits_prob = *(geno_prob+1);
+    uint8_t* X_prob = geno_prob + 2;
+    if(is_phased){
+        LOGGER.e(0, "GCTA does not support phased data currently.");
+    }
+    uint8_t double_bits_prob = bits_prob * 2;
+    uint64_t mask = (1U << bits_prob) - 1;
 
-                std::ostringstream ss;
-                ss << std::fixed << std::setprecision(1) << finished_percent * 100 << "% Estimated time remaining " << remain_time << " min"; 
-                
-                LOGGER.i(1, ss.str());
+    bool bDosageCall = options.find("dosage_call") != options.end();
+    uint32_t cut_value = ceil(mask * options_d["hard_call_thresh"]);
+    uint32_t A1U = floor(mask * 1.5);
+    uint32_t A1L = ceil(mask * 0.5);
+    double dosageScale = 16384.0 / mask;
+
+    uint32_t genoPtrSize = PgenReader::GetGenoBufPtrSize(keepSampleCT);
+    uint32_t presentPtrSize = PgenReader::GetDosagePresentSize(keepSampleCT);
+    uintptr_t *genovec = bPgen ? out + 1 : out;
+    uintptr_t *dosage_present = genovec + genoPtrSize;
+    uint16_t *dosage_main = reinterpret_cast<uint16_t*>(dosage_present + presentPtrSize);
+    std::fill(genovec, genovec + (bPgen ? genoPtrSize + presentPtrSize : (keepSampleCT + 31) / 32), 0);
+    uint32_t dosage_ct = 0;
+
+    const uint32_t samplePerPtr = sizeof(uintptr_t) * 4;
+    for(uint32_t j = 0; j < keepSampleCT; j++){
+        uint32_t sindex = sampleKeepIndex[j];
+        uint8_t item_ploidy = sample_ploidy[sindex];
+        // BED: 0 hom A1, 1 missing, 2 het, 3 hom A2; PGEN: count of A1, 3 missing
+        uintptr_t code = bPgen ? 3 : 1;
+        if(item_ploidy == 2){
+            uint32_t start_bits = sindex * double_bits_prob;
+            uint64_t geno_temp;
+            memcpy(&geno_temp, &(X_prob[start_bits/CHAR_BIT]), sizeof(geno_temp));
+            geno_temp = geno_temp >> (start_bits % CHAR_BIT);
+            uint32_t t1 = geno_temp & mask;
+            uint32_t t2 = (geno_temp >> bits_prob) & mask;
+            uint32_t t3 = mask - t1 - t2;
+            uint32_t dosageA = 2 * t1 + t2;
+            int numA1 = -1;
+            if(bDosageCall){
+                numA1 = dosageA > A1U ? 2 : (dosageA < A1L ? 0 : 1);
+            }else if(t1 >= cut_value){
+                numA1 = 2;
+            }else if(t2 >= cut_value){
+                numA1 = 1;
+            }else if(t3 >= cut_value){
+                numA1 = 0;
+            }
+            if(bPgen){
+                if(numA1 >= 0) code = numA1;
+                dosage_present[j / 64] |= (1UL << (j % 64));
+                dosage_main[dosage_ct++] = (uint16_t)(dosageA * dosageScale + 0.5);
+            }else if(numA1 >= 0){
+                const uintptr_t bedCodes[3] = {3, 2, 0};
+                code = bedCodes[numA1];
             }
+        }else if(item_ploidy <= 128){
+            LOGGER.e(0, "multiploidy detected in " + error_promp);
+        }
+        genovec[j / samplePerPtr] |= code << (2 * (j % samplePerPtr));
+    }
+    if(bPgen){
+        // a sample with missing ploidy has no dosage; the readers take a dosage
+        //   for every sample or none, so such a variant is kept as hard calls
+        if(dosage_ct != keepSampleCT){
+            std::fill(dosage_present, dosage_present + presentPtrSize, 0);
+            dosage_ct = 0;
         }
+        out[0] = dosage_ct;
+    }
 
+    if(compressFormats[fileIndex] != 0){
+        delete[] dec_data;
     }
-    //infos.close();
-    closeOut();
-    fclose(h_bgen);
 }
 
 
-
 void Geno::save_bed(uint64_t *buf, int num_marker){
     static string err_string = "can't write to [" + options["out"] + ".bed].";
     static bool inited = false;
@@ -3590,6 +3866,15 @@ int Geno::registerOption(map<string, vector<string>>& options_in) {
         return_value++;
     }
 
+    // shared with fastGWA, not erased here; --freq is saved in the result
+    //   store by --save-bin store (or zstd), and in text by a plain --save-bin
+    if(options_in.find("--save-bin") != options_in.end() && options_in["--save-bin"].size() == 1){
+        string &value = options_in["--save-bin"][0];
+        if(value == "store" || value == "zstd"){
+            options["save_bin"] = value;
+        }
+    }
+
     if(options_in.find("--freqx") != options_in.end()){
         processFunctions.push_back("freqx");
         if(options_in["--freqx"].size() != 0){
@@ -3604,7 +3889,7 @@ int Geno::registerOption(map<string, vector<string>>& options_in) {
     }
 
     if(options_in.find("--make-bed") != options_in.end()){
-        if(options.find("bgen_file") == options.end()){
+        if(options.find("bgen_file") == options.end() && options.find("mbgen_file") == options.end()){
             processFunctions.push_back("make_bed");
         }else{
             processFunctions.push_back("make_bed_bgen");
@@ -3616,6 +3901,17 @@ int Geno::registerOption(map<string, vector<string>>& options_in) {
         return_value++;
     }
 
+    if(options_in.find("--make-pgen") != options_in.end()){
+        if(options.find("bgen_file") == options.end() && options.find("mbgen_file") == options.end()){
+            LOGGER.e(0, "--make-pgen only converts from BGEN (--bgen or --mbgen) currently.");
+        }
+        processFunctions.push_back("make_pgen_bgen");
+        options_in.erase("--make-pgen");
+        options["out"] = options_in["--out"][0];
+
+        return_value++;
+    }
+
     if(options_in.find("--recodet") != options_in.end()){
         processFunctions.push_back("recodet");
         options["recode_method"] = "nomiss";
@@ -3652,7 +3948,51 @@ int Geno::registerOption(map<string, vector<string>>& options_in) {
         return_value++;
     }
 
+    // rare markers are kept sparse by the analyses supporting it; BED and PGEN
+    //   share the 2-bit hard calls read by PgenReader, BGEN stays dense
+    options_d["sparse_maf"] = 0;
+    if(options_in.find("--sparse-geno") != options_in.end()){
+        auto option = options_in["--sparse-geno"];
+        options_d["sparse_maf"] = 0.01;
+        if(option.size() == 1){
+            try{
+                options_d["sparse_maf"] = std::stod(option[0]);
+            }catch(std::invalid_argument&){
+                LOGGER.e(0, "invalid value for --sparse-geno: " + option[0] + ".");
+            }
+            if(options_d["sparse_maf"] <= 0 || options_d["sparse_maf"] > 0.5){
+                LOGGER.e(0, "the MAF threshold of --sparse-geno should be in (0, 0.5].");
+            }
+        }else if(option.size() > 1){
+            LOGGER.e(0, "--sparse-geno takes one value, the MAF threshold.");
+        }
+        LOGGER << "Variants with MAF < " << options_d["sparse_maf"] << " are kept in the sparse form (hard calls of BED and PGEN)." << std::endl;
+        options_in.erase("--sparse-geno");
+    }
 
+    // checkpoints of the genotype loop, in minutes
+    bool bCheckpoint = options_in.find("--checkpoint") != options_in.end();
+    if(bCheckpoint || options_in.find("--resume") != options_in.end()){
+        options_d["checkpoint_interval"] = 30 * 60;
+        if(bCheckpoint && options_in["--checkpoint"].size() == 1){
+            try{
+                options_d["checkpoint_interval"] = std::stod(options_in["--checkpoint"][0]) * 60;
+            }catch(std::invalid_argument&){
+                LOGGER.e(0, "invalid value for --checkpoint: " + options_in["--checkpoint"][0] + ".");
+            }
+            if(options_d["checkpoint_interval"] <= 0){
+                LOGGER.e(0, "--checkpoint should be followed by a positive number of minutes.");
+            }
+        }else if(bCheckpoint && options_in["--checkpoint"].size() > 1){
+            LOGGER.e(0, "--checkpoint takes one value, the minutes between two checkpoints.");
+        }
+        options["checkpoint_file"] = options_in["out"][0];
+        if(options_in.find("--resume") != options_in.end()){
+            options["resume"] = "yes";
+        }
+        options_in.erase("--checkpoint");
+        options_in.erase("--resume");
+    }
 
     return return_value;
 }
@@ -3794,32 +4134,78 @@ void Geno::loopDoubleFull(const vector<uint32_t> &extractMarkerIndex, GenoBuf *g
 
 void Geno::processFreq(){
     string name_out = options["out"] + ".frq";
-    int buf_size = 23068672;
-    osBuf.resize(buf_size);
-    osOut.rdbuf()->pubsetbuf(&osBuf[0], buf_size);
- 
-    osOut.open(name_out.c_str());
-    if (!osOut) { LOGGER.e(0, "cannot open the file [" + name_out + "] to write."); }
-    osOut << "CHR\tSNP\tPOS\tA1\tA2\tAF\tNCHROBS";
-    if(hasInfo){
-        osOut << "\tINFO";
-    }
-    osOut << "\n";
-
-    LOGGER << "Computing allele frequencies and saving them to [" << name_out << "]..." << std::endl;
+    bool bSaveBin = options.find("save_bin") != options.end();
+    if(bSaveBin) name_out += ".bin";
 
     int nMarker = 128;
     vector<uint32_t> extractIndex(marker->count_extract());
     std::iota(extractIndex.begin(), extractIndex.end(), 0);
+
+    numMarkerOutput = 0;
+    bool bResume = setCheckpoint("freq", extractIndex, {{"output",
+            [this](std::ostream &os){
+                CheckpointIO::write(os, numMarkerOutput);
+                if(resStore){
+                    resStore->saveState(os);
+                }else{
+                    osOut.flush();
+                    CheckpointIO::write(os, (uint64_t)osOut.tellp());
+                }
+            },
+            [this](std::istream &is){
+                CheckpointIO::read(is, numMarkerOutput);
+                resumeOutput.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+            }}});
+
+    if(bSaveBin){
+        vector<ResultColumn> columns = ResultStoreWriter::markerColumns();
+        columns.insert(columns.end(), {{"AF", RES_F64}, {"NCHROBS", RES_U32}});
+        if(hasInfo) columns.push_back({"INFO", RES_F64});
+        if(bResume){
+            std::istringstream state(resumeOutput);
+            resStore = new ResultStoreWriter(name_out, columns, options["save_bin"] == "zstd", "", state);
+        }else{
+            resStore = new ResultStoreWriter(name_out, columns, options["save_bin"] == "zstd", "");
+        }
+    }else{
+        int buf_size = 23068672;
+        osBuf.resize(buf_size);
+        osOut.rdbuf()->pubsetbuf(&osBuf[0], buf_size);
+     
+        if(bResume){
+            std::istringstream state(resumeOutput);
+            uint64_t offset;
+            CheckpointIO::read(state, offset);
+            CheckpointIO::reopenText(osOut, name_out, offset);
+        }else{
+            osOut.open(name_out.c_str());
+            if (!osOut) { LOGGER.e(0, "cannot open the file [" + name_out + "] to write."); }
+            osOut << "CHR\tSNP\tPOS\tA1\tA2\tAF\tNCHROBS";
+            if(hasInfo){
+                osOut << "\tINFO";
+            }
+            osOut << "\n";
+        }
+    }
+
+    LOGGER << "Computing allele frequencies and saving them to [" << name_out << "]..." << std::endl;
+
+    marker->buildMarkerStr();
     
     vector<function<void (uintptr_t *, const vector<uint32_t> &)>> callBacks;
     callBacks.push_back(bind(&Geno::freq_func, this, _1, _2));
 
-    numMarkerOutput = 0;
     loopDouble(extractIndex, nMarker, false, false, false, false, callBacks);
 
-    osOut.flush();
-    osOut.close();
+    if(resStore){
+        resStore->close();
+        delete resStore;
+        resStore = NULL;
+    }else{
+        osOut.flush();
+        osOut.close();
+    }
+    finishCheckpoint();
     LOGGER << "Saved " << numMarkerOutput << " SNPs." << std::endl;
 }
 
@@ -3864,6 +4250,9 @@ void Geno::processRecodet(){
 
     vector<uint32_t> extractIndex(marker->count_extract());
     std::iota(extractIndex.begin(), extractIndex.end(), 0);
+    marker->buildMarkerStr();
+    // one line holds all the samples
+    outWriter.setChunkLines(1);
     
     vector<function<void (uintptr_t *, const vector<uint32_t> &)>> callBacks;
     callBacks.push_back(bind(&Geno::recode_func, this, _1, _2));
@@ -3905,15 +4294,29 @@ void Geno::freq_func(uintptr_t* genobuf, const vector<uint32_t> &markerIndex){
         }
     }
     //output
-    for(int i = 0; i != num_marker; i++){
-        if(isValids[i]){
-            numMarkerOutput++;
-            osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t"  << af[i]
-                <<"\t" << nValidAllele[i];
-            if(hasInfo)osOut << "\t" << info[i];
-            osOut << "\n";
+    if(resStore){
+        for(int i = 0; i != num_marker; i++){
+            if(isValids[i]){
+                numMarkerOutput++;
+                int col = resStore->putMarker(marker, markerIndex[i]);
+                resStore->put(col++, af[i]);
+                resStore->put(col++, nValidAllele[i]);
+                if(hasInfo) resStore->put(col++, info[i]);
+                resStore->endRow();
+            }
         }
+        return;
     }
+    numMarkerOutput += outWriter.write(num_marker, osOut, [&](uint32_t i, TextBuffer &buf){
+        if(!isValids[i]) return false;
+        uint32_t len;
+        buf.add(marker->getMarkerStrBuf(markerIndex[i], len), len);
+        buf.addFieldNum(af[i]);
+        buf.addFieldUInt(nValidAllele[i]);
+        if(hasInfo) buf.addFieldNum(info[i]);
+        buf.add('\n');
+        return true;
+    });
 
 }
 
@@ -3927,33 +4330,29 @@ void Geno::recode_func(uintptr_t* genobuf, const vector<uint32_t> &markerIndex){
         outs[i].reserve(bufsize);
     }
     */
-    #pragma omp parallel for ordered schedule(static,1)
-    for(int i = 0; i < num_marker; i++){
+    numMarkerOutput += outWriter.write(num_marker, osOut, [&](uint32_t i, TextBuffer &buf){
         uint32_t cur_marker = markerIndex[i];
         GenoBufItem item;
         item.extractedMarkerIndex = cur_marker;
 
         getGenoDouble(genobuf, i, &item);
-
-        #pragma omp ordered
-        {
-            if(item.valid) {
-                numMarkerOutput++;
-                osOut << marker->getMarkerStrExtract(cur_marker) << "\t"
-                    << item.af << "\t" << item.nValidAllele;
-                if(hasInfo) osOut << "\t" << item.info;
-                for(int j = 0; j < keepSampleCT; j++){
-                    osOut << "\t";
-                    if(bRecodeSaveMiss && (item.missing[j/64] & (1UL << (j %64)))){
-                        osOut << "NA";
-                    }else{
-                        osOut << item.geno[j];
-                    }
-                }
-                osOut << "\n";
+        if(!item.valid) return false;
+
+        uint32_t len;
+        buf.add(marker->getMarkerStrBuf(cur_marker, len), len);
+        buf.addFieldNum(item.af);
+        buf.addFieldUInt(item.nValidAllele);
+        if(hasInfo) buf.addFieldNum(item.info);
+        for(int j = 0; j < keepSampleCT; j++){
+            if(bRecodeSaveMiss && (item.missing[j/64] & (1UL << (j %64)))){
+                buf.addNA(1);
+            }else{
+                buf.addFieldNum(item.geno[j]);
             }
         }
-    }
+        buf.add('\n');
+        return true;
+    });
 }
 
 void Geno::processMain() {
@@ -4115,15 +4514,20 @@ void Geno::processMain() {
             LOGGER.i(0, "Genotype has been saved.");
         }
 
-        if(process_function == "make_bed_bgen"){
+        if(process_function == "make_bed_bgen" || process_function == "make_pgen_bgen"){
             Pheno pheno;
             Marker marker;
             Geno geno(&pheno, &marker);
             string filename = options["out"];
+            bool bPgen = process_function == "make_pgen_bgen";
             pheno.save_pheno(filename + ".fam");
             marker.save_marker(filename + ".bim");
-            LOGGER.i(0, "Converting bgen to PLINK binary PED format [" + filename + ".bed]...");
-            geno.bgen2bed(marker.get_extract_index());
+            if(bPgen){
+                LOGGER.i(0, "Converting bgen to PLINK 2 binary format with dosages [" + filename + ".pgen]...");
+            }else{
+                LOGGER.i(0, "Converting bgen to PLINK binary PED format [" + filename + ".bed]...");
+            }
+            geno.convertBgen(bPgen);
             LOGGER.i(0, "Genotype has been saved.");
         }
 
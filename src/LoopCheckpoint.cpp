@@ -0,0 +1,157 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Checkpoints of the genotype loop
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LoopCheckpoint.h"
+#include "Logger.h"
+#include "OptionIO.h"
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+using std::to_string;
+
+static const char CKPT_MAGIC[4] = {'G', 'C', 'K', 'P'};
+static const uint32_t CKPT_VERSION = 1;
+
+void CheckpointIO::reopenText(std::ofstream &os, const string &filename, uint64_t offset){
+    if(truncate(filename.c_str(), offset) != 0){
+        LOGGER.e(0, "can't resume [" + filename + "], the output of the previous run is missing.");
+    }
+    os.open(filename.c_str(), std::ios::out | std::ios::app);
+    if(!os){
+        LOGGER.e(0, "can't open [" + filename + "] to write.");
+    }
+}
+
+FILE* CheckpointIO::reopenBinary(const string &filename, uint64_t offset){
+    if(truncate(filename.c_str(), offset) != 0){
+        LOGGER.e(0, "can't resume [" + filename + "], the output of the previous run is missing.");
+    }
+    FILE *file = fopen(filename.c_str(), "ab");
+    if(file == NULL){
+        LOGGER.e(0, "can't open [" + filename + "] to write.");
+    }
+    return file;
+}
+
+LoopCheckpoint::LoopCheckpoint(const string &filename, const string &name, const vector<uint32_t> &extractIndex,
+        uint32_t numSample, const vector<CheckpointItem> &items, double interval) : filename(filename),
+        name(name), numMarker(extractIndex.size()), numSample(numSample), items(items), interval(interval){
+    indexHash = hashIndex(extractIndex);
+    lastSave = std::chrono::steady_clock::now();
+}
+
+uint64_t LoopCheckpoint::hashIndex(const vector<uint32_t> &extractIndex){
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for(uint32_t index : extractIndex){
+        hash ^= index;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool LoopCheckpoint::matches(const vector<uint32_t> &extractIndex){
+    return extractIndex.size() == numMarker && hashIndex(extractIndex) == indexHash;
+}
+
+uint32_t LoopCheckpoint::restore(){
+    if(!checkFileReadable(filename)){
+        LOGGER.w(0, "no checkpoint [" + filename + "] to resume from, the analysis starts from the beginning.");
+        return 0;
+    }
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    uint32_t numFinished = 0;
+    try{
+        char magic[4];
+        uint32_t version, saved_numMarker, saved_numSample;
+        uint64_t saved_hash;
+        string saved_name;
+        CheckpointIO::read(in, magic);
+        CheckpointIO::read(in, version);
+        if(memcmp(magic, CKPT_MAGIC, 4) != 0 || version > CKPT_VERSION){
+            LOGGER.e(0, "[" + filename + "] is not a checkpoint of this GCTA.");
+        }
+        vector<char> name_buf;
+        CheckpointIO::readVector(in, name_buf);
+        saved_name.assign(name_buf.begin(), name_buf.end());
+        CheckpointIO::read(in, saved_numMarker);
+        CheckpointIO::read(in, saved_numSample);
+        CheckpointIO::read(in, saved_hash);
+        CheckpointIO::read(in, numFinished);
+        if(saved_name != name || saved_numMarker != numMarker || saved_numSample != numSample || saved_hash != indexHash){
+            LOGGER.e(0, "the checkpoint [" + filename + "] was saved from a different analysis or different data, "
+                    "remove it or run without --resume.");
+        }
+        for(auto &item : items){
+            vector<char> state;
+            CheckpointIO::readVector(in, name_buf);
+            CheckpointIO::readVector(in, state);
+            if(string(name_buf.begin(), name_buf.end()) != item.name){
+                LOGGER.e(0, "the checkpoint [" + filename + "] doesn't have the state of " + item.name + ".");
+            }
+            std::istringstream is(string(state.begin(), state.end()));
+            item.load(is);
+        }
+    }catch(std::ios_base::failure &){
+        LOGGER.e(0, "the checkpoint [" + filename + "] is incomplete.");
+    }
+    LOGGER.i(0, "Resuming from the checkpoint [" + filename + "]: " + to_string(numFinished) + " of "
+            + to_string(numMarker) + " SNPs have been processed.");
+    lastSave = std::chrono::steady_clock::now();
+    return numFinished;
+}
+
+void LoopCheckpoint::update(uint32_t numFinished, bool bForce){
+    auto now = std::chrono::steady_clock::now();
+    if(!bForce && std::chrono::duration<double>(now - lastSave).count() < interval) return;
+
+    // write aside and rename, a job killed while saving keeps the previous one
+    string temp_file = filename + ".tmp";
+    {
+        std::ofstream out(temp_file.c_str(), std::ios::binary);
+        if(!out){
+            LOGGER.e(0, "can't open [" + temp_file + "] to write.");
+        }
+        out.write(CKPT_MAGIC, 4);
+        CheckpointIO::write(out, CKPT_VERSION);
+        CheckpointIO::writeArray(out, name.data(), name.size());
+        CheckpointIO::write(out, numMarker);
+        CheckpointIO::write(out, numSample);
+        CheckpointIO::write(out, indexHash);
+        CheckpointIO::write(out, numFinished);
+        for(auto &item : items){
+            std::ostringstream os;
+            item.save(os);
+            string state = os.str();
+            CheckpointIO::writeArray(out, item.name.data(), item.name.size());
+            CheckpointIO::writeArray(out, state.data(), state.size());
+        }
+        out.flush();
+        if(!out){
+            LOGGER.e(0, "can't write the checkpoint to [" + temp_file + "].");
+        }
+    }
+    if(rename(temp_file.c_str(), filename.c_str()) != 0){
+        LOGGER.e(0, "can't write the checkpoint to [" + filename + "].");
+    }
+    lastSave = std::chrono::steady_clock::now();
+}
+
+void LoopCheckpoint::remove(){
+    std::remove(filename.c_str());
+}
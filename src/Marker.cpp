@@ -25,7 +25,9 @@
 #include <boost/algorithm/string/join.hpp>
 #include "utils.hpp"
 #include "OptionIO.h"
+#include "TextFormat.h"
 #include <memory>
+#include <cstring>
 #include <utility>
 #include <sqlite3.h>
 
@@ -115,12 +117,56 @@ Marker::Marker() {
         LOGGER.i(0, to_string(index_extract.size()) + " reference alleles are updated."); 
     }
 
+    if(options_i.find("shard_num") != options_i.end()){
+        keep_shard();
+    }
+
     if(index_extract.size() == 0){
         LOGGER.e(0, "no SNP remained.");
     }
 
 }
 
+string Marker::shardTag(int num_shards, int index){
+    string s_num = to_string(num_shards);
+    string s_index = to_string(index);
+    return ".shard_" + s_num + "_" + string(s_num.length() - s_index.length(), '0') + s_index;
+}
+
+// keep a contiguous range of the extracted markers. The boundaries split the
+//  marker count, or the genotype bytes to read, evenly, so the shards are
+//  disjoint, cover all the markers and keep the order of the genotype file
+void Marker::keep_shard(){
+    int shard_index = options_i["shard_index"];
+    int shard_num = options_i["shard_num"];
+    bool bSize = options["shard_by"] == "size" && byte_size.size() == chr.size();
+    if(options["shard_by"] == "size" && !bSize){
+        LOGGER.w(0, "the genotype file has the same size for all the markers, --shard splits by the marker count.");
+    }
+
+    uint64_t num = index_extract.size();
+    vector<uint64_t> cum_size(num + 1, 0);
+    for(uint64_t i = 0; i < num; i++){
+        cum_size[i + 1] = cum_size[i] + (bSize ? byte_size[index_extract[i]] : 1);
+    }
+    uint64_t total = cum_size[num];
+    auto boundary = [&](int k) -> uint64_t {
+        uint64_t target = (uint64_t)((long double)total * k / shard_num);
+        return std::lower_bound(cum_size.begin(), cum_size.end(), target) - cum_size.begin();
+    };
+    uint64_t start = boundary(shard_index - 1);
+    uint64_t end = boundary(shard_index);
+
+    vector<uint32_t> keep_index(end - start);
+    std::iota(keep_index.begin(), keep_index.end(), start);
+    LOGGER.i(0, "Shard " + to_string(shard_index) + " of " + to_string(shard_num) + ": " + to_string(keep_index.size())
+            + " SNPs (" + to_string(start + 1) + " to " + to_string(end) + " of " + to_string(num) + " SNPs) to be included.");
+    if(keep_index.size() == 0){
+        LOGGER.e(0, "no SNP in this shard, try a smaller number of shards.");
+    }
+    keep_extracted_index(keep_index);
+}
+
 void Marker::matchSNPListFile(string filename, int num_min_fields, const vector<int>& field_return, vector<string> &fields, vector<bool>& a_rev, bool update_a_rev){
     vector<string> temp_fields;
     vector<bool> temp_a_rev;
@@ -1362,6 +1408,58 @@ string Marker::get_marker(int rawindex, bool bflip){ // raw index
 string Marker::getMarkerStrExtract(int extractindex, bool bflip){ // extract index
     return get_marker(getRawIndex(extractindex), bflip);
 }
+
+void Marker::getMarkerFields(uint32_t extractindex, uint8_t &chr_out, uint32_t &pos, const string *&snp,
+        const string *&a1_out, const string *&a2_out){
+    uint32_t raw = index_extract[extractindex];
+    chr_out = chr[raw];
+    pos = pd[raw];
+    snp = &name[raw];
+    if(A_rev[raw]){
+        a1_out = &a2[raw];
+        a2_out = &a1[raw];
+    }else{
+        a1_out = &a1[raw];
+        a2_out = &a2[raw];
+    }
+}
+
+void Marker::buildMarkerStr(){
+    uint32_t n_extract = index_extract.size();
+    vector<uint32_t> lens(n_extract);
+    #pragma omp parallel for
+    for(uint32_t i = 0; i < n_extract; i++){
+        uint32_t raw = index_extract[i];
+        char temp[TextFormat::MAX_NUM_LEN];
+        lens[i] = (TextFormat::writeUInt(temp, chr[raw]) - temp) + (TextFormat::writeUInt(temp, pd[raw]) - temp)
+            + name[raw].size() + a1[raw].size() + a2[raw].size() + 4;
+    }
+    markerStrOffset.resize(n_extract + 1);
+    markerStrOffset[0] = 0;
+    for(uint32_t i = 0; i < n_extract; i++){
+        markerStrOffset[i + 1] = markerStrOffset[i] + lens[i];
+    }
+    markerStrBuf.resize(markerStrOffset[n_extract]);
+
+    #pragma omp parallel for
+    for(uint32_t i = 0; i < n_extract; i++){
+        uint32_t raw = index_extract[i];
+        char *p = markerStrBuf.data() + markerStrOffset[i];
+        const string &first = A_rev[raw] ? a2[raw] : a1[raw];
+        const string &second = A_rev[raw] ? a1[raw] : a2[raw];
+        p = TextFormat::writeUInt(p, chr[raw]);
+        *p++ = '\t';
+        memcpy(p, name[raw].data(), name[raw].size());
+        p += name[raw].size();
+        *p++ = '\t';
+        p = TextFormat::writeUInt(p, pd[raw]);
+        *p++ = '\t';
+        memcpy(p, first.data(), first.size());
+        p += first.size();
+        *p++ = '\t';
+        memcpy(p, second.data(), second.size());
+    }
+}
  
 
 bool Marker::isInExtract(uint32_t index) {
@@ -1474,6 +1572,42 @@ int Marker::registerOption(map<string, vector<string>>& options_in){
         options_i["end_chr"] = options_i["last_chr"];
     }
 
+    string op_shard = "--shard";
+    if(options_in.find(op_shard) != options_in.end()){
+        vector<string> &shard = options_in[op_shard];
+        if(shard.size() < 1 || shard.size() > 2){
+            LOGGER.e(0, op_shard + " takes the shard as i/N, and optionally count or size to split by.");
+        }
+        int shard_index = 0, shard_num = 0;
+        vector<string> fields;
+        boost::split(fields, shard[0], boost::is_any_of("/"));
+        try{
+            if(fields.size() != 2) throw std::invalid_argument(shard[0]);
+            shard_index = std::stoi(fields[0]);
+            shard_num = std::stoi(fields[1]);
+        }catch(std::exception&){
+            LOGGER.e(0, "invalid value for " + op_shard + ": " + shard[0] + ", it should be i/N, e.g. 3/500.");
+        }
+        if(shard_num < 1 || shard_index < 1 || shard_index > shard_num){
+            LOGGER.e(0, op_shard + " should have 1 <= i <= N.");
+        }
+        string shard_by = shard.size() == 2 ? shard[1] : "count";
+        if(shard_by != "count" && shard_by != "size"){
+            LOGGER.e(0, op_shard + " can only split by count or size.");
+        }
+        if(options_in.find("--merge-shards") != options_in.end()){
+            LOGGER.e(0, "can't specify " + op_shard + " and --merge-shards together.");
+        }
+        options_i["shard_index"] = shard_index;
+        options_i["shard_num"] = shard_num;
+        options["shard_by"] = shard_by;
+
+        // each shard writes to its own files
+        string tag = shardTag(shard_num, shard_index);
+        options_in["out"][0] += tag;
+        options_in["--out"][0] += tag;
+    }
+
     bool filterChrFlag = false;
     //static map<string, string> options;
     //static map<string, int> options_i;
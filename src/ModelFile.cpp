@@ -0,0 +1,182 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Versioned, memory mapped fastGWA model file
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ModelFile.h"
+#include "Logger.h"
+#include <cstring>
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+
+using std::to_string;
+
+static_assert(sizeof(ModelFileHeader) <= MODEL_FILE_ALIGN, "the header of model file is too large");
+
+static const char MODEL_MAGIC[8] = "GCTAMDL";
+
+uint64_t modelChecksum(const void *data, uint64_t size){
+    const char *ptr = static_cast<const char*>(data);
+    int64_t numWord = size / 8;
+    uint64_t s1 = 0, s2 = 0;
+    #pragma omp parallel for reduction(+:s1,s2) if(numWord > 1048576)
+    for(int64_t i = 0; i < numWord; i++){
+        uint64_t word;
+        memcpy(&word, ptr + i * 8, 8);
+        s1 += word;
+        s2 += word * (uint64_t)(i + 1);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, ptr + numWord * 8, size - numWord * 8);
+    s1 += tail;
+    s2 += tail * (uint64_t)(numWord + 1);
+    return (s1 ^ ((s2 << 32) | (s2 >> 32))) + size;
+}
+
+ModelFileWriter::ModelFileWriter(const string &filename, const ModelFileHeader &header) : filename(filename), header(header){
+    hOut = fopen(filename.c_str(), "wb");
+    if(hOut == NULL){
+        LOGGER.e(0, "can't open [" + filename + "] to write.");
+    }
+    memcpy(this->header.magic, MODEL_MAGIC, 8);
+    this->header.version = MODEL_FILE_VERSION;
+    memset(this->header.sections, 0, sizeof(this->header.sections));
+    curOffset = MODEL_FILE_ALIGN;
+}
+
+ModelFileWriter::~ModelFileWriter(){
+    if(hOut) close();
+}
+
+void ModelFileWriter::addSection(ModelSection id, const void *data, uint64_t size){
+    ModelSectionInfo &info = header.sections[id];
+    info.offset = curOffset;
+    info.size = size;
+    info.checksum = modelChecksum(data, size);
+    if(fseek(hOut, curOffset, SEEK_SET) != 0 || (size && fwrite(data, 1, size, hOut) != size)){
+        LOGGER.e(0, "can't write the model to [" + filename + "].");
+    }
+    curOffset += (size + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+    // keep an empty section distinguishable from an absent one
+    if(size == 0) curOffset += MODEL_FILE_ALIGN;
+}
+
+void ModelFileWriter::close(){
+    if(header.sections[MODEL_SEC_IDS].offset){
+        header.sampleHash = header.sections[MODEL_SEC_IDS].checksum;
+    }
+    header.headerChecksum = modelChecksum(&header, offsetof(ModelFileHeader, headerChecksum));
+
+    vector<char> header_page(MODEL_FILE_ALIGN, 0);
+    memcpy(header_page.data(), &header, sizeof(header));
+    if(fseek(hOut, 0, SEEK_SET) != 0 || fwrite(header_page.data(), 1, MODEL_FILE_ALIGN, hOut) != MODEL_FILE_ALIGN){
+        LOGGER.e(0, "can't write the model to [" + filename + "].");
+    }
+    // extend the last section with zeros to the alignment so the whole file
+    //   maps; the data already written are never touched
+    if(fflush(hOut) != 0 || ftruncate(fileno(hOut), curOffset) != 0){
+        LOGGER.e(0, "can't write the model to [" + filename + "].");
+    }
+    if(fclose(hOut) != 0){
+        LOGGER.e(0, "can't write the model to [" + filename + "].");
+    }
+    hOut = NULL;
+}
+
+static bool checkHeader(const ModelFileHeader &header){
+    return memcmp(header.magic, MODEL_MAGIC, 8) == 0 &&
+        header.headerChecksum == modelChecksum(&header, offsetof(ModelFileHeader, headerChecksum));
+}
+
+bool ModelFile::readHeader(const string &filename, ModelFileHeader &header){
+    FILE *h = fopen(filename.c_str(), "rb");
+    if(h == NULL) return false;
+    bool bRead = fread(&header, sizeof(header), 1, h) == 1;
+    fclose(h);
+    return bRead && checkHeader(header);
+}
+
+ModelFile::ModelFile(const string &filename) : filename(filename){
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0){
+        LOGGER.e(0, "can't open file [" + filename + "] to read.");
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < MODEL_FILE_ALIGN){
+        ::close(fd);
+        LOGGER.e(0, "[" + filename + "] is not a valid model file.");
+    }
+    fileSize = st.st_size;
+    // shared read only mapping: the page cache is shared by all the processes
+    void *ptr = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(ptr == MAP_FAILED){
+        LOGGER.e(0, "can't map the model file [" + filename + "] into memory.");
+    }
+    base = static_cast<char*>(ptr);
+
+    memcpy(&header, base, sizeof(header));
+    if(!checkHeader(header)){
+        LOGGER.e(0, "incorrect header in [" + filename + "]. This file can only be generated from GCTA model.");
+    }
+    if(header.version > MODEL_FILE_VERSION){
+        LOGGER.e(0, "the model file [" + filename + "] has version " + to_string(header.version)
+                + ", which is newer than this GCTA supports (" + to_string(MODEL_FILE_VERSION) + ").");
+    }
+    for(int i = 0; i < MODEL_SEC_MAX; i++){
+        const ModelSectionInfo &info = header.sections[i];
+        if(info.offset && info.offset + info.size > fileSize){
+            LOGGER.e(0, "the model file [" + filename + "] is truncated.");
+        }
+    }
+}
+
+ModelFile::~ModelFile(){
+    if(base) munmap(base, fileSize);
+}
+
+const void* ModelFile::sectionData(ModelSection id, uint64_t &count, uint64_t elemSize, bool bCheck){
+    const ModelSectionInfo &info = header.sections[id];
+    if(info.offset == 0){
+        LOGGER.e(0, "section " + to_string(id) + " is missing in the model file [" + filename + "].");
+    }
+    const char *ptr = base + info.offset;
+    if(bCheck && modelChecksum(ptr, info.size) != info.checksum){
+        LOGGER.e(0, "checksum mismatch in section " + to_string(id) + " of the model file [" + filename + "], the file is corrupted.");
+    }
+    count = info.size / elemSize;
+    return ptr;
+}
+
+vector<string> ModelFile::sampleIDs(){
+    uint64_t size;
+    const char *ptr = section<char>(MODEL_SEC_IDS, size);
+    vector<string> ids;
+    ids.reserve(header.numIndi);
+    uint64_t start = 0;
+    for(uint64_t i = 0; i < size; i++){
+        if(ptr[i] == '\n'){
+            ids.emplace_back(ptr + start, i - start);
+            start = i + 1;
+        }
+    }
+    if(ids.size() != header.numIndi){
+        LOGGER.e(0, "the number of samples in the model file [" + filename + "] doesn't match its header.");
+    }
+    return ids;
+}
@@ -556,6 +556,17 @@ uint32_t Pheno::getSeed(){
     return result.checksum();
 }
 
+string Pheno::getPhenoName(){
+    if(options.find("qpheno_file") == options.end()){
+        return "";
+    }
+    string name = options["qpheno_file"];
+    if(options.find("mpheno") != options.end()){
+        name += ":" + options["mpheno"];
+    }
+    return name;
+}
+
 vector<string> Pheno::get_id(int from_index, int to_index, string delim ){
     vector<string> out_id;
     out_id.reserve(to_index - from_index + 1);
@@ -0,0 +1,533 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Columnar binary store of per-marker results
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ResultStore.h"
+#include "Logger.h"
+#include "OptionIO.h"
+#include "TextFormat.h"
+#include "zstd.h"
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <algorithm>
+#include <omp.h>
+#include <unistd.h>
+
+static_assert(sizeof(ResultStoreHeader) == 40, "unexpected padding in ResultStoreHeader");
+static_assert(sizeof(ResultChunkIndex) == 32, "unexpected padding in ResultChunkIndex");
+
+map<string, string> ResultStore::options;
+map<string, double> ResultStore::options_d;
+vector<string> ResultStore::processFunctions;
+
+static const uint32_t RES_VERSION = 1;
+
+static uint32_t typeSize(uint8_t type){
+    switch(type){
+        case RES_U8:
+            return 1;
+        case RES_U32:
+        case RES_F32:
+            return 4;
+        case RES_F64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+ResultStoreWriter::ResultStoreWriter(const string &filename, const vector<ResultColumn> &columns, bool bCompress,
+        const string &pColumn, uint32_t chunkRows) : filename(filename), columns(columns){
+    hOut = fopen(filename.c_str(), "wb");
+    if(hOut == NULL){
+        LOGGER.e(0, "can't open [" + filename + "] to write.");
+    }
+    memcpy(header.magic, "GRES", 4);
+    header.version = RES_VERSION;
+    header.numCol = columns.size();
+    header.compress = bCompress ? 1 : 0;
+    header.numRow = 0;
+    header.chunkRows = chunkRows;
+    header.numChunk = 0;
+    header.indexStart = 0;
+    // rewritten on close
+    writeBytes(&header, sizeof(header));
+
+    for(int i = 0; i < columns.size(); i++){
+        const ResultColumn &column = columns[i];
+        uint8_t type_reserved[2] = {column.type, 0};
+        uint16_t name_len = column.name.size();
+        writeBytes(type_reserved, 2);
+        writeBytes(&name_len, sizeof(name_len));
+        writeBytes(column.name.data(), name_len);
+    }
+    initColumns(pColumn);
+}
+
+ResultStoreWriter::ResultStoreWriter(const string &filename, const vector<ResultColumn> &columns, bool bCompress,
+        const string &pColumn, std::istream &state) : filename(filename), columns(columns){
+    uint64_t offset;
+    uint64_t numIndex;
+    state.read((char *)&offset, sizeof(offset));
+    state.read((char *)&header, sizeof(header));
+    state.read((char *)&numIndex, sizeof(numIndex));
+    chunkIndex.resize(numIndex);
+    state.read((char *)chunkIndex.data(), numIndex * sizeof(ResultChunkIndex));
+    if(!state || header.numCol != columns.size() || header.compress != (bCompress ? 1u : 0u) || header.numChunk != numIndex){
+        LOGGER.e(0, "can't resume [" + filename + "], the saved state doesn't match the columns.");
+    }
+
+    hOut = fopen(filename.c_str(), "r+b");
+    if(hOut == NULL || ftruncate(fileno(hOut), offset) != 0 || fseeko(hOut, offset, SEEK_SET) != 0){
+        LOGGER.e(0, "can't resume [" + filename + "], the output of the previous run is missing.");
+    }
+    initColumns(pColumn);
+}
+
+void ResultStoreWriter::initColumns(const string &pColumn){
+    for(int i = 0; i < columns.size(); i++){
+        const ResultColumn &column = columns[i];
+        if(column.name == "CHR" && column.type == RES_U8) chrCol = i;
+        if(column.name == "POS" && column.type == RES_U32) posCol = i;
+        if(column.name == pColumn && (column.type == RES_F64 || column.type == RES_F32)) pCol = i;
+    }
+
+    colData.resize(columns.size());
+    strLens.resize(columns.size());
+}
+
+void ResultStoreWriter::saveState(std::ostream &os){
+    // a short chunk, the reader doesn't need full ones
+    flushChunk();
+    if(fflush(hOut) != 0){
+        LOGGER.e(0, "can't write to [" + filename + "].");
+    }
+    uint64_t offset = ftello(hOut);
+    uint64_t numIndex = chunkIndex.size();
+    os.write((const char *)&offset, sizeof(offset));
+    os.write((const char *)&header, sizeof(header));
+    os.write((const char *)&numIndex, sizeof(numIndex));
+    os.write((const char *)chunkIndex.data(), numIndex * sizeof(ResultChunkIndex));
+}
+
+ResultStoreWriter::~ResultStoreWriter(){
+    close();
+}
+
+vector<ResultColumn> ResultStoreWriter::markerColumns(){
+    return {{"CHR", RES_U8}, {"SNP", RES_STR}, {"POS", RES_U32}, {"A1", RES_STR}, {"A2", RES_STR}};
+}
+
+int ResultStoreWriter::putMarker(Marker *marker, uint32_t extractIndex){
+    uint8_t chr;
+    uint32_t pos;
+    const string *name, *a1, *a2;
+    marker->getMarkerFields(extractIndex, chr, pos, name, a1, a2);
+    put(0, chr);
+    putStr(1, name->data(), name->size());
+    put(2, pos);
+    putStr(3, a1->data(), a1->size());
+    putStr(4, a2->data(), a2->size());
+    return 5;
+}
+
+void ResultStoreWriter::putStr(int col, const char *str, uint32_t len){
+    vector<char> &buf = colData[col];
+    size_t size = buf.size();
+    buf.resize(size + len);
+    memcpy(&buf[size], str, len);
+    strLens[col].push_back(len);
+}
+
+void ResultStoreWriter::endRow(){
+    curRows++;
+    if(curRows == header.chunkRows){
+        flushChunk();
+    }
+}
+
+void ResultStoreWriter::writeBytes(const void *buf, size_t size){
+    if(size && fwrite(buf, 1, size, hOut) != size){
+        LOGGER.e(0, "can't write to [" + filename + "].");
+    }
+}
+
+void ResultStoreWriter::flushChunk(){
+    if(curRows == 0) return;
+
+    ResultChunkIndex index;
+    index.startByte = ftello(hOut);
+    index.numRow = curRows;
+    index.chrStart = 0;
+    index.chrEnd = 0;
+    index.reserved = 0;
+    index.posStart = 0;
+    index.posEnd = 0;
+    index.minP = std::numeric_limits<double>::quiet_NaN();
+    if(chrCol >= 0){
+        const uint8_t *chrs = (const uint8_t *)colData[chrCol].data();
+        index.chrStart = *std::min_element(chrs, chrs + curRows);
+        index.chrEnd = *std::max_element(chrs, chrs + curRows);
+    }
+    if(posCol >= 0){
+        const char *pos_data = colData[posCol].data();
+        uint32_t pos;
+        memcpy(&pos, pos_data, 4);
+        index.posStart = pos;
+        index.posEnd = pos;
+        for(uint32_t i = 1; i < curRows; i++){
+            memcpy(&pos, pos_data + 4 * i, 4);
+            index.posStart = std::min(index.posStart, pos);
+            index.posEnd = std::max(index.posEnd, pos);
+        }
+    }
+    if(pCol >= 0){
+        double minP = std::numeric_limits<double>::infinity();
+        const char *p_data = colData[pCol].data();
+        for(uint32_t i = 0; i < curRows; i++){
+            double p;
+            if(columns[pCol].type == RES_F64){
+                memcpy(&p, p_data + 8 * i, 8);
+            }else{
+                float pf;
+                memcpy(&pf, p_data + 4 * i, 4);
+                p = pf;
+            }
+            // NaN never passes the minimum
+            if(p < minP) minP = p;
+        }
+        index.minP = minP;
+    }
+
+    // strings: lengths followed by the characters
+    int numCol = columns.size();
+    for(int col = 0; col < numCol; col++){
+        if(columns[col].type == RES_STR){
+            vector<char> &buf = colData[col];
+            vector<uint32_t> &lens = strLens[col];
+            size_t len_bytes = lens.size() * sizeof(uint32_t);
+            buf.insert(buf.begin(), (const char *)lens.data(), (const char *)lens.data() + len_bytes);
+        }else if(colData[col].size() != (uint64_t)curRows * typeSize(columns[col].type)){
+            LOGGER.e(0, "inconsistent number of values in column " + columns[col].name + " of [" + filename + "].");
+        }
+    }
+
+    if(header.compress){
+        vector<vector<char>> compData(numCol);
+        vector<size_t> compSizes(numCol);
+        #pragma omp parallel for schedule(dynamic)
+        for(int col = 0; col < numCol; col++){
+            const vector<char> &raw = colData[col];
+            compData[col].resize(ZSTD_compressBound(raw.size()));
+            compSizes[col] = ZSTD_compress(compData[col].data(), compData[col].size(), raw.data(), raw.size(), 3);
+        }
+        for(int col = 0; col < numCol; col++){
+            if(ZSTD_isError(compSizes[col])){
+                LOGGER.e(0, "compressing column " + columns[col].name + " failed: " + string(ZSTD_getErrorName(compSizes[col])));
+            }
+            uint64_t sizes[2] = {colData[col].size(), compSizes[col]};
+            writeBytes(sizes, sizeof(sizes));
+            writeBytes(compData[col].data(), compSizes[col]);
+        }
+    }else{
+        for(int col = 0; col < numCol; col++){
+            uint64_t sizes[2] = {colData[col].size(), colData[col].size()};
+            writeBytes(sizes, sizeof(sizes));
+            writeBytes(colData[col].data(), colData[col].size());
+        }
+    }
+
+    for(int col = 0; col < numCol; col++){
+        colData[col].clear();
+        strLens[col].clear();
+    }
+    chunkIndex.push_back(index);
+    header.numRow += curRows;
+    header.numChunk++;
+    curRows = 0;
+}
+
+void ResultStoreWriter::close(){
+    if(hOut == NULL) return;
+    flushChunk();
+    header.indexStart = ftello(hOut);
+    writeBytes(chunkIndex.data(), chunkIndex.size() * sizeof(ResultChunkIndex));
+    fseeko(hOut, 0, SEEK_SET);
+    writeBytes(&header, sizeof(header));
+    fclose(hOut);
+    hOut = NULL;
+}
+
+ResultStoreReader::ResultStoreReader(const string &filename) : filename(filename){
+    hIn = fopen(filename.c_str(), "rb");
+    if(hIn == NULL){
+        LOGGER.e(0, "can't open [" + filename + "] to read.");
+    }
+    readBytes(&header, sizeof(header));
+    if(memcmp(header.magic, "GRES", 4) != 0){
+        LOGGER.e(0, "[" + filename + "] is not a GCTA binary result file.");
+    }
+    if(header.version > RES_VERSION){
+        LOGGER.e(0, "[" + filename + "] is saved by a newer version of GCTA (format version " + to_string(header.version) + ").");
+    }
+    if(header.indexStart == 0){
+        LOGGER.e(0, "[" + filename + "] is incomplete, the analysis may not have finished.");
+    }
+
+    columns.resize(header.numCol);
+    for(auto &column : columns){
+        uint8_t type_reserved[2];
+        uint16_t name_len;
+        readBytes(type_reserved, 2);
+        readBytes(&name_len, sizeof(name_len));
+        column.type = type_reserved[0];
+        column.name.resize(name_len);
+        readBytes(&column.name[0], name_len);
+        if(column.type > RES_F64){
+            LOGGER.e(0, "unknown column type in [" + filename + "].");
+        }
+    }
+
+    chunkIndex.resize(header.numChunk);
+    fseeko(hIn, header.indexStart, SEEK_SET);
+    readBytes(chunkIndex.data(), chunkIndex.size() * sizeof(ResultChunkIndex));
+}
+
+ResultStoreReader::~ResultStoreReader(){
+    if(hIn) fclose(hIn);
+}
+
+void ResultStoreReader::readBytes(void *buf, size_t size){
+    if(size && fread(buf, 1, size, hIn) != size){
+        LOGGER.e(0, "can't read [" + filename + "], the file may be truncated.");
+    }
+}
+
+int ResultStoreReader::findColumn(const string &name){
+    for(int i = 0; i < columns.size(); i++){
+        if(columns[i].name == name) return i;
+    }
+    return -1;
+}
+
+void ResultStoreReader::readChunk(uint32_t index, ResultChunk &chunk){
+    const ResultChunkIndex &cur_index = chunkIndex[index];
+    fseeko(hIn, cur_index.startByte, SEEK_SET);
+    uint32_t numRow = cur_index.numRow;
+    chunk.numRow = numRow;
+    chunk.data.resize(columns.size());
+    chunk.strOffset.resize(columns.size());
+    for(int col = 0; col < columns.size(); col++){
+        uint64_t sizes[2];
+        readBytes(sizes, sizeof(sizes));
+        vector<char> &data = chunk.data[col];
+        data.resize(sizes[0]);
+        if(header.compress){
+            compBuf.resize(sizes[1]);
+            readBytes(compBuf.data(), sizes[1]);
+            size_t dSize = ZSTD_decompress(data.data(), sizes[0], compBuf.data(), sizes[1]);
+            if(ZSTD_isError(dSize) || dSize != sizes[0]){
+                LOGGER.e(0, "decompressing column " + columns[col].name + " failed in [" + filename + "].");
+            }
+        }else{
+            readBytes(data.data(), sizes[0]);
+        }
+
+        if(columns[col].type == RES_STR){
+            vector<uint64_t> &offsets = chunk.strOffset[col];
+            offsets.resize(numRow + 1);
+            offsets[0] = (uint64_t)numRow * sizeof(uint32_t);
+            for(uint32_t i = 0; i < numRow; i++){
+                uint32_t len;
+                memcpy(&len, data.data() + i * sizeof(uint32_t), sizeof(uint32_t));
+                offsets[i + 1] = offsets[i] + len;
+            }
+            if(offsets[numRow] != data.size()){
+                LOGGER.e(0, "corrupted column " + columns[col].name + " in [" + filename + "].");
+            }
+        }else if(data.size() != (uint64_t)numRow * typeSize(columns[col].type)){
+            LOGGER.e(0, "corrupted column " + columns[col].name + " in [" + filename + "].");
+        }
+    }
+}
+
+int ResultStore::registerOption(map<string, vector<string>>& options_in){
+    int ret_val = 0;
+    options["out"] = options_in["out"][0];
+
+    string curFlag = "--read-bin";
+    if(options_in.find(curFlag) != options_in.end()){
+        if(options_in[curFlag].size() == 1){
+            options["read_bin"] = options_in[curFlag][0];
+            if(!checkFileReadable(options["read_bin"])){
+                LOGGER.e(0, curFlag + " " + options["read_bin"] + " not found.");
+            }
+        }else{
+            LOGGER.e(0, curFlag + " takes one binary result file.");
+        }
+        processFunctions.push_back("read_bin");
+        ret_val++;
+        options_in.erase(curFlag);
+    }
+
+    // CHR or CHR:START-END, in bp
+    curFlag = "--bin-region";
+    if(options_in.find(curFlag) != options_in.end()){
+        if(options_in[curFlag].size() != 1){
+            LOGGER.e(0, curFlag + " takes one region, e.g. 1 or 1:10000-20000.");
+        }
+        string region = options_in[curFlag][0];
+        double start = 0, end = UINT32_MAX;
+        size_t colon = region.find(':');
+        try{
+            options_d["region_chr"] = std::stoi(region.substr(0, colon));
+            if(colon != string::npos){
+                size_t dash = region.find('-', colon);
+                if(dash == string::npos) throw std::invalid_argument("region");
+                start = std::stod(region.substr(colon + 1, dash - colon - 1));
+                end = std::stod(region.substr(dash + 1));
+            }
+        }catch(std::exception&){
+            LOGGER.e(0, "illegal region in " + curFlag + ", e.g. 1 or 1:10000-20000, the chromosome shall be numeric.");
+        }
+        // CHR is stored as uint8
+        if(options_d["region_chr"] < 1 || options_d["region_chr"] > 255){
+            LOGGER.e(0, "the chromosome of " + curFlag + " shall be from 1 to 255.");
+        }
+        if(start < 0 || end > UINT32_MAX){
+            LOGGER.e(0, "the positions of " + curFlag + " shall be from 0 to " + std::to_string(UINT32_MAX) + ".");
+        }
+        if(start > end){
+            LOGGER.e(0, "the start of " + curFlag + " is larger than the end.");
+        }
+        options_d["region_start"] = start;
+        options_d["region_end"] = end;
+        options_in.erase(curFlag);
+    }
+
+    addOneValOption<double>("p_threshold", "--bin-p", options_in, options_d, 1.0, 0.0, 1.0);
+    options_in.erase("--bin-p");
+
+    return ret_val;
+}
+
+void ResultStore::extract(){
+    string filename = options["read_bin"];
+    ResultStoreReader reader(filename);
+    const vector<ResultColumn> &columns = reader.getColumns();
+    LOGGER << "Reading " << reader.count() << " rows of " << columns.size() << " columns from [" << filename << "]." << std::endl;
+
+    bool bRegion = options_d.find("region_chr") != options_d.end();
+    double pThresh = options_d["p_threshold"];
+    bool bPThresh = pThresh < 1.0;
+    int chrCol = reader.findColumn("CHR");
+    int posCol = reader.findColumn("POS");
+    int pCol = reader.findColumn("P");
+    if(bRegion && (chrCol < 0 || posCol < 0)){
+        LOGGER.e(0, "no CHR or POS column in [" + filename + "] to extract the region.");
+    }
+    if(bRegion && (columns[chrCol].type != RES_U8 || columns[posCol].type != RES_U32)){
+        LOGGER.e(0, "the CHR or POS column in [" + filename + "] is not of the marker type (uint8 and uint32), can't extract the region.");
+    }
+    if(bPThresh && pCol < 0){
+        LOGGER.e(0, "no P column in [" + filename + "] to filter by --bin-p.");
+    }
+    if(bPThresh && columns[pCol].type != RES_F64 && columns[pCol].type != RES_F32){
+        LOGGER.e(0, "the P column in [" + filename + "] is not numeric, can't filter by --bin-p.");
+    }
+    uint8_t rChr = bRegion ? (uint8_t)options_d["region_chr"] : 0;
+    uint32_t rStart = bRegion ? (uint32_t)options_d["region_start"] : 0;
+    uint32_t rEnd = bRegion ? (uint32_t)options_d["region_end"] : 0;
+
+    string out_name = options["out"] + ".txt";
+    std::ofstream out(out_name.c_str());
+    if(!out){
+        LOGGER.e(0, "can't open [" + out_name + "] to write.");
+    }
+    for(int col = 0; col < columns.size(); col++){
+        out << (col ? "\t" : "") << columns[col].name;
+    }
+    out << "\n";
+
+    ResultChunk chunk;
+    TextBuffer buf;
+    uint64_t numOut = 0;
+    uint32_t numSkipped = 0;
+    for(uint32_t index = 0; index < reader.numChunk(); index++){
+        const ResultChunkIndex &cur_index = reader.getChunkIndex(index);
+        if(bRegion && (rChr < cur_index.chrStart || rChr > cur_index.chrEnd ||
+                    (cur_index.chrStart == cur_index.chrEnd && (rEnd < cur_index.posStart || rStart > cur_index.posEnd)))){
+            numSkipped++;
+            continue;
+        }
+        // !(minP <= threshold) also skips chunks with all P missing
+        if(bPThresh && !(cur_index.minP <= pThresh)){
+            numSkipped++;
+            continue;
+        }
+
+        reader.readChunk(index, chunk);
+        buf.clear();
+        for(uint32_t row = 0; row < chunk.numRow; row++){
+            if(bRegion){
+                uint32_t pos = chunk.get<uint32_t>(posCol, row);
+                if(chunk.get<uint8_t>(chrCol, row) != rChr || pos < rStart || pos > rEnd) continue;
+            }
+            if(bPThresh){
+                double p = columns[pCol].type == RES_F64 ? chunk.get<double>(pCol, row) : chunk.get<float>(pCol, row);
+                if(!(p <= pThresh)) continue;
+            }
+            for(int col = 0; col < columns.size(); col++){
+                if(col) buf.add('\t');
+                switch(columns[col].type){
+                    case RES_STR:
+                        {
+                            uint32_t len;
+                            const char *str = chunk.getStr(col, row, len);
+                            buf.add(str, len);
+                        }
+                        break;
+                    case RES_U8:
+                        buf.addUInt(chunk.get<uint8_t>(col, row));
+                        break;
+                    case RES_U32:
+                        buf.addUInt(chunk.get<uint32_t>(col, row));
+                        break;
+                    case RES_F32:
+                        buf.addNum(chunk.get<float>(col, row));
+                        break;
+                    case RES_F64:
+                        buf.addNum(chunk.get<double>(col, row));
+                        break;
+                }
+            }
+            buf.add('\n');
+            numOut++;
+        }
+        out.write(buf.data(), buf.size());
+    }
+    out.close();
+    LOGGER << numSkipped << " of " << reader.numChunk() << " chunks were skipped by the index." << std::endl;
+    LOGGER << "Saved " << numOut << " rows to [" << out_name << "]." << std::endl;
+}
+
+void ResultStore::processMain(){
+    for(auto &process_function : processFunctions){
+        if(process_function == "read_bin"){
+            extract();
+        }
+    }
+}
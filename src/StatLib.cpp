@@ -20,6 +20,7 @@
 #include <boost/math/distributions/chi_squared.hpp>
 #include <boost/math/distributions/normal.hpp>
 #include <boost/math/distributions/beta.hpp>
+#include <boost/math/distributions/non_central_chi_squared.hpp>
 #include "cpu.h"
 
 using namespace boost::math;
@@ -68,6 +69,60 @@ namespace StatLib{
     }
 
 
+    double pchisqsum(double x, const VectorXd &lambda){
+        double c1 = lambda.sum();
+        double c2 = lambda.array().square().sum();
+        double c3 = lambda.array().cube().sum();
+        double c4 = lambda.array().square().square().sum();
+        if(!(c2 > 0) || !std::isfinite(x)){
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        double s1 = c3 / std::pow(c2, 1.5);
+        double s2 = c4 / (c2 * c2);
+        double a, delta, l;
+        if(s1 * s1 > s2){
+            a = 1.0 / (s1 - std::sqrt(s1 * s1 - s2));
+            delta = s1 * a * a * a - a * a;
+            l = a * a - 2.0 * delta;
+        }else{
+            // matching the kurtosis instead, as in SKAT
+            l = 1.0 / s2;
+            a = std::sqrt(l);
+            delta = 0;
+        }
+        double t = (x - c1) / std::sqrt(2.0 * c2);
+        double q = t * std::sqrt(2.0) * a + l + delta;
+        if(q <= 0){
+            return 1.0;
+        }
+        if(delta > 0){
+            return cdf(complement(non_central_chi_squared(l, delta), q));
+        }else{
+            return cdf(complement(chi_squared(l), q));
+        }
+    }
+
+    double acat(const VectorXd &p, const VectorXd &weight){
+        double sumW = 0, T = 0;
+        for(int i = 0; i < p.size(); i++){
+            double cp = p[i];
+            if(!std::isfinite(cp) || !(weight[i] > 0)) continue;
+            if(cp <= 0) return 0;
+            cp = std::min(cp, 1.0 - 1e-16);
+            sumW += weight[i];
+            // tan((0.5 - p) pi) is 1 / (p pi) for tiny p
+            T += weight[i] * (cp < 1e-15 ? 1.0 / (cp * M_PI) : std::tan((0.5 - cp) * M_PI));
+        }
+        if(sumW == 0){
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        T /= sumW;
+        if(T > 1e15){
+            return 1.0 / (T * M_PI);
+        }
+        return 0.5 - std::atan(T) / M_PI;
+    }
+
     double pnorm(double x, bool bLowerTail){
         if(!std::isfinite(x)){
             return std::numeric_limits<double>::quiet_NaN();
@@ -79,6 +134,49 @@ namespace StatLib{
         }
     }
 
+    // the loops are simple enough to be vectorized where the math library
+    //   has SIMD variants, large arrays are split among the threads
+    static const uint64_t BATCH_PARALLEL = 65536;
+
+    void pchisqd1(const double *x, double *p, uint64_t n){
+        #pragma omp parallel for simd if(n > BATCH_PARALLEL)
+        for(uint64_t i = 0; i < n; i++){
+            double v = x[i];
+            p[i] = (v >= 0 && v < std::numeric_limits<double>::infinity()) ?
+                std::erfc(std::sqrt(0.5 * v)) : std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+
+    void pchisqd2(const double *x, double *p, uint64_t n){
+        #pragma omp parallel for simd if(n > BATCH_PARALLEL)
+        for(uint64_t i = 0; i < n; i++){
+            double v = x[i];
+            p[i] = (v >= 0 && v < std::numeric_limits<double>::infinity()) ?
+                std::exp(-0.5 * v) : std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+
+    double lpchisqd1(double x){
+        if(!(x >= 0)){
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        double z = std::sqrt(0.5 * x);
+        if(z < 26.0){
+            return std::log(std::erfc(z));
+        }
+        // erfc(z) = exp(-z^2) / (z sqrt(pi)) * (1 - 1/(2z^2) + 3/(4z^4) - 15/(8z^6) + 105/(16z^8) ...)
+        double iz2 = 1.0 / (2.0 * z * z);
+        double series = 1.0 - iz2 * (1.0 - 3.0 * iz2 * (1.0 - 5.0 * iz2 * (1.0 - 7.0 * iz2)));
+        return -z * z - std::log(z * std::sqrt(M_PI)) + std::log(series);
+    }
+
+    void lpchisqd1(const double *x, double *lp, uint64_t n){
+        #pragma omp parallel for if(n > BATCH_PARALLEL)
+        for(uint64_t i = 0; i < n; i++){
+            lp[i] = lpchisqd1(x[i]);
+        }
+    }
+
     //n rank size,  Z shall be n * n double memory.
     // return true, success; false, unsuccess
     bool rankContrast(int n, double * Z){
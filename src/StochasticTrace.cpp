@@ -0,0 +1,155 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Stochastic estimators for large symmetric positive definite operators
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "StochasticTrace.h"
+#include <random>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "Eigen/Eigenvalues"
+
+namespace StochasticTrace {
+
+void rademacher(MatrixXd &Z, uint32_t seed){
+    std::mt19937 gen(seed);
+    double *ptr = Z.data();
+    uint64_t size = Z.size();
+    uint32_t bits = 0;
+    for(uint64_t i = 0; i < size; i++){
+        if((i & 31) == 0) bits = gen();
+        ptr[i] = (bits & 1) ? 1.0 : -1.0;
+        bits >>= 1;
+    }
+}
+
+int blockCG(const BlockOp &op, const VectorXd &diag, const MatrixXd &B, MatrixXd &X, double tol, int maxIter){
+    int nrhs = B.cols();
+    if(X.rows() != B.rows() || X.cols() != nrhs){
+        X.setZero(B.rows(), nrhs);
+    }
+    VectorXd invDiag = diag.cwiseInverse();
+
+    MatrixXd R(B.rows(), nrhs), AP(B.rows(), nrhs);
+    op(X, AP);
+    R = B - AP;
+    MatrixXd Zr = invDiag.asDiagonal() * R;
+    MatrixXd P = Zr;
+
+    VectorXd bNorm = B.colwise().norm();
+    VectorXd rz = R.cwiseProduct(Zr).colwise().sum();
+    std::vector<char> done(nrhs, 0);
+    int numDone = 0;
+    for(int j = 0; j < nrhs; j++){
+        if(R.col(j).norm() <= tol * bNorm(j)){
+            done[j] = 1;
+            numDone++;
+            P.col(j).setZero();
+        }
+    }
+
+    int iter = 0;
+    while(numDone < nrhs && iter < maxIter){
+        op(P, AP);
+        iter++;
+        for(int j = 0; j < nrhs; j++){
+            if(done[j]) continue;
+            double alpha = rz(j) / P.col(j).dot(AP.col(j));
+            X.col(j) += alpha * P.col(j);
+            R.col(j) -= alpha * AP.col(j);
+            if(R.col(j).norm() <= tol * bNorm(j)){
+                done[j] = 1;
+                numDone++;
+                P.col(j).setZero();
+                continue;
+            }
+            Zr.col(j) = invDiag.cwiseProduct(R.col(j));
+            double rz_new = R.col(j).dot(Zr.col(j));
+            P.col(j) = Zr.col(j) + (rz_new / rz(j)) * P.col(j);
+            rz(j) = rz_new;
+        }
+    }
+    return numDone == nrhs ? iter : -1;
+}
+
+double hutchinson(const MatrixXd &Z, const MatrixXd &FZ){
+    return Z.cwiseProduct(FZ).sum() / Z.cols();
+}
+
+double slqLogDet(const BlockOp &op, const MatrixXd &Z, int steps){
+    int n = Z.rows();
+    int nProbe = Z.cols();
+    steps = std::min(steps, n);
+
+    VectorXd zNorm2 = Z.colwise().squaredNorm();
+    MatrixXd Q = Z * zNorm2.cwiseSqrt().cwiseInverse().asDiagonal();
+    MatrixXd Q_prev = MatrixXd::Zero(n, nProbe);
+    MatrixXd W(n, nProbe);
+
+    // the tridiagonal matrix of each probe
+    MatrixXd alphas = MatrixXd::Zero(steps, nProbe);
+    MatrixXd betas = MatrixXd::Zero(steps, nProbe);
+    std::vector<int> len(nProbe, 0);
+    std::vector<char> active(nProbe, 1);
+
+    for(int k = 0; k < steps; k++){
+        op(Q, W);
+        bool bActive = false;
+        for(int j = 0; j < nProbe; j++){
+            if(!active[j]) continue;
+            double alpha = Q.col(j).dot(W.col(j));
+            W.col(j) -= alpha * Q.col(j);
+            if(k) W.col(j) -= betas(k - 1, j) * Q_prev.col(j);
+            alphas(k, j) = alpha;
+            len[j] = k + 1;
+
+            double beta = W.col(j).norm();
+            // invariant Krylov space, the quadrature is exact
+            if(beta <= 1e-10 * std::abs(alpha)){
+                active[j] = 0;
+                Q.col(j).setZero();
+                Q_prev.col(j).setZero();
+                continue;
+            }
+            betas(k, j) = beta;
+            Q_prev.col(j) = Q.col(j);
+            Q.col(j) = W.col(j) / beta;
+            bActive = true;
+        }
+        if(!bActive) break;
+    }
+
+    double sum = 0;
+    for(int j = 0; j < nProbe; j++){
+        int m = len[j];
+        Eigen::SelfAdjointEigenSolver<MatrixXd> eig;
+        VectorXd diag = alphas.col(j).head(m);
+        VectorXd subdiag = betas.col(j).head(std::max(m - 1, 0));
+        eig.computeFromTridiagonal(diag, subdiag, Eigen::ComputeEigenvectors);
+        if(eig.info() != Eigen::Success){
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        const VectorXd &theta = eig.eigenvalues();
+        if(theta.minCoeff() <= 0){
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        // weights are the squared first components of the eigenvectors
+        VectorXd tau2 = eig.eigenvectors().row(0).transpose().array().square();
+        sum += zNorm2(j) * tau2.dot(theta.array().log().matrix());
+    }
+    return sum / nProbe;
+}
+
+}
@@ -0,0 +1,189 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Fast text formatting of per-marker results
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TextFormat.h"
+#include <cmath>
+#include <cstdio>
+#include <cfloat>
+
+namespace {
+// exactly representable powers of 10
+const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+const uint64_t IPOW10[] = {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+    1000000000000ULL, 10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+    10000000000000000ULL, 100000000000000000ULL};
+
+// v * 10^k with one rounding, only for |k| <= 22
+inline double scale10(double v, int k){
+    return k >= 0 ? v * POW10[k] : v / POW10[-k];
+}
+
+// The scaling is monotonic, a value rounded onto x.5 may come from either side
+//   of the tie, these are left to printf.
+inline bool isTie(double x){
+    return x - std::floor(x) == 0.5;
+}
+
+inline char* writeSpecial(char *p, double v){
+    if(std::signbit(v)) *p++ = '-';
+    const char *s = std::isnan(v) ? "nan" : "inf";
+    memcpy(p, s, 3);
+    return p + 3;
+}
+
+inline char* writeDigits(char *p, uint64_t v, int ndigits){
+    for(int i = ndigits - 1; i >= 0; i--){
+        p[i] = '0' + (v % 10);
+        v /= 10;
+    }
+    return p + ndigits;
+}
+}
+
+char* TextFormat::writeUInt(char *p, uint64_t v){
+    char tmp[20];
+    int n = 0;
+    do{
+        tmp[n++] = '0' + (v % 10);
+        v /= 10;
+    }while(v);
+    while(n) *p++ = tmp[--n];
+    return p;
+}
+
+char* TextFormat::writeNum(char *p, double v, int precision){
+    if(!std::isfinite(v)) return writeSpecial(p, v);
+    if(precision < 1 || precision > 17) return p + snprintf(p, MAX_NUM_LEN, "%.*g", precision, v);
+    if(std::signbit(v)){
+        *p++ = '-';
+        v = -v;
+    }
+    if(v == 0){
+        *p++ = '0';
+        return p;
+    }
+    // small integers, e.g. genotypes, counts
+    if(v < POW10[precision] && v == (double)(uint64_t)v){
+        return writeUInt(p, (uint64_t)v);
+    }
+
+    // round to precision significant digits: m * 10^(e - precision + 1)
+    int e = (int)std::floor(std::log10(v));
+    int shift = precision - 1 - e;
+    if(shift > 22 || shift < -22){
+        return p + snprintf(p, MAX_NUM_LEN, "%.*g", precision, v);
+    }
+    double scaled = scale10(v, shift);
+    uint64_t m = (uint64_t)std::llround(scaled);
+    if(m >= IPOW10[precision]){
+        e++;
+        shift--;
+        if(shift < -22) return p + snprintf(p, MAX_NUM_LEN, "%.*g", precision, v);
+        scaled = scale10(v, shift);
+        m = (uint64_t)std::llround(scaled);
+    }else if(m < IPOW10[precision - 1]){
+        e--;
+        shift++;
+        if(shift > 22) return p + snprintf(p, MAX_NUM_LEN, "%.*g", precision, v);
+        scaled = scale10(v, shift);
+        m = (uint64_t)std::llround(scaled);
+    }
+    if(isTie(scaled)) return p + snprintf(p, MAX_NUM_LEN, "%.*g", precision, v);
+
+    char digits[20];
+    writeDigits(digits, m, precision);
+    int ndigits = precision;
+    while(ndigits > 1 && digits[ndigits - 1] == '0') ndigits--;
+
+    if(e < -4 || e >= precision){
+        *p++ = digits[0];
+        if(ndigits > 1){
+            *p++ = '.';
+            memcpy(p, digits + 1, ndigits - 1);
+            p += ndigits - 1;
+        }
+        *p++ = 'e';
+        if(e < 0){
+            *p++ = '-';
+            e = -e;
+        }else{
+            *p++ = '+';
+        }
+        if(e < 10) *p++ = '0';
+        return writeUInt(p, e);
+    }
+
+    if(e >= 0){
+        int nInt = e + 1;
+        if(ndigits <= nInt){
+            memcpy(p, digits, ndigits);
+            p += ndigits;
+            for(int i = ndigits; i < nInt; i++) *p++ = '0';
+        }else{
+            memcpy(p, digits, nInt);
+            p += nInt;
+            *p++ = '.';
+            memcpy(p, digits + nInt, ndigits - nInt);
+            p += ndigits - nInt;
+        }
+    }else{
+        *p++ = '0';
+        *p++ = '.';
+        for(int i = 0; i < -e - 1; i++) *p++ = '0';
+        memcpy(p, digits, ndigits);
+        p += ndigits;
+    }
+    return p;
+}
+
+char* TextFormat::writeFixed(char *p, double v, int decimals){
+    if(!std::isfinite(v)) return writeSpecial(p, v);
+    // outside the exact integer range of double
+    if(decimals < 0 || decimals > 17 || std::fabs(v) * POW10[decimals] >= 9e15){
+        return p + snprintf(p, MAX_NUM_LEN + decimals, "%.*f", decimals, v);
+    }
+    double scaled = std::fabs(v) * POW10[decimals];
+    if(isTie(scaled)) return p + snprintf(p, MAX_NUM_LEN + decimals, "%.*f", decimals, v);
+    bool neg = std::signbit(v);
+    uint64_t m = (uint64_t)std::llround(scaled);
+    if(neg) *p++ = '-';
+    p = writeUInt(p, m / IPOW10[decimals]);
+    if(decimals){
+        *p++ = '.';
+        p = writeDigits(p, m % IPOW10[decimals], decimals);
+    }
+    return p;
+}
+
+char* TextFormat::writeLogP(char *p, double lnp, int precision){
+    if(precision < 1 || precision > 17) precision = 6;
+    if(!(lnp < std::log(DBL_MIN))) return writeNum(p, std::exp(lnp), precision);
+    // lnp = (e + log10(m)) * ln(10) with 1 <= m < 10
+    double l10 = lnp / M_LN10;
+    double e = std::floor(l10);
+    double m = std::pow(10.0, l10 - e);
+    m = std::round(m * POW10[precision - 1]) / POW10[precision - 1];
+    if(m >= 10.0){
+        m /= 10.0;
+        e += 1.0;
+    }
+    p = writeNum(p, m, precision);
+    *p++ = 'e';
+    *p++ = '-';
+    return writeUInt(p, (uint64_t)(-e));
+}
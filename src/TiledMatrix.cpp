@@ -0,0 +1,223 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Symmetric matrix stored by tiles, in memory or in a scratch file
+
+   Developed by Zhili Zheng<zhilizheng@outlook.com>
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TiledMatrix.h"
+#include "Logger.h"
+#include <vector>
+#include <cmath>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+
+using Eigen::Lower;
+using Eigen::Upper;
+
+uint64_t TiledMatrix::storageSize(int n, int tile){
+    uint64_t nt = (n + tile - 1) / tile;
+    return nt * (nt + 1) / 2 * tile * tile * sizeof(double);
+}
+
+TiledMatrix::TiledMatrix(int n, int tile, const string &scratch) : n(n), tile(tile){
+    nt = (n + tile - 1) / tile;
+    bytes = storageSize(n, tile);
+    void *ptr = MAP_FAILED;
+    if(scratch.empty()){
+        ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }else{
+        int fd = open(scratch.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if(fd < 0){
+            LOGGER.e(0, "can't create the scratch file [" + scratch + "].");
+        }
+        if(ftruncate(fd, bytes) != 0){
+            ::close(fd);
+            unlink(scratch.c_str());
+            LOGGER.e(0, "can't allocate " + std::to_string(bytes >> 30) + " GB in the scratch file [" + scratch + "].");
+        }
+        ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        unlink(scratch.c_str());
+        bFile = true;
+    }
+    if(ptr == MAP_FAILED){
+        LOGGER.e(0, "can't map " + std::to_string(bytes >> 30) + " GB for the tiled matrix.");
+    }
+    data = static_cast<double*>(ptr);
+}
+
+TiledMatrix::~TiledMatrix(){
+    if(data) munmap(data, bytes);
+}
+
+void TiledMatrix::evict(){
+    if(bFile) madvise(data, bytes, MADV_DONTNEED);
+}
+
+void TiledMatrix::setZero(){
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < nt; i++){
+        for(int j = 0; j <= i; j++) block(i, j).setZero();
+    }
+}
+
+void TiledMatrix::add(double alpha, const TiledMatrix &B){
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < nt; i++){
+        for(int j = 0; j <= i; j++) block(i, j) += alpha * B.block(i, j);
+    }
+}
+
+void TiledMatrix::addDiagonal(const VectorXd &d){
+    for(int i = 0; i < nt; i++){
+        block(i, i).diagonal() += d.segment(tileStart(i), tileRows(i));
+    }
+}
+
+VectorXd TiledMatrix::diagonal() const{
+    VectorXd d(n);
+    for(int i = 0; i < nt; i++){
+        d.segment(tileStart(i), tileRows(i)) = block(i, i).diagonal();
+    }
+    return d;
+}
+
+// right looking: factor the diagonal tile, solve the tiles below it, update
+//   the trailing matrix. Each tile step is a task depending on the tiles it
+//   reads, so the updates of step k overlap with the factorization of k + 1
+bool TiledMatrix::cholesky(double &logdet){
+    std::vector<char> dep((uint64_t)nt * nt);
+    // the tasks only depend on the addresses of d
+    char *d = dep.data();
+    (void)d;
+    int nt = this->nt;
+    volatile bool bPD = true;
+
+    #pragma omp parallel
+    #pragma omp single
+    {
+        for(int k = 0; k < nt; k++){
+            #pragma omp task depend(inout: d[(uint64_t)k * nt + k]) shared(bPD)
+            {
+                Map<MatrixXd> A = block(k, k);
+                Eigen::LLT<Eigen::Ref<MatrixXd>> llt(A);
+                if(llt.info() != Eigen::Success) bPD = false;
+            }
+            for(int i = k + 1; i < nt; i++){
+                #pragma omp task depend(in: d[(uint64_t)k * nt + k]) depend(inout: d[(uint64_t)i * nt + k]) shared(bPD)
+                {
+                    if(bPD){
+                        Map<MatrixXd> L = block(k, k);
+                        Map<MatrixXd> A = block(i, k);
+                        L.transpose().triangularView<Upper>().solveInPlace<Eigen::OnTheRight>(A);
+                    }
+                }
+            }
+            for(int i = k + 1; i < nt; i++){
+                #pragma omp task depend(in: d[(uint64_t)i * nt + k]) depend(inout: d[(uint64_t)i * nt + i]) shared(bPD)
+                {
+                    if(bPD){
+                        Map<MatrixXd> A = block(i, i);
+                        A.selfadjointView<Lower>().rankUpdate(block(i, k), -1.0);
+                    }
+                }
+                for(int j = k + 1; j < i; j++){
+                    #pragma omp task depend(in: d[(uint64_t)i * nt + k], d[(uint64_t)j * nt + k]) depend(inout: d[(uint64_t)i * nt + j]) shared(bPD)
+                    {
+                        if(bPD){
+                            Map<MatrixXd> A = block(i, j);
+                            A.noalias() -= block(i, k) * block(j, k).transpose();
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if(!bPD) return false;
+
+    logdet = 0;
+    for(int k = 0; k < nt; k++){
+        logdet += 2.0 * block(k, k).diagonal().array().log().sum();
+    }
+    return true;
+}
+
+// L^-1 by tile columns from the last one, then L^-T * L^-1 by tile rows from
+//   the first one; both are in place since each step only reads the tiles
+//   that haven't been overwritten yet
+void TiledMatrix::inverse(){
+    for(int j = nt - 1; j >= 0; j--){
+        int rows_below = n - tileStart(j) - tileRows(j);
+        if(rows_below > 0){
+            // below the diagonal: -L22^-1 * L21 * Ljj^-1, L22^-1 is done already
+            MatrixXd panel(rows_below, tileRows(j));
+            int offset = tileStart(j) + tileRows(j);
+            #pragma omp parallel for schedule(dynamic)
+            for(int i = j + 1; i < nt; i++){
+                MatrixXd acc = block(i, i).triangularView<Lower>() * block(i, j);
+                for(int l = j + 1; l < i; l++) acc.noalias() += block(i, l) * block(l, j);
+                panel.middleRows(tileStart(i) - offset, tileRows(i)) = acc;
+            }
+            Map<MatrixXd> Ljj = block(j, j);
+            Ljj.triangularView<Lower>().solveInPlace<Eigen::OnTheRight>(panel);
+            for(int i = j + 1; i < nt; i++){
+                block(i, j) = -panel.middleRows(tileStart(i) - offset, tileRows(i));
+            }
+        }
+        Map<MatrixXd> Ljj = block(j, j);
+        MatrixXd inv = MatrixXd::Identity(tileRows(j), tileRows(j));
+        Ljj.triangularView<Lower>().solveInPlace(inv);
+        Ljj.triangularView<Lower>() = inv;
+    }
+
+    for(int i = 0; i < nt; i++){
+        #pragma omp parallel for schedule(dynamic)
+        for(int j = 0; j < i; j++){
+            MatrixXd acc = block(i, i).triangularView<Lower>().transpose() * block(i, j);
+            for(int l = i + 1; l < nt; l++) acc.noalias() += block(l, i).transpose() * block(l, j);
+            block(i, j) = acc;
+        }
+        MatrixXd Lii = block(i, i).triangularView<Lower>();
+        MatrixXd acc = Lii.transpose() * Lii;
+        for(int l = i + 1; l < nt; l++) acc.selfadjointView<Lower>().rankUpdate(block(l, i).transpose());
+        block(i, i).triangularView<Lower>() = acc;
+    }
+}
+
+void TiledMatrix::multiply(const MatrixXd &X, MatrixXd &Y) const{
+    Y.resize(n, X.cols());
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < nt; i++){
+        MatrixXd acc = block(i, i).selfadjointView<Lower>() * X.middleRows(tileStart(i), tileRows(i));
+        for(int j = 0; j < i; j++) acc.noalias() += block(i, j) * X.middleRows(tileStart(j), tileRows(j));
+        for(int j = i + 1; j < nt; j++) acc.noalias() += block(j, i).transpose() * X.middleRows(tileStart(j), tileRows(j));
+        Y.middleRows(tileStart(i), tileRows(i)) = acc;
+    }
+}
+
+double TiledMatrix::frobenius(const TiledMatrix &B) const{
+    double sum = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:sum)
+    for(int i = 0; i < nt; i++){
+        for(int j = 0; j < i; j++) sum += 2.0 * block(i, j).cwiseProduct(B.block(i, j)).sum();
+        Map<MatrixXd> Ai = block(i, i), Bi = B.block(i, i);
+        int m = tileRows(i);
+        for(int c = 0; c < m; c++){
+            sum += Ai(c, c) * Bi(c, c);
+            if(c + 1 < m) sum += 2.0 * Ai.col(c).tail(m - c - 1).dot(Bi.col(c).tail(m - c - 1));
+        }
+    }
+    return sum;
+}
@@ -25,6 +25,7 @@
 #include "Covar.h"
 #include "FastFAM.h"
 #include "LD.h"
+#include "ResultStore.h"
 #include <functional>
 #include <map>
 #include <vector>
@@ -89,11 +90,12 @@ int main(int argc, char *argv[]){
         "--update-ref-allele", "--update-freq", "--update-sex", "--mbfile", "--freqx", "--make-grm-xchr", "--make-grm-xchr-part", "--dc", "--make-grm-alg",
         "--make-bed", "--recodet", "--sum-geno-x", "--sample", "--bgen", "--mbgen", "--hard-call-thresh", "--dosage-call", "--dosage", "--mgrm", "--unify-grm", "--rel-only", 
         "--ld-matrix", "--r", "--ld-wind", "--r2", "--subtract-grm", "--save-pheno", "--save-bin", "--no-marker", "--joint-covar", "--sparse-cutoff", "--noblas", "--fastGWA-gram",
-        "--inv-t1", "--est-vg", "--force-gwa", "--reml-detail", "--h2-limit", "--gwa-no-constrain", "--verbose", "--c-inf", "--c-inf-no-filter", "--geno", "--info", "--nofilter",
+        "--inv-t1", "--est-vg", "--force-gwa", "--reml-detail", "--reml-slq", "--h2-limit", "--gwa-no-constrain", "--verbose", "--c-inf", "--c-inf-no-filter", "--geno", "--info", "--nofilter",
         "--set-list", "--burden",
         "--pfile", "--bpfile", "--mpfile", "--mbpfile", "--model-only", "--load-model", "--seed", "--fastGWA-mlm-binary", "--num-vec", "--trace-exact", "--cv-threshold", "--tao-start",
         "--acat", "--gene-list", "--snp-list", "--min-mac", "--max-maf", "--wind",
         "--envir", "--optimal-rho", "--noSandwich", "--grid-size",
+        "--read-bin", "--bin-region", "--bin-p", "--shard", "--merge-shards", "--checkpoint", "--resume", "--sparse-geno", "--make-pgen",
     };
     map<string, vector<string>> options;
     vector<string> keys;
@@ -240,7 +242,7 @@ int main(int argc, char *argv[]){
 
     //start register the options
     // Please take care of the order, C++ has few reflation feature, I did in a ugly way.
-    vector<string> module_names = {"phenotype", "marker", "genotype", "covar", "GRM", "fastFAM", "LD"};
+    vector<string> module_names = {"phenotype", "marker", "genotype", "covar", "GRM", "fastFAM", "LD", "result"};
     vector<int (*)(map<string, vector<string>>&)> registers = {
             Pheno::registerOption,
             Marker::registerOption,
@@ -248,7 +250,8 @@ int main(int argc, char *argv[]){
             Covar::registerOption,
             GRM::registerOption,
             FastFAM::registerOption,
-            LD::registerOption
+            LD::registerOption,
+            ResultStore::registerOption
     };
     vector<void (*)()> processMains = {
             Pheno::processMain,
@@ -257,7 +260,8 @@ int main(int argc, char *argv[]){
             Covar::processMain,
             GRM::processMain,
             FastFAM::processMain,
-            LD::processMain
+            LD::processMain,
+            ResultStore::processMain
     };
 
     vector<int> mains;
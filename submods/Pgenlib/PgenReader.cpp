@@ -30,6 +30,7 @@
 #include "PgenReader.h"
 #include "pgenlib_misc.h"
 #include "plink2_base.h"
+#include <algorithm>
 #include <iostream>
 #include <limits>
 
@@ -296,7 +297,13 @@ bool PgenReader::HardcallPhasePresent() const {
     }
     return ((_info_ptr->gflags & plink2::kfPgenGlobalHardcallPhasePresent) != 0);
 }
-//kfPgenGlobalDosagePresent
+
+bool PgenReader::DosagePresent() const {
+    if (!_info_ptr) {
+        stop("pgen is closed");
+    }
+    return ((_info_ptr->gflags & plink2::kfPgenGlobalDosagePresent) != 0);
+}
 
 // true: have phase, false: don't have phase
 bool PgenReader::IsPhasePresent() const{
@@ -485,6 +492,29 @@ bool PgenReader::CountHardDosage(uintptr_t *buf, uint16_t *dosage_buf, const uin
     return true;
 }
 
+void PgenReader::ExpandDosage(const uintptr_t *genovec, const uintptr_t *dosage_present, uint16_t *dosage_main, uint32_t dosageCT, uint32_t sampleCT, vector<uint32_t> &missIndex){
+    missIndex.clear();
+    if(dosageCT == sampleCT){
+        return;
+    }
+    // from the end, the compact dosages never move to the front of their place
+    uint32_t dosage_idx = dosageCT;
+    for(uint32_t i = sampleCT; i-- > 0;){
+        if((dosage_present[i / plink2::kBitsPerWord] >> (i % plink2::kBitsPerWord)) & 1){
+            dosage_main[i] = dosage_main[--dosage_idx];
+        }else{
+            uintptr_t code = (genovec[i / plink2::kBitsPerWordD2] >> (2 * (i % plink2::kBitsPerWordD2))) & 3;
+            if(code == 3){
+                missIndex.push_back(i);
+                dosage_main[i] = 0;
+            }else{
+                dosage_main[i] = code * 16384;
+            }
+        }
+    }
+    std::reverse(missIndex.begin(), missIndex.end());
+}
+
 bool PgenReader::CountHardFreqMissExtX(uintptr_t *buf, const uintptr_t *subset_iter_vec, const uintptr_t *subset_iter_vec2, 
         uint32_t rawSampleSize, uint32_t keepSize, uint32_t keepSize2, SNPInfo *snpinfo, string &errmsg, bool dosageComp, bool f_std){
     std::array<uint32_t,4> genocounts;
@@ -565,6 +595,36 @@ void PgenReader::ExtractDoubleExt(uintptr_t *in, const uintptr_t *subsets, uint3
 }
 
 
+void PgenReader::ExtractSparseExt(uintptr_t *in, const uintptr_t *subsets, uint32_t rawSampleSize, uint32_t keepSize, uint32_t commonCode, vector<uint32_t> &index, vector<uint8_t> &codes){
+    uintptr_t *bufptr = in;
+    bool newBuf = false;
+    if(rawSampleSize != keepSize){
+        newBuf = true;
+        bufptr = new uintptr_t[GetGenoBufPtrSize(keepSize)];
+        ExtractGenoExt(in, subsets, rawSampleSize, keepSize, bufptr);
+    }
+    index.clear();
+    codes.clear();
+    const uint32_t samplePerWord = sizeof(uintptr_t) * 4;
+    const uintptr_t common = (~((uintptr_t)0) / 3) * commonCode;
+    uint32_t numWord = (keepSize + samplePerWord - 1) / samplePerWord;
+    for(uint32_t w = 0; w < numWord; w++){
+        uintptr_t diff = bufptr[w] ^ common;
+        // set the low bit of each sample that differs
+        diff = (diff | (diff >> 1)) & (~((uintptr_t)0) / 3);
+        while(diff){
+            uint32_t shift = __builtin_ctzll(diff);
+            uint32_t sample = w * samplePerWord + shift / 2;
+            if(sample >= keepSize) break;
+            index.push_back(sample);
+            codes.push_back((bufptr[w] >> shift) & 3);
+            diff &= diff - 1;
+        }
+    }
+    if(newBuf){
+        delete[] bufptr;
+    }
+}
 
 void PgenReader::ReadHardcalls(vector<double> &buf, int variant_idx, int allele_idx) {
     if (!_info_ptr) {
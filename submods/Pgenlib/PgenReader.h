@@ -86,6 +86,8 @@ class PgenReader {
 
         bool HasMultiAllelic() const;
 
+        bool DosagePresent() const;
+
         void ReadIntHardcalls(vector<int32_t> &buf, int variant_idx, int allele_idx);
 
         void ReadHardcalls(vector<double> &buf, int variant_idx, int allele_idx);
@@ -108,6 +110,9 @@ class PgenReader {
         void ExtractGeno(const uintptr_t *in, uintptr_t *out);
         static void ExtractGenoExt(const uintptr_t *in, const uintptr_t * subsets, uint32_t rawSampleSize, uint32_t keepSize, uintptr_t *out);
         static void ExtractDoubleExt(uintptr_t *in, const uintptr_t *subsets, uint32_t rawSampleSize, uint32_t keepSize, const double *gtable, double *gOut, uintptr_t *missOut);
+        // the kept samples whose 2-bit genotype isn't commonCode, with their codes;
+        //   whole words of the common genotype are skipped without expansion
+        static void ExtractSparseExt(uintptr_t *in, const uintptr_t *subsets, uint32_t rawSampleSize, uint32_t keepSize, uint32_t commonCode, vector<uint32_t> &index, vector<uint8_t> &codes);
 
         /*
 
@@ -135,6 +140,9 @@ class PgenReader {
         static int GetDosagePresentSize(uint32_t sample_ct);
         static int GetDosageMainSize(uint32_t sample_ct);
 
+        // fills dosage_main of all the sampleCT samples in place, the ones not set in
+        //   dosage_present take 16384 * hard call, missing are 0 and listed in missIndex
+        static void ExpandDosage(const uintptr_t *genovec, const uintptr_t *dosage_present, uint16_t *dosage_main, uint32_t dosageCT, uint32_t sampleCT, vector<uint32_t> &missIndex);
         static bool CountHardDosage(uintptr_t *buf, uint16_t *dosage_buf, const uintptr_t *dosage_present, const vector<uint32_t> *maskp, uint32_t sampleCT, uint32_t dosageCT, SNPInfo *snpinfo, string &err);
 
 
@@ -0,0 +1,85 @@
+/* A writer of plink2 PGEN format for the biallelic variants
+ *
+ * Coded by Zhili Zheng <zhilizheng@outlook.com>
+ * Please refer to plink2 for orginal license statement and authorship
+ * https://github.com/chrchang/plink-ng
+ *
+// This library is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "PgenWriter.h"
+#include "pgenlib_write.h"
+#include "plink2_base.h"
+#include <cstdlib>
+
+PgenWriter::PgenWriter(){
+}
+
+PgenWriter::~PgenWriter(){
+    if(_state_ptr){
+        string err;
+        Close(err);
+    }
+}
+
+bool PgenWriter::Open(const string &filename, uint32_t sampleCT, uint32_t variantCT, bool hasDosage, string &err){
+    _state_ptr = new plink2::STPgenWriter;
+    plink2::PreinitSpgw(_state_ptr);
+    uintptr_t alloc_cacheline_ct;
+    uint32_t max_vrec_len;
+    plink2::PgenGlobalFlags gflags = hasDosage ? plink2::kfPgenGlobalDosagePresent : plink2::kfPgenGlobal0;
+    plink2::PglErr reterr = plink2::SpgwInitPhase1(filename.c_str(), nullptr, nullptr, variantCT, sampleCT, 2,
+            plink2::kPgenWriteBackwardSeek, gflags, 0, _state_ptr, &alloc_cacheline_ct, &max_vrec_len);
+    if(reterr != plink2::kPglRetSuccess){
+        err = "SpgwInitPhase1() error " + std::to_string(static_cast<int>(reterr));
+        delete _state_ptr;
+        _state_ptr = nullptr;
+        return false;
+    }
+    if(posix_memalign(reinterpret_cast<void**>(&_alloc), plink2::kCacheline, alloc_cacheline_ct * plink2::kCacheline) != 0){
+        err = "out of memory";
+        plink2::CleanupSpgw(_state_ptr, &reterr);
+        delete _state_ptr;
+        _state_ptr = nullptr;
+        return false;
+    }
+    plink2::SpgwInitPhase2(max_vrec_len, _state_ptr, _alloc);
+    return true;
+}
+
+bool PgenWriter::AppendDosage16(const uintptr_t *genovec, const uintptr_t *dosage_present, const uint16_t *dosage_main, uint32_t dosageCT, string &err){
+    plink2::PglErr reterr = plink2::SpgwAppendBiallelicGenovecDosage16(genovec, dosage_present, dosage_main, dosageCT, _state_ptr);
+    if(reterr != plink2::kPglRetSuccess){
+        err = "SpgwAppendBiallelicGenovecDosage16() error " + std::to_string(static_cast<int>(reterr));
+        return false;
+    }
+    return true;
+}
+
+bool PgenWriter::Close(string &err){
+    if(!_state_ptr){
+        return true;
+    }
+    plink2::PglErr reterr = plink2::SpgwFinish(_state_ptr);
+    plink2::CleanupSpgw(_state_ptr, &reterr);
+    delete _state_ptr;
+    _state_ptr = nullptr;
+    free(_alloc);
+    _alloc = nullptr;
+    if(reterr != plink2::kPglRetSuccess){
+        err = "SpgwFinish() error " + std::to_string(static_cast<int>(reterr));
+        return false;
+    }
+    return true;
+}
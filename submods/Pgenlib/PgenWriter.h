@@ -0,0 +1,52 @@
+/* A writer of plink2 PGEN format for the biallelic variants, hard calls and
+ * 16-bit dosages, a thin wrapper of the single thread writer of pgenlib.
+ *
+ * Coded by Zhili Zheng <zhilizheng@outlook.com>
+ * Please refer to plink2 for orginal license statement and authorship
+ * https://github.com/chrchang/plink-ng
+ *
+// This library is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PGENWRITER
+#define PGENWRITER
+#include <string>
+#include <cstdint>
+
+using std::string;
+
+namespace plink2 {
+    struct STPgenWriterStruct;
+}
+
+class PgenWriter {
+    public:
+        PgenWriter();
+        ~PgenWriter();
+
+        // the number of variants must be known in advance, all are appended in order
+        bool Open(const string &filename, uint32_t sampleCT, uint32_t variantCT, bool hasDosage, string &err);
+
+        // genovec: 2-bit counts of ALT, 3 missing; dosage_main holds the dosages of
+        //   the samples set in dosage_present, in units of 1/16384
+        bool AppendDosage16(const uintptr_t *genovec, const uintptr_t *dosage_present, const uint16_t *dosage_main, uint32_t dosageCT, string &err);
+
+        bool Close(string &err);
+
+    private:
+        plink2::STPgenWriterStruct* _state_ptr = nullptr;
+        unsigned char* _alloc = nullptr;
+};
+
+#endif
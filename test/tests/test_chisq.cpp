@@ -2,6 +2,7 @@
 #include "StatLib.h"
 #include <string>
 #include <iostream>
+#include <cmath>
 using std::string;
 using std::cout;
 
@@ -12,3 +13,38 @@ TEST(StatLib, validStat){
     EXPECT_TRUE(false) << "test: " << std::scientific << StatLib::pchisqd1(300) << std::endl;
 }
 
+
+TEST(StatLib, batchSameAsScalar){
+    const int n = 1000;
+    double x[n], p[n], lp[n];
+    for(int i = 0; i < n; i++){
+        x[i] = std::pow(10.0, -3 + 6.0 * i / n);
+    }
+    StatLib::pchisqd1(x, p, n);
+    StatLib::lpchisqd1(x, lp, n);
+    for(int i = 0; i < n; i++){
+        double p1 = StatLib::pchisqd1(x[i]);
+        EXPECT_NEAR(p[i], p1, 1e-12 * p1) << "x: " << x[i];
+        if(p1 > 0) EXPECT_NEAR(lp[i], std::log(p1), 1e-10 * std::abs(std::log(p1)));
+    }
+    StatLib::pchisqd2(x, p, n);
+    for(int i = 0; i < n; i++){
+        double p2 = StatLib::pchisqd2(x[i]);
+        EXPECT_NEAR(p[i], p2, 1e-12 * p2) << "x: " << x[i];
+    }
+    // p underflows, the log is still available
+    EXPECT_TRUE(std::isfinite(StatLib::lpchisqd1(1e5)));
+    EXPECT_NEAR(StatLib::lpchisqd1(1e5), -50006.0, 1.0);
+}
+
+TEST(StatLib, chisqsumAndACAT){
+    // equal weights reduce to a central chi-square
+    VectorXd lambda = VectorXd::Ones(5);
+    EXPECT_NEAR(StatLib::pchisqsum(11.0705, lambda), 0.05, 1e-5);
+
+    VectorXd p(2), w = VectorXd::Ones(2);
+    p << 0.01, 0.5;
+    EXPECT_NEAR(StatLib::acat(p, w), 0.01998, 1e-5);
+    p << 1e-20, 0.5;
+    EXPECT_NEAR(StatLib::acat(p, w), 2e-20, 1e-24);
+}
@@ -0,0 +1,42 @@
+//
+// Round trip of the fastGWA model file
+//
+#include "gtest/gtest.h"
+#include "test_config.h"
+#include "ModelFile.h"
+#include "Logger.h"
+#include <cstring>
+
+TEST(ModelFile, alignedLastSection){
+    LOGGER.open(CUR_OUT_DIR + "/test_modelfile.log");
+    const string filename = CUR_OUT_DIR + "/test_aligned.mdl.bin3";
+
+    string ids = "F1\tI1\nF2\tI2\n";
+    // exactly one page, the last byte must survive the padding on close
+    vector<double> pheno(MODEL_FILE_ALIGN / sizeof(double));
+    for(uint32_t i = 0; i < pheno.size(); i++){
+        pheno[i] = i + 0.5;
+    }
+
+    ModelFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.numIndi = 2;
+    {
+        ModelFileWriter writer(filename, header);
+        writer.addSection(MODEL_SEC_IDS, ids.data(), ids.size());
+        writer.addSection(MODEL_SEC_PHENO, pheno.data(), pheno.size() * sizeof(double));
+        writer.close();
+    }
+
+    ModelFile model(filename);
+    vector<string> sampleIDs = model.sampleIDs();
+    ASSERT_EQ(2, sampleIDs.size());
+    EXPECT_EQ("F2\tI2", sampleIDs[1]);
+
+    uint64_t count;
+    const double *readPheno = model.section<double>(MODEL_SEC_PHENO, count);
+    ASSERT_EQ(pheno.size(), count);
+    for(uint32_t i = 0; i < count; i++){
+        EXPECT_EQ(pheno[i], readPheno[i]);
+    }
+}
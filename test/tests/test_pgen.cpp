@@ -0,0 +1,82 @@
+//
+// Reads back the dosages of a PGEN in the buffer layout of Geno::readGeno_pgen
+//
+#include "gtest/gtest.h"
+#include "test_config.h"
+#include "PgenReader.h"
+#include "PgenWriter.h"
+#include <vector>
+
+TEST(Pgen, dosageReadBack){
+    const uint32_t sampleCT = 100;
+    const uint32_t variantCT = 3;
+    const string filename = CUR_OUT_DIR + "/test_dosage.pgen";
+
+    // variant 0 all dosages, 1 partly hard calls and missing, 2 hard calls only
+    vector<vector<uint16_t>> expected(variantCT, vector<uint16_t>(sampleCT));
+    vector<vector<uint32_t>> expectedMiss(variantCT);
+    string err;
+    {
+        PgenWriter writer;
+        ASSERT_TRUE(writer.Open(filename, sampleCT, variantCT, true, err)) << err;
+        for(uint32_t v = 0; v < variantCT; v++){
+            vector<uintptr_t> genovec((sampleCT + 31) / 32 + 8, 0);
+            vector<uintptr_t> present((sampleCT + 63) / 64 + 8, 0);
+            vector<uint16_t> dosages;
+            for(uint32_t i = 0; i < sampleCT; i++){
+                uintptr_t code = (i * 7 + v) % 4;
+                bool hasDosage = (v == 0) || (v == 1 && i % 3 == 0);
+                uint16_t dosage = (i * 311 + v * 17) % 32769;
+                if(hasDosage){
+                    // the hard call nearest to the dosage
+                    code = (dosage + 8192) / 16384;
+                    present[i / 64] |= (uintptr_t)1 << (i % 64);
+                    dosages.push_back(dosage);
+                    expected[v][i] = dosage;
+                }else if(code == 3){
+                    expected[v][i] = 0;
+                    expectedMiss[v].push_back(i);
+                }else{
+                    expected[v][i] = code * 16384;
+                }
+                genovec[i / 32] |= code << (2 * (i % 32));
+            }
+            ASSERT_TRUE(writer.AppendDosage16(genovec.data(), present.data(), dosages.data(), dosages.size(), err)) << err;
+        }
+        ASSERT_TRUE(writer.Close(err)) << err;
+    }
+
+    vector<uint32_t> keep(sampleCT);
+    for(uint32_t i = 0; i < sampleCT; i++){
+        keep[i] = i;
+    }
+    uint32_t rawSampleCT = sampleCT, rawVariantCT = variantCT;
+    PgenReader reader;
+    reader.Load(filename, &rawSampleCT, &rawVariantCT, keep);
+    EXPECT_TRUE(reader.DosagePresent());
+
+    // same sizes as Geno::preGenoDouble_pgen
+    uint32_t genoPtrSize = (PgenReader::GetGenoBufPtrSize(sampleCT) + 63) / 64 * 64;
+    uint32_t dosageMainPtrSize = (PgenReader::GetDosageMainSize(sampleCT) + 63) / 64 * 64;
+    uint32_t dosagePresentPtrSize = (PgenReader::GetDosagePresentSize(sampleCT) + 63) / 64 * 64;
+    uint32_t buf1PtrSize = (genoPtrSize + dosageMainPtrSize + dosagePresentPtrSize + 1 + 63) / 64 * 64;
+    vector<uintptr_t> buf(buf1PtrSize * variantCT);
+
+    for(uint32_t v = 0; v < variantCT; v++){
+        uintptr_t *cur_buf = buf.data() + v * buf1PtrSize;
+        reader.ReadDosage(cur_buf, v, 1);
+        uintptr_t *dosage_present = cur_buf + genoPtrSize;
+        uint16_t *dosage_main = reinterpret_cast<uint16_t*>(cur_buf + genoPtrSize + dosagePresentPtrSize);
+        uint32_t dosage_ct = *reinterpret_cast<uint32_t*>(cur_buf + genoPtrSize + dosagePresentPtrSize + dosageMainPtrSize);
+        if(v == 0){
+            EXPECT_EQ(sampleCT, dosage_ct);
+        }
+
+        vector<uint32_t> missIndex;
+        PgenReader::ExpandDosage(cur_buf, dosage_present, dosage_main, dosage_ct, sampleCT, missIndex);
+        EXPECT_EQ(expectedMiss[v], missIndex);
+        for(uint32_t i = 0; i < sampleCT; i++){
+            EXPECT_EQ(expected[v][i], dosage_main[i]) << "variant " << v << ", sample " << i;
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#include <gtest/gtest.h>
+#include "StochasticTrace.h"
+#include <cmath>
+
+extern int test_argc;
+extern char** test_argv;
+
+using Eigen::MatrixXd;
+
+static MatrixXd spdMatrix(int n){
+    MatrixXd M = MatrixXd::Random(n, n);
+    return M * M.transpose() / n + MatrixXd::Identity(n, n);
+}
+
+TEST(StochasticTrace, blockCG){
+    MatrixXd A = spdMatrix(300);
+    auto op = [&A](const MatrixXd &X, MatrixXd &Y){ Y = A * X; };
+    MatrixXd B = MatrixXd::Random(300, 4), X;
+    ASSERT_GE(StochasticTrace::blockCG(op, A.diagonal(), B, X, 1e-10), 0);
+    EXPECT_LT((A * X - B).norm() / B.norm(), 1e-8);
+}
+
+TEST(StochasticTrace, logDetAndTrace){
+    int n = 400;
+    MatrixXd A = spdMatrix(n);
+    auto op = [&A](const MatrixXd &X, MatrixXd &Y){ Y = A * X; };
+    MatrixXd Z(n, 100);
+    StochasticTrace::rademacher(Z, 42);
+    MatrixXd Z2(n, 100);
+    StochasticTrace::rademacher(Z2, 42);
+    EXPECT_EQ(Z, Z2);
+
+    double logdet = A.ldlt().vectorD().array().log().sum();
+    EXPECT_NEAR(StochasticTrace::slqLogDet(op, Z, 40), logdet, 0.01 * std::abs(logdet));
+
+    MatrixXd AZ = A * Z;
+    EXPECT_NEAR(StochasticTrace::hutchinson(Z, AZ), A.trace(), 0.01 * A.trace());
+
+    auto negOp = [&A](const MatrixXd &X, MatrixXd &Y){ Y = -A * X; };
+    EXPECT_TRUE(std::isnan(StochasticTrace::slqLogDet(negOp, Z, 40)));
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include "TextFormat.h"
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <string>
+#include <sstream>
+using std::string;
+
+extern int test_argc;
+extern char** test_argv;
+
+static string numStr(double v){
+    char buf[TextFormat::MAX_NUM_LEN];
+    return string(buf, TextFormat::writeNum(buf, v) - buf);
+}
+
+TEST(TextFormat, sameAsStream){
+    std::mt19937_64 rng(1);
+    std::uniform_real_distribution<double> expo(-30, 30), unif(0, 1);
+    for(int i = 0; i < 200000; i++){
+        double v = std::pow(10.0, expo(rng)) * (unif(rng) < 0.5 ? -1 : 1);
+        if(i % 3 == 0) v = (float)v;
+        if(i % 7 == 0) v = std::round(v * 1000) / 1000;
+        std::ostringstream os;
+        os << v;
+        ASSERT_EQ(numStr(v), os.str()) << "value: " << std::scientific << v;
+    }
+    double specials[] = {0, -0.0, 1, 2, 0.5, 999999, 1e6, 0.0001, 1e-5, 167150.5, 3165.165,
+        NAN, INFINITY, -INFINITY};
+    for(double v : specials){
+        char buf[64];
+        snprintf(buf, 64, "%.6g", v);
+        EXPECT_EQ(numStr(v), string(buf));
+    }
+}
+
+TEST(TextFormat, sameAsToString){
+    std::mt19937_64 rng(2);
+    std::uniform_real_distribution<double> unif(0, 1);
+    char buf[TextFormat::MAX_NUM_LEN + 6];
+    for(int i = 0; i < 200000; i++){
+        double v = unif(rng) * (i % 2 ? 1 : 1000);
+        ASSERT_EQ(string(buf, TextFormat::writeFixed(buf, v) - buf), std::to_string(v));
+    }
+}
+
+TEST(TextFormat, blockWriterOrder){
+    TextBlockWriter writer(3);
+    std::ostringstream os, expect;
+    uint32_t n = writer.write(100, os, [](uint32_t i, TextBuffer &buf){
+        if(i % 5 == 0) return false;
+        buf.addUInt(i);
+        buf.addFieldNum(i / 8.0);
+        buf.add('\n');
+        return true;
+    });
+    for(uint32_t i = 0; i < 100; i++){
+        if(i % 5 == 0) continue;
+        expect << i << "\t" << i / 8.0 << "\n";
+    }
+    EXPECT_EQ(n, 80);
+    EXPECT_EQ(os.str(), expect.str());
+}